@@ -0,0 +1,106 @@
+// EpochReclaimer.h
+//
+// Copyright (c) 2026 The Dasher Team
+
+#ifndef __EpochReclaimer_h__
+#define __EpochReclaimer_h__
+
+// CEpochReclaimer lets a single writer thread modify a data structure that any number
+// of reader threads are reading at the same time, RCU-style: instead of freeing or
+// reusing memory that readers might still be looking at, the writer unlinks it, tags
+// it with the current epoch (Current), and later reuses it once Advance reports that
+// no reader is still in that epoch or an earlier one. Readers never wait for the
+// writer: each read is bracketed by a CReadGuard, which just records the epoch in
+// which it started.
+// For changes readers cannot follow at all (e.g. renumbering everything), the writer
+// may instead exclude readers altogether, between ExclusiveBegin and ExclusiveEnd;
+// readers starting a read meanwhile wait until ExclusiveEnd.
+// At most MAX_READERS reads may be in progress at once (further ones wait for a slot).
+
+#include <atomic>
+#include <thread>
+
+/////////////////////////////////////////////////////////////////////////////
+
+class CEpochReclaimer {
+
+public:
+
+  typedef unsigned long long Epoch;
+
+  CEpochReclaimer() : m_iEpoch(1), m_bExclusive(false) {
+    for (int i = 0; i < MAX_READERS; i++) m_aiSlots[i].store(0, std::memory_order_relaxed);
+  }
+
+  // Pins the current epoch for the lifetime of the guard
+  class CReadGuard {
+  public:
+    CReadGuard(const CEpochReclaimer &reclaimer) : m_pSlot(reclaimer.Pin()) {}
+    ~CReadGuard() {m_pSlot->store(0, std::memory_order_release);}
+  private:
+    CReadGuard(const CReadGuard &);
+    CReadGuard &operator=(const CReadGuard &);
+    std::atomic<Epoch> *m_pSlot;
+  };
+
+  // Writer: the epoch with which to tag anything unlinked now
+  Epoch Current() const {return m_iEpoch.load(std::memory_order_relaxed);}
+
+  // Writer: moves on to a new epoch, and returns the oldest epoch any read may still
+  // be in; anything tagged with an earlier epoch is no longer visible to any reader.
+  Epoch Advance() {
+    const Epoch iNew = m_iEpoch.fetch_add(1) + 1;
+    Epoch iOldest = iNew;
+    for (int i = 0; i < MAX_READERS; i++) {
+      const Epoch iPinned = m_aiSlots[i].load();
+      if (iPinned && iPinned < iOldest) iOldest = iPinned;
+    }
+    return iOldest;
+  }
+
+  // Writer: stops new reads starting, and waits for those in progress to finish
+  void ExclusiveBegin() {
+    m_bExclusive.store(true);
+    for (int i = 0; i < MAX_READERS; i++)
+      while (m_aiSlots[i].load()) std::this_thread::yield();
+  }
+
+  // Writer: lets reads start again
+  void ExclusiveEnd() {m_bExclusive.store(false, std::memory_order_release);}
+
+  static const int MAX_READERS = 64;
+
+private:
+
+  // Claims a slot, and stores in it the current epoch; such that, if the writer has
+  // since advanced the epoch, it will see the slot (so will not reuse anything this
+  // read could find), or this will see the new epoch (and pin that instead).
+  std::atomic<Epoch> *Pin() const {
+    for (;;) {
+      while (m_bExclusive.load()) std::this_thread::yield();
+      for (int i = 0; i < MAX_READERS; i++) {
+        Epoch iEpoch = m_iEpoch.load(), iFree = 0;
+        if (!m_aiSlots[i].compare_exchange_strong(iFree, iEpoch)) continue;
+        while (!m_bExclusive.load()) {
+          const Epoch iNow = m_iEpoch.load();
+          if (iNow == iEpoch) return &m_aiSlots[i];
+          m_aiSlots[i].store(iEpoch = iNow);
+        }
+        //Writer wants exclusive access; give up the slot until it has finished
+        m_aiSlots[i].store(0);
+        break;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  // Epoch pinned by the read using each slot, or 0 if the slot is free
+  mutable std::atomic<Epoch> m_aiSlots[MAX_READERS];
+
+  std::atomic<Epoch> m_iEpoch;
+
+  std::atomic<bool> m_bExclusive;
+
+};
+
+#endif // __EpochReclaimer_h__
@@ -0,0 +1,111 @@
+// HandleTable.h
+//
+// Copyright (c) 2026 The Dasher Team
+
+#ifndef __HandleTable_h__
+#define __HandleTable_h__
+
+// CHandleTable stores objects T in a slab (a single vector), and refers to each by an
+// integer handle encoding its slot and that slot's generation. Alloc, lookup and Free
+// are all O(1); freed slots are reused, but with a new generation, so a handle to an
+// object that has since been freed can be detected as invalid (IsValid) - at least
+// until the generation counter wraps around.
+// Handle 0 is never returned, so may be used as a null value. At most 2^24 - 1 objects
+// may be live at once.
+// Lookups return references into the slab, which are invalidated by any Alloc.
+
+#include <vector>
+#include <cstddef>
+
+/////////////////////////////////////////////////////////////////////////////
+
+template<typename T> class CHandleTable {
+
+public:
+
+  typedef size_t Handle;
+
+  // Construct, with space reserved for the given number of objects
+  CHandleTable(size_t iReserve);
+
+  // Store the given object, and return a handle to it. (Passed by value, so may be a
+  // reference to another object in this table.)
+  Handle Alloc(T init);
+
+  // Free the object with the given (valid) handle
+  void Free(Handle h);
+
+  // Whether the handle refers to an object allocated and not yet freed
+  bool IsValid(Handle h) const;
+
+  // Object with the given (valid) handle
+  T &operator[](Handle h) {return m_vSlots[slot(h)].obj;}
+  const T &operator[](Handle h) const {return m_vSlots[slot(h)].obj;}
+
+  // Number of live objects
+  size_t Size() const {return m_vSlots.size() - 1 - m_vFree.size();}
+
+  // Calls f(obj) for every live object, i.e. allocated and not yet freed
+  template<typename F> void ForEach(F f);
+
+private:
+
+  // Low bits of a handle are the slot index, the rest the generation
+  static const int SLOT_BITS = 24;
+  static size_t slot(Handle h) {return h & ((Handle(1) << SLOT_BITS) - 1);}
+
+  struct Slot {
+    T obj;
+    Handle gen;
+    bool bLive;
+  };
+
+  // All slots, live or free; slot 0 is never used, so no handle is 0
+  std::vector<Slot> m_vSlots;
+
+  // Indices of free slots
+  std::vector<size_t> m_vFree;
+
+};
+
+template<typename T> CHandleTable<T>::CHandleTable(size_t iReserve) {
+  m_vSlots.reserve(iReserve + 1);
+  m_vSlots.resize(1);
+  m_vSlots[0].gen = 0;
+  m_vSlots[0].bLive = false;
+}
+
+template<typename T> typename CHandleTable<T>::Handle CHandleTable<T>::Alloc(T init) {
+  size_t i;
+  if (m_vFree.empty()) {
+    i = m_vSlots.size();
+    m_vSlots.resize(i + 1);
+    m_vSlots[i].gen = 0;
+  } else {
+    i = m_vFree.back();
+    m_vFree.pop_back();
+  }
+  Slot &s(m_vSlots[i]);
+  s.obj = init;
+  s.bLive = true;
+  return (s.gen << SLOT_BITS) | i;
+}
+
+template<typename T> void CHandleTable<T>::Free(Handle h) {
+  Slot &s(m_vSlots[slot(h)]);
+  s.bLive = false;
+  s.gen = (s.gen + 1) & (~Handle(0) >> SLOT_BITS);
+  m_vFree.push_back(slot(h));
+}
+
+template<typename T> bool CHandleTable<T>::IsValid(Handle h) const {
+  const size_t i = slot(h);
+  return i > 0 && i < m_vSlots.size() && m_vSlots[i].bLive && (m_vSlots[i].gen << SLOT_BITS) == (h & ~((Handle(1) << SLOT_BITS) - 1));
+}
+
+template<typename T> template<typename F> void CHandleTable<T>::ForEach(F f) {
+  for (typename std::vector<Slot>::iterator it = m_vSlots.begin(); it != m_vSlots.end(); it++)
+    if (it->bLive) f(it->obj);
+}
+
+#endif // __include__
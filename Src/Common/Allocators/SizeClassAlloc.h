@@ -0,0 +1,119 @@
+// SizeClassAlloc.h
+//
+// Copyright (c) 2026 The Dasher Team
+
+#ifndef __SizeClassAlloc_h__
+#define __SizeClassAlloc_h__
+
+// CSizeClassAlloc hands out uninitialized memory for objects of assorted small sizes
+// (e.g. the various subclasses of one base class). Each size is rounded up to a
+// multiple of GRANULE, its size class; each class has its own free list, threaded
+// through the freed blocks themselves, and fresh blocks are cut from large chunks.
+// So Alloc and Free are O(1), and the system allocator is called only for a new
+// chunk; chunks are never returned to it until the allocator is destroyed, by which
+// time everything allocated must have been freed. Sizes over MAX_SIZE are passed
+// straight to the system allocator.
+// Not thread-safe.
+
+#include <vector>
+#include <cstddef>
+#include <new>
+
+/////////////////////////////////////////////////////////////////////////////
+
+class CSizeClassAlloc {
+
+public:
+
+  static const size_t GRANULE = 16;
+  static const size_t MAX_SIZE = 4096;
+  static const size_t CHUNK_SIZE = 64 * 1024;
+
+  CSizeClassAlloc();
+  ~CSizeClassAlloc();
+
+  // Uninitialized memory for an object of the given size (aligned to GRANULE)
+  void *Alloc(size_t iSize);
+
+  // Return memory from Alloc; iSize must be that passed to Alloc
+  void Free(void *p, size_t iSize);
+
+  // Number of objects allocated and not yet freed, and the bytes they take
+  // (after rounding up to their size classes)
+  size_t NumLive() const {return m_iNumLive;}
+  size_t BytesLive() const {return m_iBytesLive;}
+
+  // Bytes obtained from the system allocator (chunks, and any objects over MAX_SIZE)
+  size_t BytesReserved() const {return m_vChunks.size() * CHUNK_SIZE + m_iBytesLarge;}
+
+private:
+
+  static size_t sizeClass(size_t iSize) {return (iSize + GRANULE - 1) / GRANULE;}
+
+  // A block on a free list
+  struct FreeBlock {
+    FreeBlock *pNext;
+  };
+
+  // Head of the free list for each size class (index = size / GRANULE)
+  std::vector<FreeBlock *> m_vFree;
+
+  // All chunks, and the unused part of the last
+  std::vector<char *> m_vChunks;
+  char *m_pChunkNext, *m_pChunkEnd;
+
+  size_t m_iNumLive, m_iBytesLive, m_iBytesLarge;
+
+};
+
+inline CSizeClassAlloc::CSizeClassAlloc()
+: m_vFree(MAX_SIZE / GRANULE + 1, static_cast<FreeBlock *>(NULL)), m_pChunkNext(NULL), m_pChunkEnd(NULL),
+  m_iNumLive(0), m_iBytesLive(0), m_iBytesLarge(0) {
+}
+
+inline CSizeClassAlloc::~CSizeClassAlloc() {
+  for (std::vector<char *>::iterator it = m_vChunks.begin(); it != m_vChunks.end(); it++)
+    ::operator delete(*it);
+}
+
+inline void *CSizeClassAlloc::Alloc(size_t iSize) {
+  m_iNumLive++;
+  if (iSize > MAX_SIZE) {
+    m_iBytesLarge += iSize;
+    m_iBytesLive += iSize;
+    return ::operator new(iSize);
+  }
+  const size_t iClass = sizeClass(iSize);
+  m_iBytesLive += iClass * GRANULE;
+  if (FreeBlock *pBlock = m_vFree[iClass]) {
+    m_vFree[iClass] = pBlock->pNext;
+    return pBlock;
+  }
+  if (m_pChunkEnd - m_pChunkNext < static_cast<ptrdiff_t>(iClass * GRANULE)) {
+    // Any remainder of the last chunk is too small for this class; it's wasted, but
+    // is less than MAX_SIZE in a CHUNK_SIZE chunk. (::operator new aligns suitably.)
+    m_vChunks.push_back(static_cast<char *>(::operator new(CHUNK_SIZE)));
+    m_pChunkNext = m_vChunks.back();
+    m_pChunkEnd = m_pChunkNext + CHUNK_SIZE;
+  }
+  void *p = m_pChunkNext;
+  m_pChunkNext += iClass * GRANULE;
+  return p;
+}
+
+inline void CSizeClassAlloc::Free(void *p, size_t iSize) {
+  m_iNumLive--;
+  if (iSize > MAX_SIZE) {
+    m_iBytesLarge -= iSize;
+    m_iBytesLive -= iSize;
+    ::operator delete(p);
+    return;
+  }
+  const size_t iClass = sizeClass(iSize);
+  m_iBytesLive -= iClass * GRANULE;
+  FreeBlock *pBlock = static_cast<FreeBlock *>(p);
+  pBlock->pNext = m_vFree[iClass];
+  m_vFree[iClass] = pBlock;
+}
+
+#endif // ndef __SizeClassAlloc_h__
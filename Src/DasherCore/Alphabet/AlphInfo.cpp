@@ -59,8 +59,8 @@ string CAlphInfo::escape(const string &ch) const {
 }
 
 CAlphInfo::~CAlphInfo() {
-  pChild->RecursiveDelete();
-  pNext->RecursiveDelete();
+  if (pChild) pChild->RecursiveDelete();
+  if (pNext) pNext->RecursiveDelete();
 }
 
 void CAlphInfo::copyCharacterFrom(const CAlphInfo *other, int idx) {
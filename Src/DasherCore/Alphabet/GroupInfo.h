@@ -23,7 +23,7 @@ struct SGroupInfo {
   void RecursiveDelete() {
     for(SGroupInfo *t=this; t; ) {
       SGroupInfo *next = t->pNext;
-      t->pChild->RecursiveDelete();
+      if (t->pChild) t->pChild->RecursiveDelete();
       delete t;
       t = next;
     }
@@ -35,6 +35,7 @@
 #include "LanguageModelling/CTWLanguageModel.h"
 #include "FileWordGenerator.h"
 
+#include <algorithm>
 #include <vector>
 #include <sstream>
 #include <iostream>
@@ -73,7 +74,7 @@ void CAlphabetManager::Setup() {
   //else, if all single-octet chars are in alphabet - leave m_sDelim==""
   // (and we'll find a delimiter for each context)
 
-  CreateLanguageModel();
+  m_pLanguageModel = CreateLanguageModel();
 }
 
 void CAlphabetManager::InitMap() {
@@ -98,29 +99,29 @@ void CAlphabetManager::InitMap() {
    */
 }
 
-void CAlphabetManager::CreateLanguageModel() {
+CLanguageModel *CAlphabetManager::CreateLanguageModel() {
   // FIXME - return to using enum here
   switch (GetLongParameter(LP_LANGUAGE_MODEL_ID)) {
     default:
       // If there is a bogus value for the language model ID, we'll default
       // to our trusty old PPM language model.
     case 0:
-      m_pLanguageModel = new CPPMLanguageModel(this, m_pAlphabet->iEnd-1);
-      break;
+      return new CPPMLanguageModel(this, m_pAlphabet->iEnd-1);
     case 2:
-      m_pLanguageModel = new CWordLanguageModel(this, m_pAlphabet, &m_map);
-      break;
-    case 3:
-      m_pLanguageModel = new CMixtureLanguageModel(this, m_pAlphabet, &m_map);
-      break;
+      return new CWordLanguageModel(this, m_pAlphabet, &m_map);
+    case 3: {
+      vector<CLanguageModel *> vComponents;
+      vComponents.push_back(new CPPMLanguageModel(this, m_pAlphabet->iEnd-1));
+      vComponents.push_back(new CDictLanguageModel(this, m_pAlphabet, &m_map));
+      return new CMixtureLanguageModel(this, m_pAlphabet->iEnd-1, vComponents);
+    }
     case 4:
-      m_pLanguageModel = new CCTWLanguageModel(m_pAlphabet->iEnd-1);
-      break;
+      return new CCTWLanguageModel(m_pAlphabet->iEnd-1, GetLongParameter(LP_LM_CTW_TABLE_SIZE));
   }
 }
 
-CTrainer *CAlphabetManager::GetTrainer() {
-  return new CTrainer(m_pInterface, m_pLanguageModel, m_pAlphabet, &m_map);
+CTrainer *CAlphabetManager::GetTrainer(CMessageDisplay *pMsgs, CLanguageModel *pLM) {
+  return new CTrainer(pMsgs, pLM, m_pAlphabet, &m_map);
 }
 
 void CAlphabetManager::MakeLabels(CDasherScreen *pScreen) {
@@ -275,7 +276,7 @@ int CAlphabetManager::GetColour(symbol sym, int iOffset) const {
 
 
 CAlphabetManager::CAlphBase::CAlphBase(int iOffset, int iColour, CDasherScreen::Label *pLabel, CAlphabetManager *pMgr)
-: CDasherNode(iOffset, iColour, pLabel), m_pMgr(pMgr) {
+: CDasherNode(iOffset, iColour, pLabel), m_pMgr(pMgr), m_iWantLbnd(0), m_iWantHbnd(CDasherModel::NORMALIZATION) {
 }
 
 void CAlphabetManager::CAlphBase::Output() {
@@ -290,7 +291,35 @@ void CAlphabetManager::CAlphBase::Undo() {
   if (m_pMgr->m_pLastOutput==this) m_pMgr->m_pLastOutput = Parent();
 }
 CAlphabetManager::CAlphNode::CAlphNode(int iOffset, int iColour, CDasherScreen::Label *pLabel, CAlphabetManager *pMgr)
-: CAlphBase(iOffset, iColour, pLabel, pMgr), m_pProbInfo(NULL) {
+: CAlphBase(iOffset, iColour, pLabel, pMgr), m_pProbInfo(NULL), m_iContext(CLanguageModel::nullContext), m_iBaseContext(CLanguageModel::nullContext), m_iPendingSymbol(0) {
+}
+
+CLanguageModel::Context CAlphabetManager::CAlphNode::context() {
+  if (m_iContext == CLanguageModel::nullContext) {
+    DASHER_ASSERT(m_iBaseContext != CLanguageModel::nullContext);
+    CLanguageModel *pLM(m_pMgr->m_pLanguageModel);
+    m_iContext = pLM->CloneContext(m_iBaseContext);
+    if (m_iPendingSymbol) pLM->EnterSymbol(m_iContext, m_iPendingSymbol);
+    m_iBaseContext = CLanguageModel::nullContext;
+  }
+  return m_iContext;
+}
+
+void CAlphabetManager::CAlphNode::SetContext(CLanguageModel::Context iContext) {
+  if (m_iContext != CLanguageModel::nullContext)
+    m_pMgr->m_pLanguageModel->ReleaseContext(m_iContext);
+  m_iContext = iContext;
+  m_iBaseContext = CLanguageModel::nullContext;
+}
+
+void CAlphabetManager::CAlphNode::DeferContext(CLanguageModel::Context iBase, symbol iSymbol) {
+  DASHER_ASSERT(m_iContext == CLanguageModel::nullContext);
+  m_iBaseContext = iBase;
+  m_iPendingSymbol = iSymbol;
+}
+
+void CAlphabetManager::CAlphNode::ParentChanging() {
+  context();
 }
 
 CAlphabetManager::CSymbolNode::CSymbolNode(int iOffset, CDasherScreen::Label *pLabel, CAlphabetManager *pMgr, symbol _iSymbol)
@@ -327,7 +356,7 @@ CAlphabetManager::CAlphNode *CAlphabetManager::GetRoot(CDasherNode *pParent, boo
     pNewNode->SetFlag(NF_SEEN, true);
     pNewNode->CDasherNode::SetFlag(NF_COMMITTED, true); //do NOT commit!
   }
-  pNewNode->iContext = p.second;
+  pNewNode->SetContext(p.second);
   return pNewNode;
 }
 
@@ -403,14 +432,30 @@ symbol CAlphabetManager::CSymbolNode::GetAlphSymbol() {
 }
 
 void CAlphabetManager::CSymbolNode::PopulateChildren() {
-  m_pMgr->IterateChildGroups(this, m_pMgr->m_pBaseGroup, NULL);
+  m_pMgr->IterateChildGroups(this, m_pMgr->m_pBaseGroup, NULL, m_iWantLbnd, m_iWantHbnd);
+}
+
+void CAlphabetManager::CSymbolNode::PopulateRange(unsigned int iLbnd, unsigned int iHbnd) {
+  m_pMgr->IterateChildGroups(this, m_pMgr->m_pBaseGroup, NULL, iLbnd, iHbnd);
 }
 int CAlphabetManager::CAlphNode::ExpectedNumChildren() {
   int i=m_pMgr->m_pBaseGroup->iNumChildNodes;
   return (m_pMgr->GetBoolParameter(BP_CONTROL_MODE)) ? i+1 : i;
 }
 
-void CAlphabetManager::GetProbs(vector<unsigned int> *pProbInfo, CLanguageModel::Context context) {
+void CAlphabetManager::PrepareToPopulate(const vector<CDasherNode *> &vNodes) {
+  vector<CAlphNode *> vNeeded;
+  for (vector<CDasherNode *>::const_iterator it = vNodes.begin(); it != vNodes.end(); it++) {
+    DASHER_ASSERT((*it)->mgr() == this);
+    if (CAlphNode *pNode = static_cast<CAlphBase *>(*it)->UncomputedProbs())
+      //(a group node may share its parent's probabilities with a sibling)
+      if (find(vNeeded.begin(), vNeeded.end(), pNode) == vNeeded.end())
+        vNeeded.push_back(pNode);
+  }
+  if (!vNeeded.empty()) GetProbs(vNeeded);
+}
+
+void CAlphabetManager::GetProbs(const vector<CAlphNode *> &vNodes) {
   const unsigned int iSymbols = m_pBaseGroup->iEnd-1;
   
   // TODO - sort out size of control node - for the timebeing I'll fix the control node at 5%
@@ -426,33 +471,39 @@ void CAlphabetManager::GetProbs(vector<unsigned int> *pProbInfo, CLanguageModel:
   //ACL used to test explicitly for MandarinDasher and if so called GetPYProbs instead
   // (by statically casting to PPMPYLanguageModel). However, have renamed PPMPYLanguageModel::GetPYProbs
   // to GetProbs as per ordinary language model, so no need to test....
-  m_pLanguageModel->GetProbs(context, *pProbInfo, iNonUniformNorm, 0);
+  vector<CLanguageModel::ProbsRequest> vRequests;
+  for (vector<CAlphNode *>::const_iterator it = vNodes.begin(); it != vNodes.end(); it++) {
+    DASHER_ASSERT(!(*it)->m_pProbInfo);
+    (*it)->m_pProbInfo = new std::vector<unsigned int>();
+    vRequests.push_back(CLanguageModel::ProbsRequest((*it)->context(), (*it)->m_pProbInfo));
+  }
+  m_pLanguageModel->GetProbsBatch(vRequests, iNonUniformNorm, 0);
 
-  DASHER_ASSERT(pProbInfo->size() == iSymbols+1);//initial 0
+  for (vector<CAlphNode *>::const_iterator it = vNodes.begin(); it != vNodes.end(); it++) {
+    vector<unsigned int> *pProbInfo = (*it)->m_pProbInfo;
+    DASHER_ASSERT(pProbInfo->size() == iSymbols+1);//initial 0
 
-  for(unsigned int k(1); k < pProbInfo->size(); ++k)
-    (*pProbInfo)[k] += iUniformAdd;
+    for(unsigned int k(1); k < pProbInfo->size(); ++k)
+      (*pProbInfo)[k] += iUniformAdd;
 
 #ifdef DEBUG
-  {
-    unsigned long iTotal = 0;
-    for(unsigned int k = 0; k < pProbInfo->size(); ++k)
-      iTotal += (*pProbInfo)[k];
-    DASHER_ASSERT(iTotal == iNorm);
-  }
+    {
+      unsigned long iTotal = 0;
+      for(unsigned int k = 0; k < pProbInfo->size(); ++k)
+        iTotal += (*pProbInfo)[k];
+      DASHER_ASSERT(iTotal == iNorm);
+    }
 #endif
-}
-
-std::vector<unsigned int> *CAlphabetManager::CAlphNode::GetProbInfo() {
-  if (!m_pProbInfo) {
-    m_pProbInfo = new std::vector<unsigned int>();
-    m_pMgr->GetProbs(m_pProbInfo, iContext);
 
     // work out cumulative probs in place
-    for(unsigned int i = 1; i < m_pProbInfo->size(); i++) {
-      (*m_pProbInfo)[i] += (*m_pProbInfo)[i - 1];
+    for(unsigned int i = 1; i < pProbInfo->size(); i++) {
+      (*pProbInfo)[i] += (*pProbInfo)[i - 1];
     }
   }
+}
+
+std::vector<unsigned int> *CAlphabetManager::CAlphNode::GetProbInfo() {
+  if (!m_pProbInfo) m_pMgr->GetProbs(std::vector<CAlphNode *>(1, this));
   return m_pProbInfo;
 }
 
@@ -464,8 +515,19 @@ std::vector<unsigned int> *CAlphabetManager::CGroupNode::GetProbInfo() {
   return CAlphNode::GetProbInfo();
 }
 
+CAlphabetManager::CAlphNode *CAlphabetManager::CGroupNode::UncomputedProbs() {
+  //as GetProbInfo
+  if (Parent() && Parent()->mgr() == mgr() && Parent()->offset()==offset())
+    return static_cast<CAlphNode *>(Parent())->UncomputedProbs();
+  return CAlphNode::UncomputedProbs();
+}
+
 void CAlphabetManager::CGroupNode::PopulateChildren() {
-  m_pMgr->IterateChildGroups(this, m_pGroup, NULL);
+  m_pMgr->IterateChildGroups(this, m_pGroup, NULL, m_iWantLbnd, m_iWantHbnd);
+}
+
+void CAlphabetManager::CGroupNode::PopulateRange(unsigned int iLbnd, unsigned int iHbnd) {
+  m_pMgr->IterateChildGroups(this, m_pGroup, NULL, iLbnd, iHbnd);
 }
 
 int CAlphabetManager::CGroupNode::ExpectedNumChildren() {
@@ -479,8 +541,8 @@ CAlphabetManager::CGroupNode *CAlphabetManager::CreateGroupNode(CAlphNode *pPare
 
   CGroupNode *pNewNode = new CGroupNode(pParent->offset(), m_mGroupLabels[pInfo], iBkgCol, this, pInfo);
 
-  //...as is the context!
-  pNewNode->iContext = m_pLanguageModel->CloneContext(pParent->iContext);
+  //...as is the context! (Not made until needed, e.g. to populate the group.)
+  pNewNode->DeferContext(pParent->context(), 0);
 
   return pNewNode;
 }
@@ -489,7 +551,7 @@ CDasherNode *CAlphabetManager::CAlphBase::RebuildGroup(CAlphNode *pParent, int i
   CGroupNode *pRet=m_pMgr->CreateGroupNode(pParent, iBkgCol, pInfo);
   if (isInGroup(pInfo)) {
     //created group node should contain this one
-    m_pMgr->IterateChildGroups(pRet,pInfo,this);
+    m_pMgr->IterateChildGroups(pRet,pInfo,this,0,CDasherModel::NORMALIZATION);
   }
   return pRet;
 }
@@ -526,8 +588,8 @@ CDasherNode *CAlphabetManager::CreateSymbolNode(CAlphNode *pParent, symbol iSymb
 
     //    pDisplayInfo->strDisplayText = ssLabel.str();
 
-    pAlphNode->iContext = m_pLanguageModel->CloneContext(pParent->iContext);
-    m_pLanguageModel->EnterSymbol(pAlphNode->iContext, iSymbol); // TODO: Don't use symbols?
+    //context made only if the node is expanded, as few of a node's children are
+    pAlphNode->DeferContext(pParent->context(), iSymbol); // TODO: Don't use symbols?
 
   return pAlphNode;
 }
@@ -544,7 +606,8 @@ CDasherNode *CAlphabetManager::CSymbolNode::RebuildSymbol(CAlphNode *pParent, sy
   return CAlphBase::RebuildSymbol(pParent, iSymbol);
 }
 
-void CAlphabetManager::IterateChildGroups(CAlphNode *pParent, const SGroupInfo *pParentGroup, CAlphBase *buildAround) {
+void CAlphabetManager::IterateChildGroups(CAlphNode *pParent, const SGroupInfo *pParentGroup, CAlphBase *buildAround,
+                                          unsigned int iWantLbnd, unsigned int iWantHbnd) {
   std::vector<unsigned int> *pCProb(pParent->GetProbInfo());
   DASHER_ASSERT((*pCProb)[0] == 0);
   const int iMin(pParentGroup->iStart);
@@ -552,7 +615,21 @@ void CAlphabetManager::IterateChildGroups(CAlphNode *pParent, const SGroupInfo *
   unsigned int iRange(pParentGroup == m_pBaseGroup ? CDasherModel::NORMALIZATION : ((*pCProb)[iMax-1] - (*pCProb)[iMin-1]));
 
   // TODO: Think through alphabet file formats etc. to make this class easier.
-  // TODO: Throw a warning if parent node already has children
+
+  //Sparse population: children already made (by a previous call) cover iHaveLbnd-iHaveHbnd;
+  // we make only those overlapping the window (widened to meet the existing ones),
+  // ignoring any of zero size (which can never be onscreen). Those before the
+  // existing ones are collected, and added in front of them, at the end.
+  const bool bSparse(iWantLbnd > 0 || iWantHbnd < CDasherModel::NORMALIZATION || !pParent->GetChildren().empty());
+  const bool bHave(!pParent->GetChildren().empty());
+  const unsigned int iHaveLbnd(bHave ? pParent->GetChildren().begin().Lbnd() : 0),
+                     iHaveHbnd(bHave ? pParent->GetChildren().back()->Hbnd() : 0);
+  if (bHave) {
+    iWantLbnd = min(iWantLbnd, iHaveHbnd);
+    iWantHbnd = max(iWantHbnd, iHaveLbnd);
+  }
+  vector<pair<CDasherNode *, pair<unsigned int, unsigned int> > > vBefore;
+  bool bComplete(true);
 
   // Create child nodes and add them
 
@@ -561,7 +638,6 @@ void CAlphabetManager::IterateChildGroups(CAlphNode *pParent, const SGroupInfo *
   // The SGroupInfo structure has something like linked list behaviour
   // Each SGroupInfo contains a pNext, a pointer to a sibling group info
   while (i < iMax) {
-    CDasherNode *pNewChild;
     bool bSymbol = !pCurrentNode //gone past last subgroup
                   || i < pCurrentNode->iStart; //not reached next subgroup
     const int iStart=i, iEnd = (bSymbol) ? i+1 : pCurrentNode->iEnd;
@@ -572,27 +648,48 @@ void CAlphabetManager::IterateChildGroups(CAlphNode *pParent, const SGroupInfo *
     unsigned int iHbnd = (((*pCProb)[iEnd-1] - (*pCProb)[iMin-1]) *
                           static_cast<uint64>(CDasherModel::NORMALIZATION)) /
                          iRange;
+    const SGroupInfo *pGroup(bSymbol ? NULL : pCurrentNode);
     if (bSymbol) {
-      pNewChild = (buildAround) ? buildAround->RebuildSymbol(pParent, i) : CreateSymbolNode(pParent, i);
       i++; //make one symbol at a time - move onto next symbol in next iteration of (outer) loop
     } else {
       DASHER_ASSERT(pCurrentNode->iNumChildNodes > 1);
-      pNewChild= (buildAround) ? buildAround->RebuildGroup(pParent, pParent->getColour(), pCurrentNode) : CreateGroupNode(pParent, pParent->getColour(), pCurrentNode);
       i = pCurrentNode->iEnd; //make one group at a time - so move past entire group...
       pCurrentNode = pCurrentNode->pNext; //next sibling of _original_ pCurrentNode (above)
       // (maybe not of pCurrentNode now, which might be a subgroup filling the original)
     }
+    if (bSparse) {
+      if (iLbnd == iHbnd || (bHave && iLbnd >= iHaveLbnd && iHbnd <= iHaveHbnd)) continue;
+      if (iHbnd <= iWantLbnd || iLbnd >= iWantHbnd) {
+        bComplete = false;
+        continue;
+      }
+    }
+    CDasherNode *pNewChild;
+    if (pGroup)
+      pNewChild= (buildAround) ? buildAround->RebuildGroup(pParent, pParent->getColour(), pGroup) : CreateGroupNode(pParent, pParent->getColour(), pGroup);
+    else
+      pNewChild = (buildAround) ? buildAround->RebuildSymbol(pParent, iStart) : CreateSymbolNode(pParent, iStart);
     //created a new node - symbol or (group which will have >1 child).
-    pNewChild->Reparent(pParent, iLbnd, iHbnd);
+    if (bHave && iHbnd <= iHaveLbnd)
+      vBefore.push_back(make_pair(pNewChild, make_pair(iLbnd, iHbnd)));
+    else
+      pNewChild->Reparent(pParent, iLbnd, iHbnd);
   }
+  for (vector<pair<CDasherNode *, pair<unsigned int, unsigned int> > >::reverse_iterator it = vBefore.rbegin(); it != vBefore.rend(); it++)
+    it->first->ReparentFirst(pParent, it->second.first, it->second.second);
 
-  if (pParentGroup == m_pBaseGroup) m_pNCManager->AddExtras(pParent);
+  //Add extras after the last symbol, once it's been made (here)
+  if (pParentGroup == m_pBaseGroup && !pParent->GetChildren().empty()
+      && pParent->GetChildren().back()->Hbnd() == (*pCProb)[iMax-1] && (!bHave || iHaveHbnd < (*pCProb)[iMax-1]))
+    m_pNCManager->AddExtras(pParent);
   pParent->SetFlag(NF_ALLCHILDREN, true);
+  pParent->SetFlag(NF_SPARSE, !bComplete);
 }
 
 CAlphabetManager::CAlphNode::~CAlphNode() {
   delete m_pProbInfo;
-  m_pMgr->m_pLanguageModel->ReleaseContext(iContext);
+  if (m_iContext != CLanguageModel::nullContext)
+    m_pMgr->m_pLanguageModel->ReleaseContext(m_iContext);
 }
 
 const std::string &CAlphabetManager::CSymbolNode::outputText() const {
@@ -701,7 +798,7 @@ CDasherNode *CAlphabetManager::CAlphBase::RebuildParent() {
 
 void CAlphabetManager::CAlphBase::RebuildForwardsFromAncestor(CAlphNode *pNewNode) {
   //now fill in the new node - recursively - until it reaches us
-  m_pMgr->IterateChildGroups(pNewNode, m_pMgr->m_pBaseGroup, this);
+  m_pMgr->IterateChildGroups(pNewNode, m_pMgr->m_pBaseGroup, this, 0, CDasherModel::NORMALIZATION);
 }
 
 // TODO: Shouldn't there be an option whether or not to learn as we write?
@@ -714,15 +811,17 @@ void CAlphabetManager::CSymbolNode::SetFlag(int iFlag, bool bValue) {
       if (Parent()->mgr() != mgr()) return; //do not set flag
       CLanguageModel *pLM(m_pMgr->m_pLanguageModel);
       // (Note: for first symbol after startup: parent is (root) group node, which'll have the alphabet default context)
-      CLanguageModel::Context ctx = pLM->CloneContext(static_cast<CAlphabetManager::CAlphNode *>(Parent())->iContext);
+      CLanguageModel::Context ctx = pLM->CloneContext(static_cast<CAlphabetManager::CAlphBase *>(Parent())->context());
       pLM->LearnSymbol(ctx, iSymbol);
       //could: pLM->ReleaseContext(ctx);
       //however, seems better to replace this node's context (i.e. which it uses to create its own children)
       // with the new (learned) context: the former was obtained by EnterSymbol rather than LearnSymbol, so
       // will be different iff this node was the first time its symbol was entered into its parent context.
       // (Yes, this node's context is unlikely to be used again, but not impossible...)
-      pLM->ReleaseContext(iContext);
-      iContext = ctx;
+      //Any children yet to make their contexts from the old one, must do so first.
+      for (ChildMap::const_iterator it = GetChildren().begin(); it != GetChildren().end(); it++)
+        (*it)->ParentChanging();
+      SetContext(ctx);
     }
   }
   CDasherNode::SetFlag(iFlag, bValue);
@@ -25,6 +25,7 @@
 #include "DasherNode.h"
 #include "NodeManager.h"
 #include "Trainer.h"
+#include "ShardedTrainer.h"
 #include "Alphabet/AlphInfo.h"
 #include "SettingsStore.h"
 #include "Observable.h"
@@ -53,7 +54,7 @@ namespace Dasher {
   /// GetColour (called from CSymbolNode constructor); CreateSymbolNode and
   /// CSymbolNode::outputText(). [many other routines access e.g. default context, training file, and so on]
 
-  class CAlphabetManager : public CNodeManager, protected CSettingsUser {
+  class CAlphabetManager : public CNodeManager, public CShardedTrainer::ModelSource, protected CSettingsUser {
   public:
     ///Create a new AlphabetManager. Note, not usable until Setup() called.
     CAlphabetManager(CSettingsUser *pCreateFrom, CDasherInterfaceBase *pInterface, CNodeCreationManager *pNCManager, const CAlphInfo *pAlphabet);
@@ -64,9 +65,19 @@ namespace Dasher {
     void Setup();
 
     virtual void MakeLabels(CDasherScreen *pScreen);
-    ///Gets a new trainer to train this LM. Caller is responsible for deallocating the
+    ///Gets a new trainer to train an LM. Caller is responsible for deallocating the
     /// trainer later.
-    virtual CTrainer *GetTrainer();
+    /// \param pMsgs to report any problems in the training text
+    /// \param pLM the LM to train: either this manager's, or one returned by CreateLanguageModel.
+    virtual CTrainer *GetTrainer(CMessageDisplay *pMsgs, CLanguageModel *pLM);
+
+    ///Creates a new (untrained) LM suitable for this manager; Setup() calls this to
+    /// create m_pLanguageModel, and others may call it to train an LM elsewhere, e.g.
+    /// in the background. Caller is responsible for deallocating the LM.
+    /// Default implementation switches on LP_LANGUAGE_MODEL_ID.
+    /// Note subclasses changing the interpretation of the AlphInfo, should override
+    /// this to take account of its new meaning.
+    virtual CLanguageModel *CreateLanguageModel();
     
     /// Gets a (Game) Word Generator to make target sentences for the current alphabet
     CWordGeneratorBase *GetGameWords();
@@ -75,6 +86,9 @@ namespace Dasher {
     /// Flush to the user's training file everything written in this AlphMgr
     /// \param pInterface to use for I/O by calling WriteTrainFile(fname,txt)
     void WriteTrainFileFull(CDasherInterfaceBase *pInterface);
+    ///Computes the probabilities needed to populate any of the nodes which haven't
+    /// yet got them, with a single call to the language model's GetProbsBatch.
+    void PrepareToPopulate(const std::vector<CDasherNode *> &vNodes);
   protected:
     ///Initializes the alphabet map (m_map) from the characters in the alphabet.
     /// Called from Setup(), i.e. before the manager is or need be usable.
@@ -82,12 +96,6 @@ namespace Dasher {
     /// with the paragraph symbol, if any), and DASHER_ASSERTs that all such
     /// characters have distinct texts.
     virtual void InitMap();
-    
-    ///Creates the LM, and stores in m_pLanguageModel.
-    /// Default implementation switches on LP_LANGUAGE_MODEL_ID.
-    /// Note subclasses changing the interpretation of the AlphInfo, should override
-    /// this to take account of its new meaning.
-    virtual void CreateLanguageModel();
 
     ///Base of all group+character information presented to the user;
     /// created by calling copyGroups on the alphabet.
@@ -116,6 +124,8 @@ namespace Dasher {
     class CAlphBase : public CDasherNode {
     public:
       CAlphabetManager *mgr() const {return m_pMgr;}
+      ///LM context in which this node's children are predicted
+      virtual CLanguageModel::Context context()=0;
       ///Rebuilds this node's parent by recreating the previous 'root' node,
       /// then calling RebuildForwardsFromAncestor
       CDasherNode *RebuildParent();
@@ -136,6 +146,11 @@ namespace Dasher {
       void Undo();
       ///Just keep track of the last node output (for training file purposes)
       void Output();
+      ///The node whose GetProbInfo PopulateChildren will use, if that has yet to
+      /// compute it; else NULL (the default, for nodes not needing probabilities)
+      virtual CAlphNode *UncomputedProbs() {return NULL;}
+      ///Override: remember the window, for PopulateChildren to use
+      void SetPopulateWindow(unsigned int iLbnd, unsigned int iHbnd) {m_iWantLbnd = iLbnd; m_iWantHbnd = iHbnd;}
     protected:
       ///Called in process of rebuilding parent: fill in the hierarchy _beneath_ the
       /// the previous root node, by calling IterateChildGroups passing this node as
@@ -152,12 +167,26 @@ namespace Dasher {
       ///return true if the specified group would contain this node
       /// (as a symbol or subgroup), any number of levels beneath it
       virtual bool isInGroup(const SGroupInfo *pGroup)=0;
+      ///Part of this node whose children are wanted, see SetPopulateWindow;
+      /// initially all of it.
+      unsigned int m_iWantLbnd, m_iWantHbnd;
     };
     ///Additionally stores LM contexts and probabilities calculated therefrom
     class CAlphNode : public CAlphBase {
     public:
       CAlphNode(int iOffset, int iColour, CDasherScreen::Label *pLabel, CAlphabetManager *pMgr);
-      CLanguageModel::Context iContext;
+      ///LM context in which this node's children are predicted, building it first if
+      /// that was deferred (see DeferContext)
+      CLanguageModel::Context context();
+      ///Sets this node's context (which it then owns), releasing any previous one
+      void SetContext(CLanguageModel::Context iContext);
+      ///Puts off making this node's context until it's first needed, then clones iBase
+      /// and enters iSymbol (0 = none, as for a group). Most nodes never get children
+      /// or probabilities, so never need one. iBase must live until then, so its owner
+      /// (our parent) calls ParentChanging before releasing it.
+      void DeferContext(CLanguageModel::Context iBase, symbol iSymbol);
+      ///Override: build the context now, while iBase still exists
+      void ParentChanging();
       ///
       /// Delete any storage alocated for this node
       ///
@@ -165,8 +194,14 @@ namespace Dasher {
       ///Have to call this from CAlphabetManager, and from CGroupNode on a _different_ CAlphNode, hence public...
       virtual std::vector<unsigned int> *GetProbInfo();
       virtual int ExpectedNumChildren();
+      virtual CAlphNode *UncomputedProbs() {return m_pProbInfo ? NULL : this;}
     private:
+      friend class CAlphabetManager;
       std::vector<unsigned int> *m_pProbInfo;
+      ///Our context, or nullContext if not yet made; then, m_iBaseContext and
+      /// m_iPendingSymbol are those passed to DeferContext
+      CLanguageModel::Context m_iContext, m_iBaseContext;
+      symbol m_iPendingSymbol;
     };
     class CSymbolNode : public CAlphNode {
     public:
@@ -176,6 +211,8 @@ namespace Dasher {
 
       ///Create the children of this node, by starting traversal of the alphabet from the top
       virtual void PopulateChildren();
+      ///Override: fill in more of the children, by traversing the alphabet again
+      virtual void PopulateRange(unsigned int iLbnd, unsigned int iHbnd);
       virtual void Output();
       virtual void Undo();
       ///Override to provide symbol number, probability, _edit_ text from alphabet
@@ -215,9 +252,13 @@ namespace Dasher {
       ///Create children of this group node, by traversing the section of the alphabet
       /// indicated by m_pGroup.
       virtual void PopulateChildren();
+      ///Override: fill in more of the children, by traversing m_pGroup again
+      virtual void PopulateRange(unsigned int iLbnd, unsigned int iHbnd);
       virtual int ExpectedNumChildren();
       virtual bool GameSearchNode(symbol sym);
       std::vector<unsigned int> *GetProbInfo();
+      ///Override: the parent's, if GetProbInfo would use the parent's probabilities
+      CAlphNode *UncomputedProbs();
       ///Override: if the group to create is the same as this node's group, return this node instead of creating a new one
       virtual CDasherNode *RebuildGroup(CAlphNode *pParent, int iBkgCol, const SGroupInfo *pInfo);
     protected:
@@ -240,6 +281,9 @@ namespace Dasher {
 
     const CAlphInfo *GetAlphabet() const;
 
+    ///The language model created by Setup(); e.g. to save it to, or restore it from, a cache.
+    CLanguageModel *GetLanguageModel() const {return m_pLanguageModel;}
+
   protected:
     ///Called to get the symbols in the context for (preceding) a new node
     /// \param pParent node to assume has been output, when obtaining context
@@ -276,10 +320,11 @@ namespace Dasher {
     CAlphabetMap m_map;
     
   private:
-    ///Wraps m_pLanguageModel->GetProbs to implement nonuniformity
+    ///Wraps m_pLanguageModel->GetProbsBatch to implement nonuniformity
     /// (also leaves space for NCManager::AddExtras to add control node)
-    /// Returns array of non-cumulative probs. Should this be protected and/or virtual???
-    void GetProbs(std::vector<unsigned int> *pProbs, CLanguageModel::Context iContext);
+    /// Stores cumulative probs in each node's m_pProbInfo (which must be NULL).
+    /// Should this be protected and/or virtual???
+    void GetProbs(const std::vector<CAlphNode *> &vNodes);
     
     ///Constructs child nodes under the specified parent according to provided group.
     /// Nodes are created by calling CreateSymbolNode and CreateGroupNode, unless buildAround is non-null.
@@ -290,7 +335,12 @@ namespace Dasher {
     /// instead of the AlphabetManager's CreateSymbolNode/CreateGroupNode methods. This is used when
     /// rebuilding parents: passing in the pre-existing node here, allows it to intercept those calls
     /// and graft itself in in place of a new node, when appropriate.
-    void IterateChildGroups(CAlphNode *pParent, const SGroupInfo *pParentGroup, CAlphBase *buildAround);
+    /// \param iWantLbnd, iWantHbnd if not the whole of the parent (0-NORMALIZATION), only
+    /// children overlapping this window are created (see CDasherNode::SetPopulateWindow).
+    /// If the parent already has some children (from such a call), only the others are
+    /// created, including any between them and the window, so they stay contiguous.
+    void IterateChildGroups(CAlphNode *pParent, const SGroupInfo *pParentGroup, CAlphBase *buildAround,
+                            unsigned int iWantLbnd, unsigned int iWantHbnd);
 
     ///Last node (owned by this manager) that was output; if a node
     /// is Undo()ne, this is set to its parent. This is used to detect
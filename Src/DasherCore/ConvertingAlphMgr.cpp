@@ -34,8 +34,8 @@ CDasherNode *CConvertingAlphMgr::CreateSymbolNode(CAlphNode *pParent, symbol iSy
     // ConversionManager's LM to clone a context from an Alphabet Node,
     // I don't know - not sure how LanguageModelling WRT conversion
     // is supposed to work...
-    CLanguageModel::Context iContext = (pParent->iContext)
-      ? m_pConvMgr->m_pLanguageModel->CloneContext(pParent->iContext)
+    CLanguageModel::Context iContext = (pParent->context())
+      ? m_pConvMgr->m_pLanguageModel->CloneContext(pParent->context())
       : m_pConvMgr->m_pLanguageModel->CreateEmptyContext(); 
 
     //ACL setting m_iOffset+1 for consistency with "proper" symbol nodes...
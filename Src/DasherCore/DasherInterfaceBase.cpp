@@ -87,7 +87,8 @@ CDasherInterfaceBase::CDasherInterfaceBase(CSettingsStore *pSettingsStore, CFile
   m_pFramerate(new CFrameRate(this)), 
   m_pSettingsStore(pSettingsStore), 
   m_pLockLabel(NULL),
-  m_preSetObserver(*pSettingsStore){
+  m_preSetObserver(*pSettingsStore),
+  m_pTrainingLabel(NULL) {
   
   pSettingsStore->Register(this);
   pSettingsStore->PreSetObservable().Register(&m_preSetObserver);
@@ -284,8 +285,13 @@ void CDasherInterfaceBase::HandleEvent(int iParameter) {
       ScheduleRedraw();
       break;
   case LP_NODE_BUDGET:
+  case LP_EXPANSION_TIME:
     delete m_defaultPolicy;
-    m_defaultPolicy = new AmortizedPolicy(m_pDasherModel,GetLongParameter(LP_NODE_BUDGET));
+    if (GetLongParameter(LP_EXPANSION_TIME) > 0)
+      m_defaultPolicy = new TimeBudgetPolicy(m_pDasherModel, GetLongParameter(LP_NODE_BUDGET),
+                                             GetLongParameter(LP_EXPANSION_TIME), m_pFramerate);
+    else
+      m_defaultPolicy = new AmortizedPolicy(m_pDasherModel,GetLongParameter(LP_NODE_BUDGET));
     break;
   case BP_SPEAK_WORDS:
     delete m_pWordSpeaker;
@@ -509,6 +515,18 @@ void CDasherInterfaceBase::NewFrame(unsigned long iTime, bool bForceRedraw) {
       bBlit = true;
     } else {
       CExpansionPolicy *pol=m_defaultPolicy;
+
+      //0. Swap in any LM trained in the background, now that nothing is using it
+      if (m_pNCManager) {
+        if (m_pNCManager->ApplyBackgroundTraining()) bForceRedraw=true;
+        const string strStatus(m_pNCManager->GetTrainingStatus());
+        if (strStatus != m_strTrainingStatus) {
+          delete m_pTrainingLabel;
+          m_pTrainingLabel = NULL;
+          m_strTrainingStatus = strStatus;
+          bForceRedraw=true;
+        }
+      }
   
       //1. Schedule any per-frame movement in the model...
       if(m_pInputFilter) {
@@ -585,6 +603,13 @@ bool CDasherInterfaceBase::Redraw(unsigned long ulTime, bool bRedrawNodes, CExpa
   if(m_pInputFilter) {
     if (m_pInputFilter->DecorateView(m_pDasherView, m_pInput)) bRedrawNodes=true;
   }
+
+  if (!m_strTrainingStatus.empty()) {
+    CDasherScreen *pScreen(m_pDasherView->Screen());
+    unsigned int iSize(GetLongParameter(LP_MESSAGE_FONTSIZE));
+    if (!m_pTrainingLabel) m_pTrainingLabel = pScreen->MakeLabel(m_strTrainingStatus, iSize);
+    pScreen->DrawString(m_pTrainingLabel, 0, 0, iSize, 4);
+  }
   
   return bRedrawNodes;
 
@@ -632,6 +657,8 @@ void CDasherInterfaceBase::ChangeColours() {
 void CDasherInterfaceBase::ChangeScreen(CDasherScreen *NewScreen) {
   
   m_DasherScreen = NewScreen;
+  delete m_pTrainingLabel; //was made by the old screen
+  m_pTrainingLabel = NULL;
   ChangeColours();
   
   if(m_pDasherView != 0) {
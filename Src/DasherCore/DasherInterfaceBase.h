@@ -86,6 +86,15 @@ public:
 	// Writes file to user data directory. 
 	virtual bool WriteUserDataFile(const std::string &filename, const std::string &strNewText, bool append) = 0;
 
+	///Obtain the last-modification time of a file, in seconds since some fixed epoch;
+	/// 0 if unknown (the default), in which case callers must compare file contents instead.
+	virtual long GetFileModificationTime(const std::string &strFileName) { return 0; }
+
+	///Full path at which to store a (binary) file of cached data in the user data directory,
+	/// e.g. a trained language model. Default returns the empty string, meaning
+	/// the platform does not support such caching.
+	virtual std::string GetUserDataFilePath(const std::string &filename) { return ""; }
+
 };
 
 /// The central class in the core of Dasher. Ties together the rest of
@@ -426,6 +435,16 @@ public:
   void ScanFiles(AbstractParser *parser, const std::string &strPattern)  {
 	  m_fileUtils->ScanFiles(parser, strPattern);
   }
+
+  ///Last-modification time of a file, or 0 if unknown; see CFileUtils.
+  long GetFileModificationTime(const std::string &strFileName) {
+	  return m_fileUtils->GetFileModificationTime(strFileName);
+  }
+
+  ///Path for a cache file in the user data directory, or "" if caching is unsupported.
+  std::string GetUserDataFilePath(const std::string &filename) {
+	  return m_fileUtils->GetUserDataFilePath(filename);
+  }
   
   // @}
   
@@ -515,6 +534,7 @@ protected:
   virtual void onUnpause(unsigned long lTime);
   
   CDasherView *GetView() {return m_pDasherView;}
+  CNodeCreationManager *GetNCManager() {return m_pNCManager;}
   
   CDasherModel * const m_pDasherModel;
   ///Framerate monitor; created in constructor, req'd for DynamicFilter subclasses
@@ -537,7 +557,8 @@ protected:
   CPreSetObserver m_preSetObserver;
   CFileUtils* m_fileUtils;
 
-  //The default expansion policy to use - an amortized policy depending on the LP_NODE_BUDGET parameter.
+  //The default expansion policy to use - an amortized policy depending on the LP_NODE_BUDGET parameter,
+  // or a time-budgetted one if LP_EXPANSION_TIME is set.
   CExpansionPolicy *m_defaultPolicy;
 
   /// Provide a new CDasherInput input device object.
@@ -591,6 +612,12 @@ protected:
   /// (so may still be NULL even if locked)
   CDasherScreen::Label *m_pLockLabel;
 
+  ///Progress of any LM training in the background (not locking Dasher), as last
+  /// obtained from the NCManager; empty if none. Rendered in a corner of the canvas.
+  std::string m_strTrainingStatus;
+  /// (Cache) renderable version of previous, or NULL
+  CDasherScreen::Label *m_pTrainingLabel;
+
   ///Whether a full redraw (inc of nodes) has been requested externally,
   /// via ScheduleRedraw, for the next frame
   bool m_bRedrawScheduled;
@@ -71,6 +71,7 @@ CDasherModel::CDasherModel() {
   m_Rootmin_min = int64_min / NORMALIZATION / 2;
   m_Rootmax_max = int64_max / NORMALIZATION / 2;
 
+  CDasherNode::AddNodeArena(&m_NodeArena);
 }
 
 CDasherModel::~CDasherModel() {
@@ -83,6 +84,8 @@ CDasherModel::~CDasherModel() {
     delete m_Root;
     m_Root = NULL;
   }
+  CDasherNode::RemoveNodeArena(&m_NodeArena);
+  DASHER_ASSERT(m_NodeArena.NumLive() == 0);
 }
 
 void CDasherModel::Make_root(CDasherNode *pNewRoot) {
@@ -249,10 +252,15 @@ bool CDasherModel::NextScheduledStep()
 
     //pick _child_ covering crosshair...
     const myint iWidth(m_Rootmax-m_Rootmin);
+    if (m_Root->GetFlag(NF_SPARSE)) {
+      //make sure it exists! (Doubles, as this is where the ints may be about to overflow)
+      const unsigned int iCross(static_cast<unsigned int>(((ORIGIN_Y - m_Rootmin) / static_cast<double>(iWidth)) * NORMALIZATION));
+      m_Root->PopulateRange(iCross, min(iCross + 1, static_cast<unsigned int>(NORMALIZATION)));
+    }
     for (CDasherNode::ChildMap::const_iterator it = m_Root->GetChildren().begin(); ;) {
-      CDasherNode *pChild(*it);
-      DASHER_ASSERT(m_Rootmin + ((pChild->Lbnd() * iWidth) / NORMALIZATION) <= ORIGIN_Y);
-      if (m_Rootmin + ((pChild->Hbnd() * iWidth) / NORMALIZATION) > ORIGIN_Y) {
+      DASHER_ASSERT(m_Rootmin + ((it.Lbnd() * iWidth) / NORMALIZATION) <= ORIGIN_Y);
+      if (m_Rootmin + ((it.Hbnd() * iWidth) / NORMALIZATION) > ORIGIN_Y) {
+        CDasherNode *pChild(*it);
         //found child to make root. proceed only if new root is on the game path....
         if (m_Root->GetFlag(NF_GAME) && !pChild->GetFlag(NF_GAME)) {
           //If the user's strayed that far off the game path,
@@ -488,7 +496,7 @@ void CDasherModel::ExpandNode(CDasherNode *pNode) {
 #endif
   pNode->PopulateChildren();
 #ifdef DEBUG
-  if (iExpect != pNode->GetChildren().size()) {
+  if (iExpect != pNode->GetChildren().size() && !pNode->GetFlag(NF_SPARSE)) {
     std::cout << "(Note: expected " << iExpect << " children, actually created " << pNode->GetChildren().size() << ")" << std::endl;
   }
 #endif
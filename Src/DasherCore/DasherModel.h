@@ -70,6 +70,10 @@ class Dasher::CDasherModel: public Observable<CDasherNode*>, private NoClones
   CDasherModel();
   ~CDasherModel();
 
+  /// The arena from which nodes are allocated while this model exists (the model adds
+  /// it, see CDasherNode::AddNodeArena); for statistics.
+  const CSizeClassAlloc &GetNodeArena() const {return m_NodeArena;}
+
   /// @name Offset routines
   /// For "bouncing" the display up and down (dynamic button modes)
   /// @{
@@ -192,6 +196,10 @@ class Dasher::CDasherModel: public Observable<CDasherNode*>, private NoClones
 
  private:
 
+  // Storage for all nodes created while this model exists. Declared first so destroyed
+  // last, after the destructor has deleted the tree.
+  CSizeClassAlloc m_NodeArena;
+
   // The root of the Dasher tree
   CDasherNode *m_Root;
 
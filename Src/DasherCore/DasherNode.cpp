@@ -24,6 +24,8 @@
 
 #include "DasherInterfaceBase.h"
 
+#include <algorithm>
+
 using namespace Dasher;
 using namespace Opts;
 using namespace std;
@@ -41,6 +43,21 @@ static int iNumNodes = 0;
 
 int Dasher::currentNumNodeObjects() {return iNumNodes;}
 
+vector<CSizeClassAlloc *> CDasherNode::s_vNodeArenas;
+size_t CDasherNode::s_iNodeBytes = 0;
+
+size_t Dasher::currentNodeBytes() {return CDasherNode::s_iNodeBytes;}
+
+void CDasherNode::AddNodeArena(CSizeClassAlloc *pArena) {
+  s_vNodeArenas.push_back(pArena);
+}
+
+void CDasherNode::RemoveNodeArena(CSizeClassAlloc *pArena) {
+  vector<CSizeClassAlloc *>::iterator it = find(s_vNodeArenas.begin(), s_vNodeArenas.end(), pArena);
+  DASHER_ASSERT(it != s_vNodeArenas.end());
+  if (it != s_vNodeArenas.end()) s_vNodeArenas.erase(it);
+}
+
 //TODO this used to be inline - should we make it so again?
 CDasherNode::CDasherNode(int iOffset, int iColour, CDasherScreen::Label *pLabel)
 : onlyChildRendered(NULL),  m_iLbnd(0), m_iHbnd(CDasherModel::NORMALIZATION), m_pParent(NULL), m_iFlags(DEFAULT_FLAGS), m_iOffset(iOffset), m_iColour(iColour), m_pLabel(pLabel) {
@@ -101,19 +118,20 @@ void CDasherNode::OrphanChild(CDasherNode *pChild) {
     }
   }
 
+  pChild->ParentChanging();
   pChild->m_pParent=NULL;
 
-  Children().clear();
-  SetFlag(NF_ALLCHILDREN, false);
+  m_mChildren.clear(NodeArena());
+  SetFlag(NF_ALLCHILDREN | NF_SPARSE, false);
 }
 
 // Delete nephews of the child which has the specified symbol
 // TODO: Need to allow for subnode
 void CDasherNode::DeleteNephews(CDasherNode *pChild) {
-  DASHER_ASSERT(Children().size() > 0);
+  DASHER_ASSERT(GetChildren().size() > 0);
 
-  ChildMap::iterator i;
-  for(i = Children().begin(); i != Children().end(); i++) {
+  ChildMap::const_iterator i;
+  for(i = GetChildren().begin(); i != GetChildren().end(); i++) {
       if(*i != pChild) {
 	(*i)->Delete_children();
     }
@@ -125,17 +143,50 @@ void CDasherNode::DeleteNephews(CDasherNode *pChild) {
 void CDasherNode::Delete_children() {
 //  std::cout << "Start: " << this << std::endl;
 
-  ChildMap::iterator i;
-  for(i = Children().begin(); i != Children().end(); i++) {
+  ChildMap::const_iterator i;
+  for(i = GetChildren().begin(); i != GetChildren().end(); i++) {
     //    std::cout << "CNM: " << (*i)->MgrID() << (*i) << " " << (*i)->Parent() << std::endl;
     delete (*i);
   }
-  Children().clear();
+  m_mChildren.clear(NodeArena());
   //  std::cout << "NM: " << MgrID() << std::endl;
-  SetFlag(NF_ALLCHILDREN, false);
+  SetFlag(NF_ALLCHILDREN | NF_SPARSE, false);
   onlyChildRendered = NULL;
 }
 
+void CDasherNode::ChildMap::grow(CSizeClassAlloc *pArena, unsigned int iReserve) {
+  const unsigned int iNewCapacity = max(max(iReserve, m_iCapacity * 2), 4u);
+  Entry *pNew = static_cast<Entry *>(AllocFrom(pArena, iNewCapacity * sizeof(Entry)));
+  if (m_iSize) copy(m_pEntries, m_pEntries + m_iSize, pNew);
+  if (m_pEntries) FreeTo(pArena, m_pEntries, m_iCapacity * sizeof(Entry));
+  m_pEntries = pNew;
+  m_iCapacity = iNewCapacity;
+}
+
+void CDasherNode::ChildMap::push_back(CSizeClassAlloc *pArena, CDasherNode *pChild, unsigned int iLbnd, unsigned int iHbnd, unsigned int iReserve) {
+  if (m_iSize == m_iCapacity) grow(pArena, iReserve);
+  Entry &e(m_pEntries[m_iSize++]);
+  e.pNode = pChild;
+  e.iLbnd = iLbnd;
+  e.iHbnd = iHbnd;
+}
+
+void CDasherNode::ChildMap::push_front(CSizeClassAlloc *pArena, CDasherNode *pChild, unsigned int iLbnd, unsigned int iHbnd, unsigned int iReserve) {
+  if (m_iSize == m_iCapacity) grow(pArena, iReserve);
+  copy_backward(m_pEntries, m_pEntries + m_iSize, m_pEntries + m_iSize + 1);
+  m_iSize++;
+  Entry &e(m_pEntries[0]);
+  e.pNode = pChild;
+  e.iLbnd = iLbnd;
+  e.iHbnd = iHbnd;
+}
+
+void CDasherNode::ChildMap::clear(CSizeClassAlloc *pArena) {
+  if (m_pEntries) FreeTo(pArena, m_pEntries, m_iCapacity * sizeof(Entry));
+  m_pEntries = NULL;
+  m_iSize = m_iCapacity = 0;
+}
+
 void CDasherNode::SetFlag(int iFlag, bool bValue) {
 
  if(bValue)
@@ -147,10 +198,22 @@ void CDasherNode::SetFlag(int iFlag, bool bValue) {
 void CDasherNode::Reparent(CDasherNode *pNewParent, unsigned int iLbnd, unsigned int iHbnd) {
   DASHER_ASSERT(!m_pParent);
   DASHER_ASSERT(pNewParent);
-  DASHER_ASSERT(!pNewParent->GetFlag(NF_ALLCHILDREN));
-  DASHER_ASSERT(iLbnd == (pNewParent->GetChildren().empty() ? 0 : pNewParent->GetChildren().back()->m_iHbnd));
+  DASHER_ASSERT(!pNewParent->GetFlag(NF_ALLCHILDREN) || pNewParent->GetFlag(NF_SPARSE));
+  //(the first child of a sparsely-populated node need not start at 0)
+  DASHER_ASSERT(pNewParent->GetChildren().empty() || iLbnd == pNewParent->GetChildren().back()->m_iHbnd);
+  m_pParent = pNewParent;
+  pNewParent->m_mChildren.push_back(pNewParent->NodeArena(), this, iLbnd, iHbnd,
+                                    pNewParent->m_mChildren.empty() ? pNewParent->ExpectedNumChildren() : 0);
+  m_iLbnd = iLbnd;
+  m_iHbnd = iHbnd;
+}
+
+void CDasherNode::ReparentFirst(CDasherNode *pNewParent, unsigned int iLbnd, unsigned int iHbnd) {
+  DASHER_ASSERT(!m_pParent);
+  DASHER_ASSERT(pNewParent);
+  DASHER_ASSERT(!pNewParent->GetChildren().empty() && iHbnd == pNewParent->GetChildren()[0]->m_iLbnd);
   m_pParent = pNewParent;
-  pNewParent->Children().push_back(this);
+  pNewParent->m_mChildren.push_front(pNewParent->NodeArena(), this, iLbnd, iHbnd, 0);
   m_iLbnd = iLbnd;
   m_iHbnd = iHbnd;
 }
@@ -159,8 +222,8 @@ int CDasherNode::MostProbableChild() {
   int iMax(0);
   int iCurrent;
 
-  for(ChildMap::iterator it(m_mChildren.begin()); it != m_mChildren.end(); ++it) {
-    iCurrent = (*it)->Range();
+  for(ChildMap::const_iterator it(m_mChildren.begin()); it != m_mChildren.end(); ++it) {
+    iCurrent = it.Hbnd() - it.Lbnd();
 
     if(iCurrent > iMax)
       iMax = iCurrent;
@@ -170,7 +233,7 @@ int CDasherNode::MostProbableChild() {
 }
 
 bool CDasherNode::GameSearchChildren(symbol sym) {
-  for (ChildMap::iterator i = Children().begin(); i != Children().end(); i++) {
+  for (ChildMap::const_iterator i = GetChildren().begin(); i != GetChildren().end(); i++) {
     if ((*i)->GameSearchNode(sym)) return true;
   }
   return false;
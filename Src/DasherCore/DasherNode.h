@@ -23,6 +23,7 @@
 
 #include "../Common/Common.h"
 #include "../Common/NoClones.h"
+#include "../Common/Allocators/SizeClassAlloc.h"
 #include "LanguageModelling/LanguageModel.h"
 #include "DasherTypes.h"
 #include "NodeManager.h"
@@ -66,6 +67,10 @@ namespace Dasher {
 /// is drawn and outlined) by default in the constructor.
 #define NF_VISIBLE 64
 
+/// NF_SPARSE - Node has been populated (NF_ALLCHILDREN), but with only some of
+/// its children, which are contiguous; the others can be created by PopulateRange.
+#define NF_SPARSE 128
+
 ///Flags to assign to a newly created node:
 #define DEFAULT_FLAGS NF_VISIBLE
 
@@ -107,8 +112,58 @@ class Dasher::CDasherNode:private NoClones {
   CDasherNode *onlyChildRendered; //cache that only one child was rendered (as it filled the screen)
 
   /// Container type for storing children. Note that it's worth
-  /// optimising this as lookup happens a lot
-  typedef std::deque<CDasherNode*> ChildMap;
+  /// optimising this as lookup happens a lot: so children are kept, in order, in a
+  /// single array allocated from the node's arena, sized by ExpectedNumChildren() when
+  /// the first child is added (and doubled if that proves too small). Each child is
+  /// stored with a copy of its Lbnd/Hbnd, so the children in a range can be found
+  /// (FirstEndingAfter) and iterated over without touching the child nodes themselves.
+  class ChildMap : private NoClones {
+    struct Entry {
+      CDasherNode *pNode;
+      unsigned int iLbnd, iHbnd;
+    };
+  public:
+    class const_iterator {
+    public:
+      const_iterator() : m_pEntry(NULL) {}
+      CDasherNode *operator*() const {return m_pEntry->pNode;}
+      ///Bounds of the child, as its Lbnd() and Hbnd() but without reading the child
+      unsigned int Lbnd() const {return m_pEntry->iLbnd;}
+      unsigned int Hbnd() const {return m_pEntry->iHbnd;}
+      const_iterator &operator++() {++m_pEntry; return *this;}
+      const_iterator operator++(int) {const_iterator old(*this); ++m_pEntry; return old;}
+      bool operator==(const const_iterator &other) const {return m_pEntry == other.m_pEntry;}
+      bool operator!=(const const_iterator &other) const {return m_pEntry != other.m_pEntry;}
+    private:
+      friend class ChildMap;
+      explicit const_iterator(const Entry *pEntry) : m_pEntry(pEntry) {}
+      const Entry *m_pEntry;
+    };
+    ///Starts empty. (The array is released by clear, which the node calls when
+    /// deleting its children, inc. on destruction.)
+    ChildMap() : m_pEntries(NULL), m_iSize(0), m_iCapacity(0) {}
+    const_iterator begin() const {return const_iterator(m_pEntries);}
+    const_iterator end() const {return const_iterator(m_pEntries + m_iSize);}
+    unsigned int size() const {return m_iSize;}
+    bool empty() const {return m_iSize == 0;}
+    CDasherNode *operator[](unsigned int i) const {return m_pEntries[i].pNode;}
+    CDasherNode *back() const {return m_pEntries[m_iSize - 1].pNode;}
+    ///The first child whose Hbnd is greater than iBound, or end() if none. O(log n).
+    const_iterator FirstEndingAfter(unsigned int iBound) const;
+  private:
+    friend class CDasherNode;
+    ///Append a child, allocating from pArena if necessary; iReserve is a hint of
+    /// how many children there will be in total.
+    void push_back(CSizeClassAlloc *pArena, CDasherNode *pChild, unsigned int iLbnd, unsigned int iHbnd, unsigned int iReserve);
+    ///As push_back, but inserts the child before all the others
+    void push_front(CSizeClassAlloc *pArena, CDasherNode *pChild, unsigned int iLbnd, unsigned int iHbnd, unsigned int iReserve);
+    ///Make room for one more child
+    void grow(CSizeClassAlloc *pArena, unsigned int iReserve);
+    ///Forget all children and release the array; pArena as passed to push_back
+    void clear(CSizeClassAlloc *pArena);
+    Entry *m_pEntries;
+    unsigned int m_iSize, m_iCapacity;
+  };
 
   /// @brief Constructor
   ///
@@ -126,6 +181,26 @@ class Dasher::CDasherNode:private NoClones {
   ///
   virtual ~CDasherNode();
 
+  /// @name Allocation
+  /// Nodes are allocated from the most recently added node arena which has not been
+  /// removed (normally, that of the CDasherModel), or by the system allocator if there
+  /// is none. Each node records where it came from, so may be deleted as normal
+  /// whichever arena is current by then; but an arena must not be removed or destroyed
+  /// while nodes allocated from it still exist.
+  /// @{
+  static void *operator new(size_t iSize);
+  static void operator delete(void *p);
+#if defined(_WIN32) && defined(_DEBUG)
+  ///Variants used by DEBUG_NEW (see top of each .cpp file); ignore the extra arguments
+  static void *operator new(size_t iSize, int, const char *, int) {return operator new(iSize);}
+  static void operator delete(void *p, int, const char *, int) {operator delete(p);}
+#endif
+  static void AddNodeArena(CSizeClassAlloc *pArena);
+  static void RemoveNodeArena(CSizeClassAlloc *pArena);
+  ///The arena this node was allocated from (NULL = system allocator)
+  inline CSizeClassAlloc *NodeArena() const;
+  /// @}
+
   void Trace() const;           // diagnostic
 
   /// @name Routines for manipulating node status
@@ -194,6 +269,11 @@ class Dasher::CDasherNode:private NoClones {
   /// existing children of the new parent; so TODO - iLower redundant?
   /// Before the call is made, the (child) node must have no parent.
   void Reparent(CDasherNode *pNewParent, unsigned int iLower, unsigned int iUpper);
+
+  /// As Reparent, but positions the node BEFORE all existing children of the new
+  /// parent, so iUpper must be the Lbnd of the first of them. Used to fill in nodes
+  /// populated sparsely (see PopulateRange).
+  void ReparentFirst(CDasherNode *pNewParent, unsigned int iLower, unsigned int iUpper);
   
   /// @brief Orphan a child of this node
   ///
@@ -213,6 +293,11 @@ class Dasher::CDasherNode:private NoClones {
   ///
   ///
   void Delete_children();
+
+  /// Called on a child before its parent goes away without it (see OrphanChild),
+  /// or changes anything the child may have put off computing from it (such as
+  /// the parent's LM context), so the child can compute it now. Default does nothing.
+  virtual void ParentChanging() {}
   /// @}
 
   ///
@@ -239,6 +324,18 @@ class Dasher::CDasherNode:private NoClones {
   /// the node budgetting algorithm to behave sub-optimally)
   virtual int ExpectedNumChildren() = 0;
 
+  /// Tells the node which part of it (from iLbnd to iHbnd, in the coordinates of its
+  /// children's bounds, i.e. 0-CDasherModel::NORMALIZATION) will be wanted if it is
+  /// populated before the next call, e.g. because only that part is onscreen.
+  /// PopulateChildren may then create only the children overlapping it, setting
+  /// NF_SPARSE if it leaves any out. The default ignores this, i.e. always creates all.
+  virtual void SetPopulateWindow(unsigned int /*iLbnd*/, unsigned int /*iHbnd*/) {}
+
+  /// Called on a node with NF_SPARSE set, to create any of its children overlapping
+  /// iLbnd-iHbnd that do not exist yet (and those between them and the existing ones);
+  /// clears NF_SPARSE if all then exist. The default does nothing.
+  virtual void PopulateRange(unsigned int /*iLbnd*/, unsigned int /*iHbnd*/) {}
+
   ///
   /// Called whenever a node belonging to this manager first
   /// moves under the crosshair
@@ -278,8 +375,6 @@ class Dasher::CDasherNode:private NoClones {
   /// @}
 
  private:
-  inline ChildMap &Children();
-
   unsigned int m_iLbnd;
   unsigned int m_iHbnd;   // the cumulative lower and upper bound prob relative to parent
 
@@ -291,6 +386,18 @@ class Dasher::CDasherNode:private NoClones {
 
   int m_iOffset;
 
+  ///Space before each node for the arena it came from (NULL = system allocator) and
+  /// the size allocated; a whole granule, so the node itself is as aligned as the block.
+  static const size_t ALLOC_HEADER = CSizeClassAlloc::GRANULE;
+  ///Memory from pArena if non-NULL, else from the system allocator
+  static inline void *AllocFrom(CSizeClassAlloc *pArena, size_t iSize);
+  static inline void FreeTo(CSizeClassAlloc *pArena, void *p, size_t iSize);
+  ///Arenas added and not removed, the current one last
+  static std::vector<CSizeClassAlloc *> s_vNodeArenas;
+  ///Total size of all nodes in existence, inc. headers
+  static size_t s_iNodeBytes;
+  friend size_t currentNodeBytes();
+
  protected:
   const int m_iColour;
   CDasherScreen::Label * m_pLabel;
@@ -300,6 +407,9 @@ class Dasher::CDasherNode:private NoClones {
 namespace Dasher {
   /// Return the number of CDasherNode objects currently in existence.
   int currentNumNodeObjects();
+  /// Return the bytes taken by the CDasherNode objects currently in existence,
+  /// wherever allocated (not counting blocks left free in any arena).
+  size_t currentNodeBytes();
 }
 
 
@@ -309,6 +419,49 @@ namespace Dasher {
 
 namespace Dasher {
 
+inline void *CDasherNode::AllocFrom(CSizeClassAlloc *pArena, size_t iSize) {
+  return pArena ? pArena->Alloc(iSize) : ::operator new(iSize);
+}
+
+inline void CDasherNode::FreeTo(CSizeClassAlloc *pArena, void *p, size_t iSize) {
+  if (pArena) pArena->Free(p, iSize);
+  else ::operator delete(p);
+}
+
+inline void *CDasherNode::operator new(size_t iSize) {
+  CSizeClassAlloc *pArena = s_vNodeArenas.empty() ? NULL : s_vNodeArenas.back();
+  iSize += ALLOC_HEADER;
+  char *p = static_cast<char *>(AllocFrom(pArena, iSize));
+  *reinterpret_cast<CSizeClassAlloc **>(p) = pArena;
+  *reinterpret_cast<size_t *>(p + sizeof(CSizeClassAlloc *)) = iSize;
+  s_iNodeBytes += iSize;
+  return p + ALLOC_HEADER;
+}
+
+inline void CDasherNode::operator delete(void *pNode) {
+  if (!pNode) return;
+  char *p = static_cast<char *>(pNode) - ALLOC_HEADER;
+  CSizeClassAlloc *pArena = *reinterpret_cast<CSizeClassAlloc **>(p);
+  const size_t iSize = *reinterpret_cast<size_t *>(p + sizeof(CSizeClassAlloc *));
+  s_iNodeBytes -= iSize;
+  FreeTo(pArena, p, iSize);
+}
+
+inline CSizeClassAlloc *CDasherNode::NodeArena() const {
+  return *reinterpret_cast<CSizeClassAlloc * const *>(reinterpret_cast<const char *>(this) - ALLOC_HEADER);
+}
+
+inline CDasherNode::ChildMap::const_iterator CDasherNode::ChildMap::FirstEndingAfter(unsigned int iBound) const {
+  //Children are contiguous and in order, so their Hbnds are increasing
+  const Entry *pLo = m_pEntries, *pHi = m_pEntries + m_iSize;
+  while (pLo < pHi) {
+    const Entry *pMid = pLo + (pHi - pLo) / 2;
+    if (pMid->iHbnd > iBound) pHi = pMid;
+    else pLo = pMid + 1;
+  }
+  return const_iterator(pLo);
+}
+
 inline unsigned int CDasherNode::Lbnd() const {
   return m_iLbnd;
 }
@@ -321,10 +474,6 @@ inline unsigned int CDasherNode::Range() const {
   return m_iHbnd - m_iLbnd;
 }
 
-inline CDasherNode::ChildMap &CDasherNode::Children() {
-  return m_mChildren;
-}
-
 inline const CDasherNode::ChildMap &CDasherNode::GetChildren() const {
   return m_mChildren;
 }
@@ -510,6 +510,8 @@ void CDasherViewSquare::DisjointRender(CDasherNode *pRender, myint y1, myint y2,
 
   const myint Range(y2-y1);
 
+  PrepareChildren(pRender, y1, y2, iDasherMinY, iDasherMaxY);
+
   //Does node cover crosshair?
   if (pOutput == pRender->Parent() && Range > CDasherModel::ORIGIN_X && y1 < CDasherModel::ORIGIN_Y && y2 > CDasherModel::ORIGIN_Y) {
     pOutput=pRender;
@@ -620,6 +622,28 @@ void CDasherViewSquare::DisjointRender(CDasherNode *pRender, myint y1, myint y2,
   }
 }
 
+void CDasherViewSquare::PrepareChildren(CDasherNode *pRender, myint y1, myint y2, myint iDasherMinY, myint iDasherMaxY) {
+  if (pRender->ChildCount() && !pRender->GetFlag(NF_SPARSE)) return; //has all its children
+
+  //Children wanted are those in the visible region plus a margin of half its height
+  // either side; or all of them, if on the game path (the game module searches them).
+  const myint iMargin((iDasherMaxY - iDasherMinY) / 2);
+  const myint iMinY(iDasherMinY - iMargin), iMaxY(iDasherMaxY + iMargin);
+  unsigned int iLbnd(0), iHbnd(CDasherModel::NORMALIZATION);
+  if (!pRender->GetFlag(NF_GAME)) {
+    //(doubles, as the root may be big enough for y*NORMALIZATION to overflow)
+    const double dRange(y2 - y1);
+    if (iMinY > y1)
+      iLbnd = static_cast<unsigned int>(std::min(1.0, (iMinY - y1) / dRange) * CDasherModel::NORMALIZATION);
+    if (iMaxY < y2)
+      iHbnd = std::min(iHbnd, static_cast<unsigned int>(std::max(0.0, (iMaxY - y1) / dRange) * CDasherModel::NORMALIZATION) + 1);
+  }
+  if (pRender->ChildCount() == 0)
+    pRender->SetPopulateWindow(iLbnd, iHbnd);
+  else if (iLbnd < pRender->GetChildren().begin().Lbnd() || iHbnd > pRender->GetChildren().back()->Hbnd())
+    pRender->PopulateRange(iLbnd, iHbnd);
+}
+
 bool CDasherViewSquare::CoversCrosshair(myint Range, myint y1, myint y2) {
   if (Range > CDasherModel::ORIGIN_X && y1 < CDasherModel::ORIGIN_Y && y2 > CDasherModel::ORIGIN_Y) {
     switch (GetLongParameter(LP_SHAPE_TYPE)) {
@@ -726,6 +750,8 @@ beginning:
   if (pOutput == pRender->Parent() && CoversCrosshair(Range, y1, y2))
     pOutput = pRender;
 
+  PrepareChildren(pRender, y1, y2, iDasherMinY, iDasherMaxY);
+
   if (pRender->ChildCount() == 0) {
     if (pOutput==pRender) {
       //covers crosshair! forcibly populate, now!
@@ -765,12 +791,20 @@ beginning:
   }
 
   //ok, need to render all children...
-  myint newy1=y1,newy2;
   CDasherNode::ChildMap::const_iterator I = pRender->GetChildren().begin(), E = pRender->GetChildren().end();
+  if (y1 < iDasherMinY && !pRender->GetFlag(NF_GAME)) {
+    //Skip children entirely above the screen: those with (y1 + Range*Hbnd/NORMALIZATION)
+    // < iDasherMinY, i.e. with Hbnd < iBound (there's nothing to do for them unless we
+    // might need to report a game-mode node)
+    const myint iBound(((iDasherMinY - y1) * CDasherModel::NORMALIZATION) / Range);
+    if (iBound > 0)
+      I = pRender->GetChildren().FirstEndingAfter(static_cast<unsigned int>(std::min(iBound, static_cast<myint>(CDasherModel::NORMALIZATION))) - 1);
+  }
+  myint newy1 = (I==E) ? y2 : y1 + (Range * I.Lbnd()) / CDasherModel::NORMALIZATION, newy2;
   while (I!=E) {
     CDasherNode *pChild(*I);
 
-    newy2 = y1 + (Range * pChild->Hbnd()) / CDasherModel::NORMALIZATION;
+    newy2 = y1 + (Range * I.Hbnd()) / CDasherModel::NORMALIZATION;
     if (pChild->GetFlag(NF_GAME)) {
       CGameNodeDrawEvent evt(pChild, newy1, newy2);
       Observable<CGameNodeDrawEvent*>::DispatchEvent(&evt);
@@ -156,6 +156,12 @@ private:
   /// @param pOutput The innermost node covering the crosshair (if any)
   void NewRender(CDasherNode * Render, myint y1, myint y2, CTextString *prevText, CExpansionPolicy &policy, double dMaxCost, CDasherNode *&pOutput);
 
+  /// Before rendering the children of a node at y1-y2: tell a leaf which of its
+  /// children will be (nearly) onscreen, so must be made if it's expanded (see
+  /// CDasherNode::SetPopulateWindow); or if the node was populated sparsely
+  /// (NF_SPARSE), make any such children it lacks (CDasherNode::PopulateRange).
+  void PrepareChildren(CDasherNode *pRender, myint y1, myint y2, myint iDasherMinY, myint iDasherMaxY);
+
   /// @name Nonlinearity
   /// Implements the non-linear part of the coordinate space mapping
 
@@ -9,6 +9,7 @@
 
 #include "ExpansionPolicy.h"
 #include "DasherModel.h"
+#include "FrameRate.h"
 #include <algorithm>
 
 using namespace Dasher;
@@ -18,6 +19,23 @@ void CExpansionPolicy::ExpandNode(CDasherNode *pNode) {
   m_pModel->ExpandNode(pNode);
 }
 
+void CExpansionPolicy::PrepareToExpand(const vector<CDasherNode *> &vNodes) {
+  //usually all nodes have the same manager, but group them by manager anyway
+  vector<bool> vDone(vNodes.size(), false);
+  vector<CDasherNode *> vSameMgr;
+  for (size_t i = 0; i < vNodes.size(); i++) {
+    if (vDone[i]) continue;
+    CNodeManager *pMgr = vNodes[i]->mgr();
+    vSameMgr.clear();
+    for (size_t j = i; j < vNodes.size(); j++)
+      if (!vDone[j] && vNodes[j]->mgr() == pMgr) {
+        vDone[j] = true;
+        if (!vNodes[j]->GetFlag(NF_ALLCHILDREN)) vSameMgr.push_back(vNodes[j]);
+      }
+    if (!vSameMgr.empty()) pMgr->PrepareToPopulate(vSameMgr);
+  }
+}
+
 bool Less(pair<double,CDasherNode *> x, pair<double, CDasherNode *> y) {return x.first < y.first;}
 bool More(pair<double,CDasherNode *> x, pair<double, CDasherNode *> y) {return x.first > y.first;}
   
@@ -76,13 +94,33 @@ bool BudgettingPolicy::apply() {
     sCollapse.pop_back();
   }
 
-  //ok, we're now within budget. However, we may still wish to "trade off" nodes
+  //ok, we're now within budget. The loop below will expand at least those nodes
+  // for which there is room without collapsing anything; prepare them all together
+  // (e.g. so their language model predictions are computed in one batch).
+  {
+    vector<CDasherNode *> vToExpand;
+    unsigned int iNumNodes = currentNumNodeObjects();
+    for (vector<pair<double,CDasherNode *> >::reverse_iterator it = sExpand.rbegin();
+         it != sExpand.rend() && it->first > collapseCost; it++) {
+      if (iNumNodes + it->second->ExpectedNumChildren() >= m_iNodeBudget) break;
+      iNumNodes += it->second->ExpectedNumChildren();
+      vToExpand.push_back(it->second);
+    }
+    PrepareToExpand(vToExpand);
+  }
+
+  //However, we may still wish to "trade off" nodes
   // against each other, in case there are any unimportant (low-cost) nodes we could collapse
   // to make room to expand other more important (high-benefit) nodes.  
   while (!sExpand.empty() && sExpand.back().first > collapseCost)
   {
     if (currentNumNodeObjects()+sExpand.back().second->ExpectedNumChildren() < m_iNodeBudget)
     {
+      if (!expandMore()) {
+        //out of time (say); the rest will have to wait for another frame
+        bReturnValue = true;
+        break;
+      }
       ExpandNode(sExpand.back().second);
       sExpand.pop_back();
       bReturnValue = true;
@@ -192,3 +230,74 @@ void AmortizedPolicy::trim() {
     else cout << "trim not equal!\n";
 #endif
 }
+
+TimeBudgetPolicy::TimeBudgetPolicy(CDasherModel *pModel, unsigned int iNodeBudget, double dBudgetMs, CFrameRate *pFramerate)
+: BudgettingPolicy(pModel, iNodeBudget), m_dBudgetMs(dBudgetMs), m_pFramerate(pFramerate), m_iForced(0) {}
+
+void TimeBudgetPolicy::ExpandNode(CDasherNode *pNode) {
+  const Clock::time_point start = Clock::now();
+  CExpansionPolicy::ExpandNode(pNode);
+  const Expansion e = {pNode->mgr(), max(1u, pNode->GetChildren().size()), msSince(start)};
+  m_vExpanded.push_back(e);
+}
+
+double TimeBudgetPolicy::estimate(CDasherNode *pNode) {
+  map<CNodeManager *, double>::const_iterator it = m_mMsPerChild.find(pNode->mgr());
+  //Nothing known about this manager yet: expect it to be cheap, and find out
+  return (it == m_mMsPerChild.end()) ? 0.0 : it->second * max(1, pNode->ExpectedNumChildren());
+}
+
+bool TimeBudgetPolicy::expandMore() {
+  //always expand at least one node per frame, so we make progress however slow they are
+  return m_vExpanded.size() == m_iForced || Clock::now() < m_deadline;
+}
+
+bool TimeBudgetPolicy::apply() {
+  const Clock::time_point start = Clock::now();
+  //Any nodes the view expanded while rendering have used up part of the budget
+  m_iForced = m_vExpanded.size();
+  double dForcedMs = 0.0;
+  for (vector<Expansion>::const_iterator it = m_vExpanded.begin(); it != m_vExpanded.end(); it++)
+    dForcedMs += it->dMs;
+  const double dAvailMs = max(0.0, m_dBudgetMs - dForcedMs);
+  m_deadline = start + chrono::duration_cast<Clock::duration>(chrono::duration<double, milli>(dAvailMs));
+
+  //Keep only the most beneficial nodes that we expect to have time to expand
+  // (so we don't prepare the others for expansion); those left will be pushed
+  // again next frame, so make sure there is one.
+  bool bDeferred = false;
+  sort(sExpand.begin(), sExpand.end(), Less);
+  double dPlannedMs = 0.0;
+  for (vector<pair<double,CDasherNode *> >::reverse_iterator it = sExpand.rbegin(); it != sExpand.rend(); it++) {
+    dPlannedMs += estimate(it->second);
+    if (dPlannedMs > dAvailMs && it != sExpand.rbegin()) {
+      sExpand.erase(sExpand.begin(), it.base());
+      bDeferred = true;
+      break;
+    }
+  }
+
+  const bool bExpanded = BudgettingPolicy::apply();
+  const double dApplyMs = msSince(start);
+
+  //Learn what expanding costs. Time in apply() not spent in the expansions
+  // themselves (preparing the nodes all together, collapsing) is shared among them.
+  double dOverheadMs = dApplyMs;
+  for (vector<Expansion>::const_iterator it = m_vExpanded.begin() + m_iForced; it != m_vExpanded.end(); it++)
+    dOverheadMs -= it->dMs;
+  if (m_vExpanded.size() > m_iForced) dOverheadMs /= m_vExpanded.size() - m_iForced;
+  for (vector<Expansion>::const_iterator it = m_vExpanded.begin(); it != m_vExpanded.end(); it++) {
+    const double dMs = it->dMs + (it >= m_vExpanded.begin() + m_iForced ? dOverheadMs : 0.0);
+    const double dSample = dMs / it->iChildren;
+    map<CNodeManager *, double>::iterator est = m_mMsPerChild.find(it->pMgr);
+    if (est == m_mMsPerChild.end())
+      m_mMsPerChild[it->pMgr] = dSample;
+    else
+      est->second += (dSample - est->second) / 4; //decaying average
+  }
+  m_vExpanded.clear();
+
+  if (dForcedMs + dApplyMs > m_dBudgetMs)
+    m_pFramerate->RecordMissedDeadline(dForcedMs + dApplyMs - m_dBudgetMs);
+  return bExpanded || bDeferred;
+}
@@ -14,12 +14,15 @@
 #include <queue>
 #include <limits>
 #include <algorithm>
+#include <map>
+#include <chrono>
 #include "DasherNode.h"
 
 class CNodeCreationManager;
 
 namespace Dasher {
   class CDasherModel;
+  class CFrameRate;
 class CExpansionPolicy
 {
 public:
@@ -32,9 +35,12 @@ public:
   ///Expand node immediately (do not wait for a call to apply()) - subclasses may use
   /// to implement their apply() methods, but public so the view can call directly for nodes
   /// which must be expanded during rendering. (Delegates to CDasherModel.)
-  void ExpandNode(CDasherNode *pNode);
+  virtual void ExpandNode(CDasherNode *pNode);
 protected:
   CExpansionPolicy(CDasherModel *pModel) : m_pModel(pModel) {}
+  ///Tell the managers of nodes about to be expanded (in order), so they can prepare
+  /// all of them together (see CNodeManager::PrepareToPopulate)
+  void PrepareToExpand(const std::vector<CDasherNode *> &vNodes);
 private:
   CDasherModel *m_pModel;
 };
@@ -62,6 +68,9 @@ public:
   bool apply() override;
 protected:
   virtual double getCost(CDasherNode *pNode, int iDasherMinY, int iDasherMaxY);
+  ///Called by apply() before each expansion, most beneficial node first;
+  /// return false to expand no more nodes this frame.
+  virtual bool expandMore() {return true;}
   ///return the intersection of the ranges (y1-y2) and (iMin-iMax)
   int getRange(int y1, int y2, int iMin, int iMax);
   std::vector<std::pair<double,CDasherNode *> > sExpand, sCollapse;
@@ -82,5 +91,51 @@ private:
 	unsigned int m_iMaxExpands;
   void trim();
 };
+
+///Limits expansion by time rather than number: each frame, expands the most
+/// beneficial nodes that can be expected to fit into a budget of milliseconds,
+/// and stops early if the budget runs out anyway. (The node budget still applies.)
+/// Expected costs are learnt by timing every expansion, per node manager and per
+/// child to be created, as e.g. Mandarin conversion nodes cost far more than
+/// alphabet nodes. Nodes left unexpanded are pushed again by the next frame (in
+/// order of benefit, along with anything new), which apply() forces to happen.
+/// Frames whose expansions overran the budget are reported to the CFrameRate.
+class TimeBudgetPolicy : public BudgettingPolicy
+{
+public:
+  TimeBudgetPolicy(CDasherModel *pModel, unsigned int iNodeBudget, double dBudgetMs, CFrameRate *pFramerate);
+  ~TimeBudgetPolicy() override = default;
+  ///Times the expansion, which counts against this frame's budget
+  /// (including if done by the view during rendering)
+  void ExpandNode(CDasherNode *pNode) override;
+  bool apply() override;
+protected:
+  bool expandMore() override;
+private:
+  typedef std::chrono::steady_clock Clock;
+  double msSince(Clock::time_point t) const {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+  }
+  ///Expected milliseconds to expand the node, from its manager's average
+  double estimate(CDasherNode *pNode);
+  const double m_dBudgetMs;
+  CFrameRate * const m_pFramerate;
+  ///Decaying average of milliseconds per child created, for each node manager
+  /// (one since deleted is harmless: a new one at the same address just starts
+  /// from its estimate)
+  std::map<CNodeManager *, double> m_mMsPerChild;
+  ///Nodes expanded this frame: the manager of each, the number of children it
+  /// got, and how long its expansion took
+  struct Expansion {
+    CNodeManager *pMgr;
+    unsigned int iChildren;
+    double dMs;
+  };
+  std::vector<Expansion> m_vExpanded;
+  ///Number of those expanded before apply() (i.e. by the view)
+  size_t m_iForced;
+  ///Time at which apply() must stop expanding
+  Clock::time_point m_deadline;
+};
 }
 #endif /*defined __ExpansionPolicy_h__*/
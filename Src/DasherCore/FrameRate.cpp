@@ -9,6 +9,8 @@ CFrameRate::CFrameRate(CSettingsUser *pCreator) :
   m_iFrames = 0;
   m_iSamples = 1;
   m_iTime = 0;
+  m_iMissedDeadlines = 0;
+  m_dMissedDeadlineMs = 0;
 
   //try and carry on from where we left off at last run
   HandleEvent(LP_X_LIMIT_SPEED);
@@ -50,6 +52,12 @@ void CFrameRate::RecordFrame(unsigned long Time)
   }
 }
 
+void CFrameRate::RecordMissedDeadline(double dOverrunMs) {
+  m_iMissedDeadlines++;
+  m_dMissedDeadlineMs += dOverrunMs;
+  DASHER_TRACEOUTPUT("Missed frame deadline by %f ms (%lu so far)\n", dOverrunMs, m_iMissedDeadlines);
+}
+
 void CFrameRate::HandleEvent(int iParameter) {
   switch (iParameter) {
     case LP_X_LIMIT_SPEED:
@@ -47,6 +47,14 @@ public:
   }
 
   void RecordFrame(unsigned long Time);
+
+  ///Record that a frame overran its time budget for expanding nodes
+  /// (see TimeBudgetPolicy), by the given number of milliseconds
+  void RecordMissedDeadline(double dOverrunMs);
+
+  ///Number of frames that have overrun their budgets, and by how long in total (ms)
+  unsigned long MissedDeadlines() const {return m_iMissedDeadlines;}
+  double MissedDeadlineMs() const {return m_dMissedDeadlineMs;}
   
 private:
   ///number of frames that have been sampled
@@ -59,6 +67,9 @@ private:
   int m_iSteps;
   
   double m_dBitsAtLimX;
+
+  unsigned long m_iMissedDeadlines;
+  double m_dMissedDeadlineMs;
 };
 /// \}
 }
@@ -26,6 +26,14 @@
 #include "CTWLanguageModel.h"
 #include <math.h> // not in use anymore? needed it for log
 #include <cstring>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 using namespace Dasher;
 
@@ -40,15 +48,16 @@ static char THIS_FILE[] = __FILE__;
 #endif
 
 
-CCTWLanguageModel::CCTWLanguageModel(int iNumSyms) : CLanguageModel(iNumSyms) {
+CCTWLanguageModel::CCTWLanguageModel(int iNumSyms, long iMaxTableSize) : CLanguageModel(iNumSyms) {
 
-	Dasher::CHashTable HashTable;  // create hashtable
 	MaxDepth = 6;   // Maximum depth of the context tree
 	MaxTries = 15;	// Max. number of attempts to find a spot in the hash table
 	alpha = 14;		// 2: KT-estimator, 1: Laplace estimator, 14 = found by P.A.J. Volf to be 'good' for text
-	MaxNrNodes = 4194304; // Max number of CCTWNodes in the table, trade-off between compression and memory usage. 2^22 = 4M
+	TableSize = 65536; // Initial number of slots in the table (512KB); doubled as it fills
+	MaxTableSize = TableSize; // trade-off between compression and memory usage (LP_LM_CTW_TABLE_SIZE, default 2^22 = 4M slots, 32MB)
+	while (MaxTableSize < (1<<30) && 2L*MaxTableSize <= iMaxTableSize) MaxTableSize *= 2;
     TotalNodes = 0; // to keep track of how many nodes are created in the table.
-	MaxFill = 0.9;  // Threshold to decide when to freeze the tree
+	MaxFill = 0.9;  // Threshold to decide when to grow the table, or (once at MaxTableSize) freeze the tree
 	Failed = 0;		// keep track of how many nodes couldn't be found or created //debug
 	Frozen = false; // to indicate if there is still room in the array of CCTWNodes
 	MaxCount = 255; // Maximum value for the counts for count-halving
@@ -56,22 +65,135 @@ CCTWLanguageModel::CCTWLanguageModel(int iNumSyms) : CLanguageModel(iNumSyms) {
 	MaxValue = (1<<NrBits) -1;
 
     NrPhases = (int)ceil(log((double)(GetSize()))/log(2.0)); // number of bits per input-symbol
-	Tree = new CCTWNode[MaxNrNodes]; // create array with all CCTWNodes.
+	Tree = AllocTable(TableSize);
+	if (!Tree) throw std::bad_alloc();
+	InitRoots();
+}
+
+CCTWLanguageModel::~ CCTWLanguageModel(){ // destructor
+	FreeTable(Tree, TableSize);
+}
 
+CCTWLanguageModel::CCTWNode *CCTWLanguageModel::AllocTable(int iSize)
+{
+#ifdef HAVE_MMAP
+	// Anonymous pages are zero, and only committed when first written
+	void *pTable = mmap(NULL, iSize*sizeof(CCTWNode), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pTable == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+	// lookups are scattered over the whole table, so save on TLB misses where we can
+	madvise(pTable, iSize*sizeof(CCTWNode), MADV_HUGEPAGE);
+#endif
+	return static_cast<CCTWNode *>(pTable);
+#else
+	return static_cast<CCTWNode *>(calloc(iSize, sizeof(CCTWNode)));
+#endif
+}
+
+void CCTWLanguageModel::FreeTable(CCTWNode *pTable, int iSize)
+{
+#ifdef HAVE_MMAP
+	munmap(pTable, iSize*sizeof(CCTWNode));
+#else
+	free(pTable);
+#endif
+}
+
+void CCTWLanguageModel::InitRoots()
+{
 	// Fill RootIndex table with indices of the RootNodes <- now I round up to next power of 2, should only create for possible symbols
-	// Does that make a noticable difference in memory usage? Rootnodes with no symbols associated will accumulate no counts, so they only cost 1 node each (6 bytes).
+	// Does that make a noticable difference in memory usage? Rootnodes with no symbols associated will accumulate no counts, so they only cost 1 node each (8 bytes).
 	// Does it waste codespace? Do rootnodes with no symbols associated with them still get assigned a positive probability?
 	// Set NrTries to max+1, to identify a RootNode
 	for (int i = 0; i<(1<<NrPhases);i++)
     {
-     RootIndex[i] = HashTable.GetHashOffSet(i) & (MaxNrNodes-1); // MaxNrNodes is a power of 2, & results in a mod operation, walk 'round' through the array
+     RootIndex[i] = HashTable.GetHashOffSet(i) & (TableSize-1); // TableSize is a power of 2, & results in a mod operation, walk 'round' through the array
 	 Tree[RootIndex[i]].NrTries = MaxTries+1; // in rootnodes the character value doesn't matter, as long as Tries = unique
+	 Tree[RootIndex[i]].Pe = MaxValue;
+	 Tree[RootIndex[i]].PwChild = MaxValue;
 	 TotalNodes++;
     }
 }
 
-CCTWLanguageModel::~ CCTWLanguageModel(){ // destructor
-	delete [] Tree;
+void CCTWLanguageModel::Grow()
+{
+	CCTWNode *pNew = AllocTable(TableSize*2);
+	if (!pNew)
+	{ // no room to grow; carry on with what we have
+		Frozen = true;
+		return;
+	}
+	CCTWNode * const pOld = Tree;
+	const int iOldSize = TableSize;
+	Tree = pNew;
+	TableSize *= 2;
+	TotalNodes = 0;
+	// RootNodes move with the table size, so remember where each was
+	std::vector<std::pair<int,int> > OldRoots; // (index in old table, root number), sorted to find where paths start
+	for (int i = 0; i<(1<<NrPhases);i++)
+		OldRoots.push_back(std::make_pair(RootIndex[i], i));
+	std::sort(OldRoots.begin(), OldRoots.end());
+	InitRoots();
+	for (std::vector<std::pair<int,int> >::const_iterator it = OldRoots.begin(); it != OldRoots.end(); it++)
+		Tree[RootIndex[it->second]] = pOld[it->first];
+
+	// A node's parent is determined by its own slot, NrTries and Symbol, so we can find every node's
+	// path by scanning the old table (rather than searching it for every possible child of every node).
+	// NewIndex[old index] is then 0 if not yet placed, -1 if not reachable, else the new index + 1.
+	std::vector<int> NewIndex(iOldSize, 0);
+	for (std::vector<std::pair<int,int> >::const_iterator it = OldRoots.begin(); it != OldRoots.end(); it++)
+		NewIndex[it->first] = RootIndex[it->second] + 1;
+	std::vector<int> Path;
+	for (int s = 0; s < iOldSize; s++)
+	{
+		if (pOld[s].NrTries == 0 || NewIndex[s]) continue; // empty, or done already
+		Path.clear();
+		int curindex = s;
+		while (!NewIndex[curindex])
+		{ // FindPath reaches curindex from its parent: nodes are never removed, and it creates a node
+		  // only at the first empty slot, so no earlier slot in the probe sequence can match.
+		  // (But a table read from file might be corrupt, so check the path ends at a root.)
+			Path.push_back(curindex);
+			const int Stepsize = (HashTable.GetHashOffSet(pOld[curindex].Symbol)<<1)+1;
+			const int parent = (curindex - pOld[curindex].NrTries*Stepsize) & (iOldSize-1);
+			if (pOld[parent].NrTries == 0 || Path.size() > MaxDepth)
+			{
+				NewIndex[curindex] = -1;
+				break;
+			}
+			curindex = parent;
+		}
+		// now find or create the rest of the path in the new table, as FindPath would
+		for (int i = Path.size()-1; i >= 0; i--)
+		{
+			if (NewIndex[curindex] == -1)
+			{ // so are all its descendants
+				NewIndex[Path[i]] = -1;
+				curindex = Path[i];
+				continue;
+			}
+			const CCTWNode &Old(pOld[Path[i]]);
+			const int Stepsize = (HashTable.GetHashOffSet(Old.Symbol)<<1)+1;
+			int newindex = NewIndex[curindex] - 1;
+			int Tries = 1;
+			for (; Tries<MaxTries; Tries++)
+			{
+				newindex = (newindex + Stepsize) & (TableSize-1);
+				if (Tree[newindex].NrTries == Tries && Tree[newindex].Symbol == Old.Symbol) break;
+				if (Tree[newindex].NrTries == 0)
+				{
+					Tree[newindex] = Old;
+					Tree[newindex].NrTries = Tries;
+					TotalNodes++;
+					break;
+				}
+			}
+			// (if there's no room, drop it, as it would have failed to be created)
+			NewIndex[Path[i]] = (Tries == MaxTries) ? -1 : newindex + 1;
+			curindex = Path[i];
+		}
+	}
+	FreeTable(pOld, iOldSize);
 }
 
 // **** Implementation of help functions *****
@@ -79,11 +201,11 @@ CCTWLanguageModel::~ CCTWLanguageModel(){ // destructor
 #define ByteBit(byte,Phase)	((byte >> ((NrPhases-1)-Phase)) & 1)
 
 // To find the index of the RootNode for a byte and a phase.
-inline int CCTWLanguageModel::MapIndex(int b, int f){
+inline int CCTWLanguageModel::MapIndex(int b, int f) const {
 	return ((1<<f)-1 + (b>>(NrPhases-f)));  //(2^phase -1) + dec. value of most significant bits
 }
 
-inline void CCTWLanguageModel::Scale(uint64 &a, uint64 &b)
+inline void CCTWLanguageModel::Scale(uint64 &a, uint64 &b) const
 {
 	// Instead of using the full 16 bits for the probabilities, use only 9,
 	// that's the only relevant information the other bits are noise <- depends on the value of MaxCount,
@@ -110,10 +232,20 @@ inline void CCTWLanguageModel::Scale(uint64 &a, uint64 &b)
 	}
 }
 
-void CCTWLanguageModel::UpdatePath(int bit, int Update, int ValidDepth, int* & index, unsigned short int & P0, unsigned short int & P1)
+// Increments the count for 'bit', first halving both if it has reached MaxCount
+static inline void CountBit(int bit, unsigned short int &CountZero, unsigned short int &CountOne, int MaxCount)
+{
+	if ((bit ? CountOne : CountZero) == MaxCount)
+	{ // half counts
+		CountZero = (CountZero+1) / 2;
+		CountOne = (CountOne+1) / 2;
+	}
+	else
+		(bit ? CountOne : CountZero)++;
+}
+
+void CCTWLanguageModel::UpdatePath(int bit, int ValidDepth, const int *index)
 { // updates the CTW data of the nodes in 'index' with value of 'bit'.
-  // Update specifies yes (1) or no (0) (GetProbs). In the case 'no', the new Pws are calculated but the tree is not
-  // altered in any way
 
 	uint64 GammaZero;  		// (GammaZero / (GammaZero + GammaOne)) = Pw(0|x)
 	uint64 GammaOne;   		// (GammaOne  / (GammaZero + GammaOne)) = Pw(1|x)
@@ -128,19 +260,14 @@ void CCTWLanguageModel::UpdatePath(int bit, int Update, int ValidDepth, int* & i
 	uint64 PwCBlock;      		// Product of the weighted block probabilities of the childnodes of sequence (x)
 	uint64 PeBlock;	  		// Local block probability of sequence (x)
 
-	// The deepest index can be a leaf, a failed node, or a not-placed node
+	// The deepest index can be a leaf, or a node that couldn't be placed (TableSize+1)
 	const int DeepestIndex = index[ValidDepth];
 
-	if (DeepestIndex == MaxNrNodes) // node didn't exist yet, both probs. equal
+	if (DeepestIndex >= TableSize) // could do more fancy things here
 	{
 		GammaZero = MaxValue;
 		GammaOne  = MaxValue;
 	}
-	else if (DeepestIndex == MaxNrNodes+1) // node couldn't be placed
-	{   // could do more fancy things here
-		GammaZero = MaxValue;
-		GammaOne  = MaxValue;
-	}
 	else
 	{ // node has to be a leaf
 		CountZero = Tree[DeepestIndex].a;
@@ -149,31 +276,9 @@ void CCTWLanguageModel::UpdatePath(int bit, int Update, int ValidDepth, int* & i
 		GammaZero = alpha*CountZero +1;
 		GammaOne  = alpha*CountOne  +1;
 
-		if (Update == 1) // update tree
-		{// first update counts
-			if(bit)
-			{
-				if (CountOne == MaxCount)
-				{ // half counts
-					CountZero = (CountZero+1) / 2;
-					CountOne = (CountOne+1) / 2;
-				}
-				else
-					CountOne++;
-			}
-			else // bit = 0
-			{
-				if (CountZero == MaxCount)
-				{ // half counts
-					CountZero = (CountZero+1) / 2;
-					CountOne = (CountOne+1) / 2;
-				}
-				else
-					CountZero++;
-			}
-			Tree[DeepestIndex].a = CountZero;
-			Tree[DeepestIndex].b = CountOne;
-		}	// end if update
+		CountBit(bit, CountZero, CountOne, MaxCount);
+		Tree[DeepestIndex].a = CountZero;
+		Tree[DeepestIndex].b = CountOne;
 	} // end if/else, deepest index done
 	// now all the internal nodes, including the rootnode
 	for(int i=ValidDepth-1;i>=0;i--)
@@ -196,61 +301,70 @@ void CCTWLanguageModel::UpdatePath(int bit, int Update, int ValidDepth, int* & i
 
 		Scale(GammaZero, GammaOne);
 
-		if (Update == 1) // update tree
-		{// first update counts
-			if(bit)
-			{
-				if (CountOne == MaxCount)
-				{ // half counts
-					CountZero = (CountZero+1) / 2;
-					CountOne = (CountOne+1) / 2;
-				}
-				else
-					CountOne++;
+		CountBit(bit, CountZero, CountOne, MaxCount);
+		if(bit)
+		{
+			Scale(PeBlockOne, PwCBlockOne);
+			Tree[index[i]].Pe = PeBlockOne; // conversion after scaling, no problem
+			Tree[index[i]].PwChild = PwCBlockOne;
+		}
+		else // bit = 0
+		{
+			Scale(PeBlockZero, PwCBlockZero);
+			Tree[index[i]].Pe = PeBlockZero;
+			Tree[index[i]].PwChild = PwCBlockZero;
+		}
+		Tree[index[i]].a = CountZero;
+		Tree[index[i]].b = CountOne;
+	}
+}
 
-				Scale(PeBlockOne, PwCBlockOne);
-				Tree[index[i]].Pe = PeBlockOne; // conversion after scaling, no problem
-				Tree[index[i]].PwChild = PwCBlockOne;
-			}
-			else // bit = 0
-			{
-				if (CountZero == MaxCount)
-				{ // half counts
-					CountZero = (CountZero+1) / 2;
-					CountOne = (CountOne+1) / 2;
-				}
-				else
-					CountZero++;
+void CCTWLanguageModel::PathProbs(int ValidDepth, const int *index, unsigned short int & P0, unsigned short int & P1) const
+{ // As UpdatePath, but only computing the Gammas, as if an update were about to happen
 
-				Scale(PeBlockZero, PwCBlockZero);
-				Tree[index[i]].Pe = PeBlockZero;
-				Tree[index[i]].PwChild = PwCBlockZero;
-			}
-			Tree[index[i]].a = CountZero;
-			Tree[index[i]].b = CountOne;
-		} // end if update
+	uint64 GammaZero;
+	uint64 GammaOne;
+
+	const int DeepestIndex = index[ValidDepth];
+	if (DeepestIndex >= TableSize) // node didn't exist yet, or couldn't be placed; both probs. equal
+	{
+		GammaZero = MaxValue;
+		GammaOne  = MaxValue;
+	}
+	else
+	{
+		GammaZero = alpha*Tree[DeepestIndex].a +1;
+		GammaOne  = alpha*Tree[DeepestIndex].b +1;
+	}
+	for(int i=ValidDepth-1;i>=0;i--)
+	{
+		const CCTWNode &Node(Tree[index[i]]);
+		const uint64 PeBlockSum = uint64(Node.Pe)*(GammaOne+GammaZero);
+		const uint64 PwCBlockSum = uint64(Node.PwChild)*((alpha*(Node.a+Node.b))+2);
+		GammaZero = PeBlockSum*((alpha*Node.a)+1) + PwCBlockSum*GammaZero;
+		GammaOne  = PeBlockSum*((alpha*Node.b)+1) + PwCBlockSum*GammaOne;
+		Scale(GammaZero, GammaOne);
 	}
 	P0 = GammaZero; // Gammas are already scaled back to 16 bits
 	P1 = GammaOne;
 }
 
-int CCTWLanguageModel::FindPath(CCTWContext & context, char NewChar, int phase, int create, int* & index)
+int CCTWLanguageModel::FindPath(const CCTWContext & context, int NewChar, int phase, int * index)
 { // Puts the Tree-array indices of the CCTWNodes on the path of Context in index.
   // Returns the depth till which the path is found, index[] deeper than that is garbage!
-  // If 'create' = 1, new nodes are created when an empty spot is found
     int Stepsize = 0;
     int curindex = RootIndex[MapIndex(NewChar,phase)];   // Find root, depending on current (newest) character in context
 	index[0] = curindex;
 
 	// From the root, find/create the nodes, corresponding to the context
-    for (unsigned int i=0; i<context.Context.size();i++)
+    for (unsigned int i=0; i<context.Size;i++)
     {
-	  unsigned char CurChar = context.Context.at(i);
+	  unsigned char CurChar = context.at(i);
 	  Stepsize = (HashTable.GetHashOffSet(CurChar)<<1)+1; // get stepsize. Shift+1 to keep result odd, to prevent cycles
       bool found = false;
       for (int Tries = 1; Tries<MaxTries; Tries++)
       {
-        curindex = (curindex + Stepsize) & (MaxNrNodes-1);
+        curindex = (curindex + Stepsize) & (TableSize-1);
 
 		if (Tree[curindex].NrTries == Tries) // node in use, is it the correct node?
         {// see if this is the correct node: compare tries and last (current) character
@@ -263,17 +377,14 @@ int CCTWLanguageModel::FindPath(CCTWContext & context, char NewChar, int phase,
         }
         if (Tree[curindex].NrTries == 0) // empty node found, create new node
         {
-		  if (!create) // No need to create a new node, let calling function know empty spot found
-		  {
-			  index[i+1] = MaxNrNodes; // to indicate node could be placed but didn't exist yet
-			  return (i+1); // +1 since i=0 is the rootnode, always valid
-		  }
           if (!Frozen) // Still space in the tree
 		  {
 			  Tree[curindex].NrTries = Tries;
 			  Tree[curindex].Symbol = CurChar;
+			  Tree[curindex].Pe = MaxValue;
+			  Tree[curindex].PwChild = MaxValue;
 			  TotalNodes++;				// new node in use
-			  if ((float)(TotalNodes)/(float)(MaxNrNodes) > MaxFill) // Max fillratio of tree reached, freeze tree
+			  if ((float)(TotalNodes)/(float)(TableSize) > MaxFill) // Max fillratio of tree reached, freeze tree (LearnSymbol grows it before this unless at MaxTableSize)
 				  Frozen = true;
 			  found = true;					// to avoid 'failed'
 			  index[i+1] = curindex;		// tell calling function where to find the node, i+1 because index[0] = rootnode
@@ -282,7 +393,7 @@ int CCTWLanguageModel::FindPath(CCTWContext & context, char NewChar, int phase,
 		  else // can't create a new node
 		  {
 			  found = false;
-			  index[i+1] = MaxNrNodes+1;	// to indicate node could not be placed
+			  index[i+1] = TableSize+1;	// to indicate node could not be placed
 			  return (i+1);					// +i since i=0 is the rootnode, always valid
 		  }
         } // else collision, set next step
@@ -290,13 +401,74 @@ int CCTWLanguageModel::FindPath(CCTWContext & context, char NewChar, int phase,
       // after MaxTries attempts:
       if (!found) // check to see if we were succesfull
       { // apparently, character could not be placed
-		index[i+1] =  MaxNrNodes+1;			// to indicate node could not be placed
+		index[i+1] =  TableSize+1;			// to indicate node could not be placed
 		return i+1;				// indicate node could not be found/created for this phase
       } //if !found
     } // for i contextsize
-return context.Context.size(); // all nodes on the path found/created
+return context.Size; // all nodes on the path found/created
 } // end findpath
 
+void CCTWLanguageModel::LookupPaths(const CCTWContext *const *Contexts, int iContexts, int iRoots, int (*Paths)[CCTWContext::MAX_SIZE+1], int *ValidDepths) const
+{ // As FindPath for each RootNode of each context, but stops at the first node that doesn't exist. The paths are
+  // independent, so are followed together, one level at a time, letting the (scattered) lookups for each level overlap.
+  // Path k for context c is Paths[c*iRoots+k].
+	unsigned int MaxSize = 0;
+	for (int c = 0; c < iContexts; c++)
+	{
+		for (int k = 0; k < iRoots; k++)
+		{
+			Paths[c*iRoots+k][0] = RootIndex[k];
+			ValidDepths[c*iRoots+k] = -1; // still going
+		}
+		if (Contexts[c]->Size > MaxSize) MaxSize = Contexts[c]->Size;
+	}
+	for (unsigned int i=0; i<MaxSize;i++)
+	{
+#ifdef __GNUC__
+		for (int c = 0; c < iContexts; c++)
+		{
+			if (i >= Contexts[c]->Size) continue;
+			const int Stepsize = (HashTable.GetHashOffSet(Contexts[c]->at(i))<<1)+1;
+			for (int k = c*iRoots; k < (c+1)*iRoots; k++)
+				if (ValidDepths[k] == -1) __builtin_prefetch(&Tree[(Paths[k][i] + Stepsize) & (TableSize-1)]);
+		}
+#endif
+		for (int c = 0; c < iContexts; c++)
+		{
+			if (i >= Contexts[c]->Size) continue;
+			const unsigned char CurChar = Contexts[c]->at(i);
+			const int Stepsize = (HashTable.GetHashOffSet(CurChar)<<1)+1; // the same for every path of the context
+			for (int k = c*iRoots; k < (c+1)*iRoots; k++)
+			{
+				if (ValidDepths[k] != -1) continue;
+				int curindex = Paths[k][i];
+				int Tries = 1;
+				for (; Tries<MaxTries; Tries++)
+				{
+					curindex = (curindex + Stepsize) & (TableSize-1);
+					if (Tree[curindex].NrTries == Tries && Tree[curindex].Symbol == CurChar) break; // node found
+					if (Tree[curindex].NrTries == 0) break;
+				}
+				if (Tries == MaxTries)
+				{ // node could not be placed
+					Paths[k][i+1] = TableSize+1;
+					ValidDepths[k] = i+1;
+				}
+				else if (Tree[curindex].NrTries == 0)
+				{ // node could be placed but didn't exist yet
+					Paths[k][i+1] = TableSize;
+					ValidDepths[k] = i+1;
+				}
+				else
+					Paths[k][i+1] = curindex;
+			}
+		}
+	}
+	for (int c = 0; c < iContexts; c++)
+		for (int k = c*iRoots; k < (c+1)*iRoots; k++)
+			if (ValidDepths[k] == -1) ValidDepths[k] = Contexts[c]->Size;
+}
+
 
 // **** Implementation of interface functions  *****
 
@@ -304,11 +476,11 @@ void CCTWLanguageModel::EnterSymbol(Context CurContext, int Symbol)
 { // add Symbol to the front of Context. If there are more than MaxDepth symbols, pop the last one
 	CCTWLanguageModel::CCTWContext &Context = *(CCTWLanguageModel::CCTWContext *) (CurContext);
 	if (Context.Full == true)
-		Context.Context.pop_back();
+		Context.pop_back();
 
-	Context.Context.push_front(Symbol);
+	Context.push_front(Symbol);
 
-	if (Context.Context.size() == MaxDepth)
+	if (Context.Size == MaxDepth)
 		Context.Full = true;
 }
 
@@ -319,45 +491,70 @@ void CCTWLanguageModel::LearnSymbol(Context CurContext, int Symbol)
   if (Context.Full == true) // context is complete, update the tree
   {	// find indices of the tree nodes corresponding to the context
 
-	int *Index = new int[Context.Context.size()+1]; // +1 for the rootnode
+	// Each phase may create up to MaxDepth nodes; make room first, as growing moves them all
+	if (!Frozen && TotalNodes + NrPhases*MaxDepth > MaxFill*TableSize && TableSize < MaxTableSize)
+		Grow();
+
+	int Index[CCTWContext::MAX_SIZE+1]; // +1 for the rootnode
 	int ValidDepth = 0;
 	for (int phase = 0;phase<NrPhases;phase++)
 	{
-		ValidDepth = FindPath(Context, Symbol, phase, 1, Index); // Find indices of the nodes for this phase and context
+		ValidDepth = FindPath(Context, Symbol, phase, Index); // Find indices of the nodes for this phase and context
 		// nodes on the path for this phase found, update the tree
-		unsigned short int stubZ =0;
-		unsigned short int stubO =0;
-		UpdatePath(ByteBit(Symbol,phase), 1, ValidDepth, Index, stubZ, stubO);
+		UpdatePath(ByteBit(Symbol,phase), ValidDepth, Index);
 	}
-	delete [] Index;
 
-	Context.Context.pop_back();     // only delete last symbol if context is complete
+	Context.pop_back();     // only delete last symbol if context is complete
   }
-  Context.Context.push_front(Symbol); // update context with newest symbol
+  Context.push_front(Symbol); // update context with newest symbol
 
-  if (Context.Context.size() == MaxDepth)
+  if (Context.Size == MaxDepth)
 		Context.Full = true;
 }
 
 void CCTWLanguageModel::GetProbs(Context context, std::vector<unsigned int> &Probs, int Norm, int iUniform) const
-{   	// because we reuse findpath and updatepath function, we need to de-const the object :(
-	// findpath should be declared const anyway (?)
-
-	CCTWLanguageModel* self = const_cast<CCTWLanguageModel*>(this);
+{
+	const CCTWContext *pContext = (const CCTWContext *)(context);
+
+	// Find the paths for all RootNodes, i.e. all internal nodes of the tree below, at once
+	const int iRoots = (1<<NrPhases)-1;
+	int Paths[(1<<8)-1][CCTWContext::MAX_SIZE+1]; // at most 8 phases, as for RootIndex; +1 for the rootnode
+	int ValidDepths[(1<<8)-1];
+	LookupPaths(&pContext, 1, iRoots, Paths, ValidDepths);
+	PathsToProbs(Paths, ValidDepths, Probs, Norm, iUniform);
+} // end function GetProbs
 
-	CCTWContext *CTWContext = ( CCTWContext *)(context);
-	CCTWContext LocalContext(*CTWContext);
+void CCTWLanguageModel::GetProbsBatch(const std::vector<ProbsRequest> &vRequests, int Norm, int iUniform) const
+{
+	const int iRoots = (1<<NrPhases)-1;
+	BatchPaths.resize(BATCH_CONTEXTS*iRoots);
+	BatchDepths.resize(BATCH_CONTEXTS*iRoots);
+	const CCTWContext *Contexts[BATCH_CONTEXTS];
+	for (size_t iFirst = 0; iFirst < vRequests.size(); iFirst += BATCH_CONTEXTS)
+	{
+		// Look up the paths for several contexts together, so even more lookups overlap
+		const int iContexts = static_cast<int>(std::min(vRequests.size() - iFirst, size_t(BATCH_CONTEXTS)));
+		for (int c = 0; c < iContexts; c++)
+			Contexts[c] = (const CCTWContext *)(vRequests[iFirst+c].first);
+		LookupPaths(Contexts, iContexts, iRoots, &BatchPaths[0].Index, &BatchDepths[0]);
+		for (int c = 0; c < iContexts; c++)
+			PathsToProbs(&BatchPaths[c*iRoots].Index, &BatchDepths[c*iRoots], *(vRequests[iFirst+c].second), Norm, iUniform);
+	}
+}
 
-	int iNumSymbols = GetSize();
+void CCTWLanguageModel::PathsToProbs(const int (*Paths)[CCTWContext::MAX_SIZE+1], const int *ValidDepths, std::vector<unsigned int> &Probs, int Norm, int iUniform) const
+{
+	const int iNumSymbols = GetSize();
 	int MinProb = iUniform / iNumSymbols; //smallest probability to assign
 
 	Probs.resize(iNumSymbols);
 	int pLeft = 0;
 
-	// calculate probabilities of all possible symbols. Again assume all 2^NrPhases
-	int *Index = new int[LocalContext.Context.size()+1]; // +1 for the rootnode
-
-	vector <unsigned short int>Interval((1<<(NrPhases+1))-1); // number of rootnodes*2 (1 prob for bit 0 and 1 each)
+	// Interval[k] is the probability of the k'th node of the binary tree over all 2^NrPhases symbols, in
+	// breadth-first order: so the children of k are 2k+1 and 2k+2, the symbols are the last 2^NrPhases,
+	// and each internal node k is the prefix predicted by RootNode k (see MapIndex). Each internal node
+	// is visited once, parents before children.
+	unsigned short int Interval[(1<<(8+1))-1]; // at most 8 phases, as for RootIndex
 	if (Norm>65535)
 	{
 		Interval[0]=65535; // to prevent overflow
@@ -366,7 +563,6 @@ void CCTWLanguageModel::GetProbs(Context context, std::vector<unsigned int> &Pro
 	else
 		Interval[0] = Norm;
 
-	int ValidDepth = 0;
 	uint64 IntervalB = 0; // 'base' interval
 	uint64 IntervalZ = 0; // divided interval for the 0-branch
 	uint64 IntervalO = 0; // divided interval for the 1-branch
@@ -374,22 +570,18 @@ void CCTWLanguageModel::GetProbs(Context context, std::vector<unsigned int> &Pro
 	unsigned short int Pw0 = 0;
 	unsigned short int Pw1 = 0;
 
-	for (int phase = 0;phase<NrPhases;phase++)
+	for (int phase = 0, k = 0;phase<NrPhases;phase++)
 	{
-		int stepsize = 1 <<(NrPhases-phase); // 2^maxphase-1 - fase
-		for (int steps = 0;steps < 1<<phase;steps++)
+		MinInterval = MinProb*1<<(NrPhases-1-phase); // leafs for each rootnode at the current phase, assuming a full alphabet!!
+		for (const int kEnd = 2*k+1; k < kEnd; k++)
 		{ // find the path for all needed symbols
 			// FIXME now I round up to next power of 2
-			ValidDepth = self->FindPath(LocalContext, steps*stepsize, phase, 0, Index); // Find indices of the nodes for this phase and context
-
-			IntervalB = Interval[(1<<phase)+ steps - 1];
-			self->UpdatePath(0,0, ValidDepth, Index, Pw0, Pw1);
+			PathProbs(ValidDepths[k], Paths[k], Pw0, Pw1);
 
+			IntervalB = Interval[k];
 			IntervalZ = (IntervalB * Pw0)/(uint64)(Pw0+Pw1); // flooring, influence of flooring P0 instead of P1 is negligible
 			IntervalO = IntervalB - IntervalZ;
 
-			MinInterval = MinProb*1<<(NrPhases-1-phase); // leafs for each rootnode at the current phase, assuming a full alphabet!!
-
 			//make sure all leafs from this point will get at least probability 1
 			if(IntervalZ < MinInterval)
 			{
@@ -402,23 +594,22 @@ void CCTWLanguageModel::GetProbs(Context context, std::vector<unsigned int> &Pro
 				IntervalO = IntervalO + (MinInterval-IntervalO);
 			}
 
-			Interval[(1<<(phase+1))+ 2*steps - 1] = IntervalZ;
-			Interval[(1<<(phase+1))+ 2*steps] = IntervalO;
-		} // for steps
+			Interval[2*k+1] = IntervalZ;
+			Interval[2*k+2] = IntervalO;
+		} // for k
 	} // for phase
-	delete [] Index;
-
-	// Copy the intervals associated with the actual symbols to the vector Probs.
-	Probs.assign((Interval.end()-(1<<NrPhases)), (Interval.end()-(1<<NrPhases)+iNumSymbols));
-	pLeft +=Probs[0]; //symbol 0 is a special dummy symbol, should get prob. 0
-	Probs[0] = 0;
-
-	// calculate how many extra symbols exist in tree, because iNumSymbols is not a power of 2
-    int Extra = (1<<NrPhases) - iNumSymbols;
-	// take the probabilities from non-existing symbols and re-divide it over existing symbols
-	for (int j = Extra; j >0; j-- ) {
-		pLeft +=Interval[Interval.size()-j];
-	}
+
+	// Copy the intervals associated with the actual symbols to Probs.
+	const unsigned short int *Leaves = Interval + (1<<NrPhases) - 1;
+	Probs[0] = 0; //symbol 0 is a special dummy symbol, should get prob. 0
+	pLeft += Leaves[0];
+	for (int j = 1; j < iNumSymbols; j++)
+		Probs[j] = Leaves[j];
+
+	// take the probabilities from non-existing symbols (because iNumSymbols is not a power of 2)
+	// and re-divide it over existing symbols
+	for (int j = iNumSymbols; j < (1<<NrPhases); j++)
+		pLeft += Leaves[j];
 
 	int iLeft = iNumSymbols-1; //divide the probability that is left over the symbols
 	for(int j = 1; j < iNumSymbols; ++j) {
@@ -427,135 +618,97 @@ void CCTWLanguageModel::GetProbs(Context context, std::vector<unsigned int> &Pro
 		--iLeft;
 		pLeft -= p;
 	}
+}
 
-} // end function GetProbs
 
+static const unsigned short int CTW_LM_ID(5), CTW_LM_VERSION(2); // version 1 was a fixed-size table of 2^22 nodes, written node by node
 
-bool CCTWLanguageModel::WriteToFile(std::string strFilename, std::string AlphabetName){
-	SLMFileHeader GenericHeader;
-	// Magic number ("%DLF" in ASCII)
-	GenericHeader.szMagic[0] = '%';
-	GenericHeader.szMagic[1] = 'D';
-	GenericHeader.szMagic[2] = 'L';
-	GenericHeader.szMagic[3] = 'F';
+// Follows the SLMFileHeader, and precedes the table itself
+struct SCTWHeader {
+	unsigned int iNodeSize;
+	unsigned int iByteOrderMark;
+	unsigned int iMaxDepth;
+	unsigned int iTableSize;
+	unsigned int iTotalNodes;
+};
 
-	GenericHeader.iAlphabetSize = GetSize(); // Number of characters in the alphabet
+static const unsigned int BYTE_ORDER_MARK(0x01020304);
+
+bool CCTWLanguageModel::WriteToFile(std::string strFilename){
+	SLMFileHeader GenericHeader;
+	memcpy(GenericHeader.szMagic, "%DLF", 4);
 	GenericHeader.iHeaderVersion = 1; // Version of the header
-	GenericHeader.iLMID = 5; // ID of the language model, 5 for CTW
-	GenericHeader.iLMMinVersion = 1; //Minimum backwards compatible version for the language model
-	GenericHeader.iLMVersion = 1; // Version number of the language model, version 1 is the stored hashtable, april 2007
-	GenericHeader.iHeaderSize = sizeof(SLMFileHeader) + AlphabetName.length(); // Total size of header (including variable length alphabet name)
-
-	FILE *OutputFile;
-	OutputFile = fopen(strFilename.c_str(), "wb");
-	if(OutputFile)
-	{
-		char * buffer;
-		buffer = new char[AlphabetName.length()+1];
-		strcpy(buffer, AlphabetName.c_str());
-
-		// write header
-		fwrite(GenericHeader.szMagic , sizeof(GenericHeader.szMagic[0]), sizeof(GenericHeader.szMagic), OutputFile );
-		fwrite(&GenericHeader.iHeaderVersion, 2,1, OutputFile);
-		fwrite(&GenericHeader.iHeaderSize, 2,1, OutputFile);
-		fwrite(&GenericHeader.iLMID, 2,1, OutputFile);
-		fwrite(&GenericHeader.iLMVersion, 2,1, OutputFile);
-		fwrite(&GenericHeader.iLMMinVersion, 2,1, OutputFile);
-		fwrite(&GenericHeader.iAlphabetSize, 2,1, OutputFile);
-		fwrite(buffer, 1, AlphabetName.length(), OutputFile ); // UTF-8 encoded alphabet name (variable length struct)
-		delete[] buffer;
-
-		// CTW specific, not in SLMFileHeader
-		fwrite(&MaxNrNodes, 4,1, OutputFile);
-
-		for(int i=0;i<MaxNrNodes;i++)
-		{
-			fwrite(&Tree[i].a, 1,1, OutputFile);
-			fwrite(&Tree[i].b, 1,1, OutputFile);
-			fwrite(&Tree[i].Symbol, 1,1,OutputFile);
-			fwrite(&Tree[i].NrTries, 1,1,OutputFile);
-			fwrite(&Tree[i].Pe, 2,1,OutputFile);
-			fwrite(&Tree[i].PwChild, 2,1,OutputFile);
-		}
-		fclose(OutputFile);
-		return true;
+	GenericHeader.iHeaderSize = sizeof(SLMFileHeader);
+	GenericHeader.iLMID = CTW_LM_ID;
+	GenericHeader.iLMVersion = CTW_LM_VERSION;
+	GenericHeader.iLMMinVersion = CTW_LM_VERSION;
+	GenericHeader.iAlphabetSize = GetSize(); // Number of characters in the alphabet
+
+	SCTWHeader CTWHeader;
+	CTWHeader.iNodeSize = sizeof(CCTWNode);
+	CTWHeader.iByteOrderMark = BYTE_ORDER_MARK;
+	CTWHeader.iMaxDepth = MaxDepth;
+	CTWHeader.iTableSize = TableSize;
+	CTWHeader.iTotalNodes = TotalNodes;
+
+	// Write to a temporary file, then move into place, so a partially-written model is never read
+	const std::string strTemp(strFilename + ".tmp");
+	FILE *OutputFile = fopen(strTemp.c_str(), "wb");
+	if (!OutputFile) return false;
+	bool bOk = fwrite(&GenericHeader, sizeof(GenericHeader), 1, OutputFile) == 1
+		&& fwrite(&CTWHeader, sizeof(CTWHeader), 1, OutputFile) == 1
+		&& fwrite(Tree, sizeof(CCTWNode), TableSize, OutputFile) == size_t(TableSize);
+	bOk = (fclose(OutputFile) == 0) && bOk;
+	if (bOk && rename(strTemp.c_str(), strFilename.c_str()))
+	{ // (Windows won't rename over an existing file)
+		remove(strFilename.c_str());
+		bOk = rename(strTemp.c_str(), strFilename.c_str()) == 0;
 	}
-	else
-		return false;
+	if (!bOk) remove(strTemp.c_str());
+	return bOk;
 }
 
-bool CCTWLanguageModel::ReadFromFile(std::string strFilename, std::string AlphabetName){
-	FILE *InputFile;
-	InputFile = fopen(strFilename.c_str(), "rb");
-	if(InputFile)
-	{
-		/* Read and check header, close file and return failure when header is not what we expect.
-		TODO: Checking of the SLMFileHeader, which is not specific to the CTW languagemodel should be done in DasherModel,
-		only CTW specific information (MaxNrNodes) should be checked here.
-		The values to compare with should be parameters and not hardcoded. */
-
-		SLMFileHeader GenericHeader;
-		char * ReadAlphabetName;
-
-		fread(&GenericHeader.szMagic , sizeof(GenericHeader.szMagic[0]), sizeof(GenericHeader.szMagic), InputFile);
-		if(memcmp(GenericHeader.szMagic,"%DLF",4))
-		{ // magic strings not equal
-			return false;
-		}
-		fread(&GenericHeader.iHeaderVersion,2,1, InputFile);
-		if(GenericHeader.iHeaderVersion != 1)
-		{ // unknown header version
-			return false;
-		}
-		fread(&GenericHeader.iHeaderSize,2,1, InputFile);
-		fread(&GenericHeader.iLMID,2,1, InputFile);
-		if(GenericHeader.iLMID != 5)
-		{ // header indicates this is not a CTW model
-			return false;
-		}
-		fread(&GenericHeader.iLMVersion,2,1, InputFile);
-		fread(&GenericHeader.iLMMinVersion,2,1, InputFile);
-		if(GenericHeader.iLMMinVersion > 1)
-		{ // header indicates stored model newer than we can handle
-			return false;
-		}
-		fread(&GenericHeader.iAlphabetSize,2,1, InputFile);
-		if(GenericHeader.iAlphabetSize != GetSize())
-		{ // header indicates stored model uses an alphabet of different size
-			return false;
-		}
-
-		ReadAlphabetName = new char[GenericHeader.iHeaderSize - sizeof(SLMFileHeader)+1];
-		fread(ReadAlphabetName,1,GenericHeader.iHeaderSize - sizeof(SLMFileHeader), InputFile);
-		ReadAlphabetName[GenericHeader.iHeaderSize - sizeof(SLMFileHeader)] = '\0'; // write the terminating 0 and read it in as well
+bool CCTWLanguageModel::ReadFromFile(std::string strFilename){
+	FILE *InputFile = fopen(strFilename.c_str(), "rb");
+	if (!InputFile) return false;
 
-		if(strcmp(ReadAlphabetName,AlphabetName.c_str()))
-		{ // header indicates stored model uses a different alphabet
-			delete[] ReadAlphabetName;
-			return false;
-		}
-		delete[] ReadAlphabetName;
-		int ReadNrNodes;
-		fread(&ReadNrNodes,4,1, InputFile);
-		if(ReadNrNodes != MaxNrNodes)
-		{ // header indicates different number of nodes in the hashtable
-			return false;
-		}
-
-		for(int i=0;i<MaxNrNodes;i++)
-		{
-			fread(&Tree[i].a,1,1,InputFile);
-			fread(&Tree[i].b,1,1,InputFile);
-			fread(&Tree[i].Symbol, 1,1,InputFile);
-			fread(&Tree[i].NrTries, 1,1,InputFile);
-			fread(&Tree[i].Pe, 2,1,InputFile);
-			fread(&Tree[i].PwChild, 2,1,InputFile);
-		}
+	SLMFileHeader GenericHeader;
+	SCTWHeader CTWHeader;
+	if (fread(&GenericHeader, sizeof(GenericHeader), 1, InputFile) != 1
+		|| memcmp(GenericHeader.szMagic, "%DLF", 4)
+		|| GenericHeader.iHeaderVersion != 1
+		|| GenericHeader.iLMID != CTW_LM_ID
+		|| GenericHeader.iLMMinVersion > CTW_LM_VERSION
+		|| GenericHeader.iAlphabetSize != GetSize()
+		|| fseek(InputFile, GenericHeader.iHeaderSize, SEEK_SET)
+		|| fread(&CTWHeader, sizeof(CTWHeader), 1, InputFile) != 1
+		|| CTWHeader.iNodeSize != sizeof(CCTWNode)
+		|| CTWHeader.iByteOrderMark != BYTE_ORDER_MARK
+		|| CTWHeader.iMaxDepth != MaxDepth
+		|| CTWHeader.iTableSize < 256 || CTWHeader.iTableSize > (unsigned int)MaxTableSize
+		|| (CTWHeader.iTableSize & (CTWHeader.iTableSize-1))) // not a power of 2
+	{
 		fclose(InputFile);
-		return true;
+		return false;
 	}
-	else
+
+	CCTWNode *pTable = AllocTable(CTWHeader.iTableSize);
+	if (!pTable || fread(pTable, sizeof(CCTWNode), CTWHeader.iTableSize, InputFile) != CTWHeader.iTableSize)
+	{
+		if (pTable) FreeTable(pTable, CTWHeader.iTableSize);
+		fclose(InputFile);
 		return false;
+	}
+	fclose(InputFile);
+
+	FreeTable(Tree, TableSize);
+	Tree = pTable;
+	TableSize = CTWHeader.iTableSize;
+	TotalNodes = CTWHeader.iTotalNodes;
+	Frozen = TableSize == MaxTableSize && (float)(TotalNodes)/(float)(TableSize) > MaxFill;
+	for (int i = 0; i<(1<<NrPhases);i++)
+		RootIndex[i] = HashTable.GetHashOffSet(i) & (TableSize-1);
+	return true;
 }
 
 inline CLanguageModel::Context CCTWLanguageModel::CreateEmptyContext() {
@@ -564,13 +717,7 @@ inline CLanguageModel::Context CCTWLanguageModel::CreateEmptyContext() {
 }
 
 inline CLanguageModel::Context CCTWLanguageModel::CloneContext(Context Copy) {
-	CCTWContext *pCont = new CCTWContext;
-    CCTWContext *pCopy = (CCTWContext *) Copy;
-
-	pCont->Full = pCopy->Full;
-	pCont->Context.assign(pCopy->Context.begin( ), pCopy->Context.end( ));
-
-	return (Context) pCont;
+	return (Context) new CCTWContext(*(CCTWContext *) Copy);
 }
 
 inline void CCTWLanguageModel::ReleaseContext(Context release) {
@@ -29,7 +29,6 @@
 #include <fstream>			
 #include "LanguageModel.h"	
 #include "HashTable.h"
-#include <deque>			
 
 using namespace Dasher;
 using namespace std;
@@ -39,7 +38,8 @@ namespace Dasher {
   // CTW language model 
   class CCTWLanguageModel: public CLanguageModel {
   public:    
-	CCTWLanguageModel(int iNumSyms);
+	CCTWLanguageModel(int iNumSyms, long iMaxTableSize);
+	// iMaxTableSize: number of slots (8 bytes each) to which the table may grow, rounded down to a power of 2
 	virtual ~ CCTWLanguageModel(); 
 
     Context CreateEmptyContext();			
@@ -49,15 +49,18 @@ namespace Dasher {
     virtual void EnterSymbol(Context context, int Symbol); 
 	virtual void LearnSymbol(Context context, int Symbol); 	
 	virtual void GetProbs(Context context, std::vector < unsigned int >&Probs, int Norm, int iUniform) const; 
+	// Looks up the paths for up to BATCH_CONTEXTS contexts at a time, all together
+	virtual void GetProbsBatch(const std::vector<ProbsRequest> &vRequests, int Norm, int iUniform) const;
 	
 	Dasher::CHashTable HashTable; // Hashtable used for storing CCTWNodes in an array
       unsigned int MaxDepth;	// Maximum depth of the tree
 	int MaxTries;	// Determines how many times to try to find an empty index for a new node (max number of collisions)
 	int alpha;		// Parameter of the KT-estimator 
 	
-	int MaxNrNodes; // Max number of CCTWNodes in the table
+	int TableSize;  // Number of slots for CCTWNodes in the table, a power of 2
+	int MaxTableSize; // Size beyond which the table is not grown; once that is MaxFill full, the tree is frozen
 	int TotalNodes; // keep track of how many nodes are created, and memory usage
-	float MaxFill;  // Treshold to decide when to freeze the tree
+	float MaxFill;  // Fill ratio at which the table is doubled in size (rehashing all nodes into the new one), or at MaxTableSize, the tree is frozen
 	int Failed;		// keep track of how many nodes couldn't be found or created		
 	bool Frozen;	// to indicate if there is still room in the array of CCTWNodes
 	int MaxCount;   // The maximum number of a and b, the counts of zeros and ones in each CCTWnode, before they are halved.
@@ -74,54 +77,76 @@ namespace Dasher {
 	  unsigned short int Pe; // Numerator of the local block probability
 	  unsigned short int PwChild; // Numerator of the product of the weighted block probabilities of the child nodes
 
-	  CCTWNode(){ // constructor		
-		a = 0;
-		b = 0;
-	    Pe = 511;      // Should be initialised to MaxValue, make that a static const
-		PwChild = 511;
-		Symbol = 0; 
-		NrTries = 0; 		
-	  }
-	~CCTWNode(){}
 	};
+	// No constructor: the table is allocated zeroed (see AllocTable), and an all-zero CCTWNode
+	// (NrTries == 0) is an empty slot. Nodes are initialised (Pe = PwChild = MaxValue) when placed.
 	
-	CCTWNode *Tree;     // array of CCTWNodes
-	int RootIndex[255]; // array of indices of the RootNodes. Depends on number of bits per character, assuming 8 
+	CCTWNode *Tree;     // array of TableSize CCTWNodes
+	int RootIndex[256]; // array of indices of the RootNodes. Depends on number of bits per character, assuming 8 
 	//TODO only create necessary rootnodes no more. Need to dynamically create this array
 
-	class CCTWContext {
+	class CCTWContext { // the most recent (up to MaxDepth) symbols, in a ring buffer
 	public:
-		CCTWContext(CCTWContext const &Input) { // copy constructor
-			Full = Input.Full;
-			Context.assign(Input.Context.begin( ), Input.Context.end( ));			
-		} 
-		CCTWContext() { // default constructor
-			Full = false;			
-		}		
-		~ CCTWContext(){};
+		static const unsigned int MAX_SIZE = 16; // a power of 2, and at least MaxDepth
+		CCTWContext() : Full(false), Start(0), Size(0) {}
+		unsigned char at(unsigned int i) const { // i'th most recent symbol, for i < Size
+			return Symbols[(Start + i) & (MAX_SIZE-1)];
+		}
+		void push_front(int Symbol) {
+			Start = (Start - 1) & (MAX_SIZE-1);
+			Symbols[Start] = Symbol;
+			Size++;
+		}
+		void pop_back() {Size--;}
 		bool Full;
-		deque<int> Context;	
+		unsigned int Start, Size;
+		unsigned char Symbols[MAX_SIZE];
 	};	
 
-	virtual bool WriteToFile(std::string strFilename, std::string AlphabetName);
-	virtual bool ReadFromFile(std::string strFilename, std::string AlphabetName);	
+	// The model file is the SLMFileHeader, then the table size and similar, then the whole table as
+	// one block; reading it replaces the table wholesale (contexts are unaffected).
+	virtual bool WriteToFile(std::string strFilename);
+	virtual bool ReadFromFile(std::string strFilename);
 // **** used help functions *****
     
 	private:
 
-	int MapIndex(int b, int f); 	
+	int MapIndex(int b, int f) const; 	
+
+	static CCTWNode *AllocTable(int iSize);
+	// Allocates a zeroed table of iSize slots, committing memory only as it is used. Returns NULL on failure.
+	static void FreeTable(CCTWNode *pTable, int iSize);
+
+	void InitRoots();
+	// Computes RootIndex for the current TableSize, and places the RootNodes in Tree there
+
+	void Grow();
+	// Doubles the size of the table, re-placing every node reachable via FindPath; freezes the tree if that fails.
 		
-	void UpdatePath(int bit, int Update, int ValidDepth, int* & index, unsigned short int & Pw0, unsigned short int & Pw1);
-	// calculates the new weighted conditional probabilities of a zero and a one (Pw0, Pw1) after an update with 'bit'
-	// on the path given in 'index'. 'Update' specifies whether or not the tree is actually updated (LearnSymbol),
-	// or only the probabilities are calculated (GetProbs).
+	void UpdatePath(int bit, int ValidDepth, const int *index);
+	// updates the CTW data of the nodes on the path given in 'index' (as found by FindPath) with 'bit'.
+
+	void PathProbs(int ValidDepth, const int *index, unsigned short int & Pw0, unsigned short int & Pw1) const;
+	// calculates the weighted conditional probabilities of a zero and a one (Pw0, Pw1) on the path given in 'index'
+	// (as found by LookupPaths), without altering the tree.
 	
-	int FindPath(CCTWContext & context, char NewChar, int phase, int create, int* & index); 
-    // Puts the Tree-array indices of the CCTWNodes on the path of Context in index. 
-	// Returns depth of found path. ``Create'' specifies whether non-existing nodes need to be
-	// created (LearnSymbol) or not (GetProbs).
+	int FindPath(const CCTWContext & context, int NewChar, int phase, int * index); 
+    // Puts the Tree-array indices of the CCTWNodes on the path of Context in index, creating any which do not exist.
+	// Returns depth of found path.
+
+	void LookupPaths(const CCTWContext *const *Contexts, int iContexts, int iRoots, int (*Paths)[CCTWContext::MAX_SIZE+1], int *ValidDepths) const;
+	// As FindPath, but for each of the first iRoots RootNodes of each of iContexts contexts at once, and without
+	// creating nodes: puts the path from RootNode k for context c in Paths[c*iRoots+k], and its depth in ValidDepths[c*iRoots+k].
+
+	void PathsToProbs(const int (*Paths)[CCTWContext::MAX_SIZE+1], const int *ValidDepths, std::vector<unsigned int> &Probs, int Norm, int iUniform) const;
+	// Computes the distribution for GetProbs from the paths (as found by LookupPaths) of a single context.
+
+	static const int BATCH_CONTEXTS = 8; // contexts whose paths GetProbsBatch looks up together
+	struct SPath {int Index[CCTWContext::MAX_SIZE+1];};
+	mutable std::vector<SPath> BatchPaths; // scratch space for GetProbsBatch
+	mutable std::vector<int> BatchDepths;
 
-	void Scale(uint64 & a, uint64 & b);
+	void Scale(uint64 & a, uint64 & b) const;
 	// Scales both inputs to fit in NrBits
 
   }; // end class CCTWLanguageModel
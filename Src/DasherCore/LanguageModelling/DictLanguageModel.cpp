@@ -21,10 +21,6 @@ using namespace std;
 // static TCHAR debug[256];
 typedef unsigned long ulong;
 
-#ifdef _WIN32
-#define snprintf _snprintf
-#endif
-
 // Track memory leaks on Windows to the line that new'd the memory
 #ifdef _WIN32
 #ifdef _DEBUG_MEMLEAKS
@@ -91,19 +87,16 @@ CDictLanguageModel::CDictnode * CDictLanguageModel::AddSymbolToNode(CDictnode *p
 /////////////////////////////////////////////////////////////////////
 
 CDictLanguageModel::CDictLanguageModel(CSettingsUser *pCreator, const CAlphInfo *pAlph, const CAlphabetMap *pAlphMap)
-:CLanguageModel(pAlph->iEnd-1), CSettingsUser(pCreator), m_pAlphMap(pAlphMap), m_iSpaceSymbol(pAlph->GetSpaceSymbol()), NodesAllocated(0), max_order(0), m_NodeAlloc(8192), m_ContextAlloc(1024) {
+:CLanguageModel(pAlph->iEnd-1), CSettingsUser(pCreator), m_pAlphMap(pAlphMap), m_iSpaceSymbol(pAlph->GetSpaceSymbol()), m_Words(8192), NodesAllocated(0), max_order(0), m_NodeAlloc(8192), m_Contexts(1024) {
   m_pRoot = m_NodeAlloc.Alloc();
   m_pRoot->sbl = -1;
-  m_rootcontext = new CDictContext(m_pRoot, 0);
-
-  nextid = 8192;                // Start of indices for words - may need to increase this for *really* large alphabets
+  m_rootcontext = m_Contexts.Alloc(CDictContext(m_pRoot, 0));
 
   std::ifstream DictFile("/usr/share/dict/words");      // FIXME - hardcoded paths == bad
 
   std::string CurrentWord;
 
-  while(!DictFile.eof()) {
-    DictFile >> CurrentWord;
+  while(DictFile >> CurrentWord) {
 
     CurrentWord = CurrentWord + " ";
 
@@ -119,6 +112,7 @@ CDictLanguageModel::CDictLanguageModel(CSettingsUser *pCreator, const CAlphInfo
     for(std::vector < symbol >::iterator it(Symbols.begin()); it != Symbols.end(); ++it) {
       MyLearnSymbol(TempContext, *it);
     }
+    ReleaseContext(TempContext);
 
   }
 
@@ -126,7 +120,7 @@ CDictLanguageModel::CDictLanguageModel(CSettingsUser *pCreator, const CAlphInfo
 
 CDictLanguageModel::~CDictLanguageModel() {
 
-  delete m_rootcontext;
+  ReleaseContext(m_rootcontext);
 
   // A non-recursive node deletion algorithm using a stack
 /*	std::stack<CDictnode*> deletenodes;
@@ -154,29 +148,13 @@ CDictLanguageModel::~CDictLanguageModel() {
 
 }
 
-int CDictLanguageModel::lookup_word(const std::string &w) {
-
-  if(dict[w] == 0) {
-    dict[w] = nextid;
-    ++nextid;
-  }
-
-  return dict[w];
-
-}
-
-int CDictLanguageModel::lookup_word_const(const std::string &w) const {
-
-  return dict.find(w)->second;
-
-}
-
 /////////////////////////////////////////////////////////////////////
 // get the probability distribution at the context
 
 void CDictLanguageModel::GetProbs(Context context, std::vector<unsigned int > &probs, int norm, int iUniform) const {
 
-  const CDictLanguageModel::CDictContext * wordcontext = (const CDictContext *)(context);
+  DASHER_ASSERT(m_Contexts.IsValid(context));
+  const CDictLanguageModel::CDictContext * wordcontext = &m_Contexts[context];
 
   int iNumSymbols = GetSize();
 
@@ -427,7 +405,7 @@ void CDictLanguageModel::GetProbs(Context context, std::vector<unsigned int > &p
 // //                   return true;
 // }
 
-void CDictLanguageModel::CollapseContext(CDictLanguageModel::CDictContext &context) const {
+void CDictLanguageModel::CollapseContext(CDictLanguageModel::CDictContext &context) {
 
   if(max_order == 0) {
     // If max_order = 0 then we are not keeping track of previous
@@ -444,7 +422,7 @@ void CDictLanguageModel::CollapseContext(CDictLanguageModel::CDictContext &conte
 
 //        CDictnode *new_head;
 
-    int new_sbl(lookup_word_const(context.current_word));
+    int new_sbl(m_Words.WordId(context.current_word));
 
     CDictnode *new_tmp;
     CDictnode *prev_tmp(NULL);
@@ -474,7 +452,7 @@ void CDictLanguageModel::CollapseContext(CDictLanguageModel::CDictContext &conte
 
     prev_tmp->vine = m_pRoot;
 
-    context.current_word = "";
+    context.current_word = CWordIndex::EMPTY;
     ++context.order;
     ++context.word_order;
 
@@ -489,7 +467,8 @@ void CDictLanguageModel::CollapseContext(CDictLanguageModel::CDictContext &conte
 }
 
 void CDictLanguageModel::MyLearnSymbol(Context c, int Symbol) {
-  CDictContext & context = *(CDictContext *) (c);
+  DASHER_ASSERT(m_Contexts.IsValid(c));
+  CDictContext & context = m_Contexts[c];
   AddSymbol(context, Symbol);
 }
 
@@ -510,11 +489,8 @@ void CDictLanguageModel::AddSymbol(CDictLanguageModel::CDictContext &context, sy
 
   // Add the new symbol to the string representation of the current word too
 
-  if(max_order > 0) {
-    char sbuffer[5];
-    snprintf(sbuffer, 5, "%04d", sym);
-    context.current_word.append(sbuffer);
-  }
+  if(max_order > 0)
+    context.current_word = m_Words.Extend(context.current_word, sym);
 
   // Propagate down the vine pointers
 
@@ -545,17 +521,15 @@ while(context.order > GetLongParameter( LP_LM_MAX_ORDER )) {
 
 void CDictLanguageModel::EnterSymbol(Context c, int Symbol) {
 
-  CDictContext & context = *(CDictContext *) (c);
+  DASHER_ASSERT(m_Contexts.IsValid(c));
+  CDictContext & context = m_Contexts[c];
 
   // Add the symbol to the current word string
 
   //  cout << max_order << std::endl;
 
-  if(max_order > 0) {
-    char sbuffer[5];
-    snprintf(sbuffer, 5, "%04d", Symbol);
-    context.current_word.append(sbuffer);
-  }
+  if(max_order > 0)
+    context.current_word = m_Words.Extend(context.current_word, Symbol);
 
   // Collapse context if necessary - note that there's no point in
   // traversing the trie for the new symbol if we're just going to
@@ -11,12 +11,12 @@
 
 #include "../../Common/NoClones.h"
 #include "../../Common/Allocators/PooledAlloc.h"
+#include "../../Common/Allocators/HandleTable.h"
 #include "PPMLanguageModel.h"
+#include "WordIndex.h"
 #include "../Alphabet/AlphInfo.h"
 #include "../Alphabet/AlphabetMap.h"
 #include <vector>
-#include <map>
-#include <string>
 #include <stdio.h>
 
 //static char dumpTrieStr[40000];
@@ -60,13 +60,7 @@ namespace Dasher {
 
     class CDictContext {
     public:
-      CDictContext(CDictContext const &input) {
-        head = input.head;
-        word_head = input.word_head;
-        current_word = input.current_word;
-        order = input.order;
-        word_order = input.word_order;
-    } CDictContext(CDictnode * _head = 0, int _order = 0):head(_head), order(_order), word_head(_head), word_order(0) {
+      CDictContext(CDictnode * _head = 0, int _order = 0):head(_head), order(_order), current_word(CWordIndex::EMPTY), word_head(_head), word_order(0) {
       };                        // FIXME - doesn't work if we're trying to create a non-empty context
       ~CDictContext() {
       };
@@ -74,7 +68,8 @@ namespace Dasher {
       CDictnode *head;
       int order;
 
-      std::string current_word;
+      /// The letters of the current word so far, as a prefix in the word index
+      int current_word;
       CDictnode *word_head;
       int word_order;
 
@@ -87,23 +82,22 @@ namespace Dasher {
 
     void AddSymbol(CDictContext & context, symbol sym);
 
-    void CollapseContext(CDictContext & context) const;
+    void CollapseContext(CDictContext & context);
 
-    int lookup_word(const std::string & w);
-    int lookup_word_const(const std::string & w) const;
-
-    CDictContext *m_rootcontext;
+    /// Context from which all empty contexts are copied
+    Context m_rootcontext;
     CDictnode *m_pRoot;
 
-    std::map < std::string, int >dict;  // Dictionary
-    int nextid;
+    /// Dictionary, giving identifiers to the words seen (from 8192, so above any symbol)
+    CWordIndex m_Words;
 
     int NodesAllocated;
 
     int max_order;
 
     mutable CSimplePooledAlloc < CDictnode > m_NodeAlloc;
-    CPooledAlloc < CDictContext > m_ContextAlloc;
+    /// Contexts, indexed by handle
+    CHandleTable < CDictContext > m_Contexts;
   };
   /// \}
 
@@ -128,24 +122,21 @@ namespace Dasher {
 ///////////////////////////////////////////////////////////////////
 
   inline CLanguageModel::Context CDictLanguageModel::CreateEmptyContext() {
-    CDictContext *pCont = m_ContextAlloc.Alloc();
-    *pCont = *m_rootcontext;
-    return (Context) pCont;
+    return CloneContext(m_rootcontext);
   }
 
 ///////////////////////////////////////////////////////////////////
 
   inline CLanguageModel::Context CDictLanguageModel::CloneContext(Context Copy) {
-    CDictContext *pCont = m_ContextAlloc.Alloc();
-    CDictContext *pCopy = (CDictContext *) Copy;
-    *pCont = *pCopy;
-    return (Context) pCont;
+    DASHER_ASSERT(m_Contexts.IsValid(Copy));
+    return m_Contexts.Alloc(m_Contexts[Copy]);
   }
 
 ///////////////////////////////////////////////////////////////////
 
   inline void CDictLanguageModel::ReleaseContext(Context release) {
-    m_ContextAlloc.Free((CDictContext *) release);
+    DASHER_ASSERT(m_Contexts.IsValid(release));
+    m_Contexts.Free(release);
   }
 
 ///////////////////////////////////////////////////////////////////
@@ -12,6 +12,7 @@
 #include "../DasherTypes.h"
 
 
+#include <utility>
 #include <vector>
 
 /////////////////////////////////////////////////////////////////////////////
@@ -99,6 +100,35 @@ public:
 
   virtual void GetProbs(Context Context, std::vector < unsigned int >&Probs, int iNorm, int iUniform) const = 0;
 
+  ///
+  /// A context, and where to put the distribution for it
+  ///
+
+  typedef std::pair<Context, std::vector<unsigned int> *> ProbsRequest;
+
+  ///
+  /// Get symbol probability distributions for several contexts at once, as if by
+  /// calling GetProbs for each in turn (with the same iNorm and iUniform). Models
+  /// may override to share work between the contexts; the default just loops.
+  ///
+
+  virtual void GetProbsBatch(const std::vector<ProbsRequest> &vRequests, int iNorm, int iUniform) const {
+    for (std::vector<ProbsRequest>::const_iterator it = vRequests.begin(); it != vRequests.end(); it++)
+      GetProbs(it->first, *(it->second), iNorm, iUniform);
+  }
+
+  ///
+  /// Get the probability of a single symbol, as GetProbs would give it (with the
+  /// same iNorm and iUniform). Models may override to avoid computing the whole
+  /// distribution; the default just calls GetProbs.
+  ///
+
+  virtual unsigned int GetProb(Context context, int Symbol, int iNorm, int iUniform) const {
+    std::vector<unsigned int> Probs;
+    GetProbs(context, Probs, iNorm, iUniform);
+    return Probs[Symbol];
+  }
+
   /// @}
 
   /// @name Persistant storage
@@ -115,6 +145,51 @@ public:
 
   /// @}
 
+  /// @name Background training
+  /// A model of the same type and parameters may be trained elsewhere (e.g. on
+  /// another thread) and then moved into this one, which may be in use meanwhile.
+  /// @{
+
+  ///
+  /// Whether AdoptModel is supported. Default is false, meaning models of this
+  /// type must be trained in place.
+  ///
+
+  virtual bool CanAdoptModel() const {
+    return false;
+  };
+
+  ///
+  /// Take over everything learnt by pTrained (which must have no live contexts,
+  /// and is left unusable), in addition to anything this model has learnt itself;
+  /// all contexts of this model remain valid. Only call if CanAdoptModel().
+  ///
+
+  virtual void AdoptModel(CLanguageModel *pTrained) {
+  };
+
+  ///
+  /// Add everything learnt by pOther (same type and parameters as this, with no
+  /// live contexts) to this model, as if this had also been trained on pOther's
+  /// text; pOther is unchanged, and all contexts of this model remain valid.
+  /// Only call if CanAdoptModel().
+  ///
+
+  virtual void MergeModel(const CLanguageModel *pOther) {
+  };
+
+  ///
+  /// Tell the model that what it has learnt so far (e.g. the system training text)
+  /// is unlikely to need changing, so may be stored more compactly (if slower to
+  /// change). Predictions are unaffected, and the model may still learn more. The
+  /// default does nothing.
+  ///
+
+  virtual void FreezeModel() {
+  };
+
+  /// @}
+
   ///
   /// Get the maximum useful context length for this language model
 
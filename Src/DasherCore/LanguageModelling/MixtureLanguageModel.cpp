@@ -0,0 +1,179 @@
+// MixtureLanguageModel.cpp
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2001-2005 David Ward
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#include "../../Common/Common.h"
+#include "MixtureLanguageModel.h"
+
+#include <thread>
+
+using namespace Dasher;
+using namespace std;
+
+// Track memory leaks on Windows to the line that new'd the memory
+#ifdef _WIN32
+#ifdef _DEBUG_MEMLEAKS
+#define DEBUG_NEW new( _NORMAL_BLOCK, THIS_FILE, __LINE__ )
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+#endif
+
+///Fraction of the total weight spread evenly over the components after each symbol
+static const double FIXED_SHARE = 1.0/1024;
+///Components with less weight than this are not consulted by GetProbs
+static const double MIN_WEIGHT = 1.0/256;
+///Norm with which components predict symbols being learnt (to update the weights)
+static const int LEARN_NORM = 1<<16;
+///Smallest batch for which GetProbsBatch starts threads (fewer contexts aren't worth it)
+static const size_t MIN_THREADED_BATCH = 4;
+
+CMixtureLanguageModel::CMixtureLanguageModel(CSettingsUser *pCreator, int iNumSyms, const vector<CLanguageModel *> &vComponents)
+: CLanguageModel(iNumSyms), CSettingsUser(pCreator), m_vComponents(vComponents), m_bAdapting(false),
+  m_bThreads(vComponents.size() > 1 && thread::hardware_concurrency() > 1),
+  m_viNorm(vComponents.size()), m_viUniform(vComponents.size()), m_vRequests(vComponents.size()), m_vProbs(vComponents.size()),
+  m_Contexts(1024) {
+  DASHER_ASSERT(!m_vComponents.empty());
+  const size_t n(m_vComponents.size());
+  if (n == 1) m_vWeights.push_back(1.0);
+  else {
+    const double dFirst = max(MIN_WEIGHT, min(1.0 - MIN_WEIGHT, GetLongParameter(LP_LM_MIXTURE) / 100.0));
+    m_vWeights.assign(n, (1.0 - dFirst) / (n-1));
+    m_vWeights[0] = dFirst;
+  }
+}
+
+CMixtureLanguageModel::~CMixtureLanguageModel() {
+  for (vector<CLanguageModel *>::const_iterator it=m_vComponents.begin(); it!=m_vComponents.end(); it++)
+    delete *it;
+}
+
+size_t CMixtureLanguageModel::AllocOffset() {
+  if (m_vFreeOffsets.empty()) {
+    const size_t iOffset = m_vComponentContexts.size();
+    m_vComponentContexts.resize(iOffset + m_vComponents.size());
+    return iOffset;
+  }
+  const size_t iOffset = m_vFreeOffsets.back();
+  m_vFreeOffsets.pop_back();
+  return iOffset;
+}
+
+CLanguageModel::Context CMixtureLanguageModel::CreateEmptyContext() {
+  const size_t iOffset = AllocOffset();
+  for (size_t i=0; i<m_vComponents.size(); i++)
+    m_vComponentContexts[iOffset+i] = m_vComponents[i]->CreateEmptyContext();
+  return m_Contexts.Alloc(iOffset);
+}
+
+CLanguageModel::Context CMixtureLanguageModel::CloneContext(Context context) {
+  const size_t iFrom = offset(context), iOffset = AllocOffset();
+  for (size_t i=0; i<m_vComponents.size(); i++)
+    m_vComponentContexts[iOffset+i] = m_vComponents[i]->CloneContext(m_vComponentContexts[iFrom+i]);
+  return m_Contexts.Alloc(iOffset);
+}
+
+void CMixtureLanguageModel::ReleaseContext(Context context) {
+  const size_t iOffset = offset(context);
+  for (size_t i=0; i<m_vComponents.size(); i++)
+    m_vComponents[i]->ReleaseContext(m_vComponentContexts[iOffset+i]);
+  m_vFreeOffsets.push_back(iOffset);
+  m_Contexts.Free(context);
+}
+
+void CMixtureLanguageModel::EnterSymbol(Context context, int Symbol) {
+  const size_t iOffset = offset(context);
+  for (size_t i=0; i<m_vComponents.size(); i++)
+    m_vComponents[i]->EnterSymbol(m_vComponentContexts[iOffset+i], Symbol);
+}
+
+void CMixtureLanguageModel::LearnSymbol(Context context, int Symbol) {
+  const size_t iOffset = offset(context);
+  if (m_bAdapting && Symbol) {
+    //Bayesian update: each weight is multiplied by the probability its component gave the symbol
+    // (with a uniform part, so no component gives probability zero)
+    double dTotal = 0;
+    for (size_t i=0; i<m_vComponents.size(); i++)
+      dTotal += (m_vWeights[i] *= m_vComponents[i]->GetProb(m_vComponentContexts[iOffset+i], Symbol, LEARN_NORM, LEARN_NORM/1000));
+    if (dTotal > 0) {
+      //Then spread a fixed share evenly, so no weight ever gets too small to recover
+      const double dShare(FIXED_SHARE / m_vComponents.size());
+      for (size_t i=0; i<m_vComponents.size(); i++)
+        m_vWeights[i] = (1.0 - FIXED_SHARE) * m_vWeights[i] / dTotal + dShare;
+    } else m_vWeights.assign(m_vComponents.size(), 1.0 / m_vComponents.size());
+  }
+
+  for (size_t i=0; i<m_vComponents.size(); i++)
+    m_vComponents[i]->LearnSymbol(m_vComponentContexts[iOffset+i], Symbol);
+}
+
+void CMixtureLanguageModel::FreezeModel() {
+  for (size_t i=0; i<m_vComponents.size(); i++)
+    m_vComponents[i]->FreezeModel();
+  m_bAdapting = true;
+}
+
+void CMixtureLanguageModel::SplitNorm(int iNorm, int iUniform) const {
+  //(scaling up the components consulted to make up for those left out)
+  double dTotal = 0;
+  size_t iLast = 0;
+  for (size_t i=0; i<m_vComponents.size(); i++)
+    if (m_vWeights[i] >= MIN_WEIGHT) {
+      dTotal += m_vWeights[i];
+      iLast = i;
+    }
+  int iNormLeft(iNorm), iUniformLeft(iUniform);
+  for (size_t i=0; i<m_vComponents.size(); i++) {
+    if (m_vWeights[i] < MIN_WEIGHT) m_viNorm[i] = m_viUniform[i] = 0;
+    else if (i == iLast) {
+      m_viNorm[i] = iNormLeft;
+      m_viUniform[i] = iUniformLeft;
+    } else {
+      iNormLeft -= (m_viNorm[i] = static_cast<int>(iNorm * m_vWeights[i] / dTotal));
+      iUniformLeft -= (m_viUniform[i] = static_cast<int>(iUniform * m_vWeights[i] / dTotal));
+    }
+  }
+}
+
+void CMixtureLanguageModel::GetProbs(Context context, vector<unsigned int> &Probs, int iNorm, int iUniform) const {
+  GetProbsBatch(vector<ProbsRequest>(1, ProbsRequest(context, &Probs)), iNorm, iUniform);
+}
+
+void CMixtureLanguageModel::GetProbsBatch(const vector<ProbsRequest> &vRequests, int iNorm, int iUniform) const {
+  SplitNorm(iNorm, iUniform);
+  const size_t n(m_vComponents.size());
+  for (size_t i=0; i<n; i++) {
+    if (!m_viNorm[i]) continue;
+    if (m_vProbs[i].size() < vRequests.size()) m_vProbs[i].resize(vRequests.size());
+    m_vRequests[i].clear();
+    for (size_t j=0; j<vRequests.size(); j++)
+      m_vRequests[i].push_back(ProbsRequest(m_vComponentContexts[offset(vRequests[j].first)+i], &m_vProbs[i][j]));
+  }
+
+  //Each component's whole batch on a thread of its own, except the first's (on this one)
+  vector<thread> vThreads;
+  const bool bThreads(m_bThreads && vRequests.size() >= MIN_THREADED_BATCH);
+  for (size_t i=0; i<n; i++) {
+    if (!m_viNorm[i]) continue;
+    if (bThreads && i > 0)
+      vThreads.push_back(thread([this, i]() {m_vComponents[i]->GetProbsBatch(m_vRequests[i], m_viNorm[i], m_viUniform[i]);}));
+    else if (!bThreads) m_vComponents[i]->GetProbsBatch(m_vRequests[i], m_viNorm[i], m_viUniform[i]);
+  }
+  if (bThreads && m_viNorm[0]) m_vComponents[0]->GetProbsBatch(m_vRequests[0], m_viNorm[0], m_viUniform[0]);
+  for (vector<thread>::iterator it=vThreads.begin(); it!=vThreads.end(); it++) it->join();
+
+  for (size_t j=0; j<vRequests.size(); j++) {
+    vector<unsigned int> &Probs(*vRequests[j].second);
+    Probs.assign(GetSize(), 0);
+    for (size_t i=0; i<n; i++) {
+      if (!m_viNorm[i]) continue;
+      const vector<unsigned int> &vProbs(m_vProbs[i][j]);
+      for (int k=1; k<GetSize(); k++) Probs[k] += vProbs[k];
+    }
+  }
+}
@@ -10,167 +10,109 @@
 #define __LanguageModelling_MixtureLanguageModel_h__
 
 #include "LanguageModel.h"
-#include "PPMLanguageModel.h"
-#include "DictLanguageModel.h"
+#include "../SettingsStore.h"
+#include "../../Common/Allocators/HandleTable.h"
 
-//#include <iostream>
 #include <vector>
 
 /////////////////////////////////////////////////////////////////////////////
 
 namespace Dasher {
-  class CMixtureLanguageModel;
 
   /// \ingroup LM
   /// \{
-  class CMixtureLanguageModel:public CLanguageModel, protected CSettingsUser {
-  public:
-
-    /////////////////////////////////////////////////////////////////////////////
-
-    CMixtureLanguageModel(CSettingsUser *pCreator, const CAlphInfo *pAlph, const CAlphabetMap *pAlphMap)
-    : CLanguageModel(pAlph->iEnd-1), CSettingsUser(pCreator) {
-
-      //      std::cout << m_pAlphabet << std::endl;
 
-      NextContext = 0;
-
-      lma = new CPPMLanguageModel(this, m_iNumSyms);
-      lmb = new CDictLanguageModel(this, pAlph, pAlphMap);
+  /// Mixes the predictions of any number of component models over the same alphabet.
+  /// Each component's weight is its posterior probability given the symbols learnt so
+  /// far (Bayesian mixing), except that after each symbol a small fixed share of the
+  /// total is spread evenly again, so a component that starts predicting better can
+  /// regain weight. GetProbs does not consult components with negligible weight.
+  ///
+  /// The weights only start to adapt once FreezeModel marks the end of the system
+  /// training text, as they should fit what the user writes; and then each learnt
+  /// symbol costs one GetProb call per component. Where there are spare cores,
+  /// GetProbsBatch hands each component but the first its share of the batch on
+  /// a thread of its own.
+  class CMixtureLanguageModel : public CLanguageModel, protected CSettingsUser {
+  public:
 
-    };
+    /// \param vComponents models with iNumSyms symbols, now owned by the mixture. The
+    /// first initially has weight LP_LM_MIXTURE percent; the rest share the remainder.
+    CMixtureLanguageModel(CSettingsUser *pCreator, int iNumSyms, const std::vector<CLanguageModel *> &vComponents);
 
-      virtual ~ CMixtureLanguageModel() {
-      delete lma;
-      delete lmb;
-    };
+    virtual ~CMixtureLanguageModel();
 
     /////////////////////////////////////////////////////////////////////////////
     // Context creation/destruction
     ////////////////////////////////////////////////////////////////////////////
 
-    // FIXME - need to work out how to do this
-
-    // Create a context (empty)
-    virtual CLanguageModel::Context CreateEmptyContext();
-    virtual CLanguageModel::Context CloneContext(CLanguageModel::Context Context);
-    virtual void ReleaseContext(CLanguageModel::Context Context);
+    virtual Context CreateEmptyContext();
+    virtual Context CloneContext(Context context);
+    virtual void ReleaseContext(Context context);
 
     /////////////////////////////////////////////////////////////////////////////
     // Context modifiers
     ////////////////////////////////////////////////////////////////////////////
 
-    // Update context with a character - only modifies context
-    virtual void EnterSymbol(CLanguageModel::Context context, int Symbol) {
-      lma->EnterSymbol(ContextMap.find(context)->second->GetContextA(), Symbol);
-      lmb->EnterSymbol(ContextMap.find(context)->second->GetContextB(), Symbol);
-    };
+    virtual void EnterSymbol(Context context, int Symbol);
 
-    // Add character to the language model at the current context and update the context 
-    // - modifies both the context and the LanguageModel
-    virtual void LearnSymbol(CLanguageModel::Context context, int Symbol) {
-      lma->LearnSymbol(ContextMap[context]->GetContextA(), Symbol);
-      lmb->LearnSymbol(ContextMap[context]->GetContextB(), Symbol);
-    };
+    /// Also updates the weights, according to how well each component predicted
+    /// Symbol in this context.
+    virtual void LearnSymbol(Context context, int Symbol);
 
     /////////////////////////////////////////////////////////////////////////////
     // Prediction
     /////////////////////////////////////////////////////////////////////////////
 
-    // Get symbol probability distribution
-    virtual void GetProbs(CLanguageModel::Context context, std::vector < unsigned int >&Probs, int iNorm, int iUniform) const {
-
-      int iNumSymbols = GetSize();
-
-        Probs.resize(iNumSymbols);
+    virtual void GetProbs(Context context, std::vector<unsigned int> &Probs, int iNorm, int iUniform) const;
 
-        std::vector < unsigned int >ProbsA(iNumSymbols);
-        std::vector < unsigned int >ProbsB(iNumSymbols);
+    virtual void GetProbsBatch(const std::vector<ProbsRequest> &vRequests, int iNorm, int iUniform) const;
 
-      int iNormA(iNorm * GetLongParameter(LP_LM_MIXTURE) / 100);
-      int iNormB(iNorm - iNormA);
-      
-      // TODO: Fix uniform here
-        lma->GetProbs(ContextMap.find(context)->second->GetContextA(), ProbsA, iNormA, 0);
-        lmb->GetProbs(ContextMap.find(context)->second->GetContextB(), ProbsB, iNormB, 0);
+    /// Forwards to each component, and starts adapting the weights.
+    virtual void FreezeModel();
 
-      for(int i(1); i < iNumSymbols; i++) {
-        Probs[i] = ProbsA[i] + ProbsB[i];
-    }};
+    /// Current weight of each component; these sum to 1.
+    const std::vector<double> &GetWeights() const {return m_vWeights;}
 
   private:
-    CLanguageModel * lma;
-    CLanguageModel *lmb;
+    /// Divides iNorm (and iUniform) between the components by weight, into m_viNorm
+    /// (and m_viUniform), leaving out (with 0) any with too little.
+    void SplitNorm(int iNorm, int iUniform) const;
 
-    class CMixtureContext {
-    public:
-      CMixtureContext(CLanguageModel * _lma, CLanguageModel * _lmb):lma(_lma), lmb(_lmb) {
-        ca = lma->CreateEmptyContext();
-        cb = lmb->CreateEmptyContext();
-      };
+    /// Index into m_vComponentContexts of the first component context of a (valid) context
+    size_t offset(Context c) const {
+      DASHER_ASSERT(m_Contexts.IsValid(c));
+      return m_Contexts[c];
+    }
 
-    CMixtureContext(CLanguageModel * _lma, CLanguageModel * _lmb, CLanguageModel::Context _ca, CLanguageModel::Context _cb):lma(_lma), lmb(_lmb), ca(_ca), cb(_cb) {
-      };
+    /// Space for a new context's component contexts; returns its offset
+    size_t AllocOffset();
 
-      ~CMixtureContext() {
-        lma->ReleaseContext(ca);
-        lmb->ReleaseContext(cb);
-      };
+    const std::vector<CLanguageModel *> m_vComponents;
 
-      CLanguageModel::Context GetContextA() {
-        return ca;
-      }
+    std::vector<double> m_vWeights;
 
-      CLanguageModel::Context GetContextB() {
-        return cb;
-      }
+    /// Whether LearnSymbol updates m_vWeights, i.e. FreezeModel has been called
+    bool m_bAdapting;
 
-    private:
-      CLanguageModel * lma;
-      CLanguageModel *lmb;
+    /// Whether to give components their own threads in GetProbsBatch
+    bool m_bThreads;
 
-      CLanguageModel::Context ca;
-      CLanguageModel::Context cb;
-    };
-
-    int NextContext;
-
-    std::map < int, CMixtureContext * >ContextMap;
+    /// Scratch space, reused so not reallocated: the norms passed to each component,
+    /// and its requests and results for each context in the batch
+    mutable std::vector<int> m_viNorm, m_viUniform;
+    mutable std::vector<std::vector<ProbsRequest> > m_vRequests;
+    mutable std::vector<std::vector<std::vector<unsigned int> > > m_vProbs;
 
+    /// Each context is an offset into the slab m_vComponentContexts, where its
+    /// contexts for each component are stored consecutively.
+    CHandleTable<size_t> m_Contexts;
+    std::vector<Context> m_vComponentContexts;
+    std::vector<size_t> m_vFreeOffsets;
   };
   /// \}
-
-///////////////////////////////////////////////////////////////////
-
-  inline CLanguageModel::Context CMixtureLanguageModel::CreateEmptyContext() {
-    CMixtureContext *pCont = new CMixtureContext(lma, lmb);
-    ContextMap[NextContext] = pCont;
-    ++NextContext;
-    return NextContext - 1;
-  }
-
-///////////////////////////////////////////////////////////////////
-
-  inline CLanguageModel::Context CMixtureLanguageModel::CloneContext(CLanguageModel::Context Copy) {
-    CMixtureContext *pCopy = ContextMap[Copy];
-    CMixtureContext *pCont = new CMixtureContext(lma, lmb, lma->CloneContext(pCopy->GetContextA()), lmb->CloneContext(pCopy->GetContextB()));
-
-    ContextMap[NextContext] = pCont;
-    ++NextContext;
-    return NextContext - 1;
-  }
-
-///////////////////////////////////////////////////////////////////
-
-  inline void CMixtureLanguageModel::ReleaseContext(CLanguageModel::Context release) {
-    // m_ContextAlloc.Free( (CMixtureContext*) release );
-    delete ContextMap[release];
-    ContextMap[release] = NULL;
-  }
 }
 
-///////////////////////////////////////////////////////////////////
-
 /////////////////////////////////////////////////////////////////////////////
 
 #endif // ndef __LanguageModelling_MixtureLanguageModel_h__
@@ -12,8 +12,21 @@
 #include <math.h>
 #include <string.h>
 #include <stack>
+#include <algorithm>
 #include <sstream>
 #include <iostream>
+#include <cstdio>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace Dasher;
 using namespace std;
@@ -30,116 +43,331 @@ static char THIS_FILE[] = __FILE__;
 
 /////////////////////////////////////////////////////////////////////
 
-CAbstractPPM::CAbstractPPM(CSettingsUser *pCreator, int iNumSyms, CPPMnode *pRoot, int iMaxOrder)
-: CLanguageModel(iNumSyms), CSettingsUser(pCreator), m_pRoot(pRoot), m_iMaxOrder(iMaxOrder<0 ? GetLongParameter(LP_LM_MAX_ORDER) : iMaxOrder), bUpdateExclusion( GetLongParameter(LP_LM_UPDATE_EXCLUSION)!=0 ), m_ContextAlloc(1024) {
-  m_pRootContext = m_ContextAlloc.Alloc();
-  m_pRootContext->head = m_pRoot;
-  m_pRootContext->order = 0;
+CAbstractPPM::CAbstractPPM(CSettingsUser *pCreator, int iNumSyms, int iMaxOrder)
+: CLanguageModel(iNumSyms), CSettingsUser(pCreator), m_iRoot(1), m_iMaxOrder(iMaxOrder<0 ? GetLongParameter(LP_LM_MAX_ORDER) : iMaxOrder), bUpdateExclusion( GetLongParameter(LP_LM_UPDATE_EXCLUSION)!=0 ), m_iTableSeq(0), m_iExclusive(0), m_pMapping(NULL), m_iMappingSize(0), m_pMappedNodes(NULL), m_iMappedNodes(0), m_piMappedSlots(NULL), m_iMappedSlots(0), m_Contexts(1024), m_iContextsMade(0), m_iUnprunableBytes(0), m_pStatic(NULL), m_iLowestUpdated(m_iRoot) {
+  DASHER_ASSERT(GetSize() <= 32767);
+  m_vNodes.reserve(8192);
+  m_vNodes.push_back(CPPMnode()); //index 0 = null
+  m_vNodes.push_back(CPPMnode(-1)); //root
+  m_vChildSlots.reserve(8192);
+  m_vChildSlots.push_back(0); //so no table starts at offset 0
+  PublishArenas();
+}
+
+CAbstractPPM::~CAbstractPPM() {
+  ReleaseMapping();
+  delete m_pStatic;
 }
 
 bool CAbstractPPM::isValidContext(const Context context) const {
-  return m_setContexts.count((const CPPMContext *)context) > 0;
+  //(not locked, as used in assertions by callers which already hold m_ContextsLock)
+  return m_Contexts.IsValid(context);
 }
 
-/////////////////////////////////////////////////////////////////////
-// Get the probability distribution at the context
+void CAbstractPPM::PublishArenas() {
+  m_pNodes.store(m_vNodes.data(), std::memory_order_release);
+  m_piSlots.store(m_vChildSlots.data(), std::memory_order_release);
+}
 
-void CPPMLanguageModel::GetProbs(Context context, std::vector<unsigned int> &probs, int norm, int iUniform) const {
-  const CPPMContext *ppmcontext = (const CPPMContext *)(context);
+void CAbstractPPM::BeginExclusive() {
+  if (m_iExclusive++ == 0) m_Epochs.ExclusiveBegin();
+}
 
-  DASHER_ASSERT(isValidContext(context));
+void CAbstractPPM::EndExclusive() {
+  DASHER_ASSERT(m_iExclusive > 0);
+  if (--m_iExclusive) return;
+  //nothing retired can still be in use
+  Reclaim();
+  m_Epochs.ExclusiveEnd();
+}
 
-  int iNumSymbols = GetSize();
-  
-  probs.resize(iNumSymbols);
+void CAbstractPPM::Reclaim() {
+  if (m_dRetiredTables.empty() && m_lRetiredNodes.empty() && m_lRetiredSlots.empty()) return;
+  const CEpochReclaimer::Epoch iOldest = m_iExclusive ? m_Epochs.Current() + 1 : m_Epochs.Advance();
+  while (!m_dRetiredTables.empty() && m_dRetiredTables.front().iEpoch < iOldest) {
+    m_mapFreeTables[m_dRetiredTables.front().iSize].push_back(m_dRetiredTables.front().iOffset);
+    m_dRetiredTables.pop_front();
+  }
+  while (!m_lRetiredNodes.empty() && m_lRetiredNodes.front().first < iOldest) m_lRetiredNodes.pop_front();
+  while (!m_lRetiredSlots.empty() && m_lRetiredSlots.front().first < iOldest) m_lRetiredSlots.pop_front();
+}
 
-  std::vector < bool > exclusions(iNumSymbols);
-  
-  unsigned int iToSpend = norm;
-  unsigned int iUniformLeft = iUniform;
+/////////////////////////////////////////////////////////////////////
+// Get the probability distribution at the context
 
-  // TODO: Sort out zero symbol case
-  probs[0] = 0;
-  exclusions[0] = false;
+void CPPMLanguageModel::GetProbs(Context context, std::vector<unsigned int> &probs, int norm, int iUniform) const {
+  ReadGuard guard(m_Epochs);
+  const CPPMContext ppmcontext(contextCopy(context));
+
+  const ProbsCacheKey key = {ppmcontext.head, ppmcontext.order, ppmcontext.staticHead, ppmcontext.staticOrder, norm, iUniform,
+    static_cast<int>(GetLongParameter(LP_LM_ALPHA)), static_cast<int>(GetLongParameter(LP_LM_BETA))};
+  unsigned long iGeneration;
+  if (FindCachedProbs(key, probs, iGeneration)) return;
+  ComputeProbs(&ppmcontext, probs, norm, iUniform, key.alpha, key.beta, Scratch(), false);
+  CacheProbs(key, probs, iGeneration);
+}
+
+void CPPMLanguageModel::GetProbsBatch(const std::vector<ProbsRequest> &vRequests, int norm, int iUniform) const {
+  const int alpha = GetLongParameter(LP_LM_ALPHA), beta = GetLongParameter(LP_LM_BETA);
+  //Contexts in a batch (e.g. nodes expanded in the same frame) often share the lower
+  // orders of their vine chains, so the children of each node are gathered only once.
+  SScratch &scratch(Scratch());
+  size_t iSlots = 16;
+  while (iSlots < 2 * vRequests.size() * (m_iMaxOrder + 2)) iSlots *= 2;
+  const SBatchLevel empty = {0, CStaticPPMTrie::NONE, 0, 0, 0};
+  scratch.vBatchLevels.assign(iSlots, empty);
+  {
+    //(one read throughout, as the children gathered must stay valid)
+    ReadGuard guard(m_Epochs);
+    for (std::vector<ProbsRequest>::const_iterator it = vRequests.begin(); it != vRequests.end(); it++) {
+      const CPPMContext ppmcontext(contextCopy(it->first));
+      const ProbsCacheKey key = {ppmcontext.head, ppmcontext.order, ppmcontext.staticHead, ppmcontext.staticOrder, norm, iUniform, alpha, beta};
+      unsigned long iGeneration;
+      if (FindCachedProbs(key, *(it->second), iGeneration)) continue;
+      ComputeProbs(&ppmcontext, *(it->second), norm, iUniform, alpha, beta, scratch, true);
+      CacheProbs(key, *(it->second), iGeneration);
+    }
+  }
+  scratch.vBatchSyms.clear();
+  scratch.vBatchCounts.clear();
+}
 
-  for (int i = 1; i < iNumSymbols; i++) {
-    probs[i] = iUniformLeft / (iNumSymbols - i);
-    iUniformLeft -= probs[i];
-    iToSpend -= probs[i];
-    exclusions[i] = false;
+CPPMLanguageModel::SScratch &CPPMLanguageModel::Scratch() const {
+  static thread_local SScratch scratch;
+  if (scratch.vLevelSyms.size() < static_cast<size_t>(GetSize())) {
+    scratch.vLevelSyms.resize(GetSize());
+    scratch.vLevelCounts.resize(GetSize());
+    scratch.vLevelSlices.resize(GetSize());
   }
+  return scratch;
+}
 
-  DASHER_ASSERT(iUniformLeft == 0);
+bool CPPMLanguageModel::FindCachedProbs(const ProbsCacheKey &key, std::vector<unsigned int> &probs, unsigned long &iGeneration) const {
+  std::lock_guard<std::mutex> lock(m_CacheLock);
+  std::map<ProbsCacheKey, ProbsCacheList::iterator>::iterator it = m_mapProbsCache.find(key);
+  if (it == m_mapProbsCache.end()) {
+    m_iCacheMisses++;
+    iGeneration = m_iCacheGeneration;
+    return false;
+  }
+  m_iCacheHits++;
+  m_lProbsCache.splice(m_lProbsCache.begin(), m_lProbsCache, it->second);
+  probs = it->second->second;
+  return true;
+}
 
-  //  bool doExclusion = GetLongParameter( LP_LM_ALPHA );
-  bool doExclusion = 0; //FIXME
+void CPPMLanguageModel::CacheProbs(const ProbsCacheKey &key, const std::vector<unsigned int> &probs, unsigned long iGeneration) const {
+  std::lock_guard<std::mutex> lock(m_CacheLock);
+  //(if learning meanwhile changed the trie, probs might not reflect it)
+  if (iGeneration != m_iCacheGeneration || m_mapProbsCache.count(key)) return;
+  if (m_lProbsCache.size() >= PROBS_CACHE_SIZE) {
+    m_mapProbsCache.erase(m_lProbsCache.back().first);
+    m_lProbsCache.pop_back();
+  }
+  m_lProbsCache.push_front(std::make_pair(key, probs));
+  m_mapProbsCache[key] = m_lProbsCache.begin();
+}
 
-  int alpha = GetLongParameter( LP_LM_ALPHA );
-  int beta = GetLongParameter( LP_LM_BETA );
+///Adds iTotal to n entries as if handing out, to each in turn, whatever is left divided
+/// by the number of entries remaining: i.e. each gets iTotal/n, and the last
+/// iTotal%n get one more.
+static inline void AddEvenly(unsigned int *probs, int n, unsigned int iTotal) {
+  const unsigned int q = iTotal / n;
+  const int iFirstExtra = n - static_cast<int>(iTotal % n);
+  for (int i = 0; i < iFirstExtra; i++) probs[i] += q;
+  for (int i = iFirstExtra; i < n; i++) probs[i] += q + 1;
+}
 
-  for (CPPMnode *pTemp = ppmcontext->head; pTemp; pTemp=pTemp->vine) {
-    int iTotal = 0;
+///How much AddEvenly(probs, n, iTotal) would add to probs[i]
+static inline unsigned int EvenShare(int i, int n, unsigned int iTotal) {
+  return iTotal / n + (i >= n - static_cast<int>(iTotal % n) ? 1 : 0);
+}
 
-    for (ChildIterator pSymbol = pTemp->children(); pSymbol != pTemp->end(); pSymbol++) {
-      symbol sym = (*pSymbol)->sym;
-      if(!(exclusions[sym] && doExclusion))
-        iTotal += (*pSymbol)->count;
+///Shares out a slice of probability among the n symbols seen in a context, according to
+/// their counts: p[i] = slice * (100*counts[i] - beta) / (100*iTotal + alpha), computed
+/// (and truncated) as a myint. Uses SIMD (AVX2 or SSE4.1, if enabled at compile time) where
+/// doubles can give exactly the same result; otherwise, or for any remainder, plain integers.
+static void SliceByCounts(const int *counts, unsigned int *p, int n, unsigned int slice, int iTotal, int alpha, int beta) {
+  const myint den = 100 * iTotal + alpha;
+  int i = 0;
+#if defined(__AVX2__) || defined(__SSE4_1__)
+  //Every numerator (< 2^52) and quotient (magnitude at most slice < 2^29) is then exact in
+  // a double, and the correctly-rounded quotient within one of the true one, so truncating
+  // it and correcting by one where (quotient * den) overshoots the numerator is exact.
+  if (slice < (1u << 29) && alpha >= 0 && beta >= 0 && beta <= 100) {
+#if defined(__AVX2__)
+    const __m256d vSlice = _mm256_set1_pd(slice), vDen = _mm256_set1_pd(static_cast<double>(den));
+    const __m256d vBeta = _mm256_set1_pd(beta), v100 = _mm256_set1_pd(100.0);
+    const __m256d vZero = _mm256_setzero_pd(), vOne = _mm256_set1_pd(1.0);
+    for (; i + 4 <= n; i += 4) {
+      const __m256d vCount = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i *>(counts + i)));
+      const __m256d vNum = _mm256_mul_pd(_mm256_sub_pd(_mm256_mul_pd(vCount, v100), vBeta), vSlice);
+      __m256d vQ = _mm256_round_pd(_mm256_div_pd(vNum, vDen), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+      const __m256d vProd = _mm256_mul_pd(vQ, vDen);
+      const __m256d vNeg = _mm256_cmp_pd(vNum, vZero, _CMP_LT_OQ);
+      //too far from zero: above a positive numerator, or below a negative one
+      const __m256d vOver = _mm256_blendv_pd(_mm256_cmp_pd(vProd, vNum, _CMP_GT_OQ), _mm256_cmp_pd(vProd, vNum, _CMP_LT_OQ), vNeg);
+      vQ = _mm256_sub_pd(vQ, _mm256_and_pd(vOver, _mm256_blendv_pd(vOne, _mm256_sub_pd(vZero, vOne), vNeg)));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(p + i), _mm256_cvttpd_epi32(vQ));
     }
+#else
+    const __m128d vSlice = _mm_set1_pd(slice), vDen = _mm_set1_pd(static_cast<double>(den));
+    const __m128d vBeta = _mm_set1_pd(beta), v100 = _mm_set1_pd(100.0);
+    const __m128d vZero = _mm_setzero_pd(), vOne = _mm_set1_pd(1.0);
+    for (; i + 2 <= n; i += 2) {
+      const __m128d vCount = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(counts + i)));
+      const __m128d vNum = _mm_mul_pd(_mm_sub_pd(_mm_mul_pd(vCount, v100), vBeta), vSlice);
+      __m128d vQ = _mm_round_pd(_mm_div_pd(vNum, vDen), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+      const __m128d vProd = _mm_mul_pd(vQ, vDen);
+      const __m128d vNeg = _mm_cmplt_pd(vNum, vZero);
+      //too far from zero: above a positive numerator, or below a negative one
+      const __m128d vOver = _mm_blendv_pd(_mm_cmpgt_pd(vProd, vNum), _mm_cmplt_pd(vProd, vNum), vNeg);
+      vQ = _mm_sub_pd(vQ, _mm_and_pd(vOver, _mm_blendv_pd(vOne, _mm_sub_pd(vZero, vOne), vNeg)));
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(p + i), _mm_cvttpd_epi32(vQ));
+    }
+#endif
+  }
+#endif
+  for (; i < n; i++)
+    p[i] = static_cast<myint>(slice) * (100 * counts[i] - beta) / den;
+}
 
-    if(iTotal) {
-      unsigned int size_of_slice = iToSpend;
-      for (ChildIterator pSymbol = pTemp->children(); pSymbol != pTemp->end(); pSymbol++) {
-        if(!(exclusions[(*pSymbol)->sym] && doExclusion)) {
-          exclusions[(*pSymbol)->sym] = 1;
-
-          unsigned int p = static_cast < myint > (size_of_slice) * (100 * (*pSymbol)->count - beta) / (100 * iTotal + alpha);
-
-          probs[(*pSymbol)->sym] += p;
-          iToSpend -= p;
-        }
-        //                              Usprintf(debug,TEXT("sym %u counts %d p %u tospend %u \n"),sym,s->count,p,tospend);      
-        //                              DebugOutput(debug);
-      }
+int CPPMLanguageModel::GatherChildren(NodeIdx iNode, CStaticPPMTrie::Idx iStatic, symbol *pSyms, int *pCounts, int &iTotal) const {
+  const CStaticPPMTrie *const pStatic = staticTrie();
+  int n = 0;
+  iTotal = 0;
+  if (iStatic != CStaticPPMTrie::NONE) {
+    CStaticPPMTrie::Idx iFirst, iEnd;
+    pStatic->children(iStatic, iFirst, iEnd);
+    for (CStaticPPMTrie::Idx i = iFirst; i < iEnd; i++) {
+      pSyms[n] = pStatic->sym(i);
+      iTotal += (pCounts[n++] = pStatic->count(i));
     }
   }
+  //(the static children are in order of symbol, so can be searched for those in both)
+  const int iStaticChildren = n;
+  if (iNode) for (ChildIterator pSymbol = children(iNode); pSymbol != childrenEnd(iNode); pSymbol++) {
+    const CPPMnode &child(node(*pSymbol));
+    const int iCount = loadRelaxed(child.count);
+    if (!iCount) continue; //(made only to be the parent or vine of another)
+    const symbol *pFound = std::lower_bound(pSyms, pSyms + iStaticChildren, child.sym);
+    if (pFound == pSyms + iStaticChildren || *pFound != child.sym) {
+      pSyms[n] = child.sym;
+      iTotal += (pCounts[n++] = iCount);
+    } else {
+      //as if counted in one node, i.e. saturating
+      int &iSum(pCounts[pFound - pSyms]);
+      const int iNew = std::min(iSum + iCount, 0xFFFF);
+      iTotal += iNew - iSum;
+      iSum = iNew;
+    }
+  }
+  return n;
+}
 
-  unsigned int size_of_slice = iToSpend;
-  int symbolsleft = 0;
+inline bool CPPMLanguageModel::NextLevel(CPPMContext &walk, NodeIdx &iLevelNode, CStaticPPMTrie::Idx &iLevelStatic) const {
+  const int iLevel = std::max(walk.head ? walk.order : -1, walk.staticOrder);
+  if (iLevel < 0) return false;
+  iLevelNode = (walk.head && walk.order == iLevel) ? walk.head : 0;
+  iLevelStatic = (walk.staticOrder == iLevel) ? walk.staticHead : CStaticPPMTrie::NONE;
+  if (iLevelNode) {
+    walk.head = node(walk.head).vine;
+    walk.order--;
+  }
+  if (iLevelStatic != CStaticPPMTrie::NONE) {
+    walk.staticHead = staticTrie()->vine(walk.staticHead);
+    walk.staticOrder--;
+  }
+  return true;
+}
 
-  for(int i = 1; i < iNumSymbols; i++)
-    if(!(exclusions[i] && doExclusion))
-      symbolsleft++;
+void CPPMLanguageModel::ComputeProbs(const CPPMContext *ppmcontext, std::vector<unsigned int> &probs, int norm, int iUniform, int alpha, int beta, SScratch &scratch, bool bBatch) const {
+  const int iNumSymbols = GetSize();
 
-//      std::ostringstream str;
-//      for (sym=0;sym<modelchars;sym++)
-//              str << probs[sym] << " ";
-//      str << std::endl;
-//      DASHER_TRACEOUTPUT("probs %s",str.str().c_str());
+  probs.assign(iNumSymbols, 0);
 
-//      std::ostringstream str2;
-//      for (sym=0;sym<modelchars;sym++)
-//              str2 << valid[sym] << " ";
-//      str2 << std::endl;
-//      DASHER_TRACEOUTPUT("valid %s",str2.str().c_str());
+  // TODO: Sort out zero symbol case
+  unsigned int iToSpend = norm - iUniform;
+  AddEvenly(&probs[1], iNumSymbols - 1, iUniform);
+
+  //FIXME: no exclusion (LP_LM_EXCLUSION) - each vine level shares out a slice of
+  // what remains among all symbols seen there, whether or not seen at a higher level.
+  unsigned int *const pSlices = &scratch.vLevelSlices[0];
+  CPPMContext walk(*ppmcontext);
+  if (!staticTrie()) walk.staticOrder = -1;
+  NodeIdx iLevelNode;
+  CStaticPPMTrie::Idx iLevelStatic;
+  while (NextLevel(walk, iLevelNode, iLevelStatic)) {
+    //gather the children into packed arrays
+    const symbol *pSyms;
+    const int *pCounts;
+    int iTotal, n;
+    if (bBatch) {
+      const size_t iMask = scratch.vBatchLevels.size() - 1;
+      size_t i = ((iLevelNode * 0x9E3779B1u) ^ (iLevelStatic * 0x85EBCA77u)) & iMask;
+      for (; scratch.vBatchLevels[i].iNode || scratch.vBatchLevels[i].iStatic != CStaticPPMTrie::NONE; i = (i + 1) & iMask)
+        if (scratch.vBatchLevels[i].iNode == iLevelNode && scratch.vBatchLevels[i].iStatic == iLevelStatic) break;
+      SBatchLevel &level(scratch.vBatchLevels[i]);
+      if (!level.iNode && level.iStatic == CStaticPPMTrie::NONE) {
+        //first time in this batch
+        level.iNode = iLevelNode;
+        level.iStatic = iLevelStatic;
+        level.iStart = scratch.vBatchSyms.size();
+        scratch.vBatchSyms.resize(level.iStart + iNumSymbols);
+        scratch.vBatchCounts.resize(level.iStart + iNumSymbols);
+        level.n = GatherChildren(iLevelNode, iLevelStatic, &scratch.vBatchSyms[level.iStart], &scratch.vBatchCounts[level.iStart], level.iTotal);
+        scratch.vBatchSyms.resize(level.iStart + level.n);
+        scratch.vBatchCounts.resize(level.iStart + level.n);
+      }
+      n = level.n; iTotal = level.iTotal;
+      pSyms = n ? &scratch.vBatchSyms[level.iStart] : NULL;
+      pCounts = n ? &scratch.vBatchCounts[level.iStart] : NULL;
+    } else {
+      n = GatherChildren(iLevelNode, iLevelStatic, &scratch.vLevelSyms[0], &scratch.vLevelCounts[0], iTotal);
+      pSyms = &scratch.vLevelSyms[0];
+      pCounts = &scratch.vLevelCounts[0];
+    }
 
-  for(int i = 1; i < iNumSymbols; i++) {
-    if(!(exclusions[i] && doExclusion)) {
-      unsigned int p = size_of_slice / symbolsleft;
-      probs[i] += p;
-      iToSpend -= p;
+    if(iTotal) {
+      SliceByCounts(pCounts, pSlices, n, iToSpend, iTotal, alpha, beta);
+      for (int i = 0; i < n; i++) {
+        probs[pSyms[i]] += pSlices[i];
+        iToSpend -= pSlices[i];
+      }
     }
   }
 
-  int iLeft = iNumSymbols-1;
+  //Whatever's left is shared out evenly
+  AddEvenly(&probs[1], iNumSymbols - 1, iToSpend);
+}
 
-  for(int i = 1; i < iNumSymbols; i++) {
-    unsigned int p = iToSpend / iLeft;
-    probs[i] += p;
-    --iLeft;
-    iToSpend -= p;
+unsigned int CPPMLanguageModel::GetProb(Context context, int Symbol, int norm, int iUniform) const {
+  if (Symbol == 0) return 0;
+  DASHER_ASSERT(Symbol > 0 && Symbol < GetSize());
+  const int alpha = GetLongParameter(LP_LM_ALPHA), beta = GetLongParameter(LP_LM_BETA);
+  SScratch &scratch(Scratch());
+  ReadGuard guard(m_Epochs);
+  CPPMContext walk(contextCopy(context));
+  if (!staticTrie()) walk.staticOrder = -1;
+
+  //As ComputeProbs, but keeping only Symbol's share (each level's slices must
+  // still all be computed, to know how much is left for the next)
+  const int n = GetSize() - 1;
+  unsigned int iProb = EvenShare(Symbol - 1, n, iUniform);
+  unsigned int iToSpend = norm - iUniform;
+  NodeIdx iLevelNode;
+  CStaticPPMTrie::Idx iLevelStatic;
+  while (NextLevel(walk, iLevelNode, iLevelStatic)) {
+    int iTotal;
+    const int iChildren = GatherChildren(iLevelNode, iLevelStatic, &scratch.vLevelSyms[0], &scratch.vLevelCounts[0], iTotal);
+    if (!iTotal) continue;
+    SliceByCounts(&scratch.vLevelCounts[0], &scratch.vLevelSlices[0], iChildren, iToSpend, iTotal, alpha, beta);
+    for (int i = 0; i < iChildren; i++) {
+      if (scratch.vLevelSyms[i] == Symbol) iProb += scratch.vLevelSlices[i];
+      iToSpend -= scratch.vLevelSlices[i];
+    }
   }
-
-  DASHER_ASSERT(iToSpend == 0);
+  return iProb + EvenShare(Symbol - 1, n, iToSpend);
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -151,12 +379,22 @@ void CAbstractPPM::EnterSymbol(Context c, int Symbol) {
 
   DASHER_ASSERT(Symbol >= 0 && Symbol < GetSize());
 
-  CPPMContext & context = *(CPPMContext *) (c);
+  //Work on a copy, as other threads may move the original (by creating contexts);
+  // but within one read, so the trie cannot be renumbered meanwhile
+  ReadGuard guard(m_Epochs);
+  CPPMContext context(contextCopy(c));
+  EnterSymbol(context, Symbol);
+  std::lock_guard<std::mutex> lock(m_ContextsLock);
+  ppmContext(c) = context;
+}
 
+void CAbstractPPM::EnterSymbol(CPPMContext &context, symbol Symbol) const {
+  //(the two tiers are independent: each moves to its own longest suffix)
+  if (m_pStatic) EnterStaticSymbol(context, Symbol);
   while(context.head) {
 
     if(context.order < m_iMaxOrder) {   // Only try to extend the context if it's not going to make it too long
-      if (CPPMnode *find = context.head->find_symbol(Symbol)) {
+      if (NodeIdx find = find_symbol(context.head, Symbol)) {
         context.order++;
         context.head = find;
         //      Usprintf(debug,TEXT("found context %x order %d\n"),head,order);
@@ -170,16 +408,32 @@ void CAbstractPPM::EnterSymbol(Context c, int Symbol) {
     // If we can't extend the current context, follow vine pointer to shorten it and try again
 
     context.order--;
-    context.head = context.head->vine;
+    context.head = node(context.head).vine;
   }
 
   if(context.head == 0) {
-    context.head = m_pRoot;
+    context.head = m_iRoot;
     context.order = 0;
   }
 
   //      std::cout << context.order << std::endl;
+}
 
+void CAbstractPPM::EnterStaticSymbol(CPPMContext &context, symbol Symbol) const {
+  //as above
+  for (;;) {
+    if (context.staticOrder < m_iMaxOrder) {
+      const CStaticPPMTrie::Idx iFound = m_pStatic->findChild(context.staticHead, Symbol);
+      if (iFound != CStaticPPMTrie::NONE) {
+        context.staticHead = iFound;
+        context.staticOrder++;
+        return;
+      }
+    }
+    if (context.staticHead == CStaticPPMTrie::ROOT) return;
+    context.staticHead = m_pStatic->vine(context.staticHead);
+    context.staticOrder--;
+  }
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -193,18 +447,40 @@ void CAbstractPPM::LearnSymbol(Context c, int Symbol) {
   
 
   DASHER_ASSERT(Symbol >= 0 && Symbol < GetSize());
-  CPPMContext & context = *(CPPMContext *) (c);
+  CPPMContext context(contextCopy(c));
+
+  m_vStaticChain.clear();
+  if (m_pStatic) {
+    //Learn at the longer of the context's suffixes in the two tiers; in the trie,
+    // which must thus have a node for it
+    m_vStaticChain.resize(context.staticOrder + 1);
+    CStaticPPMTrie::Idx iStatic = context.staticHead;
+    for (int iOrder = context.staticOrder; iOrder >= 0; iOrder--, iStatic = m_pStatic->vine(iStatic))
+      m_vStaticChain[iOrder] = iStatic;
+    if (context.staticOrder > context.order) {
+      context.head = Materialise(context.staticHead);
+      context.order = context.staticOrder;
+    }
+  }
   
-  CPPMnode* n = AddSymbolToNode(context.head, Symbol);
-  DASHER_ASSERT ( n == context.head->find_symbol(Symbol));
+  NodeIdx n = AddSymbolToNode(context.head, Symbol, context.order);
+  DASHER_ASSERT ( n == find_symbol(context.head, Symbol));
   context.head=n;
   context.order++;
   
   while(context.order > m_iMaxOrder) {
-    context.head = context.head->vine;
+    context.head = node(context.head).vine;
     context.order--;
   }
-  
+  //(the static tier is unchanged, so the context moves on there as when entering)
+  if (m_pStatic) EnterStaticSymbol(context, Symbol);
+  {
+    std::lock_guard<std::mutex> lock(m_ContextsLock);
+    ppmContext(c) = context;
+  }
+
+  Reclaim();
+  LimitMemory();
 }
 
 void CAbstractPPM::dumpSymbol(symbol sym) {
@@ -228,7 +504,7 @@ void CAbstractPPM::dumpString(char *str, int pos, int len)
   }
 }
 
-void CAbstractPPM::dumpTrie(CAbstractPPM::CPPMnode *t, int d)
+void CAbstractPPM::dumpTrie(CAbstractPPM::NodeIdx t, int d)
         // diagnostic display of the PPM trie from node t and deeper
 {
 //TODO
@@ -290,17 +566,17 @@ void CAbstractPPM::dump()
 }
 
 bool CAbstractPPM::eq(CAbstractPPM *other) {
-  std::map<CPPMnode *,CPPMnode *> equivs;
-  if (!m_pRoot->eq(other->m_pRoot,equivs)) return false;
+  std::map<NodeIdx,NodeIdx> equivs;
+  if (!eq(m_iRoot, other, other->m_iRoot, equivs)) return false;
   //have first & second being equivalent, for all entries in map, except vine ptrs not checked.
-  for (std::map<CPPMnode *,CPPMnode *>::iterator it=equivs.begin(); it!=equivs.end(); it++) {
-    CPPMnode *myVine = it->first->vine;
-    CPPMnode *oVine = it->second->vine;
-    if (myVine==NULL) {
-      if (oVine==NULL) continue;
+  for (std::map<NodeIdx,NodeIdx>::iterator it=equivs.begin(); it!=equivs.end(); it++) {
+    NodeIdx myVine = node(it->first).vine;
+    NodeIdx oVine = other->node(it->second).vine;
+    if (myVine==0) {
+      if (oVine==0) continue;
       return false;
-    } else if (oVine==NULL) return false;
-    std::map<CPPMnode *,CPPMnode *>::iterator found = equivs.find(myVine);
+    } else if (oVine==0) return false;
+    std::map<NodeIdx,NodeIdx>::iterator found = equivs.find(myVine);
     if (found->second != oVine) return false;
   }
   return true;
@@ -310,281 +586,887 @@ bool CAbstractPPM::eq(CAbstractPPM *other) {
 /// PPMnode definitions 
 ////////////////////////////////////////////////////////////////////////
 
-bool CAbstractPPM::CPPMnode::eq(CAbstractPPM::CPPMnode *other, std::map<CPPMnode *,CPPMnode *> &equivs) {
-  if (sym != other->sym)
+bool CAbstractPPM::eq(NodeIdx iNode, CAbstractPPM *other, NodeIdx iOther, std::map<NodeIdx,NodeIdx> &equivs) {
+  const CPPMnode &n(node(iNode)), &o(other->node(iOther));
+  if (n.sym != o.sym)
     return false;
-  if (count != other->count)
+  if (n.count != o.count)
     return false;
   //check children....but allow for different orders by sorting into symbol order
-  std::map<symbol, CPPMnode *> thisCh, otherCh;
-  for (ChildIterator it = children(); it != end(); it++) thisCh[(*it)->sym] = *it;
-  for (ChildIterator it = other->children(); it != other->end(); it++) otherCh[(*it)->sym] = *it;
+  std::map<symbol, NodeIdx> thisCh, otherCh;
+  for (ChildIterator it = children(iNode); it != childrenEnd(iNode); it++) thisCh[node(*it).sym] = *it;
+  for (ChildIterator it = other->children(iOther); it != other->childrenEnd(iOther); it++) otherCh[other->node(*it).sym] = *it;
   if (thisCh.size() != otherCh.size())
     return false;
-  for (std::map<symbol, CPPMnode *>::iterator it1 = thisCh.begin(), it2=otherCh.begin(); it1 != thisCh.end() ; it1++, it2++)
-    if (!it1->second->eq(it2->second, equivs))
+  for (std::map<symbol, NodeIdx>::iterator it1 = thisCh.begin(), it2=otherCh.begin(); it1 != thisCh.end() ; it1++, it2++)
+    if (!eq(it1->second, other, it2->second, equivs))
       return false; //different - note eq checks symbol
-  equivs.insert(std::pair<CPPMnode *,CPPMnode *>(this,other));
+  equivs.insert(std::pair<NodeIdx,NodeIdx>(iNode,iOther));
   return true;
 }
 
 #define MAX_RUN 4
 
-CAbstractPPM::CPPMnode * CAbstractPPM::CPPMnode::find_symbol(symbol sym) const
+CAbstractPPM::NodeIdx CAbstractPPM::find_symbol(NodeIdx iNode, symbol sym) const
 // see if symbol is a child of node
 {
-  if (m_iNumChildSlots < 0) //negative to mean "full alphabet", use direct indexing
-    return m_ppChildren[sym];
-  if (m_iNumChildSlots == 1) {
-    if (m_pChild->sym == sym)
-      return m_pChild;
+  NodeIdx iChildren;
+  int iNumSlots;
+  readChildren(node(iNode), iChildren, iNumSlots);
+  if (iNumSlots < 0) //negative to mean "full alphabet", use direct indexing
+    return loadAcquire(childTable(iChildren)[sym]);
+  if (iNumSlots == 1) {
+    if (node(iChildren).sym == sym)
+      return iChildren;
     return 0;
   }
-  if (m_iNumChildSlots <= MAX_RUN) {
-    for (int i = 0; i < m_iNumChildSlots && m_ppChildren[i]; i++)
-      if (m_ppChildren[i]->sym == sym) return m_ppChildren[i];
+  const NodeIdx *piChildren = childTable(iChildren);
+  if (iNumSlots <= MAX_RUN) {
+    for (int i = 0; i < iNumSlots; i++) {
+      const NodeIdx found = loadAcquire(piChildren[i]);
+      if (!found) break;
+      if (node(found).sym == sym) return found;
+    }
     return 0;
   }
   //  printf("finding symbol %d at node %d\n",sym,node->id);
 
   for (int i = sym; ; i++) { //search through elements which have overflowed into subsequent slots
-    CPPMnode *found = this->m_ppChildren[i % m_iNumChildSlots]; //wrap round
+    NodeIdx found = loadAcquire(piChildren[i % iNumSlots]); //wrap round
     if (!found) return 0; //null element
-    if(found->sym == sym) {
+    if(node(found).sym == sym) {
       return found;
     }
   }
   return 0;
 }
 
-void CAbstractPPM::CPPMnode::AddChild(CPPMnode *pNewChild, int numSymbols) {
-  if (m_iNumChildSlots < 0) {
-    m_ppChildren[pNewChild->sym] = pNewChild;
+CAbstractPPM::NodeIdx CAbstractPPM::AllocChildTable(int iSize) {
+  std::map<int, std::vector<NodeIdx> >::iterator it = m_mapFreeTables.find(iSize);
+  if (it != m_mapFreeTables.end() && !it->second.empty()) {
+    NodeIdx iOffset = it->second.back();
+    it->second.pop_back();
+    memset(childTable(iOffset), 0, sizeof(NodeIdx)*iSize);
+    return iOffset;
+  }
+  if (m_vChildSlots.size() + iSize > m_vChildSlots.capacity()) {
+    //Readers may be using the arena, so copy it to a new one rather than reallocating in place
+    std::vector<NodeIdx> vSlots;
+    vSlots.reserve(std::max<size_t>(2 * m_vChildSlots.capacity(), m_vChildSlots.size() + iSize));
+    vSlots.assign(m_vChildSlots.begin(), m_vChildSlots.end());
+    m_vChildSlots.swap(vSlots);
+    PublishArenas();
+    if (!m_iExclusive) {
+      m_lRetiredSlots.push_back(std::make_pair(m_Epochs.Current(), std::vector<NodeIdx>()));
+      m_lRetiredSlots.back().second.swap(vSlots);
+    }
+  }
+  NodeIdx iOffset = m_iMappedSlots + m_vChildSlots.size();
+  m_vChildSlots.resize(m_vChildSlots.size() + iSize, 0);
+  return iOffset;
+}
+
+void CAbstractPPM::FreeChildTable(NodeIdx iOffset, int iSize, bool bRetire) {
+  if (bRetire && !m_iExclusive) {
+    const SRetiredTable table = {m_Epochs.Current(), iOffset, iSize};
+    m_dRetiredTables.push_back(table);
+  } else
+    m_mapFreeTables[iSize].push_back(iOffset);
+}
+
+void CAbstractPPM::AddChild(NodeIdx iParent, NodeIdx iNewChild) {
+  //Work out the new child table fields on the side, so that readers see only
+  // the old table or the new one (complete), never one being rebuilt
+  NodeIdx iChildren = node(iParent).m_iChildren;
+  int iNumSlots = node(iParent).m_iNumChildSlots;
+  InsertChild(iChildren, iNumSlots, iNewChild, (iNumSlots == 0 || iNumSlots == 1) ? 0 : iChildren);
+  CPPMnode &parent(node(iParent)); //(makeNode not called, so reference remains valid)
+  if (iChildren == parent.m_iChildren && iNumSlots == parent.m_iNumChildSlots) return;
+  const unsigned int iSeq = m_iTableSeq.load(std::memory_order_relaxed);
+  m_iTableSeq.store(iSeq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  storeRelaxed(parent.m_iChildren, iChildren);
+  storeRelaxed(parent.m_iNumChildSlots, static_cast<short int>(iNumSlots));
+  m_iTableSeq.store(iSeq + 2, std::memory_order_release);
+}
+
+void CAbstractPPM::InsertChild(NodeIdx &iChildren, int &iNumSlots, NodeIdx iNewChild, NodeIdx iPublished) {
+  const int numSymbols = GetSize();
+  const symbol sym = node(iNewChild).sym;
+  if (iNumSlots < 0) {
+    storeRelease(childTable(iChildren)[sym], iNewChild);
   }
   else 
   {
-    if (m_iNumChildSlots == 0) {
-      m_iNumChildSlots = 1;
-      m_pChild = pNewChild;
+    if (iNumSlots == 0) {
+      iNumSlots = 1;
+      iChildren = iNewChild;
       return;
-    } else if (m_iNumChildSlots == 1) {
+    } else if (iNumSlots == 1) {
       //no room, have to resize...
-    } else if (m_iNumChildSlots<=MAX_RUN) {
-      for (int i = 0; i < m_iNumChildSlots; i++)
-        if (!m_ppChildren[i]) {
-          m_ppChildren[i] = pNewChild;
+    } else if (iNumSlots<=MAX_RUN) {
+      NodeIdx *piChildren = childTable(iChildren);
+      for (int i = 0; i < iNumSlots; i++)
+        if (!piChildren[i]) {
+          storeRelease(piChildren[i], iNewChild);
           return;
         }
     } else {
-      
+      NodeIdx *piChildren = childTable(iChildren);
 
-      int start = pNewChild->sym;
+      int start = sym;
       //find length of run (including to-be-inserted element)....
-      while (m_ppChildren[start = (start + m_iNumChildSlots - 1) % m_iNumChildSlots]);
+      while (piChildren[start = (start + iNumSlots - 1) % iNumSlots]);
 
-      int idx = pNewChild->sym;
-      while (m_ppChildren[idx %= m_iNumChildSlots]) ++idx;
+      int idx = sym;
+      while (piChildren[idx %= iNumSlots]) ++idx;
       //found NULL
       int stop = idx;
-      while (m_ppChildren[stop = (stop + 1) % m_iNumChildSlots]);
+      while (piChildren[stop = (stop + 1) % iNumSlots]);
       //start and idx point to NULLs (with inserted element somewhere inbetween)
       
-      int runLen = (m_iNumChildSlots + stop - (start+1)) % m_iNumChildSlots;
+      int runLen = (iNumSlots + stop - (start+1)) % iNumSlots;
       if (runLen <= MAX_RUN) {
         //ok, maintain size
-        m_ppChildren[idx] = pNewChild;
+        storeRelease(piChildren[idx], iNewChild);
         return;
       }
     }
-    //resize!
-    CPPMnode **oldChildren = m_ppChildren;
-    int oldSlots = m_iNumChildSlots;
+    //resize! (into a new table, which readers cannot see until AddChild publishes it)
+    NodeIdx oldChildren = iChildren;
+    int oldSlots = iNumSlots;
     int newNumElems;
-    if (m_iNumChildSlots >= numSymbols/4) {
-      m_iNumChildSlots = -numSymbols; // negative = "use direct indexing"
+    if (iNumSlots >= numSymbols/4) {
+      iNumSlots = -numSymbols; // negative = "use direct indexing"
       newNumElems = numSymbols;
     } else {
-      m_iNumChildSlots+=m_iNumChildSlots+1;
-      newNumElems = m_iNumChildSlots;
+      iNumSlots+=iNumSlots+1;
+      newNumElems = iNumSlots;
     }
-    m_ppChildren = new CPPMnode *[newNumElems]; //null terminator
-    memset (m_ppChildren, 0, sizeof(CPPMnode *)*newNumElems);
+    iChildren = AllocChildTable(newNumElems);
     if (oldSlots == 1)
-      AddChild((CPPMnode *)oldChildren, numSymbols);
+      InsertChild(iChildren, iNumSlots, oldChildren, iPublished);
     else {
-      while (oldSlots-- > 0) if (oldChildren[oldSlots]) AddChild(oldChildren[oldSlots], numSymbols);
-      delete[] oldChildren;
+      for (int i = oldSlots; i-- > 0;) if (NodeIdx iChild = childTable(oldChildren)[i]) InsertChild(iChildren, iNumSlots, iChild, iPublished);
+      FreeChildTable(oldChildren, oldSlots, oldChildren == iPublished);
     }
-    AddChild(pNewChild, numSymbols);
+    InsertChild(iChildren, iNumSlots, iNewChild, iPublished);
   }
 }
 
-CAbstractPPM::CPPMnode * CAbstractPPM::AddSymbolToNode(CPPMnode *pNode, symbol sym) {
+CAbstractPPM::NodeIdx CAbstractPPM::makeNode(symbol sym) {
+  if (m_vNodes.size() == m_vNodes.capacity()) {
+    //Readers may be using the arena, so copy it to a new one rather than reallocating in place
+    std::vector<CPPMnode> vNodes;
+    vNodes.reserve(std::max<size_t>(2 * m_vNodes.capacity(), 8192));
+    vNodes.assign(m_vNodes.begin(), m_vNodes.end());
+    m_vNodes.swap(vNodes);
+    PublishArenas();
+    if (!m_iExclusive) {
+      m_lRetiredNodes.push_back(std::make_pair(m_Epochs.Current(), std::vector<CPPMnode>()));
+      m_lRetiredNodes.back().second.swap(vNodes);
+    }
+  }
+  m_vNodes.push_back(CPPMnode(sym));
+  return m_iMappedNodes + m_vNodes.size()-1;
+}
+
+CAbstractPPM::NodeIdx CAbstractPPM::AddSymbolToNode(NodeIdx iNode, symbol sym, int iOrder) {
 
-  CPPMnode *pReturn = pNode->find_symbol(sym);
+  NodeIdx iReturn = find_symbol(iNode, sym);
 
   //      std::cout << sym << ",";
 
-  if(pReturn != NULL) {
-    pReturn->count++;
+  if (!iReturn && iOrder < static_cast<int>(m_vStaticChain.size())) {
+    //Seen before (so, not new) if in the static tier; count it in a node here
+    const CStaticPPMTrie::Idx iStatic = m_pStatic->findChild(m_vStaticChain[iOrder], sym);
+    if (iStatic != CStaticPPMTrie::NONE) iReturn = MaterialiseChild(iNode, iStatic);
+  }
+
+  if(iReturn) {
+    m_iLowestUpdated = bUpdateExclusion ? iNode : m_iRoot;
+    CPPMnode &n(node(iReturn));
+    if (n.count < 0xFFFF) storeRelaxed(n.count, static_cast<unsigned short int>(n.count + 1));
     if (!bUpdateExclusion) {
       //update vine contexts too. Guaranteed to exist if child does!
-      for (CPPMnode *v = pReturn->vine; v; v=v->vine) {
-        DASHER_ASSERT(v == m_pRoot || v->sym == sym);
-        v->count++;
+      for (NodeIdx v = n.vine; v; v=node(v).vine) {
+        DASHER_ASSERT(v == m_iRoot || node(v).sym == sym);
+        CPPMnode &vn(node(v));
+        if (vn.count < 0xFFFF) storeRelaxed(vn.count, static_cast<unsigned short int>(vn.count + 1));
       }
     }
   } else {
-    //symbol does not exist at this level
-    pReturn = makeNode(sym); //count initialized to 1 but no vine pointer
-    pNode->AddChild(pReturn, GetSize());
-    pReturn->vine = (pNode==m_pRoot) ? m_pRoot : AddSymbolToNode(pNode->vine,sym);
+    //symbol does not exist at this level; complete the new node (with its vine
+    // pointer) before linking it in, so readers never find one half-made
+    iReturn = makeNode(sym); //count initialized to 1 but no vine pointer
+    if (iNode == m_iRoot) m_iLowestUpdated = m_iRoot;
+    NodeIdx iVine = (iNode==m_iRoot) ? m_iRoot : AddSymbolToNode(node(iNode).vine, sym, iOrder - 1);
+    node(iReturn).vine = iVine; //(recursive call may have moved the arena)
+    AddChild(iNode, iReturn);
   }
   
-  return pReturn;
+  return iReturn;
+}
+
+CAbstractPPM::NodeIdx CAbstractPPM::Materialise(CStaticPPMTrie::Idx iStatic) {
+  if (iStatic == CStaticPPMTrie::ROOT) return m_iRoot;
+  return MaterialiseChild(Materialise(m_pStatic->parent(iStatic)), iStatic);
+}
+
+CAbstractPPM::NodeIdx CAbstractPPM::MaterialiseChild(NodeIdx iParent, CStaticPPMTrie::Idx iStatic) {
+  const symbol sym = m_pStatic->sym(iStatic);
+  if (NodeIdx iFound = find_symbol(iParent, sym)) return iFound;
+  //as AddSymbolToNode, complete before linking in
+  const NodeIdx iNew = makeNode(sym);
+  node(iNew).count = 0;
+  const NodeIdx iVine = (iParent == m_iRoot) ? m_iRoot : MaterialiseChild(node(iParent).vine, m_pStatic->vine(iStatic));
+  node(iNew).vine = iVine;
+  AddChild(iParent, iNew);
+  return iNew;
 }
 
 CPPMLanguageModel::CPPMLanguageModel(CSettingsUser *pCreator, int iNumSyms)
-: CAbstractPPM(pCreator, iNumSyms, new CPPMnode(-1)), NodesAllocated(0), m_NodeAlloc(8192) {
+: CAbstractPPM(pCreator, iNumSyms), m_iCacheHits(0), m_iCacheMisses(0), m_iCacheGeneration(0) {
+}
+
+CPPMLanguageModel::~CPPMLanguageModel() {
+  DASHER_TRACEOUTPUT("PPM GetProbs cache: %lu hits, %lu misses\n", m_iCacheHits, m_iCacheMisses);
 }
 
-CAbstractPPM::CPPMnode *CPPMLanguageModel::makeNode(int sym) {
-  CPPMnode *res = m_NodeAlloc.Alloc();
-  res->sym = sym;
-  ++NodesAllocated;
-  return res;
+void CPPMLanguageModel::LearnSymbol(Context c, int Symbol) {
+  if (!Symbol) return;
+  CAbstractPPM::LearnSymbol(c, Symbol);
+  //The children of every node on the vine chain from the head were updated, down to
+  // (with update exclusion) the first that already had a child for Symbol. (Any
+  // nodes materialised elsewhere count 0, so change no distribution.) Invalidate
+  // afterwards, so GetProbs on another thread cannot cache what it read meanwhile.
+  // If learning pruned the trie, the cache was emptied anyway.
+  InvalidateProbsCache(LowestUpdated());
 }
 
-struct BinaryRecord {
-  int m_iIndex;
-  int m_iChild;
-  int m_iNext;
-  int m_iVine;
-  unsigned short int m_iCount;
-  short int m_iSymbol;
+void CPPMLanguageModel::InvalidateProbsCache(NodeIdx iNode) {
+  std::lock_guard<std::mutex> lock(m_CacheLock);
+  m_iCacheGeneration++;
+  if (iNode == m_iRoot) {
+    //on every chain
+    m_lProbsCache.clear();
+    m_mapProbsCache.clear();
+    return;
+  }
+  for (ProbsCacheList::iterator it = m_lProbsCache.begin(); it != m_lProbsCache.end(); ) {
+    NodeIdx iTemp = it->first.head;
+    while (iTemp && iTemp != iNode) iTemp = node(iTemp).vine;
+    if (iTemp) {
+      m_mapProbsCache.erase(it->first);
+      it = m_lProbsCache.erase(it);
+    } else it++;
+  }
+}
+
+/// Precedes the node and child-table arrays written by SaveTrie. All fields are
+/// in native byte order; files from machines with a different byte order or node
+/// layout are rejected by LoadTrie, rather than converted.
+struct STrieHeader {
+  unsigned int iNodeSize;
+  unsigned int iByteOrderMark;
+  unsigned int iNumNodes;
+  unsigned int iNumSlots;
 };
 
-bool CPPMLanguageModel::WriteToFile(std::string strFilename) {
+static const unsigned int BYTE_ORDER_MARK(0x01020304);
+
+bool CAbstractPPM::SaveTrie(std::ofstream &oOutputFile) const {
+  //first pass: work out size of compacted child tables
+  STrieHeader sHeader;
+  sHeader.iNodeSize = sizeof(CPPMnode);
+  sHeader.iByteOrderMark = BYTE_ORDER_MARK;
+  sHeader.iNumNodes = NumNodes()+1; //inc. null node
+  sHeader.iNumSlots = 1; //slot 0 unused, as in memory
+  for (NodeIdx i=0; i<sHeader.iNumNodes; i++) {
+    const CPPMnode &n(node(i));
+    if (n.m_iNumChildSlots != 0 && n.m_iNumChildSlots != 1)
+      sHeader.iNumSlots += abs(n.m_iNumChildSlots);
+  }
+  oOutputFile.write(reinterpret_cast<const char *>(&sHeader), sizeof(sHeader));
+
+  //second pass: nodes, with child table offsets rewritten to be consecutive
+  NodeIdx iNextSlot = 1;
+  for (NodeIdx i=0; i<sHeader.iNumNodes; i++) {
+    CPPMnode n(node(i));
+    if (n.m_iNumChildSlots != 0 && n.m_iNumChildSlots != 1) {
+      n.m_iChildren = iNextSlot;
+      iNextSlot += abs(n.m_iNumChildSlots);
+    }
+    oOutputFile.write(reinterpret_cast<const char *>(&n), sizeof(CPPMnode));
+  }
+  DASHER_ASSERT(iNextSlot == sHeader.iNumSlots);
+
+  //third pass: the child tables themselves, in the same order
+  const NodeIdx iNull(0);
+  oOutputFile.write(reinterpret_cast<const char *>(&iNull), sizeof(NodeIdx));
+  for (NodeIdx i=0; i<sHeader.iNumNodes; i++) {
+    const CPPMnode &n(node(i));
+    if (n.m_iNumChildSlots != 0 && n.m_iNumChildSlots != 1)
+      oOutputFile.write(reinterpret_cast<const char *>(childTable(n.m_iChildren)), abs(n.m_iNumChildSlots)*sizeof(NodeIdx));
+  }
+  return oOutputFile.good();
+}
 
-  std::map<CPPMnode *, int> mapIdx;
-  int iNextIdx(1); // Index of 0 means NULL;
+static void Unmap(void *pMapping, size_t iSize) {
+#ifdef HAVE_MMAP
+  munmap(pMapping, iSize);
+#else
+  free(pMapping);
+#endif
+}
 
-  std::ofstream oOutputFile(strFilename.c_str());
+bool CAbstractPPM::LoadTrie(const std::string &strFilename, size_t iOffset) {
+  DASHER_ASSERT(iOffset % sizeof(NodeIdx) == 0);
+  void *pMapping;
+  size_t iSize;
+#ifdef HAVE_MMAP
+  int fd = open(strFilename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat sStat;
+  if (fstat(fd, &sStat) || sStat.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  iSize = sStat.st_size;
+  //Private, so any writes (i.e. learning) copy the affected pages, and never reach the file
+  pMapping = mmap(NULL, iSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (pMapping == MAP_FAILED) return false;
+#else
+  FILE *pInputFile = fopen(strFilename.c_str(), "rb");
+  if (!pInputFile) return false;
+  fseek(pInputFile, 0, SEEK_END);
+  iSize = ftell(pInputFile);
+  fseek(pInputFile, 0, SEEK_SET);
+  pMapping = malloc(iSize);
+  if (!pMapping || fread(pMapping, 1, iSize, pInputFile) != iSize) {
+    free(pMapping);
+    fclose(pInputFile);
+    return false;
+  }
+  fclose(pInputFile);
+#endif
 
-  RecursiveWrite(m_pRoot, NULL, &mapIdx, &iNextIdx, &oOutputFile);
+  const STrieHeader *pHeader = reinterpret_cast<const STrieHeader *>(static_cast<char *>(pMapping) + iOffset);
+  const size_t iNodesOffset = iOffset + sizeof(STrieHeader);
+  if (iNodesOffset > iSize
+      || pHeader->iNodeSize != sizeof(CPPMnode)
+      || pHeader->iByteOrderMark != BYTE_ORDER_MARK
+      || pHeader->iNumNodes < 2 || pHeader->iNumSlots < 1
+      || iNodesOffset + pHeader->iNumNodes*sizeof(CPPMnode) + pHeader->iNumSlots*sizeof(NodeIdx) > iSize) {
+    Unmap(pMapping, iSize);
+    return false;
+  }
+  //(a stale or corrupt file must not lead us outside the mapping)
+  const CPPMnode *pNodes = reinterpret_cast<const CPPMnode *>(static_cast<char *>(pMapping) + iNodesOffset);
+  if (!ValidTrie(pNodes, pHeader->iNumNodes, reinterpret_cast<const NodeIdx *>(pNodes + pHeader->iNumNodes), pHeader->iNumSlots)) {
+    Unmap(pMapping, iSize);
+    return false;
+  }
 
-  oOutputFile.close();
+  //ok - discard the old trie (inc. any previous mapping) and switch over to the new one
+  BeginExclusive();
+  ReleaseMapping();
+  m_pMapping = pMapping;
+  m_iMappingSize = iSize;
+  m_pMappedNodes = reinterpret_cast<CPPMnode *>(static_cast<char *>(pMapping) + iNodesOffset);
+  m_iMappedNodes = pHeader->iNumNodes;
+  m_piMappedSlots = reinterpret_cast<NodeIdx *>(m_pMappedNodes + m_iMappedNodes);
+  m_iMappedSlots = pHeader->iNumSlots;
+  std::vector<CPPMnode>().swap(m_vNodes);
+  std::vector<NodeIdx>().swap(m_vChildSlots);
+  PublishArenas();
+  m_mapFreeTables.clear();
+  m_dRetiredTables.clear();
+
+  //root is in the same place, but anything else might not be
+  const CPPMContext empty(EmptyContext());
+  {
+    std::lock_guard<std::mutex> lock(m_ContextsLock);
+    m_Contexts.ForEach([&empty](CPPMContext &context) {context = empty;});
+  }
+  EndExclusive();
+  return true;
+}
 
-  return false;
+bool CAbstractPPM::ValidTrie(const CPPMnode *pNodes, NodeIdx iNumNodes, const NodeIdx *piSlots, NodeIdx iNumSlots) const {
+  //the child of a node, or an entry of its table (0 = none)
+  auto validChild = [&](NodeIdx iChild) {
+    return iChild == 0 || (iChild < iNumNodes && pNodes[iChild].sym > 0 && pNodes[iChild].sym < GetSize());
+  };
+  for (NodeIdx i = 0; i < iNumNodes; i++) {
+    const CPPMnode &n(pNodes[i]);
+    if (n.vine >= iNumNodes) return false;
+    if (n.m_iNumChildSlots == 0) continue;
+    if (n.m_iNumChildSlots == 1) {
+      if (n.m_iChildren == 0 || !validChild(n.m_iChildren)) return false;
+      continue;
+    }
+    const NodeIdx iSlots = abs(n.m_iNumChildSlots);
+    if (n.m_iNumChildSlots < 0 && iSlots < static_cast<NodeIdx>(GetSize())) return false;
+    if (n.m_iChildren == 0 || n.m_iChildren >= iNumSlots || iSlots > iNumSlots - n.m_iChildren) return false;
+    bool bNull = false;
+    for (NodeIdx j = 0; j < iSlots; j++) {
+      const NodeIdx iChild = piSlots[n.m_iChildren + j];
+      if (!validChild(iChild)) return false;
+      bNull |= (iChild == 0);
+    }
+    if (n.m_iNumChildSlots > MAX_RUN && !bNull) return false;
+  }
+  return true;
 }
 
-bool CPPMLanguageModel::RecursiveWrite(CPPMnode *pNode, CPPMnode *pNextSibling, std::map<CPPMnode *, int> *pmapIdx, int *pNextIdx, std::ofstream *pOutputFile) {
+void CAbstractPPM::ReleaseMapping() {
+  if (!m_pMapping) return;
+  Unmap(m_pMapping, m_iMappingSize);
+  m_pMapping = NULL;
+  m_pMappedNodes = NULL; m_iMappedNodes = 0;
+  m_piMappedSlots = NULL; m_iMappedSlots = 0;
+}
 
-  // Dump node here
+void CAbstractPPM::SwapTrie(CAbstractPPM &other) {
+  DASHER_ASSERT(GetSize() == other.GetSize() && m_iMaxOrder == other.m_iMaxOrder);
+  BeginExclusive();
+  other.BeginExclusive();
+  //So nothing retired need follow its arena to the other model
+  Reclaim();
+  other.Reclaim();
+  m_vNodes.swap(other.m_vNodes);
+  m_vChildSlots.swap(other.m_vChildSlots);
+  m_mapFreeTables.swap(other.m_mapFreeTables);
+  std::swap(m_pMapping, other.m_pMapping);
+  std::swap(m_iMappingSize, other.m_iMappingSize);
+  std::swap(m_pMappedNodes, other.m_pMappedNodes);
+  std::swap(m_iMappedNodes, other.m_iMappedNodes);
+  std::swap(m_piMappedSlots, other.m_piMappedSlots);
+  std::swap(m_iMappedSlots, other.m_iMappedSlots);
+  std::swap(m_pStatic, other.m_pStatic);
+  PublishArenas();
+  other.PublishArenas();
+  other.EndExclusive();
+  EndExclusive();
+}
 
-  BinaryRecord sBR;
+void CAbstractPPM::MergeTrie(const CAbstractPPM &other, std::vector<NodeIdx> &vMap) {
+  DASHER_ASSERT(GetSize() == other.GetSize() && m_iMaxOrder == other.m_iMaxOrder);
+  //(new nodes are linked in before their counts and vines are set)
+  BeginExclusive();
+  if (const CStaticPPMTrie *pStatic = other.m_pStatic) {
+    //First the static tier, whose nodes are in level order, so each parent is mapped
+    // before its children; as below
+    std::vector<NodeIdx> vStaticMap(pStatic->NumNodes(), 0);
+    std::vector<CStaticPPMTrie::Idx> vCreated;
+    vStaticMap[CStaticPPMTrie::ROOT] = m_iRoot;
+    for (CStaticPPMTrie::Idx i = 0; i < pStatic->NumNodes(); i++) {
+      CStaticPPMTrie::Idx iFirst, iEnd;
+      pStatic->children(i, iFirst, iEnd);
+      for (CStaticPPMTrie::Idx iChild = iFirst; iChild < iEnd; iChild++) {
+        NodeIdx iMapped = find_symbol(vStaticMap[i], pStatic->sym(iChild));
+        if (!iMapped) {
+          iMapped = makeNode(pStatic->sym(iChild));
+          node(iMapped).count = 0;
+          AddChild(vStaticMap[i], iMapped);
+          vCreated.push_back(iChild);
+        }
+        node(iMapped).count = static_cast<unsigned short>(std::min(node(iMapped).count + pStatic->count(iChild), 0xFFFF));
+        vStaticMap[iChild] = iMapped;
+      }
+    }
+    for (std::vector<CStaticPPMTrie::Idx>::const_iterator it = vCreated.begin(); it != vCreated.end(); it++)
+      node(vStaticMap[*it]).vine = vStaticMap[pStatic->vine(*it)];
+  }
+  vMap.assign(other.NumNodes()+1, 0);
+  //nodes created here, whose vine pointers can only be set once all of other is mapped
+  std::vector<NodeIdx> vCreated;
+  std::stack<NodeIdx> toDo;
+  vMap[other.m_iRoot] = m_iRoot;
+  toDo.push(other.m_iRoot);
+  while (!toDo.empty()) {
+    const NodeIdx iOther = toDo.top(); toDo.pop();
+    const NodeIdx iThis = vMap[iOther];
+    //(every root starts with a count of 1, so only add what other has learnt since)
+    const unsigned int iCount = node(iThis).count + other.node(iOther).count - (iOther == other.m_iRoot ? 1 : 0);
+    node(iThis).count = static_cast<unsigned short>(std::min(iCount, 0xFFFFu));
+    for (ChildIterator it = other.children(iOther); it != other.childrenEnd(iOther); it++) {
+      const NodeIdx iChild = *it;
+      if (!iChild) continue;
+      NodeIdx iMapped = find_symbol(iThis, other.node(iChild).sym);
+      if (!iMapped) {
+        iMapped = makeNode(other.node(iChild).sym);
+        node(iMapped).count = 0; //whole count added when popped
+        AddChild(iThis, iMapped);
+        vCreated.push_back(iChild);
+      }
+      vMap[iChild] = iMapped;
+      toDo.push(iChild);
+    }
+  }
+  //the vine of a node in other is a node in other, so has now been mapped
+  for (std::vector<NodeIdx>::const_iterator it = vCreated.begin(); it != vCreated.end(); it++)
+    node(vMap[*it]).vine = vMap[other.node(*it).vine];
+  EndExclusive();
+}
 
-  sBR.m_iIndex = GetIndex(pNode, pmapIdx, pNextIdx); 
-  sBR.m_iNext = GetIndex(pNextSibling, pmapIdx, pNextIdx); 
-  sBR.m_iVine = GetIndex(pNode->vine, pmapIdx, pNextIdx);
-  sBR.m_iCount = pNode->count;
-  sBR.m_iSymbol = pNode->sym;
+void CAbstractPPM::RemapStaticContexts(const CAbstractPPM &other) {
+  //The node in our static tier for each of other's nodes (NONE if none), mapped from the root down
+  std::vector<CStaticPPMTrie::Idx> vStaticMap;
+  if (m_pStatic) {
+    vStaticMap.assign(other.NumNodes()+1, CStaticPPMTrie::NONE);
+    vStaticMap[other.m_iRoot] = CStaticPPMTrie::ROOT;
+    std::stack<NodeIdx> toDo;
+    toDo.push(other.m_iRoot);
+    while (!toDo.empty()) {
+      const NodeIdx iOther = toDo.top(); toDo.pop();
+      for (ChildIterator it = other.children(iOther); it != other.childrenEnd(iOther); it++) {
+        const CStaticPPMTrie::Idx iStatic = m_pStatic->findChild(vStaticMap[iOther], other.node(*it).sym);
+        if (iStatic == CStaticPPMTrie::NONE) continue; //(nor any descendant)
+        vStaticMap[*it] = iStatic;
+        toDo.push(*it);
+      }
+    }
+  }
+  const CStaticPPMTrie *pStatic = m_pStatic;
+  std::lock_guard<std::mutex> lock(m_ContextsLock);
+  m_Contexts.ForEach([&vStaticMap, &other, pStatic](CPPMContext &context) {
+    context.staticHead = CStaticPPMTrie::ROOT;
+    context.staticOrder = pStatic ? 0 : -1;
+    if (!pStatic) return;
+    //(every suffix of a node in other's trie is on its vine chain, ending at the root)
+    int iOrder = context.order;
+    for (NodeIdx iNode = context.head; iNode; iNode = other.node(iNode).vine, iOrder--)
+      if (vStaticMap[iNode] != CStaticPPMTrie::NONE) {
+        context.staticHead = vStaticMap[iNode];
+        context.staticOrder = iOrder;
+        return;
+      }
+  });
+}
 
-  ChildIterator it =pNode->children();
-  CPPMnode *pCurrentChild = (it == pNode->end()) ? NULL : *it++;
-  sBR.m_iChild = GetIndex(pCurrentChild, pmapIdx, pNextIdx); 
-  
-  pOutputFile->write(reinterpret_cast<char*>(&sBR), sizeof(BinaryRecord));
+void CAbstractPPM::ReplaceStaticTrie(CStaticPPMTrie *pStatic) {
+  DASHER_ASSERT(m_iExclusive > 0);
+  delete m_pStatic;
+  m_pStatic = pStatic;
+  const CStaticPPMTrie::Idx iStaticRoot(CStaticPPMTrie::ROOT);
+  const int iStaticOrder(pStatic ? 0 : -1);
+  std::lock_guard<std::mutex> lock(m_ContextsLock);
+  m_Contexts.ForEach([iStaticRoot, iStaticOrder](CPPMContext &context) {
+    context.staticHead = iStaticRoot;
+    context.staticOrder = iStaticOrder;
+  });
+}
 
-  if (pCurrentChild) {
-    for (CPPMnode *pNextChild; it != pNode->end(); pCurrentChild = pNextChild) {
-      pNextChild = *it++;
-      RecursiveWrite(pCurrentChild, pNextChild, pmapIdx, pNextIdx, pOutputFile);
+void CAbstractPPM::FreezeTrie(int iQuantisedBits) {
+  typedef CStaticPPMTrie::Idx Idx;
+  BeginExclusive();
+  //Make the new static tier in level order, from both tiers at once: each node of it
+  // being the node for the same symbols in the trie (0 if none) and the old static
+  // tier (NONE if none), its children those of either, with the sum of their counts
+  struct SSource {
+    symbol sym;
+    NodeIdx iNode;
+    Idx iStatic;
+    unsigned int iCount;
+    bool operator<(const SSource &o) const {return sym < o.sym;}
+  };
+  const SSource root = {-1, m_iRoot, m_pStatic ? CStaticPPMTrie::ROOT : CStaticPPMTrie::NONE, node(m_iRoot).count};
+  std::vector<SSource> vSources(1, root), vChildren;
+  std::vector<int> vNumChildren;
+  std::vector<symbol> vSyms(1, root.sym);
+  std::vector<unsigned short> vCounts(1, node(m_iRoot).count);
+  std::vector<Idx> vVines(1, CStaticPPMTrie::NONE), vFirstChild;
+  //new index for each node in the trie and old static tier, for remapping contexts
+  std::vector<Idx> vFromTrie(NumNodes()+1, CStaticPPMTrie::NONE), vFromStatic(NumStaticNodes(), CStaticPPMTrie::NONE);
+  for (Idx i = 0; i < vSources.size(); i++) {
+    const SSource src(vSources[i]);
+    if (src.iNode) vFromTrie[src.iNode] = i;
+    if (src.iStatic != CStaticPPMTrie::NONE) vFromStatic[src.iStatic] = i;
+    vChildren.clear();
+    if (src.iStatic != CStaticPPMTrie::NONE) {
+      Idx iFirst, iEnd;
+      m_pStatic->children(src.iStatic, iFirst, iEnd);
+      for (Idx iChild = iFirst; iChild < iEnd; iChild++) {
+        const SSource child = {m_pStatic->sym(iChild), 0, iChild, m_pStatic->count(iChild)};
+        vChildren.push_back(child);
+      }
+    }
+    const size_t iStaticChildren = vChildren.size();
+    if (src.iNode) for (ChildIterator it = children(src.iNode); it != childrenEnd(src.iNode); it++) {
+      const SSource child = {node(*it).sym, *it, CStaticPPMTrie::NONE, node(*it).count};
+      std::vector<SSource>::iterator pFound = std::lower_bound(vChildren.begin(), vChildren.begin() + iStaticChildren, child);
+      if (pFound != vChildren.begin() + iStaticChildren && pFound->sym == child.sym) {
+        pFound->iNode = child.iNode;
+        pFound->iCount += child.iCount;
+      } else vChildren.push_back(child);
+    }
+    std::sort(vChildren.begin(), vChildren.end());
+    vFirstChild.push_back(static_cast<Idx>(vSources.size()));
+    vNumChildren.push_back(static_cast<int>(vChildren.size()));
+    for (std::vector<SSource>::const_iterator it = vChildren.begin(); it != vChildren.end(); it++) {
+      vSources.push_back(*it);
+      vSyms.push_back(it->sym);
+      vCounts.push_back(static_cast<unsigned short>(std::min(it->iCount, 0xFFFFu)));
+      //The vine of a child is the child, by the same symbol, of its parent's vine;
+      // which is of lower order, so has been numbered (as have its children) already
+      Idx iVine = CStaticPPMTrie::ROOT;
+      if (i != CStaticPPMTrie::ROOT) {
+        const Idx iParentVine = vVines[i];
+        const std::vector<symbol>::const_iterator itBegin = vSyms.begin() + vFirstChild[iParentVine],
+          itEnd = itBegin + vNumChildren[iParentVine], itFound = std::lower_bound(itBegin, itEnd, it->sym);
+        DASHER_ASSERT(itFound != itEnd && *itFound == it->sym);
+        iVine = static_cast<Idx>(itFound - vSyms.begin());
+      }
+      vVines.push_back(iVine);
     }
-    RecursiveWrite(pCurrentChild, NULL, pmapIdx, pNextIdx, pOutputFile);
   }
+  CStaticPPMTrie *pStatic = new CStaticPPMTrie(vNumChildren, vSyms, vCounts, vVines, iQuantisedBits);
+  std::vector<SSource>().swap(vSources);
 
-  return true;
+  //Each context's suffix in the new tier is the longer of those it had in the two;
+  // while in the (now empty) trie, it has only the root
+  {
+    const CStaticPPMTrie *pOldStatic = m_pStatic;
+    const NodeIdx iRoot(m_iRoot);
+    std::lock_guard<std::mutex> lock(m_ContextsLock);
+    m_Contexts.ForEach([&vFromTrie, &vFromStatic, pOldStatic, iRoot](CPPMContext &context) {
+      if (pOldStatic && context.staticOrder > context.order)
+        context.staticHead = vFromStatic[context.staticHead];
+      else {
+        context.staticHead = vFromTrie[context.head];
+        context.staticOrder = context.order;
+      }
+      context.head = iRoot;
+      context.order = 0;
+    });
+  }
+  delete m_pStatic;
+  m_pStatic = pStatic;
+
+  //Empty the trie, as in the constructor
+  ReleaseMapping();
+  std::vector<CPPMnode> vNodes;
+  vNodes.reserve(8192);
+  vNodes.push_back(CPPMnode()); //index 0 = null
+  vNodes.push_back(CPPMnode(-1)); //root
+  m_vNodes.swap(vNodes);
+  std::vector<NodeIdx>(1, 0).swap(m_vChildSlots);
+  m_vChildSlots.reserve(8192);
+  PublishArenas();
+  m_mapFreeTables.clear();
+  m_dRetiredTables.clear();
+  m_iUnprunableBytes = 0;
+  m_iLowestUpdated = m_iRoot;
+  std::vector<NodeIdx> vMap(vFromTrie.size(), 0);
+  vMap[m_iRoot] = m_iRoot;
+  TriePruned(vMap, false);
+  EndExclusive();
 }
 
-int CPPMLanguageModel::GetIndex(CPPMnode *pAddr, std::map<CPPMnode *, int> *pmapIdx, int *pNextIdx) {
+void CAbstractPPM::RemapContexts(const std::vector<NodeIdx> &vMap) {
+  std::lock_guard<std::mutex> lock(m_ContextsLock);
+  m_Contexts.ForEach([&vMap](CPPMContext &context) {
+    DASHER_ASSERT(context.head < vMap.size() && vMap[context.head]);
+    context.head = vMap[context.head];
+  });
+}
 
-  int iIndex;
-  if(pAddr == NULL)
-    iIndex = 0;
-  else {
-    std::map<CPPMnode *, int>::iterator it(pmapIdx->find(pAddr));
-    
-    if(it == pmapIdx->end()) {
-      iIndex = *pNextIdx;
-      pmapIdx->insert(std::pair<CPPMnode *, int>(pAddr, iIndex));
-      ++(*pNextIdx);
+void CAbstractPPM::LimitMemory() {
+  const long iMaxKB = GetLongParameter(LP_LM_MAX_MEMORY);
+  if (iMaxKB <= 0) return;
+  const size_t iMax = static_cast<size_t>(iMaxKB) * 1024;
+  if (BytesUsed() <= std::max(iMax, m_iUnprunableBytes)) return;
+  const size_t iTarget = iMax / 4 * 3;
+  //Pruning renumbers the nodes, so readers must wait
+  BeginExclusive();
+  //Age only once there are no more (unneeded, high-order) singletons to remove
+  for (bool bAge = false; BytesUsed() > iTarget; ) {
+    if (Prune(iTarget, bAge)) bAge = false;
+    else if (!bAge) bAge = true;
+    else break;
+  }
+  EndExclusive();
+  //If still over (i.e. everything left is needed), don't try again on every symbol,
+  // but only once the trie has grown by another quarter of the limit
+  m_iUnprunableBytes = (BytesUsed() > iMax) ? BytesUsed() + iMax / 4 : 0;
+}
+
+bool CAbstractPPM::Prune(size_t iTarget, bool bAge) {
+  const NodeIdx iNumNodes = NumNodes() + 1; //inc. null node
+  //Child tables are rebuilt without any free ones, so this is likely an overestimate
+  const NodeIdx iToRemove = static_cast<NodeIdx>(iNumNodes * (1.0 - double(iTarget) / BytesUsed())) + 1;
+  //Parent of every node, and all nodes in breadth-first order (i.e. by increasing order)
+  std::vector<NodeIdx> vParent(iNumNodes, 0), vOrder;
+  vOrder.reserve(iNumNodes);
+  vOrder.push_back(m_iRoot);
+  for (size_t i = 0; i < vOrder.size(); i++)
+    for (ChildIterator it = children(vOrder[i]); it != childrenEnd(vOrder[i]); it++) {
+      vParent[*it] = vOrder[i];
+      vOrder.push_back(*it);
     }
+
+  //Decide from the highest order down, so that any node which might need another
+  // (as its child, or by a vine pointer to it) has been decided already; this also
+  // means nodes of higher order are removed first
+  std::vector<char> vNeeded(iNumNodes, false);
+  {
+    std::lock_guard<std::mutex> lock(m_ContextsLock);
+    m_Contexts.ForEach([&vNeeded](CPPMContext &context) {vNeeded[context.head] = true;});
+  }
+  std::vector<NodeIdx> vMap(iNumNodes, 0); //for now, just nonzero = keep
+  vMap[m_iRoot] = 1;
+  NodeIdx iRemoved = 0;
+  for (size_t i = vOrder.size(); i-- > 1; ) {
+    const NodeIdx n = vOrder[i];
+    if (iRemoved < iToRemove && vParent[n] != m_iRoot && node(n).count <= (bAge ? 2 : 1) && !vNeeded[n])
+      iRemoved++;
     else {
-      iIndex = it->second;
+      vMap[n] = 1;
+      vNeeded[vParent[n]] = vNeeded[node(n).vine] = true;
     }
   }
-  return iIndex;
+  if (!iRemoved) return false;
+  std::vector<NodeIdx>().swap(vOrder);
+  std::vector<char>().swap(vNeeded);
+
+  //Copy the nodes kept, in the same order, into a new arena (halving counts if aging)
+  std::vector<CPPMnode> vNodes;
+  vNodes.reserve(iNumNodes - iRemoved);
+  vNodes.push_back(CPPMnode()); //index 0 = null
+  for (NodeIdx i = 1; i < iNumNodes; i++)
+    if (vMap[i]) {
+      vMap[i] = vNodes.size();
+      vNodes.push_back(CPPMnode(node(i).sym));
+      vNodes.back().count = bAge ? (node(i).count + 1) / 2 : node(i).count;
+    }
+  for (NodeIdx i = 1; i < iNumNodes; i++)
+    if (vMap[i]) vNodes[vMap[i]].vine = vMap[node(i).vine];
+
+  //Switch over (discarding any mapped file, as everything is now copied), and rebuild
+  // the child tables
+  ReleaseMapping();
+  m_vNodes.swap(vNodes);
+  std::vector<NodeIdx>(1, 0).swap(m_vChildSlots);
+  PublishArenas();
+  m_mapFreeTables.clear();
+  m_dRetiredTables.clear();
+  for (NodeIdx i = 1; i < iNumNodes; i++)
+    if (vMap[i] && vParent[i]) AddChild(vMap[vParent[i]], vMap[i]);
+
+  RemapContexts(vMap);
+  m_iLowestUpdated = m_iRoot;
+  TriePruned(vMap, bAge);
+  return true;
 }
 
-bool CPPMLanguageModel::ReadFromFile(std::string strFilename) {
-  
-  std::ifstream oInputFile(strFilename.c_str());
-  //map from file index, to address of node object with that index
-  std::map<int, CPPMnode*> oMap;
-  //map from file index, to address of *parent* for that node
-  // - only stored for the child that will *next* be read.
-  std::map<int, CPPMnode *> parentMap;
-  BinaryRecord sBR;
-  bool bStarted(false);
-
-  while(!oInputFile.eof()) {
-    oInputFile.read(reinterpret_cast<char *>(&sBR), sizeof(BinaryRecord));
-
-    CPPMnode *pCurrent(GetAddress(sBR.m_iIndex, &oMap));
-
-    pCurrent->vine = GetAddress(sBR.m_iVine, &oMap);
-    pCurrent->count = sBR.m_iCount;
-    pCurrent->sym = sBR.m_iSymbol;
-
-    //if this node has a parent...
-    std::map<int,CPPMnode *>::iterator it(parentMap.find(sBR.m_iIndex));
-    if (it != parentMap.end()) {
-      CPPMnode *parent = it->second;
-      parent->AddChild(pCurrent,GetSize());
-      //erase the record of parent hood, now we've realized it
-      parentMap.erase(it);
-      //add mapping for the _next_ sibling; since siblings will be read in the order
-      // they were written out, when the next sibling is read it will find the mapping.
-      if (sBR.m_iNext) parentMap.insert(pair<int,CPPMnode *>(sBR.m_iNext,parent));
-    }
-    
-    //if the node has children, record for the benefit of the first child
-    // this node's address...(said child will be the first one read)
-    if (sBR.m_iChild) parentMap.insert(pair<int,CPPMnode *>(sBR.m_iChild, pCurrent));
-    
-    if(!bStarted) {
-      m_pRoot = pCurrent;
-      bStarted = true;
-    }
-  }
+///PPM files are a SLMFileHeader (with no alphabet name), then the trie as
+/// written by SaveTrie. Version 2 adds, between the two, the static tier (as
+/// written by CStaticPPMTrie::Write), padded to a multiple of 4 bytes; version 3
+/// is the same, but with the static tier's counts quantised. Each file is written
+/// as the lowest version that can hold it.
+static const unsigned short int PPM_LM_ID(0), PPM_LM_VERSION(3), PPM_LM_TRIE_VERSION(1), PPM_LM_STATIC_VERSION(2), PPM_LM_QUANTISED_VERSION(3);
+
+void CPPMLanguageModel::AdoptModel(CLanguageModel *pTrained) {
+  CPPMLanguageModel *pOther = static_cast<CPPMLanguageModel *>(pTrained);
+  //Take the trained trie, and merge what we had (i.e. learnt while it was being
+  // trained) into it; then our contexts, which point into the latter, must follow.
+  BeginExclusive();
+  SwapTrie(*pOther);
+  std::vector<NodeIdx> vMap;
+  MergeTrie(*pOther, vMap);
+  RemapStaticContexts(*pOther);
+  RemapContexts(vMap);
+  InvalidateProbsCache(m_iRoot);
+  LimitMemory();
+  EndExclusive();
+}
 
-  oInputFile.close();
+void CPPMLanguageModel::MergeModel(const CLanguageModel *pOther) {
+  //our existing nodes keep their indices, so contexts need no remapping
+  std::vector<NodeIdx> vMap;
+  BeginExclusive();
+  MergeTrie(*static_cast<const CPPMLanguageModel *>(pOther), vMap);
+  InvalidateProbsCache(m_iRoot);
+  LimitMemory();
+  EndExclusive();
+}
 
-  return false;
+void CPPMLanguageModel::TriePruned(const std::vector<NodeIdx> &vMap, bool bAged) {
+  InvalidateProbsCache(m_iRoot);
 }
 
-CPPMLanguageModel::CPPMnode *CPPMLanguageModel::GetAddress(int iIndex, std::map<int, CPPMnode*> *pMap) {
-  if (iIndex==0) return NULL;
-  std::map<int, CPPMnode*>::iterator it(pMap->find(iIndex));
+void CPPMLanguageModel::FreezeModel() {
+  //(the cache is emptied via TriePruned)
+  const long iCountBits = GetLongParameter(LP_LM_COUNT_BITS);
+  FreezeTrie((iCountBits >= 2 && iCountBits <= 15) ? static_cast<int>(iCountBits) : 0);
+}
 
-  if(it == pMap->end()) {
-    CPPMnode *pNewNode;
-    pNewNode = m_NodeAlloc.Alloc();
-    pMap->insert(std::pair<int, CPPMnode*>(iIndex, pNewNode));
-    return pNewNode;
+bool CPPMLanguageModel::WriteToFile(std::string strFilename) {
+  SLMFileHeader sHeader;
+  memcpy(sHeader.szMagic, "%DLF", 4);
+  sHeader.iHeaderVersion = 1;
+  sHeader.iHeaderSize = sizeof(SLMFileHeader);
+  sHeader.iLMID = PPM_LM_ID;
+  sHeader.iLMVersion = sHeader.iLMMinVersion = !staticTrie() ? PPM_LM_TRIE_VERSION
+    : staticTrie()->Quantised() ? PPM_LM_QUANTISED_VERSION : PPM_LM_STATIC_VERSION;
+  sHeader.iAlphabetSize = GetSize();
+
+  //Write to a temporary file, then move into place: the existing file may be
+  // mapped (by us or another LM), and must not be modified in place.
+  const std::string strTemp(strFilename + ".tmp");
+  std::ofstream oOutputFile(strTemp.c_str(), std::ios::binary);
+  oOutputFile.write(reinterpret_cast<const char *>(&sHeader), sizeof(sHeader));
+  if (staticTrie() && staticTrie()->Write(oOutputFile)) {
+    //(so LoadTrie can map the trie in place)
+    const char acPad[sizeof(NodeIdx)] = {0};
+    oOutputFile.write(acPad, (sizeof(NodeIdx) - oOutputFile.tellp() % sizeof(NodeIdx)) % sizeof(NodeIdx));
   }
-  else {
-    return it->second;
+  bool bOk = oOutputFile.good() && SaveTrie(oOutputFile);
+  oOutputFile.close();
+  if (bOk && !oOutputFile.fail()) {
+    if (rename(strTemp.c_str(), strFilename.c_str())) {
+      //(Windows won't rename over an existing file)
+      remove(strFilename.c_str());
+      bOk = rename(strTemp.c_str(), strFilename.c_str()) == 0;
+    }
+  } else bOk = false;
+  if (!bOk) remove(strTemp.c_str());
+  return bOk;
+}
+
+bool CPPMLanguageModel::ReadFromFile(std::string strFilename) {
+  SLMFileHeader sHeader;
+  std::ifstream oInputFile(strFilename.c_str(), std::ios::binary);
+  oInputFile.read(reinterpret_cast<char *>(&sHeader), sizeof(sHeader));
+  if (!oInputFile.good()
+      || memcmp(sHeader.szMagic, "%DLF", 4)
+      || sHeader.iHeaderVersion != 1
+      || sHeader.iLMID != PPM_LM_ID
+      || sHeader.iLMMinVersion > PPM_LM_VERSION
+      || sHeader.iAlphabetSize != GetSize()
+      || sHeader.iHeaderSize % sizeof(NodeIdx))
+    return false;
+  CStaticPPMTrie *pStatic = NULL;
+  size_t iTrieOffset = sHeader.iHeaderSize;
+  if (sHeader.iLMVersion >= PPM_LM_STATIC_VERSION) {
+    pStatic = new CStaticPPMTrie();
+    oInputFile.seekg(sHeader.iHeaderSize);
+    if (!pStatic->Read(oInputFile, sHeader.iLMVersion >= PPM_LM_QUANTISED_VERSION)) {
+      delete pStatic;
+      return false;
+    }
+    iTrieOffset = static_cast<size_t>(oInputFile.tellg());
+    iTrieOffset += (sizeof(NodeIdx) - iTrieOffset % sizeof(NodeIdx)) % sizeof(NodeIdx);
   }
+  oInputFile.close();
+  BeginExclusive();
+  const bool bOk = LoadTrie(strFilename, iTrieOffset);
+  if (bOk) ReplaceStaticTrie(pStatic);
+  else delete pStatic;
+  InvalidateProbsCache(m_iRoot);
+  EndExclusive();
+  return bOk;
 }
@@ -10,15 +10,21 @@
 #define __PPMLanguageModel_h__
 
 #include "../../Common/NoClones.h"
-#include "../../Common/Allocators/PooledAlloc.h"
+#include "../../Common/Allocators/HandleTable.h"
+#include "../../Common/Allocators/EpochReclaimer.h"
 
 #include "LanguageModel.h"
+#include "StaticPPMTrie.h"
 #include "../SettingsStore.h"
 #include "stdlib.h"
 #include <vector>
 #include <fstream>
 #include <set>
 #include <map>
+#include <list>
+#include <deque>
+#include <atomic>
+#include <mutex>
 
 namespace Dasher {
 
@@ -31,92 +37,253 @@ namespace Dasher {
   /// in a context, i.e. navigating and updating the tree, with update exclusion according
   /// to LP_LM_UPDATE_EXCLUSION
   ///
-  /// Subclasses must implement CLanguageModel::GetProbs and a makeNode() method (perhaps
-  /// using a pooled allocator).
+  /// Nodes are stored contiguously in a single arena (m_vNodes) and refer to each other
+  /// by 32-bit index (NodeIdx) rather than by pointer; index 0 means "no node". Child
+  /// tables (for nodes with more than one child) live in a second pooled arena
+  /// (m_vChildSlots), with free-lists per table size so tables can be recycled as
+  /// nodes grow. Subclasses needing extra per-node data (e.g. PPMPY) should store it
+  /// in their own vector indexed by NodeIdx.
+  ///
+  /// A trie may also be loaded from file (LoadTrie), in which case the nodes and child
+  /// tables in the file are mapped into memory copy-on-write and used in place: indices
+  /// below m_iMappedNodes (resp. m_iMappedSlots) refer to the mapping, those above to
+  /// the (heap) arenas, which thus act as an overlay holding anything learnt since.
+  ///
+  /// If LP_LM_MAX_MEMORY is set, then whenever learning takes the trie (nodes and child
+  /// tables) over that many KB, the model is pruned (see Prune) until it is back under
+  /// three quarters of the limit; its counts are aged (halved) whenever that requires
+  /// removing more than the nodes seen only once. Note the arenas may reserve up to twice what is used,
+  /// and pruning temporarily needs a second copy of the trie.
+  ///
+  /// One thread (the writer) may learn while any number of others (readers) create,
+  /// clone, release and EnterSymbol into contexts, without waiting for it; as may
+  /// CPPMLanguageModel::GetProbs, but not (yet) GetProbs of the other subclasses. So the
+  /// writer never changes in place anything a reader could be following: new nodes are
+  /// complete before being linked in, full child tables are replaced rather than grown,
+  /// and full arenas copied to bigger ones. Anything so replaced is retired, tagged with
+  /// the current epoch of m_Epochs, and reclaimed (Reclaim) only once every read begun
+  /// in or before that epoch has finished. Readers thus always see a well-formed trie,
+  /// each count being as at some moment during the read. Bulk changes which renumber or
+  /// replace nodes (Prune, LoadTrie, SwapTrie, MergeTrie) instead exclude readers (see
+  /// BeginExclusive) while they run.
+  ///
+  /// What has been learnt may also be frozen (FreezeTrie) into a CStaticPPMTrie, i.e.
+  /// a static tier taking a fraction of the memory, after which the trie (m_vNodes etc.)
+  /// starts again empty, as an overlay recording only what is learnt since: each of
+  /// its nodes counting just what has been learnt there since, and so created for any
+  /// context (or symbol in a context) in which there is anything new to count, even if
+  /// also in the static tier. (Nodes created only to make way for such, i.e. to give
+  /// another its parent and vine, count 0.) Contexts then track their longest suffix
+  /// in each tier separately, so the counts for the longer of the two, and each of its
+  /// suffixes, are the sums of those in the tiers: the same as if nothing had been
+  /// frozen. Only CPPMLanguageModel::GetProbs uses such sums, so only that subclass
+  /// freezes its trie.
+  ///
+  /// Subclasses must implement CLanguageModel::GetProbs.
   ///
   class CAbstractPPM :public CLanguageModel, protected CSettingsUser, private NoClones {
   protected:
+    ///Index of a node in m_vNodes; 0 = null.
+    typedef unsigned int NodeIdx;
     class ChildIterator;
     class CPPMnode {
     private:
-      union {
-        CPPMnode **m_ppChildren;
-        CPPMnode *m_pChild;
-      };
-      ///Elements in above array, including nulls, as follows:
-      /// (a) negative -> absolute value is number of elems in m_ppChildren, but use direct indexing
-      /// (b) 1 -> use m_pChild as direct pointer to CPPMnode (no array)
-      /// (c) 2-MAX_RUN -> m_ppChildren is unordered array of that many elems
-      /// (d) >MAX_RUN ->  m_ppChildren is an inline hash (overflow to next elem) with that many slots
-      int m_iNumChildSlots;
-      friend class CPPMLanguageModel;
-	  public:
-      ChildIterator children() const;
-      const ChildIterator end() const;
-      void AddChild(CPPMnode *pNewChild, int numSymbols);
-      CPPMnode * find_symbol(symbol sym)const;
-      CPPMnode *vine;
+      ///Meaning depends on m_iNumChildSlots:
+      /// (a) 0 -> unused (no children)
+      /// (b) 1 -> index of the only child node (no table)
+      /// (c) otherwise -> offset into m_vChildSlots of the first element of the child table
+      NodeIdx m_iChildren;
+      ///Elements in the child table, including nulls, as follows:
+      /// (a) negative -> absolute value is number of elems in table, but use direct indexing
+      /// (b) 1 -> m_iChildren is the index of the only child (no table)
+      /// (c) 2-MAX_RUN -> table is unordered array of that many elems
+      /// (d) >MAX_RUN ->  table is an inline hash (overflow to next elem) with that many slots
+      /// (short, to keep CPPMnode at 16 bytes; so alphabets are limited to 32767 symbols,
+      /// as per the short symbol numbers in the existing file format)
+      short int m_iNumChildSlots;
+      friend class CAbstractPPM;
+    public:
+      ///Saturates at 0xFFFF rather than wrapping
       unsigned short int count;
+      NodeIdx vine;
       symbol sym;
       CPPMnode(symbol sym);
       CPPMnode();
-      virtual ~CPPMnode();
-      virtual bool eq(CPPMnode *other, std::map<CPPMnode *,CPPMnode *> &equivs);
-	  };
+    };
+    ///Visits the non-null entries of a child table from last to first; or, for a node
+    /// with only one child (no table), just that. Any iterator which has finished
+    /// compares equal to any other, so to childrenEnd.
     class ChildIterator {
     private:
+      NodeIdx at(int i) const {return m_piTable ? loadAcquire(m_piTable[i]) : m_iOnly;}
       void nxt() {
-        if (m_ppChild == m_ppStop) return;
-        while ((--m_ppChild) != m_ppStop)
-          if (*m_ppChild) break;
+        if (m_i < 0) return;
+        while (--m_i >= 0)
+          if (at(m_i)) break;
       }
     public:
-      bool operator==(const ChildIterator &other) const {return m_ppChild==other.m_ppChild && m_ppStop == other.m_ppStop;}
-      bool operator!=(const ChildIterator &other) const {return m_ppChild!=other.m_ppChild || m_ppStop!=other.m_ppStop;}
-      CPPMnode *operator*() const {return (m_ppChild == m_ppStop) ? NULL : *m_ppChild;}
+      bool operator==(const ChildIterator &other) const {return m_i == other.m_i && (m_i < 0 || m_piTable == other.m_piTable);}
+      bool operator!=(const ChildIterator &other) const {return !(*this == other);}
+      NodeIdx operator*() const {return (m_i < 0) ? 0 : at(m_i);}
       ChildIterator &operator++() {nxt(); return *this;} //prefix
       ChildIterator operator++(int) {ChildIterator temp(*this); nxt(); return temp;}
-      //operator CPPMnode *() {return node;} //implicit conversion
-      //operator bool();                     //implicit conversion 2
-      ChildIterator(CPPMnode *const *ppChild, CPPMnode *const *ppStop) : m_ppChild(ppChild), m_ppStop(ppStop) {nxt();}
+      ///Over a table of iSlots entries, or (piTable NULL) just iOnly if nonzero
+      ChildIterator(const NodeIdx *piTable, int iSlots, NodeIdx iOnly) : m_piTable(piTable), m_iOnly(iOnly), m_i(iSlots) {nxt();}
+      ///Finished
+      ChildIterator() : m_piTable(NULL), m_iOnly(0), m_i(-1) {}
     private:
-      CPPMnode *const *m_ppChild, *const *m_ppStop;
+      const NodeIdx *m_piTable;
+      NodeIdx m_iOnly;
+      int m_i;
     };
 
     class CPPMContext {
     public:
-      CPPMContext(CPPMContext const &input) {
-        head = input.head;
-        order = input.order;
-      } CPPMContext(CPPMnode * _head = 0, int _order = 0):head(_head), order(_order) {
+      CPPMContext(NodeIdx _head = 0, int _order = 0, CStaticPPMTrie::Idx _staticHead = CStaticPPMTrie::ROOT, int _staticOrder = -1)
+      : head(_head), order(_order), staticHead(_staticHead), staticOrder(_staticOrder) {
       };
       ~CPPMContext() {
       };
       void dump();
-      CPPMnode *head;
+      NodeIdx head;
       int order;
+      ///Longest suffix of the context in the static tier, and its length; -1 if there
+      /// is no static tier
+      CStaticPPMTrie::Idx staticHead;
+      int staticOrder;
     };
     
-    ///Makes a new node, of whatever kind (subclass of CPPMnode, perhaps with extra info)
-    /// is required by the subclass, for the specified symbol. (Initial count will be 1.)
-    virtual CPPMnode *makeNode(int sym)=0;
     /// \param iMaxOrder max order of model; anything <0 means to use LP_LM_MAX_ORDER.
-    CAbstractPPM(CSettingsUser *pCreator, int iNumSyms, CPPMnode *pRoot, int iMaxOrder=-1);
+    CAbstractPPM(CSettingsUser *pCreator, int iNumSyms, int iMaxOrder=-1);
+
+    ///Access a node by index. Note references are invalidated by makeNode (in the
+    /// writer; readers' remain valid until the end of their read).
+    CPPMnode &node(NodeIdx i) {return i < m_iMappedNodes ? m_pMappedNodes[i] : m_pNodes.load(std::memory_order_acquire)[i - m_iMappedNodes];}
+    const CPPMnode &node(NodeIdx i) const {return i < m_iMappedNodes ? m_pMappedNodes[i] : m_pNodes.load(std::memory_order_acquire)[i - m_iMappedNodes];}
+    ///Iterate over the children of a node (in no particular order); valid only
+    /// until the next call to AddChild (in the writer; or, in a reader, the end of
+    /// the read, though children added meanwhile may or may not be visited).
+    ChildIterator children(NodeIdx i) const;
+    const ChildIterator childrenEnd(NodeIdx) const {return ChildIterator();}
+    /// \return index of child of node iNode with the specified symbol, or 0 if none.
+    NodeIdx find_symbol(NodeIdx iNode, symbol sym) const;
+    void AddChild(NodeIdx iParent, NodeIdx iNewChild);
+    ///Makes a new node for the specified symbol (count 1, no vine pointer) at the end of the arena.
+    NodeIdx makeNode(symbol sym);
+    ///Bytes currently reserved by the node and child-table arenas (not inc. any mapped
+    /// file, nor arenas retired but not yet reclaimed)
+    size_t BytesAllocated() const {return m_vNodes.capacity()*sizeof(CPPMnode) + m_vChildSlots.capacity()*sizeof(NodeIdx);}
+
+    ///For fields the writer may update while readers read them: the writer stores
+    /// links to new nodes and tables with release semantics, and readers load them
+    /// with acquire; counts are loaded and stored relaxed.
+    template<typename T> static T loadAcquire(const T &t);
+    template<typename T> static T loadRelaxed(const T &t);
+    template<typename T> static void storeRelease(T &t, T v);
+    template<typename T> static void storeRelaxed(T &t, T v);
+
+    ///Pins the current epoch for the duration of a read (see CEpochReclaimer)
+    typedef CEpochReclaimer::CReadGuard ReadGuard;
+    ///Waits for any reads in progress to finish, and makes new ones wait until the
+    /// matching EndExclusive; calls may be nested. For use by the writer only.
+    void BeginExclusive();
+    void EndExclusive();
+
+    ///Writes a small header, all nodes, then the child tables (compacted, i.e. omitting
+    /// any free tables), such that they can be used in place by LoadTrie.
+    bool SaveTrie(std::ofstream &oOutputFile) const;
+    ///Replaces the current trie with one stored by SaveTrie at a given offset in a file.
+    /// Where supported (HAVE_MMAP), the file is mmap'd MAP_PRIVATE, i.e. copy-on-write,
+    /// and nodes used in place; otherwise it is read into a single heap buffer. Existing
+    /// contexts are reset to the root.
+    /// \param iOffset offset of the trie in the file; must be a multiple of 4.
+    /// \return false if the file could not be read or the trie was not compatible (or
+    /// failed ValidTrie), in which case the current trie is unchanged.
+    bool LoadTrie(const std::string &strFilename, size_t iOffset);
+    ///Checks a trie loaded from file is safe to use: every vine and child is a node, with
+    /// a symbol of this alphabet; every child table lies within the slots, direct-indexed
+    /// tables have room for every symbol, and hash tables have a null (to end a search).
+    bool ValidTrie(const CPPMnode *pNodes, NodeIdx iNumNodes, const NodeIdx *piSlots, NodeIdx iNumSlots) const;
+
+    ///Exchanges the entire trie (nodes, child tables, any mapped file, static tier) with that of
+    /// another model, which must have the same alphabet size and order. Contexts are
+    /// not updated, so must be remapped (or not used) afterwards.
+    void SwapTrie(CAbstractPPM &other);
+    ///Adds all the counts in another trie (same alphabet size and order; inc. any in
+    /// its static tier) into this one, creating any nodes not already present.
+    /// \param vMap filled in with, for each node index in other, the index of the
+    /// corresponding node (i.e. reached by the same symbols) in this.
+    void MergeTrie(const CAbstractPPM &other, std::vector<NodeIdx> &vMap);
+    ///Updates every context of this model to point at vMap[current head]
+    void RemapContexts(const std::vector<NodeIdx> &vMap);
+    ///For contexts whose heads are in other's trie (as after SwapTrie, before
+    /// RemapContexts): sets the suffix of each in this model's static tier to the
+    /// longest suffix of its head found there. (Any suffix it had in other's static
+    /// tier is forgotten.)
+    void RemapStaticContexts(const CAbstractPPM &other);
+
+    ///Freezes everything learnt so far into a (new) static tier, emptying the trie
+    /// (see class comment); contexts are remapped to match. Readers are excluded meanwhile.
+    /// \param iQuantisedBits 0 to keep counts exact, else bits in which to quantise
+    /// each (see CStaticPPMTrie)
+    void FreezeTrie(int iQuantisedBits);
+    ///The static tier, or NULL if nothing has been frozen
+    const CStaticPPMTrie *staticTrie() const {return m_pStatic;}
+    ///Replaces the static tier (taking ownership of pStatic, which may be NULL), and
+    /// resets every context's suffix in it to the root. Readers must be excluded.
+    void ReplaceStaticTrie(CStaticPPMTrie *pStatic);
+    ///The lowest-order node whose children the last LearnSymbol added to or updated
+    /// (m_iRoot if none, or if the trie has been pruned since)
+    NodeIdx LowestUpdated() const {return m_iLowestUpdated;}
+    ///Makes anything retired which no read can still be using available for reuse;
+    /// called by LearnSymbol, but also to be called by anything else adding nodes.
+    void Reclaim();
+
+    ///Prunes the trie, if over LP_LM_MAX_MEMORY, until back under 3/4 of it (or nothing
+    /// more can be removed); called by LearnSymbol, but also to be called by anything
+    /// else adding nodes in bulk.
+    void LimitMemory();
+    ///Called after Prune has renumbered the remaining nodes: vMap maps each old node
+    /// index to its new one, or to 0 if the node was removed; bAged if all counts were
+    /// also halved. Subclasses storing their own per-node data should move (and age)
+    /// it likewise, e.g. by RenumberNodeData, and discard anything cached about nodes.
+    virtual void TriePruned(const std::vector<NodeIdx> &/*vMap*/, bool /*bAged*/) {}
+    ///Moves per-node data (indexed by NodeIdx, and possibly not yet extended to cover
+    /// every node) to follow the renumbering vMap made by Prune, discarding that for
+    /// removed nodes.
+    template<typename T> static void RenumberNodeData(std::vector<T> &vData, const std::vector<NodeIdx> &vMap);
     
     void dumpSymbol(symbol sym);
     void dumpString(char *str, int pos, int len);
-    void dumpTrie(CPPMnode * t, int d);
+    void dumpTrie(NodeIdx t, int d);
     
-    CPPMContext *m_pRootContext;
-    CPPMnode *m_pRoot;
+    ///The context with the given handle, which must be valid (checked in debug builds).
+    /// Note references are invalidated by creating or cloning a context, so this is
+    /// for use only when no other thread may be doing so; otherwise use contextCopy.
+    CPPMContext &ppmContext(Context c) {DASHER_ASSERT(isValidContext(c)); return m_Contexts[c];}
+    const CPPMContext &ppmContext(Context c) const {DASHER_ASSERT(isValidContext(c)); return m_Contexts[c];}
+    ///Copy of the context with the given handle, safe whatever other threads are doing
+    CPPMContext contextCopy(Context c) const {
+      std::lock_guard<std::mutex> lock(m_ContextsLock);
+      return ppmContext(c);
+    }
+
+    ///A context with nothing entered
+    CPPMContext EmptyContext() const {return CPPMContext(m_iRoot, 0, CStaticPPMTrie::ROOT, m_pStatic ? 0 : -1);}
+
+    ///Index of the root node (always 1; index 0 is a null/sentinel node)
+    const NodeIdx m_iRoot;
     
     /// Cache parameters that don't make sense to adjust during the life of a language model...
     const int m_iMaxOrder; 
     const bool bUpdateExclusion;
+
+    ///Tracks which reads are in progress, so the writer knows what it may reclaim
+    CEpochReclaimer m_Epochs;
     
   public:
     virtual bool eq(CAbstractPPM *other);
-    virtual ~CAbstractPPM() {};
+    virtual ~CAbstractPPM();
 
     Context CreateEmptyContext();
     void ReleaseContext(Context context);
@@ -127,94 +294,320 @@ namespace Dasher {
 
     void dump();
     bool isValidContext(const Context c) const ;
+
+    ///Number of nodes in the trie (inc. the root), i.e. not inc. any static tier
+    int NumNodes() const {return m_iMappedNodes + m_vNodes.size()-1;}
+    ///Bytes taken by all nodes and child tables (inc. any mapped from file, and free
+    /// tables awaiting reuse), i.e. the measure limited by LP_LM_MAX_MEMORY
+    size_t BytesUsed() const {return (NumNodes()+1)*sizeof(CPPMnode) + (m_iMappedSlots + m_vChildSlots.size())*sizeof(NodeIdx);}
+    ///Number of nodes in, and bytes taken by, the static tier (0 if none)
+    int NumStaticNodes() const {return m_pStatic ? m_pStatic->NumNodes() : 0;}
+    size_t StaticBytesUsed() const {return m_pStatic ? m_pStatic->BytesUsed() : 0;}
+    ///Number of contexts created or cloned so far, and of those not yet released
+    unsigned long ContextsMade() const {std::lock_guard<std::mutex> lock(m_ContextsLock); return m_iContextsMade;}
+    size_t LiveContexts() const {std::lock_guard<std::mutex> lock(m_ContextsLock); return m_Contexts.Size();}
   private:
-    CPPMnode *AddSymbolToNode(CPPMnode * pNode, symbol sym);
+    ///Moves a context (not in m_Contexts) on by a symbol; call within a read.
+    void EnterSymbol(CPPMContext &context, symbol Symbol) const;
+    ///Moves on just the suffix of a context in the static tier
+    void EnterStaticSymbol(CPPMContext &context, symbol Symbol) const;
+    ///Adds sym to the context, of length iOrder, at iNode (see LearnSymbol), and
+    /// likewise to its suffixes as necessary; returns the node for the context + sym.
+    /// A symbol already seen in the static tier (m_vStaticChain) is counted in a node
+    /// materialised for it.
+    NodeIdx AddSymbolToNode(NodeIdx iNode, symbol sym, int iOrder);
+    ///Node for the same symbols as a node in the static tier, creating it (and any
+    /// nodes it needs as parent or vine) with a count of 0 if necessary
+    NodeIdx Materialise(CStaticPPMTrie::Idx iStatic);
+    ///Likewise, for a static node whose parent is known to correspond to iParent
+    NodeIdx MaterialiseChild(NodeIdx iParent, CStaticPPMTrie::Idx iStatic);
+    ///Inserts iNewChild into a child table described by (iChildren, iNumSlots), which
+    /// AddChild publishes afterwards if changed; any table replaced is freed, or retired
+    /// if iPublished (i.e. readers may be using it).
+    void InsertChild(NodeIdx &iChildren, int &iNumSlots, NodeIdx iNewChild, NodeIdx iPublished);
+    ///Reads the child table fields of a node consistently, even if the writer is
+    /// replacing its table meanwhile (m_iTableSeq is then odd, or changes).
+    void readChildren(const CPPMnode &n, NodeIdx &iChildren, int &iNumSlots) const;
+    ///Removes (and reclaims the space of) nodes of order 2 or more with a count of 1,
+    /// highest order first, until roughly enough have gone to bring BytesUsed down to
+    /// iTarget. A node is never removed if needed by something kept: i.e. if the head
+    /// of a live context, or the parent or vine target of a node not removed. All vine
+    /// pointers thus remain valid, as do contexts (which are remapped).
+    /// \param bAge first age the trie, by halving every count (rounding up); so nodes
+    /// with a count of 2 may also be removed.
+    /// \return false (leaving the trie unchanged) if no node could be removed.
+    /// Readers must be excluded (as by LimitMemory).
+    bool Prune(size_t iTarget, bool bAge);
+    bool eq(NodeIdx iNode, CAbstractPPM *other, NodeIdx iOther, std::map<NodeIdx,NodeIdx> &equivs);
+    ///Returns offset in m_vChildSlots of a zeroed table of the specified size,
+    /// reusing a previously-freed table if possible
+    NodeIdx AllocChildTable(int iSize);
+    ///Makes a table available for reuse: immediately, if no reader can have seen it,
+    /// else once Reclaim finds no read could still be using it.
+    void FreeChildTable(NodeIdx iOffset, int iSize, bool bRetire);
+    NodeIdx *childTable(NodeIdx iOffset) {return iOffset < m_iMappedSlots ? m_piMappedSlots + iOffset : m_piSlots.load(std::memory_order_acquire) + (iOffset - m_iMappedSlots);}
+    const NodeIdx *childTable(NodeIdx iOffset) const {return iOffset < m_iMappedSlots ? m_piMappedSlots + iOffset : m_piSlots.load(std::memory_order_acquire) + (iOffset - m_iMappedSlots);}
+    ///Points m_pNodes and m_piSlots at the current arenas
+    void PublishArenas();
+    ///Unmaps/frees any file previously loaded by LoadTrie, discarding the nodes therein
+    void ReleaseMapping();
 
-    CPooledAlloc < CPPMContext > m_ContextAlloc;
-    
-    std::set<const CPPMContext *> m_setContexts;
+    ///All nodes in the trie, indexed by NodeIdx. Never reallocated in place, as
+    /// readers may be using it: when full, makeNode copies it into a bigger vector.
+    std::vector<CPPMnode> m_vNodes;
+    ///Arena holding all child tables; likewise copied rather than reallocated
+    std::vector<NodeIdx> m_vChildSlots;
+    ///Start of m_vNodes and m_vChildSlots, as readers should use them
+    std::atomic<CPPMnode *> m_pNodes;
+    std::atomic<NodeIdx *> m_piSlots;
+    ///Free lists of tables in m_vChildSlots, by size
+    std::map<int, std::vector<NodeIdx> > m_mapFreeTables;
+
+    ///Child tables, and whole arenas, replaced while readers might be using them,
+    /// in order of retirement, each with the epoch in which it was retired
+    struct SRetiredTable {
+      CEpochReclaimer::Epoch iEpoch;
+      NodeIdx iOffset;
+      int iSize;
+    };
+    std::deque<SRetiredTable> m_dRetiredTables;
+    std::list<std::pair<CEpochReclaimer::Epoch, std::vector<CPPMnode> > > m_lRetiredNodes;
+    std::list<std::pair<CEpochReclaimer::Epoch, std::vector<NodeIdx> > > m_lRetiredSlots;
+    ///Odd while the writer is changing the child table fields of any node
+    std::atomic<unsigned int> m_iTableSeq;
+    ///Depth of nested BeginExclusive calls
+    int m_iExclusive;
+
+    ///File loaded by LoadTrie (NULL if none), and its size
+    void *m_pMapping;
+    size_t m_iMappingSize;
+    ///Nodes and child tables within m_pMapping; the first m_iMappedNodes nodes
+    /// and m_iMappedSlots child table entries are stored here rather than in the vectors.
+    CPPMnode *m_pMappedNodes;
+    NodeIdx m_iMappedNodes;
+    NodeIdx *m_piMappedSlots;
+    NodeIdx m_iMappedSlots;
+
+    ///All live contexts; a Context is a handle into this table. Locked by m_ContextsLock,
+    /// except where only one thread is using the model.
+    CHandleTable<CPPMContext> m_Contexts;
+    mutable std::mutex m_ContextsLock;
+    ///Count of calls to CreateEmptyContext and CloneContext; locked likewise
+    unsigned long m_iContextsMade;
+
+    ///Size to which the trie may grow before LimitMemory tries again to prune it,
+    /// after an attempt left it over the limit (0 = no such attempt)
+    size_t m_iUnprunableBytes;
+
+    ///The static tier (NULL if none); replaced only while readers are excluded
+    CStaticPPMTrie *m_pStatic;
+    ///For LearnSymbol: the suffixes, by length, of the context being learnt in the
+    /// static tier
+    std::vector<CStaticPPMTrie::Idx> m_vStaticChain;
+    ///See LowestUpdated
+    NodeIdx m_iLowestUpdated;
   };
 
   ///"Standard" PPM language model: GetProbs uses counts in PPM child nodes,
   /// universal alpha+beta values read from LP_LM_ALPHA and LP_LM_BETA,
   /// max order from LP_LM_MAX_ORDER.
+  ///
+  /// The most recent PROBS_CACHE_SIZE distributions computed by GetProbs are cached
+  /// (least-recently-used discarded first), as many nodes are often built on the same
+  /// context head. A distribution depends on the children of every node on the vine
+  /// chain from the head, so LearnSymbol discards any entry whose chain includes the
+  /// lowest-order node it updates (i.e. everything, without update exclusion).
+  ///
+  /// GetProbs and GetProbsBatch may be called from any number of threads at once, and
+  /// while another learns (see CAbstractPPM).
+  ///
+  /// FreezeModel moves everything learnt so far into a static tier (see CAbstractPPM);
+  /// GetProbs then shares out probability at each order according to the sum of the
+  /// counts in both tiers. If LP_LM_COUNT_BITS is set, counts in the static tier are
+  /// quantised into so many bits (unless exact counts would need no more), saving
+  /// memory at a small cost in accuracy.
   class CPPMLanguageModel : public CAbstractPPM {
   public:
     CPPMLanguageModel(CSettingsUser *pCreator, int iNumSyms);
+    virtual ~CPPMLanguageModel();
     virtual void GetProbs(Context context, std::vector < unsigned int >&Probs, int norm, int iUniform) const;
+    ///Reads alpha and beta once, and gathers the children of each node on the
+    /// contexts' vine chains only once, however many of the chains include it.
+    virtual void GetProbsBatch(const std::vector<ProbsRequest> &vRequests, int norm, int iUniform) const;
+    ///Walks the vine chain as GetProbs does, but without building (or caching) the distribution
+    virtual unsigned int GetProb(Context context, int Symbol, int norm, int iUniform) const;
+    virtual void LearnSymbol(Context context, int Symbol);
+    virtual bool CanAdoptModel() const {return true;}
+    virtual void AdoptModel(CLanguageModel *pTrained);
+    virtual void MergeModel(const CLanguageModel *pOther);
+    virtual void FreezeModel();
+
+    ///Number of GetProbs calls answered from / not found in the cache, since creation
+    unsigned long GetProbsCacheHits() const {std::lock_guard<std::mutex> lock(m_CacheLock); return m_iCacheHits;}
+    unsigned long GetProbsCacheMisses() const {std::lock_guard<std::mutex> lock(m_CacheLock); return m_iCacheMisses;}
+
+    static const size_t PROBS_CACHE_SIZE = 64;
   protected:
-    /// Makes a standard CPPMnode, but using a pooled allocator (m_NodeAlloc) - faster!
-    virtual CPPMnode *makeNode(int sym);
-    
     virtual bool WriteToFile(std::string strFilename);
     virtual bool ReadFromFile(std::string strFilename);
+    virtual void TriePruned(const std::vector<NodeIdx> &vMap, bool bAged);
   private:
-    int NodesAllocated;
+    struct ProbsCacheKey;
+    struct SScratch;
+    ///Computes the distribution for GetProbs, without reference to the cache
+    /// \param bBatch true to gather children into (and reuse them from) scratch.vBatchLevels
+    void ComputeProbs(const CPPMContext *ppmcontext, std::vector<unsigned int> &probs, int norm, int iUniform, int alpha, int beta, SScratch &scratch, bool bBatch) const;
+    ///Stores the symbols and counts of the children of a node in pSyms and pCounts,
+    /// and their total count in iTotal; returns the number of children. The node is
+    /// given as that in the trie (0 if none) and that for the same symbols in the static
+    /// tier (CStaticPPMTrie::NONE if none), whose children's counts are summed.
+    int GatherChildren(NodeIdx iNode, CStaticPPMTrie::Idx iStatic, symbol *pSyms, int *pCounts, int &iTotal) const;
+    ///Steps walk (initially a context) down to the next order, from the head down, at which
+    /// it may have a node in the trie, the static tier, or both (the longer suffix ending in
+    /// both at the same order); puts that level's nodes (as for GatherChildren) in iLevelNode
+    /// and iLevelStatic. Returns false once there are none left.
+    bool NextLevel(CPPMContext &walk, NodeIdx &iLevelNode, CStaticPPMTrie::Idx &iLevelStatic) const;
+    ///If the cache holds the distribution for key, copies it into probs and returns
+    /// true; else returns false, and the generation of the cache, for CacheProbs.
+    bool FindCachedProbs(const ProbsCacheKey &key, std::vector<unsigned int> &probs, unsigned long &iGeneration) const;
+    ///Adds a distribution to the cache, discarding the least recently used if full;
+    /// unless anything has been invalidated since generation iGeneration, as the
+    /// distribution might then be out of date.
+    void CacheProbs(const ProbsCacheKey &key, const std::vector<unsigned int> &probs, unsigned long iGeneration) const;
+    ///Discards cached distributions for every head whose vine chain includes iNode
+    void InvalidateProbsCache(NodeIdx iNode);
 
-    bool RecursiveWrite(CPPMnode *pNode, CPPMnode *pNextSibling, std::map<CPPMnode *, int> *pmapIdx, int *pNextIdx, std::ofstream *pOutputFile);
-    int GetIndex(CPPMnode *pAddr, std::map<CPPMnode *, int> *pmapIdx, int *pNextIdx);
-    CPPMnode *GetAddress(int iIndex, std::map<int, CPPMnode*> *pMap);
+    ///For GetProbsBatch: the children of a node gathered so far in the current
+    /// batch, as a range of vBatchSyms and vBatchCounts, and their total count
+    struct SBatchLevel {
+      NodeIdx iNode;
+      CStaticPPMTrie::Idx iStatic; //unused slot if this is NONE, and iNode 0
+      size_t iStart;
+      int n, iTotal;
+    };
+    ///Scratch space for ComputeProbs, one per thread (see Scratch)
+    struct SScratch {
+      ///The symbols and counts of the children of one node, packed contiguously, and
+      /// the probability given to each
+      std::vector<symbol> vLevelSyms;
+      std::vector<int> vLevelCounts;
+      std::vector<unsigned int> vLevelSlices;
+      ///Open-addressed (linear probing) on iNode; size a power of two, at least twice
+      /// the number of vine nodes the current batch could visit
+      std::vector<SBatchLevel> vBatchLevels;
+      std::vector<symbol> vBatchSyms;
+      std::vector<int> vBatchCounts;
+    };
+    ///The calling thread's scratch space, with the per-level arrays big enough for this model
+    SScratch &Scratch() const;
 
-    mutable CSimplePooledAlloc < CPPMnode > m_NodeAlloc;
+    ///Everything on which a cached distribution depends, besides the trie itself
+    struct ProbsCacheKey {
+      NodeIdx head;
+      int order;
+      CStaticPPMTrie::Idx staticHead;
+      int staticOrder, norm, iUniform, alpha, beta;
+      bool operator<(const ProbsCacheKey &o) const {
+        if (head != o.head) return head < o.head;
+        if (order != o.order) return order < o.order;
+        if (staticHead != o.staticHead) return staticHead < o.staticHead;
+        if (staticOrder != o.staticOrder) return staticOrder < o.staticOrder;
+        if (norm != o.norm) return norm < o.norm;
+        if (iUniform != o.iUniform) return iUniform < o.iUniform;
+        if (alpha != o.alpha) return alpha < o.alpha;
+        return beta < o.beta;
+      }
+    };
+    typedef std::list<std::pair<ProbsCacheKey, std::vector<unsigned int> > > ProbsCacheList;
+    ///Cached distributions, most recently used first, and an index into them
+    mutable ProbsCacheList m_lProbsCache;
+    mutable std::map<ProbsCacheKey, ProbsCacheList::iterator> m_mapProbsCache;
+    mutable unsigned long m_iCacheHits, m_iCacheMisses;
+    ///Incremented by every InvalidateProbsCache
+    unsigned long m_iCacheGeneration;
+    ///Locks all the above
+    mutable std::mutex m_CacheLock;
   };
 
   /// @}
-  inline CAbstractPPM::ChildIterator CPPMLanguageModel::CPPMnode::children() const {
-    //if m_iNumChildSlots = 0 / 1, m_ppChildren is direct pointer, else ptr to array (of pointers)
-    CPPMnode *const *ppChild = (m_iNumChildSlots == 0 || m_iNumChildSlots == 1) ? &m_pChild : m_ppChildren;
-    return ChildIterator(ppChild + abs(m_iNumChildSlots), ppChild - 1);
+#ifdef __GNUC__
+  template<typename T> inline T CAbstractPPM::loadAcquire(const T &t) {return __atomic_load_n(&t, __ATOMIC_ACQUIRE);}
+  template<typename T> inline T CAbstractPPM::loadRelaxed(const T &t) {return __atomic_load_n(&t, __ATOMIC_RELAXED);}
+  template<typename T> inline void CAbstractPPM::storeRelease(T &t, T v) {__atomic_store_n(&t, v, __ATOMIC_RELEASE);}
+  template<typename T> inline void CAbstractPPM::storeRelaxed(T &t, T v) {__atomic_store_n(&t, v, __ATOMIC_RELAXED);}
+#else
+  template<typename T> inline T CAbstractPPM::loadAcquire(const T &t) {
+    const T v = *static_cast<const volatile T *>(&t);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return v;
   }
-  
-  inline const CAbstractPPM::ChildIterator CPPMLanguageModel::CPPMnode::end() const {
-    //if m_iNumChildSlots = 0 / 1, m_ppChildren is direct pointer, else ptr to array (of pointers)
-    CPPMnode *const *ppChild = (m_iNumChildSlots == 0 || m_iNumChildSlots == 1) ? &m_pChild : m_ppChildren;
-    return ChildIterator(ppChild, ppChild - 1);
+  template<typename T> inline T CAbstractPPM::loadRelaxed(const T &t) {return *static_cast<const volatile T *>(&t);}
+  template<typename T> inline void CAbstractPPM::storeRelease(T &t, T v) {
+    std::atomic_thread_fence(std::memory_order_release);
+    *static_cast<volatile T *>(&t) = v;
+  }
+  template<typename T> inline void CAbstractPPM::storeRelaxed(T &t, T v) {*static_cast<volatile T *>(&t) = v;}
+#endif
+
+  inline void CAbstractPPM::readChildren(const CPPMnode &n, NodeIdx &iChildren, int &iNumSlots) const {
+    for (;;) {
+      const unsigned int iSeq = m_iTableSeq.load(std::memory_order_acquire);
+      iChildren = loadRelaxed(n.m_iChildren);
+      iNumSlots = loadRelaxed(n.m_iNumChildSlots);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (!(iSeq & 1) && m_iTableSeq.load(std::memory_order_relaxed) == iSeq) return;
+    }
+  }
+
+  inline CAbstractPPM::ChildIterator CAbstractPPM::children(NodeIdx i) const {
+    //if m_iNumChildSlots = 0 / 1, m_iChildren is the child index itself, else offset of table
+    NodeIdx iChildren;
+    int iNumSlots;
+    readChildren(node(i), iChildren, iNumSlots);
+    if (iNumSlots == 0 || iNumSlots == 1) return ChildIterator(NULL, iNumSlots, iChildren);
+    return ChildIterator(childTable(iChildren), abs(iNumSlots), 0);
   }
 
   inline Dasher::CAbstractPPM::CPPMnode::CPPMnode(symbol _sym): sym(_sym) {
     vine = 0;
     m_iNumChildSlots = 0;
-    m_ppChildren = NULL;
+    m_iChildren = 0;
     count = 1;
   }
 
   inline CAbstractPPM::CPPMnode::CPPMnode() {
     vine = 0;
     m_iNumChildSlots = 0;
-    m_ppChildren = NULL;
+    m_iChildren = 0;
     count = 1;
   }
-  
-  inline CAbstractPPM::CPPMnode::~CPPMnode() {
-    //single child = is direct pointer to node, not array...
-    if (m_iNumChildSlots != 1)
-      delete[] m_ppChildren;
+
+  template<typename T> void CAbstractPPM::RenumberNodeData(std::vector<T> &vData, const std::vector<NodeIdx> &vMap) {
+    std::vector<T> vNew;
+    for (NodeIdx i = 0; i < vData.size() && i < vMap.size(); i++)
+      if (NodeIdx iNew = vMap[i]) {
+        if (vNew.size() <= iNew) vNew.resize(iNew + 1);
+        std::swap(vNew[iNew], vData[i]);
+      }
+    vData.swap(vNew);
   }
 
   inline CLanguageModel::Context CAbstractPPM::CreateEmptyContext() {
-    CPPMContext *pCont = m_ContextAlloc.Alloc();
-    *pCont = *m_pRootContext;
-
-    m_setContexts.insert(pCont);
-
-    return (Context) pCont;
+    std::lock_guard<std::mutex> lock(m_ContextsLock);
+    m_iContextsMade++;
+    return m_Contexts.Alloc(EmptyContext());
   }
 
   inline CLanguageModel::Context CAbstractPPM::CloneContext(Context Copy) {
-    CPPMContext *pCont = m_ContextAlloc.Alloc();
-    CPPMContext *pCopy = (CPPMContext *) Copy;
-    *pCont = *pCopy;
-
-    m_setContexts.insert(pCont);
-
-    return (Context) pCont;
+    std::lock_guard<std::mutex> lock(m_ContextsLock);
+    m_iContextsMade++;
+    return m_Contexts.Alloc(ppmContext(Copy));
   }
 
   inline void CAbstractPPM::ReleaseContext(Context release) {
-
-    m_setContexts.erase(m_setContexts.find((CPPMContext *) release));
-
-    m_ContextAlloc.Free((CPPMContext *) release);
+    std::lock_guard<std::mutex> lock(m_ContextsLock);
+    DASHER_ASSERT(m_Contexts.IsValid(release));
+    m_Contexts.Free(release);
   }
 }                               // end namespace Dasher
 
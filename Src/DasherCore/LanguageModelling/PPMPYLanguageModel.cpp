@@ -13,6 +13,7 @@
 #include "../../Common/Common.h"
 #include "PPMPYLanguageModel.h"
 #include "LanguageModel.h"
+#include <algorithm>
 #include <math.h>
 #include <stack>
 #include <sstream>
@@ -31,10 +32,86 @@ static char THIS_FILE[] = __FILE__;
 #endif
 #endif
 
+///Largest pinyin table kept sorted; bigger ones are hashed
+static const int MAX_SORTED = 8;
+
+///Slot at which to start looking for a pinyin symbol in a hashed table of 2^iLogSlots
+static inline unsigned int PYHash(symbol pysym, int iLogSlots) {
+  return (static_cast<unsigned int>(pysym) * 0x9E3779B1u) >> (32 - iLogSlots);
+}
+
 /////////////////////////////////////////////////////////////////////
 
 CPPMPYLanguageModel::CPPMPYLanguageModel(CSettingsUser *pCreator, int iNumCHsyms, int iNumPYsyms)
-  :CAbstractPPM(pCreator, iNumCHsyms, new CPPMPYnode(-1), 2), NodesAllocated(0), m_NodeAlloc(8192), m_iNumPYsyms(iNumPYsyms) {
+  :CAbstractPPM(pCreator, iNumCHsyms, 2), m_iNumPYsyms(iNumPYsyms) {
+  //(pinyin symbols are stored as unsigned shorts)
+  DASHER_ASSERT(iNumPYsyms <= 0xFFFF);
+}
+
+unsigned int CPPMPYLanguageModel::AllocPYTable(int iLogSlots) {
+  if (m_vFreePYTables.size() <= static_cast<size_t>(iLogSlots)) m_vFreePYTables.resize(iLogSlots+1);
+  std::vector<unsigned int> &vFree(m_vFreePYTables[iLogSlots]);
+  const SPYEntry empty = {0, 0};
+  if (!vFree.empty()) {
+    const unsigned int iOffset = vFree.back();
+    vFree.pop_back();
+    std::fill(m_vPYSlots.begin() + iOffset, m_vPYSlots.begin() + iOffset + (1 << iLogSlots), empty);
+    return iOffset;
+  }
+  const unsigned int iOffset = m_vPYSlots.size();
+  m_vPYSlots.resize(iOffset + (1 << iLogSlots), empty);
+  return iOffset;
+}
+
+void CPPMPYLanguageModel::InsertPY(SPYTable &table, const SPYEntry &entry) {
+  SPYEntry *pEntries = &m_vPYSlots[table.iOffset];
+  const int iSlots = 1 << table.iLogSlots;
+  if (iSlots <= MAX_SORTED) {
+    int i = table.iUsed;
+    for (; i > 0 && pEntries[i-1].sym > entry.sym; i--) pEntries[i] = pEntries[i-1];
+    pEntries[i] = entry;
+  } else {
+    unsigned int i = PYHash(entry.sym, table.iLogSlots);
+    while (pEntries[i].sym) i = (i + 1) & (iSlots - 1);
+    pEntries[i] = entry;
+  }
+  table.iUsed++;
+}
+
+bool CPPMPYLanguageModel::IncrementPY(NodeIdx iNode, symbol pysym) {
+  SPYTable &table(m_vPYChildren[iNode]);
+  if (table.iUsed) {
+    SPYEntry *pEntries = &m_vPYSlots[table.iOffset];
+    const int iSlots = 1 << table.iLogSlots;
+    SPYEntry *pFound = NULL;
+    if (iSlots <= MAX_SORTED) {
+      for (int i = 0; i < table.iUsed && pEntries[i].sym <= pysym; i++)
+        if (pEntries[i].sym == pysym) pFound = &pEntries[i];
+    } else {
+      for (unsigned int i = PYHash(pysym, table.iLogSlots); pEntries[i].sym; i = (i + 1) & (iSlots - 1))
+        if (pEntries[i].sym == pysym) {pFound = &pEntries[i]; break;}
+    }
+    if (pFound) {
+      if (pFound->count < 0xFFFF) pFound->count++;
+      return true;
+    }
+    //not present; make room if necessary
+    if (iSlots <= MAX_SORTED ? table.iUsed == iSlots : 4 * (table.iUsed + 1) > 3 * iSlots) {
+      const SPYTable old = table;
+      table.iLogSlots++;
+      table.iOffset = AllocPYTable(table.iLogSlots); //(may move m_vPYSlots)
+      table.iUsed = 0;
+      for (int i = 0; i < iSlots; i++)
+        if (m_vPYSlots[old.iOffset + i].sym) InsertPY(table, m_vPYSlots[old.iOffset + i]);
+      m_vFreePYTables[old.iLogSlots].push_back(old.iOffset);
+    }
+  } else {
+    table.iLogSlots = 0;
+    table.iOffset = AllocPYTable(0);
+  }
+  const SPYEntry entry = {static_cast<unsigned short int>(pysym), 1};
+  InsertPY(table, entry);
+  return false;
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -173,7 +250,7 @@ void CPPMPYLanguageModel::GetPartProbs(Context context, std::vector<pair<symbol,
   //  std::cout<<"Norms is "<<norm<<std::endl;
   //  std::cout<<"iUniform is "<<iUniform<<std::endl;
 
-  const CPPMContext *ppmcontext = (const CPPMContext *)(context);
+  const CPPMContext *ppmcontext = &ppmContext(context);
 
   //  DASHER_ASSERT(m_setContexts.count(ppmcontext) > 0);
 
@@ -205,14 +282,15 @@ void CPPMPYLanguageModel::GetPartProbs(Context context, std::vector<pair<symbol,
   int alpha = GetLongParameter( LP_LM_ALPHA );
   int beta = GetLongParameter( LP_LM_BETA );
 
-  int *vCounts=new int[vChildren.size()]; //num occurrences of symbol at same index in vChildren
+  m_vPartCounts.resize(vChildren.size());
+  int *vCounts=&m_vPartCounts[0]; //num occurrences of symbol at same index in vChildren
 
   //new code
-  for (CPPMnode *pTemp = ppmcontext->head; pTemp; pTemp=pTemp->vine) {
+  for (NodeIdx iTemp = ppmcontext->head; iTemp; iTemp=node(iTemp).vine) {
     int iTotal=0, i=0;
     for (std::vector<pair<symbol, unsigned int> >::const_iterator it = vChildren.begin(); it!=vChildren.end(); it++,i++) {
-      if (CPPMnode *pFound = pTemp->find_symbol(it->first)) {
-        iTotal += vCounts[i] = pFound->count; //double assignment
+      if (NodeIdx iFound = find_symbol(iTemp, it->first)) {
+        iTotal += vCounts[i] = node(iFound).count; //double assignment
       } else
         vCounts[i] = 0;
     }
@@ -232,7 +310,6 @@ void CPPMPYLanguageModel::GetPartProbs(Context context, std::vector<pair<symbol,
       }
     }
   }
-  delete[] vCounts;
   //code
   //std::cout<<"after lan mod second loop"<<std::endl;
 
@@ -283,7 +360,7 @@ void CPPMPYLanguageModel::GetPartProbs(Context context, std::vector<pair<symbol,
 // by an explicit cast to PPMPYLanguageModel whenever MandarinDasher was activated. Renaming
 // to GetProbs causes the normal (virtual) call to come straight here without any special-casing...
 void CPPMPYLanguageModel::GetProbs(Context context, std::vector<unsigned int> &probs, int norm, int iUniform) const {
-  const CPPMContext *ppmcontext = (const CPPMContext *)(context);
+  const CPPMContext *ppmcontext = &ppmContext(context);
 
   //  std::cout<<"PPMCONTEXT symbol: "<<ppmcontext->head->symbol<<std::endl;
   /*
@@ -301,65 +378,49 @@ void CPPMPYLanguageModel::GetProbs(Context context, std::vector<unsigned int> &p
   
   probs.resize(iNumSymbols);
 
-  std::vector < bool > exclusions(iNumSymbols);
-  
   unsigned int iToSpend = norm;
   unsigned int iUniformLeft = iUniform;
 
   // TODO: Sort out zero symbol case
   probs[0] = 0;
-  exclusions[0] = false;
 
   int i;
   for(i = 1; i < iNumSymbols; i++) {
     probs[i] = iUniformLeft / (iNumSymbols - i);
     iUniformLeft -= probs[i];
     iToSpend -= probs[i];
-    exclusions[i] = false;
   }
 
   DASHER_ASSERT(iUniformLeft == 0);
 
-  //  bool doExclusion = GetLongParameter( LP_LM_ALPHA );
-  bool doExclusion = 0; //FIXME
+  //FIXME: no exclusion (LP_LM_EXCLUSION) - each vine level shares out a slice of
+  // what remains among all pinyin symbols seen there.
 
   int alpha = GetLongParameter( LP_LM_ALPHA );
   int beta = GetLongParameter( LP_LM_BETA );
 
-  for (CPPMnode *pTemp = ppmcontext->head; pTemp; pTemp = pTemp->vine) {
+  for (NodeIdx iTemp = ppmcontext->head; iTemp; iTemp = node(iTemp).vine) {
+    //no pinyin learnt (yet) in this context
+    if (iTemp >= m_vPYChildren.size() || !m_vPYChildren[iTemp].iUsed) continue;
+    const SPYEntry *pEntries = &m_vPYSlots[m_vPYChildren[iTemp].iOffset];
+    const SPYEntry *const pEnd = pEntries + (1 << m_vPYChildren[iTemp].iLogSlots);
+
     int iTotal = 0;
-    const map<symbol, unsigned short int> &pychild( static_cast<CPPMPYnode *>(pTemp)->pychild);
+    for (const SPYEntry *pEntry = pEntries; pEntry != pEnd; pEntry++)
+      iTotal += pEntry->count; //(zero for unused entries)
 
-    for (map<symbol, unsigned short int>::const_iterator it=pychild.begin(); it!=pychild.end(); it++) {
-      if(!(exclusions[it->first] && doExclusion))
-        iTotal += it->second;
-    }
-
-    if(iTotal) {
-      unsigned int size_of_slice = iToSpend;
-      
-      for (map<symbol, unsigned short int>::const_iterator it = pychild.begin(); it!=pychild.end(); it++) {
-        if(!(exclusions[it->first] && doExclusion)) {
-          exclusions[it->first] = 1;
-	    
-          unsigned int p = static_cast < myint > (size_of_slice) * (100 * it->second - beta) / (100 * iTotal + alpha);
-	    
-          probs[it->first] += p;
-          iToSpend -= p;
-        }
-	  //                              Usprintf(debug,TEXT("sym %u counts %d p %u tospend %u \n"),sym,s->count,p,tospend);      
-	  //                              DebugOutput( debug);
-      }
+    unsigned int size_of_slice = iToSpend;
 
+    for (const SPYEntry *pEntry = pEntries; pEntry != pEnd; pEntry++) {
+      if (!pEntry->sym) continue;
+      unsigned int p = static_cast < myint > (size_of_slice) * (100 * pEntry->count - beta) / (100 * iTotal + alpha);
+      probs[pEntry->sym] += p;
+      iToSpend -= p;
     }
   }
 
   unsigned int size_of_slice = iToSpend;
-  int symbolsleft = 0;
-
-  for(i = 1; i < iNumSymbols; i++)
-    if(!(exclusions[i] && doExclusion))
-      symbolsleft++;
+  int symbolsleft = iNumSymbols - 1;
 
 //      std::ostringstream str;
 //      for (sym=0;sym<modelchars;sym++)
@@ -374,11 +435,9 @@ void CPPMPYLanguageModel::GetProbs(Context context, std::vector<unsigned int> &p
 //      DASHER_TRACEOUTPUT("valid %s",str2.str().c_str());
 
   for(i = 1; i < iNumSymbols; i++) {
-    if(!(exclusions[i] && doExclusion)) {
-      unsigned int p = size_of_slice / symbolsleft;
-      probs[i] += p;
-      iToSpend -= p;
-    }
+    unsigned int p = size_of_slice / symbolsleft;
+    probs[i] += p;
+    iToSpend -= p;
   }
 
   int iLeft = iNumSymbols-1;
@@ -402,7 +461,7 @@ void CPPMPYLanguageModel::LearnPYSymbol(Context c, int pysym) {
     return;
 
   DASHER_ASSERT(pysym > 0 && pysym <= m_iNumPYsyms);
-  CPPMPYLanguageModel::CPPMContext & context = *(CPPMContext *) (c);
+  CPPMPYLanguageModel::CPPMContext & context = ppmContext(c);
  
   //  std::cout<<"py learn context : "<<context.head->symbol<<std::endl;
   /*   CPPMPYnode * pNode = m_pRoot->child;
@@ -414,9 +473,14 @@ void CPPMPYLanguageModel::LearnPYSymbol(Context c, int pysym) {
      std::cout<<" "<<std::endl;
   */
 
-  for (CPPMnode *pNode = context.head; pNode; pNode=pNode->vine) {
-    if (static_cast<CPPMPYnode *>(pNode)->pychild[pysym]++) {
-      //count non-zero before increment, i.e. sym already present
+  if (m_vPYChildren.size() <= static_cast<size_t>(NumNodes())) {
+    const SPYTable empty = {0, 0, 0};
+    m_vPYChildren.resize(NumNodes()+1, empty);
+  }
+
+  for (NodeIdx iNode = context.head; iNode; iNode=node(iNode).vine) {
+    if (IncrementPY(iNode, pysym)) {
+      //sym already present
       if (bUpdateExclusion) break;
     }
   }
@@ -425,13 +489,6 @@ void CPPMPYLanguageModel::LearnPYSymbol(Context c, int pysym) {
   //context.order++;
 }
 
-CPPMPYLanguageModel::CPPMPYnode *CPPMPYLanguageModel::makeNode(int sym) {
-  CPPMPYnode *res = m_NodeAlloc.Alloc();
-  res->sym=sym;
-  ++NodesAllocated;
-  return res;
-}
-
 //Mandarin - PY not enabled for these read-write functions
 bool CPPMPYLanguageModel::WriteToFile(std::string strFilename) {
   return false;
@@ -441,3 +498,20 @@ bool CPPMPYLanguageModel::WriteToFile(std::string strFilename) {
 bool CPPMPYLanguageModel::ReadFromFile(std::string strFilename) {
   return false;
 }
+
+void CPPMPYLanguageModel::TriePruned(const std::vector<NodeIdx> &vMap, bool bAged) {
+  RenumberNodeData(m_vPYChildren, vMap);
+  //Then copy the tables of the nodes kept into a new arena, discarding any free tables
+  std::vector<SPYEntry> vSlots;
+  for (std::vector<SPYTable>::iterator it = m_vPYChildren.begin(); it != m_vPYChildren.end(); it++) {
+    if (!it->iUsed) continue;
+    const unsigned int iOffset = vSlots.size();
+    vSlots.insert(vSlots.end(), m_vPYSlots.begin() + it->iOffset, m_vPYSlots.begin() + it->iOffset + (1 << it->iLogSlots));
+    it->iOffset = iOffset;
+  }
+  m_vPYSlots.swap(vSlots);
+  m_vFreePYTables.clear();
+  if (!bAged) return;
+  for (std::vector<SPYEntry>::iterator it = m_vPYSlots.begin(); it != m_vPYSlots.end(); it++)
+    it->count = (it->count + 1) / 2;
+}
@@ -50,7 +50,7 @@ namespace Dasher {
     void LearnPYSymbol(Context context, int Symbol);
 
     ///Predicts probabilities for the next Pinyin symbol (blending as per PPM,
-    /// but using the pychild map rather than child CPPMPYnodes).
+    /// but using the per-node pinyin counts rather than child nodes).
     /// \param Probs vector to fill with predictions for pinyin symbols: will be filled
     ///  with m_iNumPYsyms numbers plus an initial 0. 
     virtual void GetProbs(Context context, std::vector < unsigned int >&Probs, int norm, int iUniform) const;
@@ -67,18 +67,47 @@ namespace Dasher {
     virtual bool ReadFromFile(std::string strFilename);
 
   protected:
-    class CPPMPYnode : public CPPMnode {
-    public:
-      /// map from pinyin-symbol to count: the number of times each pinyin symbol has been seen in this context
-      std::map<symbol,unsigned short int> pychild;
-      inline CPPMPYnode(int sym) : CPPMnode(sym) {}
-      inline CPPMPYnode() : CPPMnode() {}
-    };
-    CPPMPYnode *makeNode(int sym);
-    
+    ///Moves (and ages) the per-node counts along with the trie's nodes
+    virtual void TriePruned(const std::vector<NodeIdx> &vMap, bool bAged);
+
   private:
-    int NodesAllocated;
-    mutable CSimplePooledAlloc < CPPMPYnode > m_NodeAlloc;
+    ///Pinyin counts for one node: a table of entries in m_vPYSlots, of 2^iLogSlots
+    /// entries. Tables of up to MAX_SORTED entries are kept sorted by symbol, any
+    /// unused entries at the end; larger ones are open hash tables (linear probing),
+    /// kept at most 3/4 full. Either way, unused entries have symbol 0.
+    struct SPYTable {
+      ///Offset into m_vPYSlots of the first entry
+      unsigned int iOffset;
+      ///Number of entries in use (0 = no table)
+      unsigned short int iUsed;
+      unsigned char iLogSlots;
+    };
+    struct SPYEntry {
+      unsigned short int sym;
+      ///Saturates at 0xFFFF rather than wrapping
+      unsigned short int count;
+    };
+
+    ///Increments the count for a pinyin symbol at a node, adding it if necessary.
+    /// \return true if the symbol was already present
+    bool IncrementPY(NodeIdx iNode, symbol pysym);
+    ///Inserts an entry for a symbol not already present into a table with room for it
+    void InsertPY(SPYTable &table, const SPYEntry &entry);
+    ///Returns offset in m_vPYSlots of a zeroed table of 2^iLogSlots entries,
+    /// reusing a freed one if possible
+    unsigned int AllocPYTable(int iLogSlots);
+
+    ///For each node (indexed by NodeIdx), its table of pinyin counts: i.e. the number
+    /// of times each pinyin symbol has been seen in that context. May be shorter than
+    /// the node arena, in which case missing entries are empty.
+    std::vector<SPYTable> m_vPYChildren;
+    ///Entries of all the pinyin tables
+    std::vector<SPYEntry> m_vPYSlots;
+    ///Free lists of tables in m_vPYSlots, indexed by log2 of size
+    std::vector<std::vector<unsigned int> > m_vFreePYTables;
+
+    ///Scratch space for GetPartProbs: count of each candidate symbol at one level
+    std::vector<int> m_vPartCounts;
 
     const int m_iNumPYsyms;
   };
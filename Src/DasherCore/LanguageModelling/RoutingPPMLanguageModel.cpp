@@ -24,12 +24,44 @@ static char THIS_FILE[] = __FILE__;
 /////////////////////////////////////////////////////////////////////
 
 CRoutingPPMLanguageModel::CRoutingPPMLanguageModel(CSettingsUser *pCreator, const vector<symbol> *pBaseSyms, const vector<set<symbol> > *pRoutes, bool bRoutesContextSensitive)
-:CAbstractPPM(pCreator, pRoutes->size()-1, new CRoutingPPMnode(-1), GetLongParameter(LP_LM_MAX_ORDER)), NodesAllocated(0), m_NodeAlloc(8192), m_pBaseSyms(pBaseSyms), m_pRoutes(pRoutes), m_bRoutesContextSensitive(bRoutesContextSensitive) {
+:CAbstractPPM(pCreator, pRoutes->size()-1, GetLongParameter(LP_LM_MAX_ORDER)), m_pBaseSyms(pBaseSyms), m_pRoutes(pRoutes), m_bRoutesContextSensitive(bRoutesContextSensitive) {
   DASHER_ASSERT(pBaseSyms->size() >= pRoutes->size());
+  m_viRouteIndex.resize(pBaseSyms->size());
+  for (vector<set<symbol> >::const_iterator it = pRoutes->begin(); it != pRoutes->end(); it++) {
+    m_viRoutesStart.push_back(m_vRoutesByBase.size());
+    for (set<symbol>::const_iterator it2 = it->begin(); it2 != it->end(); it2++) {
+      m_viRouteIndex[*it2] = m_vRoutesByBase.size() - m_viRoutesStart.back();
+      m_vRoutesByBase.push_back(*it2);
+    }
+  }
+  m_viRoutesStart.push_back(m_vRoutesByBase.size());
+  m_vRouteCounts.push_back(0); //so offset 0 can mean "none"
+}
+
+const unsigned short int *CRoutingPPMLanguageModel::RouteCounts(NodeIdx iNode) const {
+  if (iNode >= m_vNodeRoutes.size()) return NULL; //no routes learnt
+  const SNodeRoutes &routes(m_vNodeRoutes[iNode]);
+  if (NumRoutes(node(iNode).sym) <= INLINE_ROUTES) return routes.aCounts;
+  return routes.iOffset ? &m_vRouteCounts[routes.iOffset] : NULL;
+}
+
+unsigned short int *CRoutingPPMLanguageModel::RouteCounts(NodeIdx iNode) {
+  if (m_vNodeRoutes.size() <= static_cast<size_t>(NumNodes())) {
+    const SNodeRoutes empty = {{0}};
+    m_vNodeRoutes.resize(NumNodes()+1, empty);
+  }
+  SNodeRoutes &routes(m_vNodeRoutes[iNode]);
+  const int iNumRoutes = NumRoutes(node(iNode).sym);
+  if (iNumRoutes <= INLINE_ROUTES) return routes.aCounts;
+  if (!routes.iOffset) {
+    routes.iOffset = m_vRouteCounts.size();
+    m_vRouteCounts.resize(m_vRouteCounts.size() + iNumRoutes, 0);
+  }
+  return &m_vRouteCounts[routes.iOffset];
 }
 
 void CRoutingPPMLanguageModel::GetProbs(Context context, std::vector<unsigned int> &probs, int norm, int iUniform) const {
-  const CPPMContext *ppmcontext = (const CPPMContext *)(context);
+  const CPPMContext *ppmcontext = &ppmContext(context);
 
   const int iNumSymbols(m_pBaseSyms->size()); //i.e., the #routes - so loop from i=1 to <iNumSymbols
   probs.resize(iNumSymbols);
@@ -54,19 +86,20 @@ void CRoutingPPMLanguageModel::GetProbs(Context context, std::vector<unsigned in
   //first, fill out the probabilities of the base symbols, as per ordinary PPM
   // (TODO, could move CPPMLanguageModel::GetProbs into CAbstractPPM, would do
   // this for us?)
-  vector<unsigned int> baseProbs(GetSize()); //i.e. # base symbols
-  for (CPPMnode *pTemp = ppmcontext->head; pTemp; pTemp = pTemp->vine) {
+  vector<unsigned int> &baseProbs(m_vBaseProbs); //i.e. # base symbols
+  baseProbs.assign(GetSize(), 0);
+  for (NodeIdx iTemp = ppmcontext->head; iTemp; iTemp = node(iTemp).vine) {
     int iTotal = 0;
-    for (ChildIterator it=pTemp->children(); it!=pTemp->end(); it++)
-      iTotal += (*it)->count;
+    for (ChildIterator it=children(iTemp); it!=childrenEnd(iTemp); it++)
+      iTotal += node(*it).count;
     
     if(iTotal) {
       unsigned int size_of_slice = iToSpend;
       
-      for (ChildIterator it=pTemp->children(); it!=pTemp->end(); it++) {
-        unsigned int p = static_cast < myint > (size_of_slice) * (100 * (*it)->count - beta) / (100 * iTotal + alpha);
+      for (ChildIterator it=children(iTemp); it!=childrenEnd(iTemp); it++) {
+        unsigned int p = static_cast < myint > (size_of_slice) * (100 * node(*it).count - beta) / (100 * iTotal + alpha);
           
-        baseProbs[(*it)->sym] += p;
+        baseProbs[node(*it).sym] += p;
         iToSpend -= p;
       
         //                              Usprintf(debug,TEXT("sym %u counts %d p %u tospend %u \n"),sym,s->count,p,tospend);      
@@ -85,22 +118,27 @@ void CRoutingPPMLanguageModel::GetProbs(Context context, std::vector<unsigned in
   
   //second, use those figures as the _total_ to divide up between the routes
   // _for_each_base_symbol_.
-  for (CPPMnode *pTemp = ppmcontext->head; pTemp; pTemp=pTemp->vine) {
-    if (pTemp!=m_pRoot && !m_bRoutesContextSensitive) continue;
+  for (NodeIdx iTemp = ppmcontext->head; iTemp; iTemp=node(iTemp).vine) {
+    if (iTemp!=m_iRoot && !m_bRoutesContextSensitive) continue;
 
-    for (ChildIterator it = pTemp->children(); it!=pTemp->end(); it++) {
-      const CRoutingPPMnode *pNode(static_cast<CRoutingPPMnode*>(*it));
+    for (ChildIterator it = children(iTemp); it!=childrenEnd(iTemp); it++) {
+      const unsigned short int *pCounts = RouteCounts(*it);
+      if (!pCounts) continue; //no routes learnt
+      const symbol sym(node(*it).sym);
+      const symbol *pRoutes = &m_vRoutesByBase[m_viRoutesStart[sym]];
+      const int iNumRoutes = NumRoutes(sym);
       int iTotal=0; //total for base symbol corresponding to child (at this level of PPM tree)
-      for (map<symbol,unsigned short int>::const_iterator it2=pNode->m_routes.begin(); it2!=pNode->m_routes.end(); it2++)
-        iTotal += it2->second;
+      for (int i=0; i<iNumRoutes; i++)
+        iTotal += pCounts[i];
       if (iTotal) {
         //divvy up some of baseProbs according to the distribution
-        // of pNode->m_routes
-        unsigned int size_of_slice = baseProbs[pNode->sym];
-        for (map<symbol,unsigned short int>::const_iterator it2=pNode->m_routes.begin(); it2!=pNode->m_routes.end(); it2++) {
-          unsigned int p = size_of_slice * (100 * it2->second - beta) / (100*iTotal + alpha);
-          probs[it2->first] += p;
-          baseProbs[pNode->sym] -= p;
+        // of routes for the child
+        unsigned int size_of_slice = baseProbs[sym];
+        for (int i=0; i<iNumRoutes; i++) {
+          if (!pCounts[i]) continue; //route not seen
+          unsigned int p = size_of_slice * (100 * pCounts[i] - beta) / (100*iTotal + alpha);
+          probs[pRoutes[i]] += p;
+          baseProbs[sym] -= p;
         }
       }
     }
@@ -113,12 +151,11 @@ void CRoutingPPMLanguageModel::GetProbs(Context context, std::vector<unsigned in
     
     //ok, so there's some probability mass assigned to the base symbol,
     // which we haven't assigned to any route
-    const set<symbol> &routes((*m_pRoutes)[i]);
     //divide it up evenly
-    int iLeft = routes.size();
-    for (set<symbol>::iterator it = routes.begin(); it!=routes.end(); it++) {
+    int iLeft = NumRoutes(i);
+    for (int j = m_viRoutesStart[i]; j < m_viRoutesStart[i+1]; j++) {
       unsigned int p = baseProbs[i] / iLeft;
-      probs[*it] += p;
+      probs[m_vRoutesByBase[j]] += p;
       baseProbs[i] -= p;
       --iLeft;
     }
@@ -129,26 +166,32 @@ void CRoutingPPMLanguageModel::GetProbs(Context context, std::vector<unsigned in
 /////////////////////////////////////////////////////////////////////
 
 symbol CRoutingPPMLanguageModel::GetBestRoute(Context ctx) {
-  const CPPMContext *context = (const CPPMContext *)ctx;
-  DASHER_ASSERT(context->head && context->head != m_pRoot);
+  const CPPMContext *context = &ppmContext(ctx);
+  DASHER_ASSERT(context->head && context->head != m_iRoot);
   
-  map<symbol,unsigned int> probs; //of the routes leading to this base sym
+  //every node on the vine chain is for the same base sym, with the same routes
+  const symbol base(node(context->head).sym);
+  const int iNumRoutes = NumRoutes(base);
+  vector<unsigned int> &probs(m_vRouteProbs); //of the routes leading to this base sym
+  probs.assign(iNumRoutes, 0);
   int iToSpend = 1<<16; //arbitrary, could be anything
   int alpha = GetLongParameter(LP_LM_ALPHA), beta=GetLongParameter(LP_LM_BETA);
   
-  for (CPPMnode *pTemp = context->head; pTemp!=m_pRoot; pTemp=pTemp->vine) {
-    if (pTemp->vine!=m_pRoot && !m_bRoutesContextSensitive) continue;
+  for (NodeIdx iTemp = context->head; iTemp!=m_iRoot; iTemp=node(iTemp).vine) {
+    if (node(iTemp).vine!=m_iRoot && !m_bRoutesContextSensitive) continue;
+    const unsigned short int *pCounts = RouteCounts(iTemp);
+    if (!pCounts) continue;
 
-    const CRoutingPPMnode *node(static_cast<CRoutingPPMnode*>(pTemp));
     unsigned long iTotal=0;
-    for (map<symbol,unsigned short int>::const_iterator it=node->m_routes.begin(); it!=node->m_routes.end(); it++)
-      iTotal += it->second;
+    for (int i=0; i<iNumRoutes; i++)
+      iTotal += pCounts[i];
     if (!iTotal) continue;
     const int size_of_slice(iToSpend);
-    for (map<symbol,unsigned short int>::const_iterator it=node->m_routes.begin(); it!=node->m_routes.end(); it++) {
-      unsigned int p = size_of_slice * (100*it->second - beta) / (100*iTotal+ alpha);
+    for (int i=0; i<iNumRoutes; i++) {
+      if (!pCounts[i]) continue; //route not seen
+      unsigned int p = size_of_slice * (100*pCounts[i] - beta) / (100*iTotal+ alpha);
       iToSpend-=p;
-      probs[it->first]+=p;
+      probs[i]+=p;
     }
   }
   //Could divvy up rest uniformly...but there's no point, this won't affect
@@ -158,16 +201,12 @@ symbol CRoutingPPMLanguageModel::GetBestRoute(Context ctx) {
   // box)
   
   pair<symbol,unsigned int> best;//initially (0,0)
-  for (map<symbol, unsigned int>::iterator it=probs.begin(); it!=probs.end(); it++) {
-    DASHER_ASSERT((*m_pRoutes)[context->head->sym].count(it->first));
-    if (it->second>best.second) best=*it;
-  }
+  for (int i=0; i<iNumRoutes; i++)
+    if (probs[i]>best.second) best=make_pair(m_vRoutesByBase[m_viRoutesStart[base]+i], probs[i]);
   
   if (best.second) return best.first;
-  //no data. pick one at random
-  const set<symbol> &options((*m_pRoutes)[context->head->sym]);
-  //in fact, (very pseudo)-random:
-  return *(options.begin());
+  //no data. pick one at random - in fact, (very pseudo)-random:
+  return m_vRoutesByBase[m_viRoutesStart[base]];
 }
 
 void CRoutingPPMLanguageModel::LearnBaseSymbol(Context c, int baseSym) {
@@ -179,21 +218,15 @@ void CRoutingPPMLanguageModel::LearnSymbol(Context ctx, int sym) {
   LearnBaseSymbol(ctx, base);
   //ctx now updated, points to node for learnt base sym
   DASHER_ASSERT((*m_pRoutes)[base].size());
-  if ((*m_pRoutes)[base].size()==1) return; //no need to store, saves computation if we don't
-  for (CPPMnode *node=((CPPMContext*)ctx)->head; node!=m_pRoot; node=node->vine) {
-    if (node->vine!=m_pRoot && !m_bRoutesContextSensitive) continue;
-    else if (static_cast<CRoutingPPMnode*>(node)->m_routes[sym]++) //returns old value, i.e. 0 if not present
+  if (NumRoutes(base)==1) return; //no need to store, saves computation if we don't
+  for (NodeIdx iNode=ppmContext(ctx).head; iNode!=m_iRoot; iNode=node(iNode).vine) {
+    if (node(iNode).vine!=m_iRoot && !m_bRoutesContextSensitive) continue;
+    unsigned short int &count(RouteCounts(iNode)[m_viRouteIndex[sym]]);
+    if (count++) //i.e. was present already
       if (bUpdateExclusion) break;
   }
 }
 
-CRoutingPPMLanguageModel::CRoutingPPMnode *CRoutingPPMLanguageModel::makeNode(int sym) {
-  CRoutingPPMnode *res = m_NodeAlloc.Alloc();
-  res->sym=sym;
-  ++NodesAllocated;
-  return res;
-}
-
 //Mandarin - PY not enabled for these read-write functions
 bool CRoutingPPMLanguageModel::WriteToFile(std::string strFilename) {
   return false;
@@ -203,3 +236,25 @@ bool CRoutingPPMLanguageModel::WriteToFile(std::string strFilename) {
 bool CRoutingPPMLanguageModel::ReadFromFile(std::string strFilename) {
   return false;
 }
+
+void CRoutingPPMLanguageModel::TriePruned(const std::vector<NodeIdx> &vMap, bool bAged) {
+  RenumberNodeData(m_vNodeRoutes, vMap);
+  //Then copy the pooled counts of the nodes kept, discarding those of the nodes removed
+  std::vector<unsigned short int> vCounts(1, 0);
+  for (NodeIdx i = 0; i < m_vNodeRoutes.size(); i++) {
+    SNodeRoutes &routes(m_vNodeRoutes[i]);
+    const int iNumRoutes = NumRoutes(node(i).sym);
+    if (iNumRoutes <= INLINE_ROUTES) {
+      if (bAged)
+        for (int j = 0; j < iNumRoutes; j++) routes.aCounts[j] = (routes.aCounts[j] + 1) / 2;
+    } else if (routes.iOffset) {
+      const unsigned int iOffset = vCounts.size();
+      for (int j = 0; j < iNumRoutes; j++) {
+        const unsigned short int count = m_vRouteCounts[routes.iOffset + j];
+        vCounts.push_back(bAged ? (count + 1) / 2 : count);
+      }
+      routes.iOffset = iOffset;
+    }
+  }
+  m_vRouteCounts.swap(vCounts);
+}
@@ -65,23 +65,42 @@ namespace Dasher {
     virtual bool ReadFromFile(std::string strFilename);
     
   protected:
-    ///Subclass to additionally store counts of route by which this context (i.e.
-    /// the last base symbol within) was entered, when we know that.
-    class CRoutingPPMnode : public CPPMnode {
-    public:
-      ///map from route (to the last base sym only) to count by which that route
-      /// was definitely used.
-      std::map<symbol,unsigned short int> m_routes;
-      inline CRoutingPPMnode(int sym) : CPPMnode(sym) {}
-      inline CRoutingPPMnode() : CPPMnode() {}
-    };
-    ///Always returns a CRoutingPPMnode. TODO, work through class and use standard
-    /// map-less PPMnodes for unambiguous base syms (which have only one route) ?
-    CRoutingPPMnode *makeNode(int sym);
-    
+    ///Moves (and ages) the per-node counts along with the trie's nodes
+    virtual void TriePruned(const std::vector<NodeIdx> &vMap, bool bAged);
+
   private:
-    int NodesAllocated;
-    CSimplePooledAlloc < CRoutingPPMnode > m_NodeAlloc;
+    ///Route counts for bases with at most this many routes are stored in the node's
+    /// entry in m_vNodeRoutes; for any others, in m_vRouteCounts
+    static const int INLINE_ROUTES = 4;
+    ///Counts, by which each route to a node's (last) base sym was definitely used,
+    /// when we know that; in the order of m_vRoutesByBase (0 = not seen).
+    union SNodeRoutes {
+      unsigned short int aCounts[INLINE_ROUTES];
+      ///For bases with more than INLINE_ROUTES routes: offset into m_vRouteCounts,
+      /// or 0 if none stored yet
+      unsigned int iOffset;
+    };
+    ///Number of routes to a base sym
+    int NumRoutes(symbol base) const {return m_viRoutesStart[base+1] - m_viRoutesStart[base];}
+    ///Counts stored for the routes to the base sym of a node, or NULL if none
+    const unsigned short int *RouteCounts(NodeIdx iNode) const;
+    ///Counts for the routes to the base sym of a node, allocating them if necessary
+    unsigned short int *RouteCounts(NodeIdx iNode);
+
+    ///For each node (indexed by NodeIdx), counts for the routes to its base sym,
+    /// where that has more than one route. May be shorter than the node arena, in
+    /// which case missing entries are empty.
+    std::vector<SNodeRoutes> m_vNodeRoutes;
+    ///Pool of counts for bases with more than INLINE_ROUTES routes (element 0 unused)
+    std::vector<unsigned short int> m_vRouteCounts;
+    ///Routes to each base sym (a flattened copy of *m_pRoutes, each in ascending
+    /// order): those to base b are elements m_viRoutesStart[b] to m_viRoutesStart[b+1]-1
+    std::vector<symbol> m_vRoutesByBase;
+    std::vector<int> m_viRoutesStart;
+    ///Index of each route among those to its base (indexed by route)
+    std::vector<int> m_viRouteIndex;
+    ///Scratch space for GetProbs and GetBestRoute
+    mutable std::vector<unsigned int> m_vBaseProbs, m_vRouteProbs;
     const std::vector<symbol> *m_pBaseSyms;
     const std::vector<std::set<symbol> > *m_pRoutes;
     const bool m_bRoutesContextSensitive;
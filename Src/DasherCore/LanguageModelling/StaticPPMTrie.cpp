@@ -0,0 +1,339 @@
+// StaticPPMTrie.cpp
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#include "../../Common/Common.h"
+#include "StaticPPMTrie.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace Dasher;
+using namespace std;
+
+// Track memory leaks on Windows to the line that new'd the memory
+#ifdef _WIN32
+#ifdef _DEBUG_MEMLEAKS
+#define DEBUG_NEW new( _NORMAL_BLOCK, THIS_FILE, __LINE__ )
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+#endif
+
+const CStaticPPMTrie::Idx CStaticPPMTrie::ROOT;
+const CStaticPPMTrie::Idx CStaticPPMTrie::NONE;
+const size_t CStaticPPMTrie::SELECT_SAMPLE;
+
+static inline int PopCount(unsigned long long w) {
+#ifdef __GNUC__
+  return __builtin_popcountll(w);
+#else
+  int n = 0;
+  for (; w; w &= w - 1) n++;
+  return n;
+#endif
+}
+
+///Position of the r'th (from 0) set bit of w, which must have more than r
+static inline int SelectInWord(unsigned long long w, int r) {
+  while (r--) w &= w - 1;
+#ifdef __GNUC__
+  return __builtin_ctzll(w);
+#else
+  int i = 0;
+  while (!(w & 1)) {w >>= 1; i++;}
+  return i;
+#endif
+}
+
+///Number of bits needed to store v (at least 1)
+static int BitsFor(unsigned long long v) {
+  int iBits = 1;
+  while (iBits < 64 && (v >> iBits)) iBits++;
+  return iBits;
+}
+
+void CStaticPPMTrie::CPackedArray::init(size_t iSize, int iBits) {
+  DASHER_ASSERT(iBits > 0 && iBits <= 64);
+  m_iBits = iBits;
+  m_iMask = (iBits == 64) ? ~Word(0) : (Word(1) << iBits) - 1;
+  m_vWords.assign((iSize * iBits + 63) / 64 + 1, 0);
+}
+
+void CStaticPPMTrie::CPackedArray::set(size_t i, Word v) {
+  DASHER_ASSERT((v & m_iMask) == v);
+  const size_t iBit = i * m_iBits, iWord = iBit >> 6;
+  const int iShift = static_cast<int>(iBit & 63);
+  m_vWords[iWord] |= v << iShift;
+  if (iShift + m_iBits > 64) m_vWords[iWord + 1] |= v >> (64 - iShift);
+}
+
+CStaticPPMTrie::CStaticPPMTrie() : m_iNumNodes(0) {
+}
+
+CStaticPPMTrie::CStaticPPMTrie(const vector<int> &vNumChildren, const vector<symbol> &vSyms,
+                               const vector<unsigned short> &vCounts, const vector<Idx> &vVines,
+                               int iQuantisedBits)
+: m_iNumNodes(static_cast<Idx>(vNumChildren.size())) {
+  DASHER_ASSERT(m_iNumNodes > 0 && vSyms.size() == m_iNumNodes && vCounts.size() == m_iNumNodes && vVines.size() == m_iNumNodes);
+
+  //Shape
+  const size_t iLoudsBits = 2 * static_cast<size_t>(m_iNumNodes) - 1;
+  m_vLouds.assign(iLoudsBits / 64 + 2, 0);
+  size_t iPos = 0;
+  for (Idx i = 0; i < m_iNumNodes; i++) {
+    for (int c = 0; c < vNumChildren[i]; c++, iPos++) m_vLouds[iPos >> 6] |= Word(1) << (iPos & 63);
+    iPos++; //0
+  }
+  DASHER_ASSERT(iPos == iLoudsBits);
+  IndexLouds();
+
+  //Symbols and vines, each in as many bits as the largest needs
+  symbol iMaxSym = 0;
+  for (Idx i = 1; i < m_iNumNodes; i++) iMaxSym = max(iMaxSym, vSyms[i]);
+  m_syms.init(m_iNumNodes, BitsFor(iMaxSym));
+  m_vines.init(m_iNumNodes, BitsFor(m_iNumNodes - 1));
+  for (Idx i = 1; i < m_iNumNodes; i++) {
+    m_syms.set(i, vSyms[i]);
+    DASHER_ASSERT(vVines[i] < m_iNumNodes);
+    m_vines.set(i, vVines[i]);
+  }
+
+  //Counts: most are small, so pick the width minimizing the total size, inc. that of
+  // storing separately those which don't fit (i.e. need all 1s, or more)
+  vector<size_t> vNeeding(18, 0); //number of counts needing exactly so many bits
+  for (Idx i = 0; i < m_iNumNodes; i++) vNeeding[BitsFor(vCounts[i] + 1u)]++;
+  const size_t iBigCost = 8 * (sizeof(Idx) + sizeof(unsigned short));
+  int iCountBits = 16;
+  size_t iBest = ~size_t(0);
+  for (int iBits = 1; iBits <= 16; iBits++) {
+    size_t iBig = 0;
+    for (int b = iBits + 1; b < 18; b++) iBig += vNeeding[b];
+    const size_t iCost = static_cast<size_t>(m_iNumNodes) * iBits + iBig * iBigCost;
+    if (iCost < iBest) {iBest = iCost; iCountBits = iBits;}
+  }
+
+  //Quantising into as many bits (or more) would save nothing, so then store exactly
+  if (iQuantisedBits && iQuantisedBits < iCountBits) {
+    DASHER_ASSERT(iQuantisedBits >= 2 && iQuantisedBits <= 15);
+    unsigned short iMaxCount = 0;
+    for (Idx i = 0; i < m_iNumNodes; i++) iMaxCount = max(iMaxCount, vCounts[i]);
+    MakeCountValues(iQuantisedBits, iMaxCount);
+    m_counts.init(m_iNumNodes, iQuantisedBits);
+    for (Idx i = 0; i < m_iNumNodes; i++) m_counts.set(i, QuantiseCount(vCounts[i]));
+  } else {
+    m_counts.init(m_iNumNodes, iCountBits);
+    const Word iEscape = (Word(1) << iCountBits) - 1;
+    for (Idx i = 0; i < m_iNumNodes; i++) {
+      if (vCounts[i] < iEscape) m_counts.set(i, vCounts[i]);
+      else {
+        m_counts.set(i, iEscape);
+        m_vBigCountNodes.push_back(i);
+        m_vBigCounts.push_back(vCounts[i]);
+      }
+    }
+  }
+}
+
+void CStaticPPMTrie::MakeCountValues(int iBits, unsigned short iMaxCount) {
+  const int iCodes = 1 << iBits, iExact = iCodes / 2;
+  //(as if the largest count were at least the last code, so each can differ)
+  if (iMaxCount < iCodes - 1) iMaxCount = static_cast<unsigned short>(iCodes - 1);
+  const double dRatio = pow(double(iMaxCount) / iExact, 1.0 / (iCodes - 1 - iExact));
+  m_vCountValues.resize(iCodes);
+  double dValue = iExact;
+  for (int i = 0; i < iCodes; i++) {
+    if (i < iExact) m_vCountValues[i] = static_cast<unsigned short>(i);
+    else {
+      //strictly increasing (so every code means something different), leaving room
+      // for the codes above
+      const int iValue = max(m_vCountValues[i - 1] + 1, static_cast<int>(dValue + 0.5));
+      m_vCountValues[i] = static_cast<unsigned short>(min(iValue, iMaxCount - (iCodes - 1 - i)));
+      dValue *= dRatio;
+    }
+  }
+  m_vCountValues.back() = iMaxCount;
+}
+
+CStaticPPMTrie::Word CStaticPPMTrie::QuantiseCount(unsigned short iCount) const {
+  if (iCount >= m_vCountValues.back()) return m_vCountValues.size() - 1;
+  const vector<unsigned short>::const_iterator it = lower_bound(m_vCountValues.begin(), m_vCountValues.end(), iCount);
+  Word iCode = it - m_vCountValues.begin();
+  //round down if below the geometric mean of the values either side
+  if (*it != iCount && static_cast<unsigned int>(iCount) * iCount < static_cast<unsigned int>(*(it - 1)) * *it)
+    iCode--;
+  return iCode;
+}
+
+void CStaticPPMTrie::IndexLouds() {
+  m_vSelect1.clear();
+  m_vSelect0.clear();
+  size_t aiSeen[2] = {0, 0};
+  const size_t iLoudsBits = 2 * static_cast<size_t>(m_iNumNodes) - 1;
+  for (size_t iPos = 0; iPos < iLoudsBits; iPos++) {
+    const int b = (m_vLouds[iPos >> 6] >> (iPos & 63)) & 1;
+    if (aiSeen[b]++ % SELECT_SAMPLE == 0) (b ? m_vSelect1 : m_vSelect0).push_back(iPos);
+  }
+}
+
+size_t CStaticPPMTrie::Select(bool bOne, size_t j) const {
+  //from the nearest sample at or before, count forwards a Word at a time
+  size_t iPos = (bOne ? m_vSelect1 : m_vSelect0)[j / SELECT_SAMPLE];
+  int k = static_cast<int>(j % SELECT_SAMPLE);
+  if (!k) return iPos;
+  size_t iWord = ++iPos >> 6;
+  Word w = (bOne ? m_vLouds[iWord] : ~m_vLouds[iWord]) & (~Word(0) << (iPos & 63));
+  for (;;) {
+    const int n = PopCount(w);
+    if (k <= n) return iWord * 64 + SelectInWord(w, k - 1);
+    k -= n;
+    iWord++;
+    w = bOne ? m_vLouds[iWord] : ~m_vLouds[iWord];
+  }
+}
+
+unsigned short CStaticPPMTrie::count(Idx i) const {
+  const Word v = m_counts.get(i);
+  if (!m_vCountValues.empty()) return m_vCountValues[v];
+  if (v != (Word(1) << m_counts.bits()) - 1) return static_cast<unsigned short>(v);
+  const vector<Idx>::const_iterator it = lower_bound(m_vBigCountNodes.begin(), m_vBigCountNodes.end(), i);
+  DASHER_ASSERT(it != m_vBigCountNodes.end() && *it == i);
+  return m_vBigCounts[it - m_vBigCountNodes.begin()];
+}
+
+void CStaticPPMTrie::children(Idx i, Idx &iFirst, Idx &iEnd) const {
+  //node i's 1s start just after the (i-1)'th 0; the 1s before them are those of
+  // the children of earlier nodes, i.e. every node after the root up to iFirst
+  const size_t iStart = (i == ROOT) ? 0 : Select(false, i - 1) + 1;
+  iFirst = static_cast<Idx>(iStart - i + 1);
+  //and they run up to the next 0
+  size_t iWord = iStart >> 6;
+  Word w = ~m_vLouds[iWord] & (~Word(0) << (iStart & 63));
+  while (!w) w = ~m_vLouds[++iWord];
+  iEnd = iFirst + static_cast<Idx>(iWord * 64 + SelectInWord(w, 0) - iStart);
+}
+
+CStaticPPMTrie::Idx CStaticPPMTrie::findChild(Idx i, symbol s) const {
+  Idx iLo, iHi;
+  children(i, iLo, iHi);
+  while (iLo < iHi) {
+    const Idx iMid = iLo + (iHi - iLo) / 2;
+    const symbol m = sym(iMid);
+    if (m == s) return iMid;
+    if (m < s) iLo = iMid + 1; else iHi = iMid;
+  }
+  return NONE;
+}
+
+size_t CStaticPPMTrie::BytesUsed() const {
+  return (m_vLouds.size() + m_syms.m_vWords.size() + m_counts.m_vWords.size() + m_vines.m_vWords.size()) * sizeof(Word)
+    + (m_vSelect0.size() + m_vSelect1.size()) * sizeof(size_t)
+    + m_vBigCountNodes.size() * sizeof(Idx) + (m_vBigCounts.size() + m_vCountValues.size()) * sizeof(unsigned short);
+}
+
+/// Precedes the arrays written by Write, in native byte order (as SaveTrie)
+struct SStaticTrieHeader {
+  unsigned int iByteOrderMark;
+  unsigned int iNumNodes;
+  unsigned int iSymBits, iCountBits, iVineBits;
+  unsigned int iNumBigCounts;
+};
+
+static const unsigned int STATIC_BYTE_ORDER_MARK(0x01020304);
+
+template<typename T> static void WriteVector(ostream &out, const vector<T> &v) {
+  if (!v.empty()) out.write(reinterpret_cast<const char *>(&v[0]), v.size() * sizeof(T));
+}
+
+template<typename T> static bool ReadVector(istream &in, vector<T> &v, size_t iSize) {
+  v.resize(iSize);
+  if (iSize) in.read(reinterpret_cast<char *>(&v[0]), iSize * sizeof(T));
+  return in.good();
+}
+
+bool CStaticPPMTrie::Write(ostream &out) const {
+  SStaticTrieHeader sHeader;
+  sHeader.iByteOrderMark = STATIC_BYTE_ORDER_MARK;
+  sHeader.iNumNodes = m_iNumNodes;
+  sHeader.iSymBits = m_syms.bits();
+  sHeader.iCountBits = m_counts.bits();
+  sHeader.iVineBits = m_vines.bits();
+  sHeader.iNumBigCounts = static_cast<unsigned int>(m_vBigCounts.size());
+  out.write(reinterpret_cast<const char *>(&sHeader), sizeof(sHeader));
+  WriteVector(out, m_vLouds);
+  WriteVector(out, m_syms.m_vWords);
+  WriteVector(out, m_counts.m_vWords);
+  WriteVector(out, m_vines.m_vWords);
+  WriteVector(out, m_vBigCountNodes);
+  WriteVector(out, m_vBigCounts);
+  WriteVector(out, m_vCountValues);
+  return out.good();
+}
+
+bool CStaticPPMTrie::Read(istream &in, bool bQuantised) {
+  SStaticTrieHeader sHeader;
+  in.read(reinterpret_cast<char *>(&sHeader), sizeof(sHeader));
+  if (!in.good() || sHeader.iByteOrderMark != STATIC_BYTE_ORDER_MARK
+      || sHeader.iNumNodes == 0 || sHeader.iNumNodes > 0x7FFFFFFFu
+      || sHeader.iSymBits < 1 || sHeader.iSymBits > 16
+      || sHeader.iCountBits < 1 || sHeader.iCountBits > 16
+      || sHeader.iVineBits < 1 || sHeader.iVineBits > 32
+      || sHeader.iNumBigCounts > sHeader.iNumNodes
+      || (bQuantised && (sHeader.iCountBits < 2 || sHeader.iCountBits > 15 || sHeader.iNumBigCounts)))
+    return false;
+  CStaticPPMTrie trie;
+  trie.m_iNumNodes = sHeader.iNumNodes;
+  const size_t iLoudsBits = 2 * static_cast<size_t>(trie.m_iNumNodes) - 1;
+  trie.m_syms.init(trie.m_iNumNodes, sHeader.iSymBits);
+  trie.m_counts.init(trie.m_iNumNodes, sHeader.iCountBits);
+  trie.m_vines.init(trie.m_iNumNodes, sHeader.iVineBits);
+  if (!ReadVector(in, trie.m_vLouds, iLoudsBits / 64 + 2)
+      || !ReadVector(in, trie.m_syms.m_vWords, trie.m_syms.m_vWords.size())
+      || !ReadVector(in, trie.m_counts.m_vWords, trie.m_counts.m_vWords.size())
+      || !ReadVector(in, trie.m_vines.m_vWords, trie.m_vines.m_vWords.size())
+      || !ReadVector(in, trie.m_vBigCountNodes, sHeader.iNumBigCounts)
+      || !ReadVector(in, trie.m_vBigCounts, sHeader.iNumBigCounts)
+      || !ReadVector(in, trie.m_vCountValues, bQuantised ? size_t(1) << sHeader.iCountBits : 0))
+    return false;
+
+  //Check the shape: one 1 for every node but the root, one 0 for every node
+  // (the last bit), and nothing after
+  size_t iOnes = 0;
+  for (size_t i = 0; i < trie.m_vLouds.size(); i++) iOnes += PopCount(trie.m_vLouds[i]);
+  if (iOnes != trie.m_iNumNodes - 1u || (trie.m_vLouds[iLoudsBits >> 6] >> (iLoudsBits & 63)) != 0
+      || trie.m_vLouds.back() != 0 || ((trie.m_vLouds[(iLoudsBits - 1) >> 6] >> ((iLoudsBits - 1) & 63)) & 1))
+    return false;
+  for (Idx i = 1; i < trie.m_iNumNodes; i++)
+    if (trie.m_vines.get(i) >= trie.m_iNumNodes) return false;
+  if (bQuantised) {
+    //any code is valid, but the values must increase (from 0), as MakeCountValues
+    if (trie.m_vCountValues[0] != 0) return false;
+    for (size_t i = 1; i < trie.m_vCountValues.size(); i++)
+      if (trie.m_vCountValues[i] <= trie.m_vCountValues[i - 1]) return false;
+  } else {
+    //every count of all 1s, and only those, must be held separately
+    const Word iEscape = (Word(1) << sHeader.iCountBits) - 1;
+    size_t iBig = 0;
+    for (Idx i = 0; i < trie.m_iNumNodes; i++)
+      if (trie.m_counts.get(i) == iEscape && (iBig == trie.m_vBigCountNodes.size() || trie.m_vBigCountNodes[iBig++] != i))
+        return false;
+    if (iBig != trie.m_vBigCountNodes.size()) return false;
+  }
+  trie.IndexLouds();
+  swap(m_iNumNodes, trie.m_iNumNodes);
+  m_vLouds.swap(trie.m_vLouds);
+  m_vSelect1.swap(trie.m_vSelect1);
+  m_vSelect0.swap(trie.m_vSelect0);
+  swap(m_syms, trie.m_syms);
+  swap(m_counts, trie.m_counts);
+  swap(m_vines, trie.m_vines);
+  m_vBigCountNodes.swap(trie.m_vBigCountNodes);
+  m_vBigCounts.swap(trie.m_vBigCounts);
+  m_vCountValues.swap(trie.m_vCountValues);
+  return true;
+}
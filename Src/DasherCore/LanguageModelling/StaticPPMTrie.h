@@ -0,0 +1,138 @@
+// StaticPPMTrie.h
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef __LanguageModelling_StaticPPMTrie_h__
+#define __LanguageModelling_StaticPPMTrie_h__
+
+#include "../DasherTypes.h"
+
+#include <vector>
+#include <iostream>
+
+/////////////////////////////////////////////////////////////////////////////
+
+namespace Dasher {
+
+  /// \ingroup LM
+  /// \{
+
+  /// A PPM trie which can no longer change (e.g. that learnt from the system training
+  /// text), stored succinctly: a few bytes per node, rather than a CPPMnode (and child
+  /// table slot) each. Nodes are numbered in level order (breadth-first, root 0, the
+  /// children of each node consecutive and in increasing order of symbol), so the
+  /// shape of the trie is just a LOUDS bit-string: for each node in turn, a 1 for each
+  /// child then a 0. The children of node i are then found by selecting the i'th 0;
+  /// the parent of a node by selecting its 1. The symbol, count and vine pointer of
+  /// each node are each packed into as few bits as the largest needs, except that
+  /// counts take only as many bits as most need, with any too big for that held
+  /// separately. Alternatively, counts may be quantised: each stored as a code of a
+  /// fixed number of bits, standing for a value (small counts exactly, larger ones
+  /// on a logarithmic scale) looked up in a table; this loses a little accuracy.
+  /// May be read from any number of threads at once.
+  class CStaticPPMTrie {
+  public:
+    typedef unsigned int Idx;
+    static const Idx ROOT = 0;
+    ///No node (e.g. the vine of the root, or findChild finding nothing)
+    static const Idx NONE = 0xFFFFFFFFu;
+
+    ///Empty (no nodes at all); for Read
+    CStaticPPMTrie();
+
+    ///Encodes a trie given as arrays with an entry for each node, in level order
+    /// (as above). The symbol and vine of the root are ignored.
+    /// \param iQuantisedBits 0 to store counts exactly; else, the number of bits
+    /// (2 to 15) in which to store each count quantised. Counts are still stored
+    /// exactly if that takes no more bits per count.
+    CStaticPPMTrie(const std::vector<int> &vNumChildren, const std::vector<symbol> &vSyms,
+                   const std::vector<unsigned short> &vCounts, const std::vector<Idx> &vVines,
+                   int iQuantisedBits);
+
+    ///Number of nodes, inc. the root
+    Idx NumNodes() const {return m_iNumNodes;}
+
+    symbol sym(Idx i) const {return static_cast<symbol>(m_syms.get(i));}
+    unsigned short count(Idx i) const;
+    Idx vine(Idx i) const {return i == ROOT ? NONE : static_cast<Idx>(m_vines.get(i));}
+    Idx parent(Idx i) const {return i == ROOT ? NONE : static_cast<Idx>(Select(true, i - 1) - (i - 1));}
+
+    ///The children of node i are those numbered from iFirst up to (not inc.) iEnd
+    void children(Idx i, Idx &iFirst, Idx &iEnd) const;
+    ///Child of node i with the specified symbol, or NONE
+    Idx findChild(Idx i, symbol sym) const;
+
+    ///Whether counts are quantised (so, only approximate)
+    bool Quantised() const {return !m_vCountValues.empty();}
+
+    ///Bytes taken by all the arrays
+    size_t BytesUsed() const;
+
+    ///Writes the trie in a form Read can load back
+    bool Write(std::ostream &out) const;
+    ///Replaces this trie with one written by Write
+    /// \param bQuantised whether the data is that of a Quantised() trie (which Write
+    /// follows with the table of values), as the reader must record separately.
+    /// \return false (leaving this trie unchanged) if the data could not be read or
+    /// was not a well-formed trie from a machine of the same byte order.
+    bool Read(std::istream &in, bool bQuantised);
+
+  private:
+    typedef unsigned long long Word;
+
+    ///Fixed-width unsigned integers packed into an array of Words (with a spare
+    /// Word at the end, so get never need check whether a value spans two)
+    class CPackedArray {
+    public:
+      CPackedArray() : m_iBits(0) {}
+      void init(size_t iSize, int iBits);
+      Word get(size_t i) const {
+        const size_t iBit = i * m_iBits, iWord = iBit >> 6;
+        const int iShift = static_cast<int>(iBit & 63);
+        Word w = m_vWords[iWord] >> iShift;
+        if (iShift + m_iBits > 64) w |= m_vWords[iWord + 1] << (64 - iShift);
+        return w & m_iMask;
+      }
+      void set(size_t i, Word v);
+      int bits() const {return m_iBits;}
+      std::vector<Word> m_vWords;
+    private:
+      int m_iBits;
+      Word m_iMask;
+    };
+
+    ///Position in m_vLouds of the j'th (from 0) 1 (if bOne) or 0 (if not)
+    size_t Select(bool bOne, size_t j) const;
+    ///Samples every SELECT_SAMPLE'th 1 and 0 in m_vLouds, for Select
+    void IndexLouds();
+    ///Fills m_vCountValues for codes of iBits bits: the lower half of the codes stand
+    /// for themselves, the upper half for values rising geometrically to iMaxCount
+    void MakeCountValues(int iBits, unsigned short iMaxCount);
+    ///Code whose value is nearest to (in ratio) iCount, or the last code if none is
+    /// as big
+    Word QuantiseCount(unsigned short iCount) const;
+    static const size_t SELECT_SAMPLE = 256;
+
+    Idx m_iNumNodes;
+    ///LOUDS bits (2*m_iNumNodes - 1 of them), 64 per Word, lowest bit first
+    std::vector<Word> m_vLouds;
+    ///Position of the (k*SELECT_SAMPLE)'th 1 / 0, for each k
+    std::vector<size_t> m_vSelect1, m_vSelect0;
+    CPackedArray m_syms, m_counts, m_vines;
+    ///Nodes whose counts are too big for m_counts (which then holds all 1s), in
+    /// increasing order, and their counts
+    std::vector<Idx> m_vBigCountNodes;
+    std::vector<unsigned short> m_vBigCounts;
+    ///If counts are quantised, the value of each code in m_counts (in increasing
+    /// order); else empty
+    std::vector<unsigned short> m_vCountValues;
+  };
+
+  /// \}
+}
+
+#endif // __LanguageModelling_StaticPPMTrie_h__
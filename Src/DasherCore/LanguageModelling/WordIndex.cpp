@@ -0,0 +1,82 @@
+// WordIndex.cpp
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#include "../../Common/Common.h"
+#include "WordIndex.h"
+
+using namespace Dasher;
+using namespace std;
+
+// Track memory leaks on Windows to the line that new'd the memory
+#ifdef _WIN32
+#ifdef _DEBUG_MEMLEAKS
+#define DEBUG_NEW new( _NORMAL_BLOCK, THIS_FILE, __LINE__ )
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+#endif
+
+const int CWordIndex::EMPTY;
+
+///Initial size of the hash table (a power of two)
+static const size_t INITIAL_TABLE_SIZE = 1024;
+
+CWordIndex::CWordIndex(int iFirstWordId) : m_vTable(INITIAL_TABLE_SIZE, EMPTY), m_iNextWordId(iFirstWordId) {
+  const SNode empty = {-1, -1, 0, -1};
+  m_vNodes.push_back(empty);
+}
+
+unsigned int CWordIndex::Slot(int iPrefix, symbol sym) const {
+  const unsigned int iMask = static_cast<unsigned int>(m_vTable.size() - 1);
+  for (unsigned int i = Hash(iPrefix, sym) & iMask; ; i = (i + 1) & iMask) {
+    const int iChild = m_vTable[i];
+    if (iChild == EMPTY) return i;
+    const SNode &node(m_vNodes[iChild]);
+    if (node.iParent == iPrefix && node.sym == sym) return i;
+  }
+}
+
+int CWordIndex::Find(int iPrefix, symbol sym) const {
+  const int iChild = m_vTable[Slot(iPrefix, sym)];
+  return iChild == EMPTY ? -1 : iChild;
+}
+
+int CWordIndex::Extend(int iPrefix, symbol sym) {
+  DASHER_ASSERT(iPrefix >= 0 && iPrefix < NumPrefixes());
+  unsigned int i = Slot(iPrefix, sym);
+  if (m_vTable[i] != EMPTY) return m_vTable[i];
+  //Keep the table at most half full
+  if (2 * (m_vNodes.size() + 1) > m_vTable.size()) {
+    Grow();
+    i = Slot(iPrefix, sym);
+  }
+  const SNode node = {iPrefix, sym, m_vNodes[iPrefix].iLength + 1, -1};
+  m_vTable[i] = static_cast<int>(m_vNodes.size());
+  m_vNodes.push_back(node);
+  return m_vTable[i];
+}
+
+void CWordIndex::Grow() {
+  m_vTable.assign(m_vTable.size() * 2, EMPTY);
+  for (int iChild = 1; iChild < NumPrefixes(); iChild++)
+    m_vTable[Slot(m_vNodes[iChild].iParent, m_vNodes[iChild].sym)] = iChild;
+}
+
+int CWordIndex::WordId(int iPrefix) {
+  DASHER_ASSERT(iPrefix >= 0 && iPrefix < NumPrefixes());
+  int &iWordId(m_vNodes[iPrefix].iWordId);
+  if (iWordId == -1) iWordId = m_iNextWordId++;
+  return iWordId;
+}
+
+void CWordIndex::GetSymbols(int iPrefix, vector<symbol> &vSymbols) const {
+  vSymbols.resize(Length(iPrefix));
+  for (int i = iPrefix; i != EMPTY; i = m_vNodes[i].iParent)
+    vSymbols[m_vNodes[i].iLength - 1] = m_vNodes[i].sym;
+}
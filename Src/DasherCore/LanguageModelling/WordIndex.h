@@ -0,0 +1,92 @@
+// WordIndex.h
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef __LanguageModelling_WordIndex_h__
+#define __LanguageModelling_WordIndex_h__
+
+#include "../DasherTypes.h"
+
+#include <vector>
+
+/////////////////////////////////////////////////////////////////////////////
+
+namespace Dasher {
+
+  /// \ingroup LM
+  /// \{
+
+  /// Dictionary of words (sequences of symbols) for the word-level language models.
+  /// Every prefix of every word seen is a node in a trie, numbered consecutively from
+  /// EMPTY; the edges (parent prefix, symbol) -> child prefix are kept in a single
+  /// open-addressed hash table, so a model can keep the current word in each context
+  /// as just a prefix number and extend it one symbol at a time as symbols are entered.
+  /// Words are given identifiers, from a first value set at construction, when first
+  /// looked up.
+  class CWordIndex {
+  public:
+    /// Prefix number of the empty word
+    static const int EMPTY = 0;
+
+    /// \param iFirstWordId identifier to give the first word looked up
+    CWordIndex(int iFirstWordId);
+
+    /// Prefix number for a prefix extended by a symbol, adding it if not already present
+    int Extend(int iPrefix, symbol sym);
+
+    /// Prefix number for a prefix extended by a symbol, or -1 if not present
+    int Find(int iPrefix, symbol sym) const;
+
+    /// Identifier of the word spelt by a prefix, allocating the next if it hasn't one yet
+    int WordId(int iPrefix);
+
+    /// Identifier of the word spelt by a prefix, or -1 if it hasn't one
+    int FindWordId(int iPrefix) const {return m_vNodes[iPrefix].iWordId;}
+
+    /// Number of symbols in a prefix
+    int Length(int iPrefix) const {return m_vNodes[iPrefix].iLength;}
+
+    /// Replaces the contents of vSymbols with the symbols spelling a prefix
+    void GetSymbols(int iPrefix, std::vector<symbol> &vSymbols) const;
+
+    /// Number of prefixes (including the empty one)
+    int NumPrefixes() const {return static_cast<int>(m_vNodes.size());}
+
+  private:
+    struct SNode {
+      int iParent;
+      symbol sym;
+      int iLength;
+      int iWordId;
+    };
+
+    static unsigned int Hash(int iPrefix, symbol sym) {
+      return (static_cast<unsigned int>(iPrefix) * 0x9E3779B1u) ^ (static_cast<unsigned int>(sym) * 0x85EBCA77u);
+    }
+
+    /// Slot of m_vTable holding the edge, or the empty slot where it would go
+    unsigned int Slot(int iPrefix, symbol sym) const;
+
+    /// Doubles the size of the hash table
+    void Grow();
+
+    /// Indexed by prefix number
+    std::vector<SNode> m_vNodes;
+
+    /// Open-addressed (linear probing) table of prefix numbers, indexed by hash of
+    /// (parent, symbol); size a power of two; EMPTY marks an unused slot, as the empty
+    /// prefix is never a child.
+    std::vector<int> m_vTable;
+
+    int m_iNextWordId;
+  };
+  /// \}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+#endif // ndef __LanguageModelling_WordIndex_h__
@@ -12,6 +12,7 @@
 #include "../Alphabet/AlphabetMap.h"
 
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <fstream>
@@ -24,10 +25,6 @@ using namespace std;
 // static TCHAR debug[256];
 typedef unsigned long ulong;
 
-#ifdef _WIN32
-#define snprintf _snprintf
-#endif
-
 // Track memory leaks on Windows to the line that new'd the memory
 #ifdef _WIN32
 #ifdef _DEBUG_MEMLEAKS
@@ -123,8 +120,9 @@ CWordLanguageModel::CWordnode * CWordLanguageModel::AddSymbolToNode(CWordnode *p
 
 CWordLanguageModel::CWordLanguageModel(CSettingsUser *pCreator, 
 				       const CAlphInfo *pAlph, const CAlphabetMap *pAlphMap)
-  :CLanguageModel(pAlph->iEnd-1), CSettingsUser(pCreator), m_iSpaceSymbol(pAlph->GetSpaceSymbol()), NodesAllocated(0),
-   max_order(2), m_NodeAlloc(8192), m_ContextAlloc(1024) {
+  :CLanguageModel(pAlph->iEnd-1), CSettingsUser(pCreator), m_iSpaceSymbol(pAlph->GetSpaceSymbol()),
+   iWordStart(8192),             // Start of indices for words - may need to increase this for *really* large alphabets
+   m_Words(iWordStart), NodesAllocated(0), max_order(2), m_NodeAlloc(8192), m_Contexts(1024) {
   
   // Construct a root node for the trie
 
@@ -138,14 +136,11 @@ CWordLanguageModel::CWordLanguageModel(CSettingsUser *pCreator,
 
   // Construct a root context
   
-  m_rootcontext = new CWordContext(m_pRoot, 0);
+  CWordContext root(m_pRoot, 0);
   
-  m_rootcontext->m_pSpellingModel = pSpellingModel;
-  m_rootcontext->oSpellingContext = pSpellingModel->CreateEmptyContext();
-
-  iWordStart = 8192;
-
-  nextid = iWordStart;          // Start of indices for words - may need to increase this for *really* large alphabets
+  root.m_pSpellingModel = pSpellingModel;
+  root.oSpellingContext = pSpellingModel->CreateEmptyContext();
+  m_rootcontext = m_Contexts.Alloc(root);
 
   wordidx = 0;
 
@@ -153,7 +148,7 @@ CWordLanguageModel::CWordLanguageModel(CSettingsUser *pCreator,
 
 CWordLanguageModel::~CWordLanguageModel() {
 
-  delete m_rootcontext;
+  ReleaseContext(m_rootcontext);
   delete pSpellingModel;
 
   // A non-recursive node deletion algorithm using a stack
@@ -182,127 +177,89 @@ CWordLanguageModel::~CWordLanguageModel() {
 
 }
 
-int CWordLanguageModel::lookup_word(const std::string &w) {
-  if(dict[w] == 0) {
-    dict[w] = nextid;
-    ++nextid;
-  }
-
-  return dict[w];
-}
-
-int CWordLanguageModel::lookup_word_const(const std::string &w) const {
-  std::cout << "Looking up (const) " << w << std::endl;
-
-  return dict.find(w)->second;
-}
-
 /////////////////////////////////////////////////////////////////////
 // get the probability distribution at the context
 
 void CWordLanguageModel::GetProbs(Context context, std::vector<unsigned int> &probs, int norm, int iUniform) const {
-  // Got rid of const below
-
-  CWordLanguageModel::CWordContext * wordcontext = (CWordContext *) (context);
-
-  // Make sure that the probability vector has the right length
-
-  int iNumSymbols = GetSize();
-  probs.resize(iNumSymbols);
+  DASHER_ASSERT(m_Contexts.IsValid(context));
+  CWordContext &wordcontext(m_Contexts[context]);
 
-  // For the prototype work with double precision to make things easier to normalise
+  const int iNumSymbols = GetSize();
+  probs.assign(iNumSymbols, 0);
 
-  std::vector < double >dProbs(iNumSymbols);
+  // All in integers: alpha is in hundredths, so counts are multiplied by 100 to match
 
-  for(std::vector < double >::iterator it(dProbs.begin()); it != dProbs.end(); ++it)
-    *it = 0.0;
-
-  double alpha = GetLongParameter(LP_LM_WORD_ALPHA) / 100.0;
+  const myint alpha = GetLongParameter(LP_LM_WORD_ALPHA);
   //  double beta = LanguageModelParams()->GetValue( std::string( "LMBeta" ) )/100.0;
 
   // Ignore beta for now - we'll need to know how many different words have been seen, not just the total count.
 
-  double dToSpend(1.0);
-
-  CWordnode *pTmp = wordcontext->head;
-  CWordnode *pTmpWord = wordcontext->word_head;
-
-  // We'll assume that these stay in sync for now - maybe do something more robust later.
-
-  while(pTmp) {
+  const myint iToSpend = norm;
 
-    // Get the total count from the word node
+  // Each level of the word part of the model leaves alpha / (total + alpha) of what
+  // reaches it to the next; first find what it leaves altogether, i.e. how much it
+  // would spend by itself, to weigh that against the spelling model. We'll assume
+  // that head and word_head stay in sync for now - maybe do something more robust later.
 
-    int iTotal(pTmpWord->count);
+  myint iLeftByWords = iToSpend;
+  for(CWordnode *pTmp = wordcontext.head, *pTmpWord = wordcontext.word_head; pTmp; pTmp = pTmp->vine, pTmpWord = pTmpWord->vine)
+    iLeftByWords = iLeftByWords * alpha / (100 * myint(pTmpWord->count) + alpha);
 
-    if(iTotal) {
+  const myint iWords = iToSpend - iLeftByWords;
+  const myint iSpelling = iToSpend * wordcontext.m_iSpellingWeight / SPELLING_WEIGHT_ONE;
 
-      CWordnode *pTmpChild(pTmp->child);
+  // Scale the word part so that it gets iWordShare, the spelling model the rest
 
-      while(pTmpChild) {
-        // make sure we only get child nodes which correspond
-        // to symbols (not words).
+  const myint iWordShare = (iWords + iSpelling) ? iToSpend * iWords / (iWords + iSpelling) : 0;
+  myint iSpent = 0;
 
-        if(pTmpChild->sbl < iWordStart) {
+  if(iWords) {
+    myint iSlice = iToSpend;
+    for(CWordnode *pTmp = wordcontext.head, *pTmpWord = wordcontext.word_head; pTmp; pTmp = pTmp->vine, pTmpWord = pTmpWord->vine) {
+      const myint iDenom = 100 * myint(pTmpWord->count) + alpha;
 
-          double dP;
-
-          if(pTmpChild->count > 0)
-            dP = dToSpend * (pTmpChild->count) / static_cast < double >(iTotal + alpha);
-          else
-          dP = 0.0;
-
-          dProbs[pTmpChild->sbl] += dP;
+      if(pTmpWord->count) {
+        for(CWordnode *pTmpChild = pTmp->child; pTmpChild; pTmpChild = pTmpChild->next) {
+          // make sure we only get child nodes which correspond
+          // to symbols (not words).
+          if(pTmpChild->sbl < iWordStart && pTmpChild->count > 0) {
+            const myint p = std::min(iSlice * 100 * pTmpChild->count / iDenom * iWordShare / iWords, iWordShare - iSpent);
+            probs[pTmpChild->sbl] += static_cast<unsigned int>(p);
+            iSpent += p;
+          }
         }
-
-        pTmpChild = pTmpChild->next;
       }
 
+      iSlice = iSlice * alpha / iDenom;
     }
-
-    dToSpend *= alpha / static_cast < double >(iTotal + alpha);
-
-    pTmp = pTmp->vine;
-    pTmpWord = pTmpWord->vine;
-
-  }
-
-  // Get probabilities from the spelling model (note we cache these for later)
-
-  wordcontext->m_iSpellingNorm = norm;
-
-  int iSpellingNorm(wordcontext->m_iSpellingNorm);
-
-  wordcontext->m_pSpellingModel->GetProbs(wordcontext->oSpellingContext, wordcontext->oSpellingProbs, iSpellingNorm, 0);
-
-  double dNorm(0.0);
-
-  for(int i(0); i < iNumSymbols; ++i) {
-    dProbs[i] += wordcontext->m_dSpellingFactor * wordcontext->oSpellingProbs[i] / static_cast < double >(wordcontext->m_iSpellingNorm);
-    dNorm += dProbs[i];
   }
 
-  // Convert back to integer representation
+  // Get probabilities from the spelling model (note we cache these in the context, at
+  // the full norm, for AddSymbol to update the spelling weight)
 
-  int iToSpend(norm);
+  wordcontext.m_iSpellingNorm = static_cast<int>(iToSpend);
+  wordcontext.m_pSpellingModel->GetProbs(wordcontext.oSpellingContext, wordcontext.oSpellingProbs, wordcontext.m_iSpellingNorm, 0);
 
-  for(int i(0); i < iNumSymbols; ++i) {
-    probs[i] = (unsigned int) (norm * dProbs[i] / dNorm);
-    iToSpend -= probs[i];
+  if(iToSpend) {
+    const myint iSpellingShare = iToSpend - iSpent;
+    for(int i(0); i < iNumSymbols; ++i) {
+      const myint p = wordcontext.oSpellingProbs[i] * iSpellingShare / iToSpend;
+      probs[i] += static_cast<unsigned int>(p);
+      iSpent += p;
+    }
   }
 
-  // Check that we haven't got anything left over due to rounding errors:
+  // Share out anything left over due to rounding evenly
 
-  int iLeft = iNumSymbols;
+  unsigned int iLeft = static_cast<unsigned int>(iToSpend - iSpent);
 
-  for(int j = 0; j < iNumSymbols; ++j) {
-    unsigned int p = iToSpend / iLeft;
+  for(int j = 1; j < iNumSymbols; ++j) {
+    unsigned int p = iLeft / (iNumSymbols - j);
     probs[j] += p;
-    --iLeft;
-    iToSpend -= p;
+    iLeft -= p;
   }
 
-  DASHER_ASSERT(iToSpend == 0);
+  DASHER_ASSERT(iLeft == 0);
 }
 
 /// Collapse the context. This also has the effect of entering a count
@@ -327,12 +284,8 @@ void CWordLanguageModel::CollapseContext(CWordLanguageModel::CWordContext &conte
   }
   else {
 
-    std::vector < symbol > oSymbols;
-
-    for(std::string::iterator it(context.current_word.begin()); it != context.current_word.end(); it += 4) {
-      std::string fragment(it, it + 4);
-      oSymbols.push_back(atoi(fragment.c_str()));
-    }
+    std::vector < symbol > &oSymbols(m_vWordSymbols);
+    m_Words.GetSymbols(context.current_word, oSymbols);
 
     if(bLearn) {                // Only do this if we are learning
       // We need to increment all substrings - start at the current context striped back to the word level
@@ -433,7 +386,7 @@ void CWordLanguageModel::CollapseContext(CWordLanguageModel::CWordContext &conte
 
     // Collapse down word part regardless of whether we're learning or not
 
-    int iNewSymbol(lookup_word(context.current_word));
+    int iNewSymbol(m_Words.WordId(context.current_word));
 
     // Insert into the spelling model if this is a new word
 
@@ -493,7 +446,7 @@ void CWordLanguageModel::CollapseContext(CWordLanguageModel::CWordContext &conte
 
     context.head = context.word_head;
     context.order = context.word_order;
-    context.current_word = "";
+    context.current_word = CWordIndex::EMPTY;
 
     context.m_pSpellingModel->ReleaseContext(context.oSpellingContext);
     context.oSpellingContext = context.m_pSpellingModel->CreateEmptyContext();
@@ -519,7 +472,8 @@ void CWordLanguageModel::CollapseContext(CWordLanguageModel::CWordContext &conte
 }
 
 void CWordLanguageModel::LearnSymbol(Context c, int Symbol) {
-  CWordContext & context = *(CWordContext *) (c);
+  DASHER_ASSERT(m_Contexts.IsValid(c));
+  CWordContext & context = m_Contexts[c];
   AddSymbol(context, Symbol, true);
 }
 
@@ -529,8 +483,9 @@ void CWordLanguageModel::LearnSymbol(Context c, int Symbol) {
 void CWordLanguageModel::AddSymbol(CWordLanguageModel::CWordContext &context, symbol sym, bool bLearn) {
   DASHER_ASSERT(sym >= 0 && sym < GetSize());
 
-  if( context.oSpellingProbs.size() != 0 )
-    context.m_dSpellingFactor *= context.oSpellingProbs[sym] / static_cast < double >(context.m_iSpellingNorm);
+  if(context.m_iSpellingNorm != 0)
+    context.m_iSpellingWeight = static_cast < unsigned int >(static_cast < myint > (context.m_iSpellingWeight) * context.oSpellingProbs[sym] / context.m_iSpellingNorm);
+  context.m_iSpellingNorm = 0;        // (the cached distribution was for the old context)
 
   // Update the context for the spelling model;
 
@@ -577,20 +532,16 @@ void CWordLanguageModel::AddSymbol(CWordLanguageModel::CWordContext &context, sy
 
   pTmpVine->vine = NULL;        // (not sure if this is needed)
 
-  // Add the new symbol to the string representation too - note that
-  // string is actually a series of integers, not the actual symbols -
-  // doesn't matter as long as we're consistent and unique.
+  // Add the new symbol to the current word too
 
-  char sbuffer[5];
-  snprintf(sbuffer, 5, "%04d", sym);
-  context.current_word.append(sbuffer);
+  context.current_word = m_Words.Extend(context.current_word, sym);
 
   // Collapse the context (with learning) if we've just entered a space
   // FIXME - we need to generalise this for more languages.
 
   if(sym == m_iSpaceSymbol) {
     CollapseContext(context, bLearn);
-    context.m_dSpellingFactor = 1.0;
+    context.m_iSpellingWeight = SPELLING_WEIGHT_ONE;
   }
 
 }
@@ -601,6 +552,7 @@ void CWordLanguageModel::AddSymbol(CWordLanguageModel::CWordContext &context, sy
 void CWordLanguageModel::EnterSymbol(Context c, int Symbol) {
   // Same as AddSymbol but without learning in CollapseContext 
 
-  CWordContext & context = *(CWordContext *) (c);
+  DASHER_ASSERT(m_Contexts.IsValid(c));
+  CWordContext & context = m_Contexts[c];
   AddSymbol(context, Symbol, false);
 }
@@ -13,14 +13,14 @@
 
 #include "../../Common/NoClones.h"
 #include "../../Common/Allocators/PooledAlloc.h"
+#include "../../Common/Allocators/HandleTable.h"
 #include "PPMLanguageModel.h"
+#include "WordIndex.h"
 #include "../SettingsStore.h"
 #include "../Alphabet/AlphInfo.h"
 #include "../Alphabet/AlphabetMap.h"
 
 #include <vector>
-#include <map>
-#include <string>
 #include <stdio.h>
 
 //static char dumpTrieStr[40000];
@@ -48,6 +48,9 @@ namespace Dasher {
     virtual void EnterSymbol(Context context, int Symbol);
     virtual void LearnSymbol(Context context, int Symbol);
 
+    ///Number of nodes in the word trie
+    int NumNodes() const {return NodesAllocated;}
+
   private:
     
       class CWordnode {
@@ -67,17 +70,31 @@ namespace Dasher {
 
 
 
+    /// Fixed-point representation of 1.0 for CWordContext::m_iSpellingWeight
+    static const unsigned int SPELLING_WEIGHT_ONE = 1u << 31;
+
     class CWordContext {
     public:
       CWordContext(CWordContext const &input) {
+        *this = input;
+      }
+
+      /// Copies everything but the spelling distribution cached by GetProbs
+      CWordContext &operator=(CWordContext const &input) {
         head = input.head;
         word_head = input.word_head;
         current_word = input.current_word;
         order = input.order;
         word_order = input.word_order;
-      } 
+        m_iSpellingNorm = 0;
+        m_iSpellingWeight = input.m_iSpellingWeight;
+        m_pSpellingModel = input.m_pSpellingModel;
+        oSpellingContext = input.oSpellingContext;
+        return *this;
+      }
       
-      CWordContext(CWordnode * _head = 0, int _order = 0): head(_head), order(_order), word_head(_head), word_order(0)
+      CWordContext(CWordnode * _head = 0, int _order = 0): head(_head), order(_order), current_word(CWordIndex::EMPTY), word_head(_head), word_order(0),
+        m_iSpellingNorm(0), m_iSpellingWeight(SPELLING_WEIGHT_ONE)
 	{};                        // FIXME - doesn't work if we're trying to create a non-empty context
       ~CWordContext() {
       };
@@ -85,13 +102,20 @@ namespace Dasher {
       CWordnode *head;
       int order;
 
-      std::string current_word;
+      /// The letters of the current word so far, as a prefix in the word index
+      int current_word;
       CWordnode *word_head;
       int word_order;
 
+      /// Distribution from the spelling model, as computed by the last GetProbs (at norm
+      /// m_iSpellingNorm), or none if m_iSpellingNorm is 0
       std::vector < unsigned int >oSpellingProbs;
       int m_iSpellingNorm;
-      double m_dSpellingFactor;
+
+      /// Probability the spelling model gave the letters of the current word so far,
+      /// with SPELLING_WEIGHT_ONE representing 1.0: the weight given to the spelling
+      /// model's predictions against those of the word part of the model
+      unsigned int m_iSpellingWeight;
 
       /// Pointer to the letter based model - note that we don't
       /// actually own this, so don't delete it
@@ -111,18 +135,21 @@ namespace Dasher {
 
     void CollapseContext(CWordContext & context, bool bLearn);
 
-    int lookup_word(const std::string & w);
-    int lookup_word_const(const std::string & w) const;
-
     const int m_iSpaceSymbol;
     
-    CWordContext *m_rootcontext;
+    /// Context from which all empty contexts are cloned
+    Context m_rootcontext;
     CWordnode *m_pRoot;
 
-    std::map < std::string, int >dict;  // Dictionary
-    int nextid;
+    /// Symbol numbers below this are letters; word identifiers start here
     int iWordStart;
 
+    /// Dictionary, giving identifiers to the words seen
+    CWordIndex m_Words;
+
+    /// The letters of the word being collapsed (reused by CollapseContext)
+    std::vector < symbol >m_vWordSymbols;
+
     int wordidx;
 
     int NodesAllocated;
@@ -133,7 +160,9 @@ namespace Dasher {
 
 
     mutable CSimplePooledAlloc < CWordnode > m_NodeAlloc;
-    CPooledAlloc < CWordContext > m_ContextAlloc;
+    /// Contexts, indexed by handle; mutable as GetProbs stores its spelling
+    /// distribution in the context
+    mutable CHandleTable < CWordContext > m_Contexts;
   };
   /// \}
 
@@ -158,32 +187,31 @@ namespace Dasher {
 ///////////////////////////////////////////////////////////////////
 
   inline CLanguageModel::Context CWordLanguageModel::CreateEmptyContext() {
-    return CloneContext((Context)m_rootcontext);
+    return CloneContext(m_rootcontext);
   }
 
 ///////////////////////////////////////////////////////////////////
 
   inline CLanguageModel::Context CWordLanguageModel::CloneContext(Context Copy) {
-    CWordContext *pCont = m_ContextAlloc.Alloc();
-    CWordContext *pCopy = (CWordContext *) Copy;
-    *pCont = *pCopy;
+    DASHER_ASSERT(m_Contexts.IsValid(Copy));
+    CWordContext cont(m_Contexts[Copy]);
 
     // Create a clone of the spelling context
 
-    pCont->oSpellingContext = pCont->m_pSpellingModel->CloneContext(pCopy->oSpellingContext);
+    cont.oSpellingContext = cont.m_pSpellingModel->CloneContext(cont.oSpellingContext);
 
-    return (Context) pCont;
+    return m_Contexts.Alloc(cont);
   }
 
 ///////////////////////////////////////////////////////////////////
 
   inline void CWordLanguageModel::ReleaseContext(Context release) {
-    // Urgh!
-    CWordContext *pCont(reinterpret_cast<CWordContext *>(release));
+    DASHER_ASSERT(m_Contexts.IsValid(release));
+    CWordContext &cont(m_Contexts[release]);
     
-    pCont->m_pSpellingModel->ReleaseContext(pCont->oSpellingContext);
+    cont.m_pSpellingModel->ReleaseContext(cont.oSpellingContext);
 
-    m_ContextAlloc.Free(pCont);
+    m_Contexts.Free(release);
   }
 
 ///////////////////////////////////////////////////////////////////
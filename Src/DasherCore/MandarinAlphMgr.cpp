@@ -157,14 +157,14 @@ CMandarinAlphMgr::~CMandarinAlphMgr() {
   m_pPYgroups->RecursiveDelete();
 }
 
-void CMandarinAlphMgr::CreateLanguageModel() {
+CLanguageModel *CMandarinAlphMgr::CreateLanguageModel() {
   //std::cout<<"CHALphabet size "<< pCHAlphabet->GetNumberTextSymbols(); [7603]
   //std::cout<<"Setting PPMPY model"<<std::endl;
-  m_pLanguageModel = new CPPMPYLanguageModel(this, m_vGroupsByConversion.size()-1, m_vConversionsByGroup.size()-1);
+  return new CPPMPYLanguageModel(this, m_vGroupsByConversion.size()-1, m_vConversionsByGroup.size()-1);
 }
 
-CMandarinAlphMgr::CMandarinTrainer::CMandarinTrainer(CMessageDisplay *pMsgs, CMandarinAlphMgr *pMgr)
-: CTrainer(pMsgs, pMgr->m_pLanguageModel, pMgr->m_pAlphabet, &pMgr->m_map), m_pMgr(pMgr) {
+CMandarinAlphMgr::CMandarinTrainer::CMandarinTrainer(CMessageDisplay *pMsgs, CMandarinAlphMgr *pMgr, CLanguageModel *pLM)
+: CTrainer(pMsgs, pLM, pMgr->m_pAlphabet, &pMgr->m_map), m_pMgr(pMgr) {
   //We pass in the alphabet to define the context-switch escape character, and the default context.
 
   m_iStartSym=0;  
@@ -256,8 +256,8 @@ void CMandarinAlphMgr::CMandarinTrainer::Train(CAlphabetMap::SymbolStream &syms)
 }
 
 
-CTrainer *CMandarinAlphMgr::GetTrainer() {
-  return new CMandarinTrainer(m_pInterface, this);
+CTrainer *CMandarinAlphMgr::GetTrainer(CMessageDisplay *pMsgs, CLanguageModel *pLM) {
+  return new CMandarinTrainer(pMsgs, this, pLM);
 }
 
 CAlphabetManager::CAlphNode *CMandarinAlphMgr::CreateSymbolRoot(int iOffset, CLanguageModel::Context ctx, symbol chSym) {
@@ -297,7 +297,7 @@ CDasherNode *CMandarinAlphMgr::CreateSymbolNode(CAlphNode *pParent, symbol iSymb
   if (convs.size()>1 || m_vLabels[iSymbol])
     return CreateConvRoot(pParent, iSymbol);
   //elide CConvRoot...
-  return CreateCHSymbol(pParent,pParent->iContext, *(convs.begin()), iSymbol);
+  return CreateCHSymbol(pParent,pParent->context(), *(convs.begin()), iSymbol);
 }
 
 CMandarinAlphMgr::CConvRoot *CMandarinAlphMgr::CreateConvRoot(CAlphNode *pParent, symbol iPYsym) {
@@ -307,7 +307,7 @@ CMandarinAlphMgr::CConvRoot *CMandarinAlphMgr::CreateConvRoot(CAlphNode *pParent
   CConvRoot *pConv = new CConvRoot(pParent->offset(), this, iPYsym);
     
   // and use the same context too (pinyin syll+tone is _not_ used as part of the LM context)
-  pConv->iContext = m_pLanguageModel->CloneContext(pParent->iContext);
+  pConv->iContext = m_pLanguageModel->CloneContext(pParent->context());
   return pConv;
 }
 
@@ -320,19 +320,39 @@ CMandarinAlphMgr::CConvRoot::CConvRoot(int iOffset, CMandarinAlphMgr *pMgr, symb
   //colour + label from ConversionManager.
 }
 
+CMandarinAlphMgr::CConvRoot::~CConvRoot() {
+  mgr()->m_pLanguageModel->ReleaseContext(iContext);
+}
+
 int CMandarinAlphMgr::CConvRoot::ExpectedNumChildren() {
   return mgr()->m_vConversionsByGroup[m_pySym].size();
 }
 
 void CMandarinAlphMgr::CConvRoot::PopulateChildren() {
-  PopulateChildrenWithExisting(NULL);
+  PopulateChildrenWithExisting(NULL, m_iWantLbnd, m_iWantHbnd);
+}
+
+void CMandarinAlphMgr::CConvRoot::PopulateRange(unsigned int iLbnd, unsigned int iHbnd) {
+  PopulateChildrenWithExisting(NULL, iLbnd, iHbnd);
 }
 
-void CMandarinAlphMgr::CConvRoot::PopulateChildrenWithExisting(CMandSym *existing) {
+void CMandarinAlphMgr::CConvRoot::PopulateChildrenWithExisting(CMandSym *existing, unsigned int iWantLbnd, unsigned int iWantHbnd) {
   if (m_vChInfo.empty()) {
     mgr()->GetConversions(m_vChInfo,m_pySym, iContext);
   }
-  
+
+  //Sparse population, as CAlphabetManager::IterateChildGroups
+  const bool bSparse(iWantLbnd > 0 || iWantHbnd < CDasherModel::NORMALIZATION || !GetChildren().empty());
+  const bool bHave(!GetChildren().empty());
+  const unsigned int iHaveLbnd(bHave ? GetChildren().begin().Lbnd() : 0),
+                     iHaveHbnd(bHave ? GetChildren().back()->Hbnd() : 0);
+  if (bHave) {
+    iWantLbnd = min(iWantLbnd, iHaveHbnd);
+    iWantHbnd = max(iWantHbnd, iHaveLbnd);
+  }
+  vector<pair<CMandSym *, pair<unsigned int, unsigned int> > > vBefore;
+  bool bComplete(true);
+
   int iCum(0);
   
   // Finally loop through and create the children
@@ -341,19 +361,31 @@ void CMandarinAlphMgr::CConvRoot::PopulateChildrenWithExisting(CMandSym *existin
     const unsigned int iLbnd(iCum), iHbnd(iCum + it->second);
     
     iCum = iHbnd;
+    if (bSparse) {
+      if (iLbnd == iHbnd || (bHave && iLbnd >= iHaveLbnd && iHbnd <= iHaveHbnd)) continue;
+      if (iHbnd <= iWantLbnd || iLbnd >= iWantHbnd) {
+        bComplete = false;
+        continue;
+      }
+    }
     CMandSym *pNewNode = (existing)
       ? existing->RebuildCHSymbol(this, it->first)
       : mgr()->CreateCHSymbol(this, this->iContext, it->first, m_pySym);
-    pNewNode->Reparent(this, iLbnd, iHbnd);
+    if (bHave && iHbnd <= iHaveLbnd)
+      vBefore.push_back(make_pair(pNewNode, make_pair(iLbnd, iHbnd)));
+    else
+      pNewNode->Reparent(this, iLbnd, iHbnd);
   }
+  for (vector<pair<CMandSym *, pair<unsigned int, unsigned int> > >::reverse_iterator it = vBefore.rbegin(); it != vBefore.rend(); it++)
+    it->first->ReparentFirst(this, it->second.first, it->second.second);
+  SetFlag(NF_SPARSE, !bComplete);
 }
 
 CMandarinAlphMgr::CMandSym *CMandarinAlphMgr::CreateCHSymbol(CDasherNode *pParent, CLanguageModel::Context iContext, symbol iCHsym, symbol iPYparent) {
   int iNewOffset = pParent->offset()+1;
   if (m_vCHtext[iCHsym] == "\r\n") iNewOffset++;
   CMandSym *pNewNode = new CMandSym(iNewOffset, this, iCHsym, iPYparent);
-  pNewNode->iContext = m_pLanguageModel->CloneContext(iContext);
-  m_pLanguageModel->EnterSymbol(pNewNode->iContext, iCHsym);
+  pNewNode->DeferContext(iContext, iCHsym);
   return pNewNode;
 }
 
@@ -480,7 +512,7 @@ CDasherNode *CMandarinAlphMgr::CMandSym::RebuildSymbol(CAlphNode *pParent, symbo
     }
     //ok, will be a PY-to-Chinese conversion choice
     CConvRoot *pConv = mgr()->CreateConvRoot(pParent, iSymbol);
-    pConv->PopulateChildrenWithExisting(this);
+    pConv->PopulateChildrenWithExisting(this, 0, CDasherModel::NORMALIZATION);
     return pConv;
   }
   return CAlphBase::RebuildSymbol(pParent, iSymbol);
@@ -509,7 +541,7 @@ void CMandarinAlphMgr::CMandSym::RebuildForwardsFromAncestor(CAlphNode *pNewNode
         //compute probability of each chinese symbol for that pinyin (=by filtering)
         // context is the same as the ancestor = previous chinese, as pinyin not part of context
         vector<pair<symbol, unsigned int> > vChineseProbs;
-        mgr()->GetConversions(vChineseProbs, *p_it, pNewNode->iContext);
+        mgr()->GetConversions(vChineseProbs, *p_it, pNewNode->context());
         //now find us in that list
         long thisProb; //i.e. P(this pinyin) * P(this chinese | this pinyin)
         for (vector<pair<symbol,unsigned int> >::iterator c_it = vChineseProbs.begin(); ;) {
@@ -73,7 +73,8 @@ namespace Dasher {
     class CMandarinTrainer : public CTrainer {
     public:
       /// Construct a new MandarinTrainer. Reads alphabet etc. directly from pMgr.
-      CMandarinTrainer(CMessageDisplay *pMsgs, CMandarinAlphMgr *pMgr);
+      /// \param pLM a PPMPYLanguageModel created by pMgr
+      CMandarinTrainer(CMessageDisplay *pMsgs, CMandarinAlphMgr *pMgr, CLanguageModel *pLM);
     protected:
       //override...
       virtual void Train(CAlphabetMap::SymbolStream &syms);
@@ -92,7 +93,7 @@ namespace Dasher {
     ~CMandarinAlphMgr();
     
     ///ACL: returns a MandarinTrainer too.
-    CTrainer *GetTrainer();
+    CTrainer *GetTrainer(CMessageDisplay *pMsgs, CLanguageModel *pLM);
     
     ///Disable game mode. The target sentence might appear in several places...!!
     CWordGeneratorBase *GetGameWords() {return NULL;}
@@ -108,7 +109,7 @@ namespace Dasher {
     /// are rehashed from the original/input alphabet to remove duplicates;
     void InitMap();
     ///WZ: Mandarin Dasher Change. Sets language model to PPMPY.
-    void CreateLanguageModel();
+    CLanguageModel *CreateLanguageModel();
     
     ///Process SGroupInfo's from the alphabet into form suitable for m_pPYgroups
     /// \param pBase group from alphabet (i.e. containing unhashed CH symbol numbers)
@@ -160,11 +161,19 @@ namespace Dasher {
     public:
       /// \param pySym symbol in pinyin alphabet; must have >1 possible chinese conversion.
       CConvRoot(int iOffset, CMandarinAlphMgr *pMgr, symbol pySym);
+      ~CConvRoot();
       CMandarinAlphMgr *mgr() const {return static_cast<CMandarinAlphMgr *>(CAlphBase::mgr());}
       void PopulateChildren();
-      void PopulateChildrenWithExisting(CMandSym *existing);
+      ///Override: fill in more of the children (see PopulateChildrenWithExisting)
+      void PopulateRange(unsigned int iLbnd, unsigned int iHbnd);
+      ///Creates the children, or if the window iWantLbnd-iWantHbnd is not the whole
+      /// node, only those overlapping it (and between it and any already made), as
+      /// CAlphabetManager::IterateChildGroups.
+      /// \param existing if non-NULL, a node to graft in in place of the new node for its symbol
+      void PopulateChildrenWithExisting(CMandSym *existing, unsigned int iWantLbnd, unsigned int iWantHbnd);
       int ExpectedNumChildren();
       CLanguageModel::Context iContext;
+      CLanguageModel::Context context() {return iContext;}
       void SetFlag(int iFlag, bool bValue);
       const symbol m_pySym;
       ///A "symbol" to be rebuilt, is a PY sound, i.e. potentially this
@@ -190,6 +199,7 @@ namespace Dasher {
     /// one corresponding chinese symbol (=> this), or a CConvRoot (if this chinese symbol is one of many possible
     /// chinese symbols for a particular pinyin).
     /// \param iContext parent node's context, from which to generate context for this node
+    /// (when first needed; see CAlphNode::DeferContext)
     /// \param iCHsym symbol number in chinese alphabet
     /// \param pyParent pinyin-alphabet symbol which was used to enter this chinese symbol (if known, else 0)
     CMandSym *CreateCHSymbol(CDasherNode *pParent, CLanguageModel::Context iContext, symbol iCHsym, symbol pyParent);
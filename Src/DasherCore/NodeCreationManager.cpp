@@ -8,19 +8,47 @@
 #include "Observable.h"
 
 #include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 using namespace Dasher;
 
 //Wraps the ParseFile of a provided Trainer, to setup progress notification
 // - and then passes self, as a ProgressIndicator, to the Trainer's ParseFile method.
+// Normally progress is shown by locking the interface; if constructed with a separate
+// CMessageDisplay (for errors), it is instead only recorded, in atomics which the main
+// thread may poll, so that the trainer may be run on another thread.
 class ProgressNotifier : public AbstractParser, private CTrainer::ProgressIndicator {
 public:
   ProgressNotifier(CDasherInterfaceBase *pInterface, CTrainer *pTrainer)
-  : AbstractParser(pInterface), m_bSystem(false), m_bUser(false), m_pInterface(pInterface), m_pTrainer(pTrainer) { }
+  : AbstractParser(pInterface), m_bSystem(false), m_bUser(false), m_pInterface(pInterface), m_pTrainer(pTrainer),
+  m_bBackground(false), m_iProgress(-1), m_bUserText(false), m_bCancel(false), m_pIn(NULL) {
+    pTrainer->SetProgressIndicator(this);
+  }
+  ProgressNotifier(CDasherInterfaceBase *pInterface, CShardedTrainer *pTrainer)
+  : AbstractParser(pInterface), m_bSystem(false), m_bUser(false), m_pInterface(pInterface), m_pTrainer(pTrainer),
+  m_bBackground(false), m_iProgress(-1), m_bUserText(false), m_bCancel(false), m_pIn(NULL) {
+    pTrainer->SetProgressIndicator(this);
+  }
+  ProgressNotifier(CDasherInterfaceBase *pInterface, CMessageDisplay *pMsgs, CTrainer *pTrainer)
+  : AbstractParser(pMsgs), m_bSystem(false), m_bUser(false), m_pInterface(pInterface), m_pTrainer(pTrainer),
+  m_bBackground(true), m_iProgress(-1), m_bUserText(false), m_bCancel(false), m_pIn(NULL) {
+    pTrainer->SetProgressIndicator(this);
+  }
   void bytesRead(off_t n) {
+    //stop reading (the trainer will see end-of-file shortly) if we've been cancelled
+    if (m_bCancel) m_pIn->setstate(ios::failbit);
     int iNewPercent = ((m_iStart + n)*100)/m_iStop;
     if (iNewPercent != m_iPercent) {
-      m_pInterface->SetLockStatus(m_strDisplay, m_iPercent = iNewPercent);
+      m_iPercent = iNewPercent;
+      if (m_bBackground) m_iProgress = iNewPercent;
+      else m_pInterface->SetLockStatus(m_strDisplay, iNewPercent);
     }
   }
   bool ParseFile(const string &strFilename, bool bUser) {
@@ -29,30 +57,258 @@ public:
     if (m_iStop==0) return false;
     return AbstractParser::ParseFile(strFilename, bUser);
   }
+  ///Train on just the part of a (user) file after the first iFrom bytes,
+  /// e.g. text appended since the model was last cached.
+  bool ParseTail(const string &strFilename, off_t iFrom) {
+    m_iStart = 0;
+    m_iStop = m_pInterface->GetFileSize(strFilename) - iFrom;
+    if (m_iStop<=0) return false;
+    std::ifstream in(strFilename.c_str(), ios::binary);
+    if (!in.seekg(iFrom)) return false;
+    return Parse("file://"+strFilename, in, true);
+  }
   bool Parse(const string &strUrl, istream &in, bool bUser) {
     m_strDisplay = bUser ? _("Training on User Text") : _("Training on System Text");
-    m_pInterface->SetLockStatus(m_strDisplay, m_iPercent=0);
-    m_pTrainer->SetProgressIndicator(this);
-    if (!m_pTrainer->Parse(strUrl, in, bUser)) return false;
+    if (m_bBackground) {
+      m_bUserText = bUser;
+      m_iProgress = m_iPercent = 0;
+    } else m_pInterface->SetLockStatus(m_strDisplay, m_iPercent=0);
+    m_pIn = &in;
+    if (!m_pTrainer->Parse(strUrl, in, bUser) || m_bCancel) return false;
     if (bUser) m_bUser=true; else m_bSystem=true;
     return true;
   }
+  ///For background use: the percentage of the current file trained so far, or -1
+  /// if not yet started; and whether that file is user (rather than system) text.
+  int Progress(bool &bUserText) const {bUserText = m_bUserText; return m_iProgress;}
+  ///For background use: abandon training as soon as possible
+  void Cancel() {m_bCancel = true;}
+  bool Cancelled() const {return m_bCancel;}
   bool m_bSystem, m_bUser;
 private:
   CDasherInterfaceBase *m_pInterface;
-  CTrainer *m_pTrainer;
+  ///The CTrainer or CShardedTrainer to which we are the ProgressIndicator
+  AbstractParser *m_pTrainer;
   off_t m_iStart, m_iStop;
   int m_iPercent;
   string m_strDisplay;
+  const bool m_bBackground;
+  std::atomic<int> m_iProgress;
+  std::atomic<bool> m_bUserText, m_bCancel;
+  istream *m_pIn;
+};
+
+//Trains on each of the files (as listed by ScanFiles) in turn, until cancelled. The
+// LM is frozen (see CLanguageModel::FreezeModel) once it has the system text, i.e.
+// before the first user file, or at the end if there are none; it then grows only
+// by what the user writes.
+static void TrainOnFiles(ProgressNotifier &pn, CLanguageModel *pLM, const vector<pair<string,bool> > &vFiles) {
+  bool bFrozen = false;
+  for (vector<pair<string,bool> >::const_iterator it=vFiles.begin(); it!=vFiles.end() && !pn.Cancelled(); it++) {
+    if (it->second && !bFrozen) {
+      pLM->FreezeModel();
+      bFrozen = true;
+    }
+    pn.ParseFile(it->first, it->second);
+  }
+  if (!bFrozen && !pn.Cancelled()) pLM->FreezeModel();
+}
+
+//Records the files which ScanFiles finds, in order, without reading them.
+class TrainingFileLister : public AbstractParser {
+public:
+  TrainingFileLister(CMessageDisplay *pMsgs) : AbstractParser(pMsgs) {}
+  bool ParseFile(const string &strFilename, bool bUser) {
+    m_vFiles.push_back(pair<string,bool>(strFilename, bUser));
+    return true;
+  }
+  bool Parse(const string &, istream &, bool) {return false;}
+  vector<pair<string,bool> > m_vFiles;
+};
+
+//Caches the trained language model in the user data directory, so that
+// selecting an alphabet need not retrain from scratch each time. The cache
+// is keyed (in a separate text file) by the alphabet, the LM parameters that
+// affect training, and the path, size, modification time and (FNV-1a) content
+// hash of each training file; if the only change is that user files have grown
+// (by Dasher appending to them), the cached model is loaded and trained on just
+// the new text.
+class TrainedModelCache {
+public:
+  ///Note the size and modification time of the training files vFiles (path, and
+  /// whether user text) are read here; Save() will describe the files as they were then.
+  TrainedModelCache(CDasherInterfaceBase *pInterface, CLanguageModel *pLM, const string &strAlphID,
+                    const string &strParams, const vector<pair<string,bool> > &vFiles)
+  : m_pLM(pLM), m_strParams(strParams), m_bDirty(true) {
+    string strName("lmcache_");
+    for (string::const_iterator it=strAlphID.begin(); it!=strAlphID.end(); it++)
+      strName += (isalnum(static_cast<unsigned char>(*it)) ? *it : '_');
+    m_strModelPath = pInterface->GetUserDataFilePath(strName + ".dlm");
+    if (!m_strModelPath.empty()) m_strKeyPath = pInterface->GetUserDataFilePath(strName + ".key");
+    for (vector<pair<string,bool> >::const_iterator it=vFiles.begin(); it!=vFiles.end(); it++) {
+      SFileInfo info;
+      info.strPath = it->first; info.bUser = it->second;
+      info.iSize = pInterface->GetFileSize(info.strPath);
+      info.iModTime = pInterface->GetFileModificationTime(info.strPath);
+      info.bHashed = false;
+      m_vFiles.push_back(info);
+    }
+  }
+
+  ///Bring the LM up-to-date with the training files from the cache, if possible.
+  /// \return true if done (any new user text has been trained via pn); false if the
+  /// caller must train on all the files itself (the LM is then still untrained).
+  bool Load(ProgressNotifier &pn) {
+    if (m_strKeyPath.empty()) return false;
+    std::ifstream key(m_strKeyPath.c_str());
+    string strLine;
+    if (!getline(key, strLine) || strLine != m_strParams) return false;
+    vector<pair<string,off_t> > vTails;
+    for (vector<SFileInfo>::iterator it=m_vFiles.begin(); it!=m_vFiles.end(); it++) {
+      SFileInfo cached;
+      if (!(key >> cached.bUser >> cached.iSize >> cached.iModTime >> cached.iHash) || !getline(key >> ws, cached.strPath)
+          || cached.strPath != it->strPath || cached.bUser != it->bUser) return false;
+      if (it->iSize == cached.iSize) {
+        if (it->iModTime && it->iModTime == cached.iModTime) {
+          it->iHash = cached.iHash; it->bHashed = true;
+        } else if (!Hash(*it) || it->iHash != cached.iHash) return false;
+      } else if (it->bUser && it->iSize > cached.iSize) {
+        unsigned long long iPrefixHash;
+        if (!Hash(it->strPath, cached.iSize, iPrefixHash) || iPrefixHash != cached.iHash) return false;
+        vTails.push_back(pair<string,off_t>(it->strPath, cached.iSize));
+      } else return false;
+    }
+    if (getline(key >> ws, strLine)) return false; //training file(s) since removed
+    if (!m_pLM->ReadFromFile(m_strModelPath)) return false;
+    for (vector<SFileInfo>::iterator it=m_vFiles.begin(); it!=m_vFiles.end(); it++)
+      if (it->iSize) (it->bUser ? pn.m_bUser : pn.m_bSystem) = true;
+    for (vector<pair<string,off_t> >::iterator it=vTails.begin(); it!=vTails.end(); it++)
+      pn.ParseTail(it->first, it->second);
+    m_bDirty = !vTails.empty();
+    return true;
+  }
+
+  ///Write the LM, and then the key describing it, if either has changed since Load.
+  /// Does not use the interface, so may be called on another thread.
+  void Save() {
+    if (!m_bDirty || m_strKeyPath.empty()) return;
+    //remove old key first, so a partially-written model is never used
+    remove(m_strKeyPath.c_str());
+    if (!m_pLM->WriteToFile(m_strModelPath)) return; //LM does not support serialization
+    std::ostringstream key;
+    key << m_strParams << std::endl;
+    for (vector<SFileInfo>::iterator it=m_vFiles.begin(); it!=m_vFiles.end(); it++) {
+      if (!it->bHashed && !Hash(*it)) {remove(m_strModelPath.c_str()); return;}
+      key << it->bUser << " " << it->iSize << " " << it->iModTime << " " << it->iHash << " " << it->strPath << std::endl;
+    }
+    std::ofstream out(m_strKeyPath.c_str());
+    out << key.str();
+  }
+
+private:
+  struct SFileInfo {
+    string strPath;
+    bool bUser;
+    off_t iSize;
+    long iModTime;
+    unsigned long long iHash;
+    bool bHashed;
+  };
+  bool Hash(SFileInfo &info) {
+    return info.bHashed = Hash(info.strPath, info.iSize, info.iHash);
+  }
+  ///FNV-1a over the first iLength bytes of a file; false if it has fewer.
+  static bool Hash(const string &strPath, off_t iLength, unsigned long long &iHash) {
+    std::ifstream in(strPath.c_str(), ios::binary);
+    iHash = 14695981039346656037ULL;
+    char buf[65536];
+    while (iLength > 0) {
+      in.read(buf, static_cast<std::streamsize>(std::min<off_t>(iLength, sizeof(buf))));
+      std::streamsize n = in.gcount();
+      if (n <= 0) return false;
+      for (std::streamsize i=0; i<n; i++) {
+        iHash ^= static_cast<unsigned char>(buf[i]);
+        iHash *= 1099511628211ULL;
+      }
+      iLength -= n;
+    }
+    return true;
+  }
+
+  CLanguageModel *m_pLM;
+  const string m_strParams;
+  string m_strModelPath, m_strKeyPath;
+  vector<SFileInfo> m_vFiles;
+  bool m_bDirty;
 };
 
+//Trains a fresh LM on a worker thread, while the user writes with the live one;
+// any messages (e.g. errors in the training text) are queued until Finish().
+class CNodeCreationManager::CBackgroundTraining : public CMessageDisplay {
+public:
+  CBackgroundTraining(CDasherInterfaceBase *pInterface, CAlphabetManager *pMgr, const string &strParams,
+                      const vector<pair<string,bool> > &vFiles)
+  : m_bFinished(false), m_pLM(pMgr->CreateLanguageModel()), m_pTrainer(pMgr->GetTrainer(this, m_pLM)),
+  m_pn(pInterface, this, m_pTrainer), m_cache(pInterface, m_pLM, pMgr->GetAlphabet()->GetID(), strParams, vFiles),
+  m_vFiles(vFiles) {
+    m_thread = std::thread(&CBackgroundTraining::Run, this);
+  }
+  virtual ~CBackgroundTraining() {
+    m_pn.Cancel();
+    if (m_thread.joinable()) m_thread.join();
+    delete m_pTrainer;
+    delete m_pLM;
+  }
+  void Message(const string &strText, bool bInterrupt) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_vMessages.push_back(pair<string,bool>(strText, bInterrupt));
+  }
+  bool Finished() const {return m_bFinished;}
+  ///Call (on the main thread) once Finished(): passes on any queued messages.
+  /// \return the trained LM, which the caller must then AdoptModel (before deleting this).
+  CLanguageModel *Finish(CMessageDisplay *pMsgs, bool &bUser, bool &bSystem) {
+    m_thread.join();
+    for (vector<pair<string,bool> >::iterator it=m_vMessages.begin(); it!=m_vMessages.end(); it++)
+      pMsgs->Message(it->first, it->second);
+    bUser = m_pn.m_bUser; bSystem = m_pn.m_bSystem;
+    return m_pLM;
+  }
+  int Progress(bool &bUserText) const {return m_pn.Progress(bUserText);}
+private:
+  void Run() {
+    TrainOnFiles(m_pn, m_pLM, m_vFiles);
+    if (!m_pn.Cancelled()) m_cache.Save();
+    m_bFinished = true;
+  }
+  //(messages may be queued by the constructors of later members)
+  std::mutex m_mutex;
+  vector<pair<string,bool> > m_vMessages;
+  std::atomic<bool> m_bFinished;
+  CLanguageModel * const m_pLM;
+  CTrainer * const m_pTrainer;
+  ProgressNotifier m_pn;
+  TrainedModelCache m_cache;
+  const vector<pair<string,bool> > m_vFiles;
+  std::thread m_thread;
+};
+
+///Tells the user if there was no (user) training text
+static void ReportTrainingText(CMessageDisplay *pMsgs, const CAlphInfo *pAlphInfo, bool bUser, bool bSystem) {
+  if (!bUser) {
+    ///TRANSLATORS: These 3 messages will be displayed when the user has just chosen a new alphabet. The %s parameter will be the name of the alphabet.
+    const char *msg = bSystem ? _("No user training text found - if you have written in \"%s\" before, this means Dasher may not be learning from previous sessions")
+    : _("No training text (user or system) found for \"%s\". Dasher will still work but entry will be slower. We suggest downloading a training text file from the Dasher website, or constructing your own.");
+    pMsgs->FormatMessageWithString(msg, pAlphInfo->GetID().c_str());
+  }
+}
+
 CNodeCreationManager::CNodeCreationManager(
   CSettingsUser *pCreateFrom,
   Dasher::CDasherInterfaceBase *pInterface,
   const Dasher::CAlphIO *pAlphIO,
   const Dasher::CControlBoxIO *pControlBoxIO
   ) : CSettingsUserObserver(pCreateFrom),
-  m_pInterface(pInterface), m_pControlManager(NULL), m_pScreen(NULL) {
+  m_pInterface(pInterface), m_pControlManager(NULL), m_pScreen(NULL), m_pBackgroundTraining(NULL) {
 
   const Dasher::CAlphInfo *pAlphInfo(pAlphIO->GetInfo(GetStringParameter(SP_ALPHABET_ID)));
 
@@ -80,16 +336,30 @@ CNodeCreationManager::CNodeCreationManager(
   //all other configuration changes, etc., that might be necessary for a particular conversion mode,
   // are implemented by AlphabetManager subclasses overriding the following two methods:
   m_pAlphabetManager->Setup();
-  m_pTrainer = m_pAlphabetManager->GetTrainer();
+  CLanguageModel *pLM = m_pAlphabetManager->GetLanguageModel();
+  m_pTrainer = m_pAlphabetManager->GetTrainer(pInterface, pLM);
     
   if (!pAlphInfo->GetTrainingFile().empty()) {
     ProgressNotifier pn(pInterface, m_pTrainer);
-    pInterface->ScanFiles(&pn,pAlphInfo->GetTrainingFile());
-    if (!pn.m_bUser) {
-      ///TRANSLATORS: These 3 messages will be displayed when the user has just chosen a new alphabet. The %s parameter will be the name of the alphabet.
-      const char *msg = pn.m_bSystem ? _("No user training text found - if you have written in \"%s\" before, this means Dasher may not be learning from previous sessions")
-      : _("No training text (user or system) found for \"%s\". Dasher will still work but entry will be slower. We suggest downloading a training text file from the Dasher website, or constructing your own.");
-      pInterface->FormatMessageWithString(msg, pAlphInfo->GetID().c_str());
+    TrainingFileLister lister(pInterface);
+    pInterface->ScanFiles(&lister,pAlphInfo->GetTrainingFile());
+    std::ostringstream params;
+    //Format version, then everything that affects the result of training
+    params << "1 " << pAlphInfo->GetID() << " " << pAlphInfo->m_iConversionID << " " << pAlphInfo->iEnd
+           << " " << GetLongParameter(LP_LANGUAGE_MODEL_ID) << " " << GetLongParameter(LP_LM_MAX_ORDER)
+           << " " << GetLongParameter(LP_LM_UPDATE_EXCLUSION) << " " << GetLongParameter(LP_LM_MAX_MEMORY)
+           << " " << GetLongParameter(LP_LM_COUNT_BITS) << " " << GetLongParameter(LP_LM_CTW_TABLE_SIZE);
+    TrainedModelCache cache(pInterface, pLM, pAlphInfo->GetID(), params.str(), lister.m_vFiles);
+    if (cache.Load(pn)) {
+      cache.Save(); //if any new user text
+      ReportTrainingText(pInterface, pAlphInfo, pn.m_bUser, pn.m_bSystem);
+    } else if (pLM->CanAdoptModel()) {
+      //Leave the user writing with the (untrained) LM meanwhile; see ApplyBackgroundTraining.
+      m_pBackgroundTraining = new CBackgroundTraining(pInterface, m_pAlphabetManager, params.str(), lister.m_vFiles);
+    } else {
+      TrainOnFiles(pn, pLM, lister.m_vFiles);
+      cache.Save();
+      ReportTrainingText(pInterface, pAlphInfo, pn.m_bUser, pn.m_bSystem);
     }
     //3. Finished, so unlock.
     m_pInterface->SetLockStatus("", -1);
@@ -116,6 +386,8 @@ CNodeCreationManager::CNodeCreationManager(
 }
 
 CNodeCreationManager::~CNodeCreationManager() {
+  //stop training before deleting the alphabet it reads
+  delete m_pBackgroundTraining;
   delete m_pAlphabetManager;
   delete m_pTrainer;
   
@@ -158,6 +430,30 @@ void CNodeCreationManager::AddExtras(CDasherNode *pParent) {
 
 void 
 CNodeCreationManager::ImportTrainingText(const std::string &strPath) {
-  ProgressNotifier pn(m_pInterface, m_pTrainer);
-	pn.ParseFile(strPath, true);
+  //Bulk imports may be large: use every core (if the LM supports merging)
+  CShardedTrainer trainer(m_pInterface, m_pAlphabetManager, m_pAlphabetManager->GetLanguageModel(),
+                          std::max(1u, std::thread::hardware_concurrency()));
+  ProgressNotifier pn(m_pInterface, &trainer);
+  pn.ParseFile(strPath, true);
+}
+
+bool CNodeCreationManager::ApplyBackgroundTraining() {
+  if (!m_pBackgroundTraining || !m_pBackgroundTraining->Finished()) return false;
+  bool bUser, bSystem;
+  CLanguageModel *pTrained = m_pBackgroundTraining->Finish(m_pInterface, bUser, bSystem);
+  m_pAlphabetManager->GetLanguageModel()->AdoptModel(pTrained);
+  delete m_pBackgroundTraining;
+  m_pBackgroundTraining = NULL;
+  ReportTrainingText(m_pInterface, GetAlphabet(), bUser, bSystem);
+  return true;
+}
+
+string CNodeCreationManager::GetTrainingStatus() const {
+  if (!m_pBackgroundTraining) return "";
+  bool bUserText;
+  int iPercent = m_pBackgroundTraining->Progress(bUserText);
+  ostringstream os;
+  os << (bUserText ? _("Training on User Text") : _("Training on System Text"));
+  if (iPercent > 0) os << " " << iPercent << "%";
+  return os.str();
 }
@@ -58,6 +58,16 @@ class CNodeCreationManager : public Dasher::CSettingsUserObserver {
 
   void ImportTrainingText(const std::string &strPath);
 
+  ///If the LM has been trained in the background (i.e. on another thread, while the
+  /// user writes with whatever it has learnt so far), and training has now finished,
+  /// moves the trained model into the live LM. Existing contexts (e.g. in nodes) remain
+  /// valid. Call only between frames, i.e. when the LM is not otherwise in use.
+  /// \return true if the LM changed.
+  bool ApplyBackgroundTraining();
+
+  ///Text describing the progress of any training in the background; empty if none.
+  std::string GetTrainingStatus() const;
+
   unsigned long GetAlphNodeNormalization() {return m_iAlphNorm;}
   
   ///Called to add any non-alphabet (non-symbol) children to a top-level node (root or symbol).
@@ -77,6 +87,10 @@ class CNodeCreationManager : public Dasher::CSettingsUserObserver {
   
   ///Screen to use to create node labels
   Dasher::CDasherScreen *m_pScreen;
+
+  class CBackgroundTraining;
+  ///Training in progress on another thread, if any; NULL if none
+  CBackgroundTraining *m_pBackgroundTraining;
 };
 /// @}
 
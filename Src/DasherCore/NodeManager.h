@@ -1,10 +1,21 @@
 #ifndef __nodemanager_h__
 #define __nodemanager_h__
+
+#include <vector>
+
 namespace Dasher {
+  class CDasherNode;
   
   /// A marker class for anything that can be returned by CDasherNode::mgr()
   ///  - as a void* return type can't be covariantly overridden :-(
   class CNodeManager {
+  public:
+    virtual ~CNodeManager() {}
+    ///Called with nodes (all having this as mgr()) which are about to have
+    /// PopulateChildren called, e.g. those an expansion policy will expand this
+    /// frame, so that managers can do any work those need together (such as
+    /// computing language model predictions in one batch). Default does nothing.
+    virtual void PrepareToPopulate(const std::vector<CDasherNode *> &/*vNodes*/) {}
   };
 }
 #endif
@@ -64,6 +64,9 @@ const lp_table longparamtable[] = {
   {LP_LM_ALPHA, "LMAlpha", Persistence::PERSISTENT, 49, "LMAlpha"},
   {LP_LM_BETA, "LMBeta", Persistence::PERSISTENT, 77, "LMBeta"},
   {LP_LM_MIXTURE, "LMMixture", Persistence::PERSISTENT, 50, "LMMixture"},
+  {LP_LM_MAX_MEMORY, "LMMaxMemory", Persistence::PERSISTENT, 0, "Size in KB beyond which the PPM language model is aged and pruned (0 = unlimited)"},
+  {LP_LM_COUNT_BITS, "LMCountBits", Persistence::PERSISTENT, 0, "Bits in which the PPM language model stores each count of the text it was trained on, log-quantised (0 = exact; else 2-15, but exact if that needs no more)"},
+  {LP_LM_CTW_TABLE_SIZE, "LMCTWTableSize", Persistence::PERSISTENT, 4194304, "Number of slots (8 bytes each, rounded down to a power of 2) to which the CTW language model's table may grow"},
   {LP_LINE_WIDTH, "LineWidth", Persistence::PERSISTENT, 1, "Width to draw crosshair and mouse line"},
   {LP_GEOMETRY, "Geometry", Persistence::PERSISTENT, 0, "Screen geometry (mostly for tall thin screens) - 0=old-style, 1=square no-xhair, 2=squish, 3=squish+log"},
   {LP_LM_WORD_ALPHA, "WordAlpha", Persistence::PERSISTENT, 50, "Alpha value for word-based model"},
@@ -83,6 +86,7 @@ const lp_table longparamtable[] = {
 #else
   {LP_NODE_BUDGET, "NodeBudget", Persistence::PERSISTENT, 3000, "Target (min) number of node objects to maintain"},
 #endif
+  {LP_EXPANSION_TIME, "ExpansionTime", Persistence::PERSISTENT, 0, "Milliseconds per frame to spend expanding nodes, timed (0 = expand a fixed number per frame instead)"},
   {LP_OUTLINE_WIDTH, "OutlineWidth", Persistence::PERSISTENT, 0, "Absolute value is line width to draw boxes (fill iff >=0)" },
   {LP_MIN_NODE_SIZE, "MinNodeSize", Persistence::PERSISTENT, 50, "Minimum size of node (in dasher coords) to draw" }, 
 #ifdef WITH_MAEMO
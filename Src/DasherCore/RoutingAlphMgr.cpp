@@ -53,8 +53,8 @@ void CRoutingAlphMgr::InitMap() {
   }
 }
 
-void CRoutingAlphMgr::CreateLanguageModel() {
-  m_pLanguageModel = new CRoutingPPMLanguageModel(this, &m_vBaseSyms, &m_vRoutes, m_pAlphabet->m_iConversionID==4);
+CLanguageModel *CRoutingAlphMgr::CreateLanguageModel() {
+  return new CRoutingPPMLanguageModel(this, &m_vBaseSyms, &m_vRoutes, m_pAlphabet->m_iConversionID==4);
 }
 
 string CRoutingAlphMgr::CRoutedSym::trainText() {
@@ -105,19 +105,17 @@ CDasherNode *CRoutingAlphMgr::CreateSymbolNode(CAlphNode *pParent, symbol iSymbo
   if (m_pAlphabet->GetText(iSymbol)=="\r\n") iNewOffset++;
   CSymbolNode *pAlphNode = new CRoutedSym(iNewOffset, m_vLabels[iSymbol], this, iSymbol);
   
-  pAlphNode->iContext = m_pLanguageModel->CloneContext(pParent->iContext);
-  
   //namely, we want to enter only the BASE symbol into the LM, not the route
   // (which would be out of range):
-  m_pLanguageModel->EnterSymbol(pAlphNode->iContext, m_vBaseSyms[iSymbol]);
+  pAlphNode->DeferContext(pParent->context(), m_vBaseSyms[iSymbol]);
   // (Unfortunately, we can't make EnterSymbol take route numbers, because
   // it has base symbols passed to it from the alphabet map)
   return pAlphNode;
 
 }
 
-CRoutingAlphMgr::CRoutingTrainer::CRoutingTrainer(CMessageDisplay *pMsgs, CRoutingAlphMgr *pMgr)
-: CTrainer(pMsgs, pMgr->m_pLanguageModel, pMgr->m_pAlphabet, &pMgr->m_map), m_pMgr(pMgr) {
+CRoutingAlphMgr::CRoutingTrainer::CRoutingTrainer(CMessageDisplay *pMsgs, CRoutingAlphMgr *pMgr, CLanguageModel *pLM)
+: CTrainer(pMsgs, pLM, pMgr->m_pAlphabet, &pMgr->m_map), m_pMgr(pMgr) {
   
   m_iStartSym=0;  
   vector<symbol> trainStartSyms;
@@ -185,9 +183,9 @@ void CRoutingAlphMgr::CRoutingTrainer::Train(CAlphabetMap::SymbolStream &syms) {
 }
 
 
-CTrainer *CRoutingAlphMgr::GetTrainer() {
+CTrainer *CRoutingAlphMgr::GetTrainer(CMessageDisplay *pMsgs, CLanguageModel *pLM) {
   //We pass in the pinyin alphabet to define the context-switch escape character, and the default context.
   // Although the default context will be symbolified via the _chinese_ alphabet, this seems reasonable
   // as it is the Pinyin alphabet which defines the conversion mapping (i.e. m_strConversionTarget!)
-  return new CRoutingTrainer(m_pInterface, this);
+  return new CRoutingTrainer(pMsgs, this, pLM);
 }
@@ -46,7 +46,7 @@ namespace Dasher {
     CRoutingAlphMgr(CSettingsUser *pCreator, CDasherInterfaceBase *pInterface, CNodeCreationManager *pNCManager, const CAlphInfo *pAlphabet);
     
     ///Override to return a CRoutingTrainer
-    CTrainer *GetTrainer();
+    CTrainer *GetTrainer(CMessageDisplay *pMsgs, CLanguageModel *pLM);
     
     ///Disable game mode. The target sentence might appear in several places...!!
     CWordGeneratorBase *GetGameWords() {return NULL;}
@@ -56,7 +56,7 @@ namespace Dasher {
     /// and m_vGroupsByRoute to record which symbols were identified together.
     void InitMap();
     ///Override to create a RoutingPPMLanguageModel
-    void CreateLanguageModel();
+    CLanguageModel *CreateLanguageModel();
 
     ///Creates a symbol, i.e. including route.
     /// Both ctx and sym were reconstructed from m_map (filled by InitMap), so
@@ -99,7 +99,7 @@ namespace Dasher {
     /// is specified, somewhat better than PPMPY).
     class CRoutingTrainer : public CTrainer {
     public:
-      CRoutingTrainer(CMessageDisplay *pMsgs, CRoutingAlphMgr *pMgr);
+      CRoutingTrainer(CMessageDisplay *pMsgs, CRoutingAlphMgr *pMgr, CLanguageModel *pLM);
     protected:
       //override...
       virtual void Train(CAlphabetMap::SymbolStream &syms);
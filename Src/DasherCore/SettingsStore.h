@@ -136,14 +136,11 @@ private:
   /// SettingsUsers (i.e. in a tree), so _could_ be modified to copy a SettingsStore
   /// pointer from the creator to inherit settings.
   class CSettingsUser {
-  private:
-    friend class CDasherInterfaceBase;
+  public:
     ///Create the root of the SettingsUser hierarchy from a SettingsStore.
-    /// ATM we allow only one SettingsStore, so this c'tor is private and 
-    /// used only by the DasherInterface; if/when multiple SettingsStores
-    /// are used, could be made public.
+    /// ATM we allow only one SettingsStore, so this should be used only once: by
+    /// the DasherInterface, or by a standalone tool (e.g. benchmark) in its place.
     CSettingsUser(CSettingsStore *pSettingsStore);
-  public:
     virtual ~CSettingsUser();
   protected:
     ///Create a new SettingsUser, inheriting+sharing settings from the creator.
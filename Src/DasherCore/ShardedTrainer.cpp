@@ -0,0 +1,148 @@
+#include "../Common/Common.h"
+
+#include "ShardedTrainer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace Dasher;
+using namespace std;
+
+// Track memory leaks on Windows to the line that new'd the memory
+#ifdef _WIN32
+#ifdef _DEBUG_MEMLEAKS
+#define DEBUG_NEW new( _NORMAL_BLOCK, THIS_FILE, __LINE__ )
+#define new DEBUG_NEW
+#undef THIS_FILE
+static char THIS_FILE[] = __FILE__;
+#endif
+#endif
+
+//Collects messages from trainers on any thread, to be passed on later from the main one.
+class QueuedMessages : public CMessageDisplay {
+public:
+  void Message(const string &strText, bool bInterrupt) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_vMessages.push_back(pair<string,bool>(strText, bInterrupt));
+  }
+  ///Passes on each distinct message once, in the order first received
+  void Flush(CMessageDisplay *pMsgs) {
+    set<string> seen;
+    for (vector<pair<string,bool> >::iterator it=m_vMessages.begin(); it!=m_vMessages.end(); it++)
+      if (seen.insert(it->first).second) pMsgs->Message(it->first, it->second);
+    m_vMessages.clear();
+  }
+private:
+  std::mutex m_mutex;
+  vector<pair<string,bool> > m_vMessages;
+};
+
+//Records the progress of one shard, for the main thread to poll.
+class ShardProgress : public CTrainer::ProgressIndicator {
+public:
+  ShardProgress() : m_iBytes(0) {}
+  void bytesRead(off_t n) {m_iBytes = n;}
+  std::atomic<off_t> m_iBytes;
+};
+
+CShardedTrainer::CShardedTrainer(CMessageDisplay *pMsgs, ModelSource *pSource, CLanguageModel *pLanguageModel, int iShards)
+: AbstractParser(pMsgs), m_pSource(pSource), m_pLanguageModel(pLanguageModel), m_iShards(iShards), m_pProg(NULL) {
+}
+
+bool CShardedTrainer::Parse(const string &strDesc, istream &in, bool bUser) {
+  if (in.fail()) {
+    m_pMsgs->FormatMessageWithString(_("Unable to open file \"%s\" for reading"),strDesc.c_str());
+    return false;
+  }
+  const string strText((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+  //Shard boundaries: just after the first newline following each equal division
+  vector<size_t> vStarts(1, 0);
+  const int iShards = m_pLanguageModel->CanAdoptModel()
+    ? min<size_t>(m_iShards, strText.size() / MIN_SHARD_BYTES) : 1;
+  for (int i=1; i<iShards; i++) {
+    size_t iPos = strText.find('\n', (strText.size()*i)/iShards);
+    if (iPos==string::npos) break;
+    if (++iPos > vStarts.back() && iPos < strText.size()) vStarts.push_back(iPos);
+  }
+  vStarts.push_back(strText.size());
+  const int iCount = vStarts.size()-1;
+
+  if (iCount<=1) {
+    //Not worth it (or not possible): train in place, exactly as CTrainer would.
+    CTrainer *pTrainer = m_pSource->GetTrainer(m_pMsgs, m_pLanguageModel);
+    pTrainer->SetProgressIndicator(m_pProg);
+    istringstream is(strText);
+    bool bRes = pTrainer->Parse(strDesc, is, bUser);
+    delete pTrainer;
+    return bRes;
+  }
+
+  //Models, trainers and streams are created here on the main thread (e.g. as the
+  // trainers may report problems in the alphabet), but only used by one worker each.
+  QueuedMessages msgs;
+  vector<CLanguageModel *> vModels;
+  vector<CTrainer *> vTrainers;
+  vector<istringstream *> vStreams;
+  vector<ShardProgress> vProgress(iCount);
+  for (int i=0; i<iCount; i++) {
+    vModels.push_back(m_pSource->CreateLanguageModel());
+    vTrainers.push_back(m_pSource->GetTrainer(&msgs, vModels.back()));
+    vTrainers.back()->SetProgressIndicator(&vProgress[i]);
+    vStreams.push_back(new istringstream(strText.substr(vStarts[i], vStarts[i+1]-vStarts[i])));
+  }
+
+  vector<char> vResults(iCount, false);
+  int iRunning(iCount);
+  std::mutex mutex;
+  std::condition_variable done;
+  vector<std::thread> vThreads;
+  for (int i=0; i<iCount; i++)
+    vThreads.push_back(std::thread([&, i]() {
+      vResults[i] = vTrainers[i]->Parse(strDesc, *vStreams[i], bUser);
+      std::lock_guard<std::mutex> lock(mutex);
+      --iRunning;
+      done.notify_one();
+    }));
+  //Report overall progress while waiting (from this thread, as the indicator may
+  // e.g. update the display)
+  for (std::unique_lock<std::mutex> lock(mutex); iRunning > 0; ) {
+    done.wait_for(lock, std::chrono::milliseconds(100));
+    if (m_pProg) {
+      off_t iTotal = 0;
+      for (int i=0; i<iCount; i++) iTotal += vProgress[i].m_iBytes;
+      m_pProg->bytesRead(iTotal);
+    }
+  }
+  for (int i=0; i<iCount; i++) vThreads[i].join();
+  vThreads.clear();
+
+  //Merge pairwise, in parallel, into the first shard's model...
+  for (int iStep=1; iStep<iCount; iStep*=2) {
+    for (int i=0; i+iStep<iCount; i+=2*iStep)
+      vThreads.push_back(std::thread(&CLanguageModel::MergeModel, vModels[i], vModels[i+iStep]));
+    for (vector<std::thread>::iterator it=vThreads.begin(); it!=vThreads.end(); it++) it->join();
+    vThreads.clear();
+  }
+  //...and then that into the target. AdoptModel takes over the merged trie, and adds
+  // in whatever the target had already; for a bulk import, that is usually the smaller.
+  m_pLanguageModel->AdoptModel(vModels[0]);
+
+  bool bRes = true;
+  for (int i=0; i<iCount; i++) {
+    bRes = bRes && vResults[i];
+    delete vStreams[i];
+    delete vTrainers[i];
+    delete vModels[i];
+  }
+  msgs.Flush(m_pMsgs);
+  return bRes;
+}
@@ -0,0 +1,62 @@
+#ifndef __sharded_trainer_h__
+#define __sharded_trainer_h__
+
+#include "Trainer.h"
+
+#include <string>
+#include <istream>
+
+namespace Dasher {
+  ///Trains a language model on a large text using several threads. The text is split
+  /// at paragraph boundaries (newlines) into shards, each of which is trained by its own
+  /// CTrainer into a fresh model on a separate thread; those models are then merged
+  /// pairwise (also in parallel, via MergeModel) and the result moved into the target
+  /// model (via AdoptModel).
+  ///
+  /// The result is close to, but not exactly, what training the whole text sequentially
+  /// with a single CTrainer would produce:
+  /// (1) each shard starts from an empty context, so at most (max order) symbols after
+  ///     each shard boundary are learnt in a shorter context than they would have been;
+  /// (2) with update exclusion, a shard adds to the counts of lower-order nodes whenever
+  ///     it first creates the corresponding higher-order node, even if another shard
+  ///     created that node too; so lower-order counts may exceed those from sequential
+  ///     training by up to one per shard for each such node.
+  /// Without update exclusion the merge itself is exact, leaving only (1).
+  ///
+  /// Texts too small to give each shard at least MIN_SHARD_BYTES, and models which do
+  /// not support merging (see CLanguageModel::CanAdoptModel), are trained sequentially.
+  class CShardedTrainer : public AbstractParser {
+  public:
+    ///Source of fresh models and of trainers for them; implemented by CAlphabetManager.
+    class ModelSource {
+    public:
+      virtual CLanguageModel *CreateLanguageModel()=0;
+      virtual CTrainer *GetTrainer(CMessageDisplay *pMsgs, CLanguageModel *pLM)=0;
+    };
+
+    ///Smallest piece of text worth training on a separate thread
+    static const size_t MIN_SHARD_BYTES = 256*1024;
+
+    /// \param pSource to create the per-shard models and trainers
+    /// \param pLanguageModel model into which to merge everything learnt; must not be
+    /// used by any other thread during Parse.
+    /// \param iShards maximum number of shards, i.e. of threads, to use
+    CShardedTrainer(CMessageDisplay *pMsgs, ModelSource *pSource, CLanguageModel *pLanguageModel, int iShards);
+
+    ///Progress is reported (on the thread calling Parse) as the total number of bytes
+    /// trained so far, summed over all shards.
+    void SetProgressIndicator(CTrainer::ProgressIndicator *pProg) {m_pProg = pProg;}
+
+    ///Reads the whole stream and trains on it; bUser ignored. Messages from the
+    /// per-shard trainers are passed on (once each) when training has finished.
+    bool Parse(const std::string &strDesc, std::istream &in, bool bUser);
+
+  private:
+    ModelSource * const m_pSource;
+    CLanguageModel * const m_pLanguageModel;
+    const int m_iShards;
+    CTrainer::ProgressIndicator *m_pProg;
+  };
+}
+
+#endif
@@ -41,6 +41,9 @@ static UserLogParamMask s_UserLogParamMaskTable [] = {
   {LP_LM_ALPHA,             userLogParamOutputToSimple},
   {LP_LM_BETA,              userLogParamOutputToSimple},
   {LP_LM_MIXTURE,           userLogParamOutputToSimple},
+  {LP_LM_MAX_MEMORY,        userLogParamOutputToSimple},
+  {LP_LM_COUNT_BITS,        userLogParamOutputToSimple},
+  {LP_LM_CTW_TABLE_SIZE,    userLogParamOutputToSimple},
   {LP_LM_WORD_ALPHA,        userLogParamOutputToSimple},
   {-1, -1}  // Flag value that should always be at the end
 };
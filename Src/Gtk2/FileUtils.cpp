@@ -52,3 +52,19 @@ bool FileUtils::WriteUserDataFile(const std::string &filename, const std::string
   fclose(f);
   return written == strNewText.length();
 }
+
+long FileUtils::GetFileModificationTime(const std::string &strFileName) {
+  struct stat sStatInfo;
+
+  if(!stat(strFileName.c_str(), &sStatInfo))
+    return sStatInfo.st_mtime;
+  else
+    return 0;
+}
+
+std::string FileUtils::GetUserDataFilePath(const std::string &filename) {
+  std::string strFilename = getenv("HOME");
+  strFilename += "/.dasher/";
+  mkdir(strFilename.c_str(), S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+  return strFilename + filename;
+}
@@ -0,0 +1,105 @@
+// bounded_ppm.cpp
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+// Benchmark for the memory-bounded PPM model (LP_LM_MAX_MEMORY): for each budget
+// given, trains a PPM model on the first 90% of a file and then reports the bits per
+// symbol with which it predicts the remaining 10% (learning as it goes, as when the
+// user writes), along with the size of the trie, compared against an unbounded model.
+//
+// Usage: BoundedPPM <alphabet file> <alphabet ID> <training file> <budget in KB>...
+// e.g.   BoundedPPM Data/alphabets/alphabet.english.xml "English with limited punctuation" Data/training/training_english_GB.txt 4096 2048 1024 512
+
+#include "../../Common/Common.h"
+#include "../../DasherCore/SettingsStore.h"
+#include "../../DasherCore/LanguageModelling/PPMLanguageModel.h"
+#include "../../DasherCore/Alphabet/AlphIO.h"
+#include "../../DasherCore/Alphabet/AlphabetMap.h"
+#include "test_support.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+using namespace Dasher;
+using namespace std;
+
+class ConsoleMessages : public CMessageDisplay {
+public:
+  void Message(const string &strText, bool bInterrupt) {
+    cerr << strText << endl;
+  }
+};
+
+///Bits per symbol with which pLM predicts vSyms, learning each after predicting it
+static double BitsPerSymbol(CLanguageModel *pLM, const vector<symbol> &vSyms) {
+  const int iNorm(1<<16), iUniform(iNorm/20);
+  CLanguageModel::Context ctx = pLM->CreateEmptyContext();
+  vector<unsigned int> vProbs;
+  double dBits = 0;
+  for (vector<symbol>::const_iterator it = vSyms.begin(); it != vSyms.end(); it++) {
+    pLM->GetProbs(ctx, vProbs, iNorm, iUniform);
+    dBits -= log(double(vProbs[*it]) / iNorm) / log(2.0);
+    pLM->LearnSymbol(ctx, *it);
+  }
+  pLM->ReleaseContext(ctx);
+  return vSyms.empty() ? 0 : dBits / vSyms.size();
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 5) {
+    cerr << "Usage: " << argv[0] << " <alphabet file> <alphabet ID> <training file> <budget in KB>..." << endl;
+    return 1;
+  }
+  ConsoleMessages msgs;
+  CAlphIO alphIO(&msgs);
+  alphIO.ParseFile(argv[1], false);
+  const CAlphInfo *pInfo = alphIO.GetInfo(argv[2]);
+
+  //as CAlphabetManager::InitMap
+  CAlphabetMap map;
+  int iPara = pInfo->GetParagraphSymbol();
+  if (iPara) map.AddParagraphSymbol(iPara);
+  for (int i = 1; i < pInfo->iEnd; i++)
+    if (i!=iPara) map.Add(pInfo->GetText(i), i);
+
+  vector<symbol> vSyms;
+  ifstream in(argv[3], ios::binary);
+  CAlphabetMap::SymbolStream syms(in);
+  for (symbol sym; (sym = syms.next(&map)) != -1; )
+    if (sym) vSyms.push_back(sym); //skip anything not in alphabet
+  const vector<symbol> vTrain(vSyms.begin(), vSyms.begin() + vSyms.size()*9/10);
+  const vector<symbol> vTest(vSyms.begin() + vTrain.size(), vSyms.end());
+
+  TestSettings settings;
+  TestUser user(&settings);
+
+  cout << "budget KB\tnodes\tKB used\ttrain secs\tbits/symbol\tvs unbounded" << endl;
+  //unbounded (0) first, as the baseline
+  vector<long> vBudgets(1, 0);
+  for (int iArg = 4; iArg < argc; iArg++) vBudgets.push_back(atol(argv[iArg]));
+  double dBase = 0;
+  for (vector<long>::const_iterator itB = vBudgets.begin(); itB != vBudgets.end(); itB++) {
+    const long iBudget = *itB;
+    settings.SetLongParameter(LP_LM_MAX_MEMORY, iBudget);
+    CPPMLanguageModel lm(&user, pInfo->iEnd-1);
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    CLanguageModel::Context ctx = lm.CreateEmptyContext();
+    for (vector<symbol>::const_iterator it = vTrain.begin(); it != vTrain.end(); it++)
+      lm.LearnSymbol(ctx, *it);
+    lm.ReleaseContext(ctx);
+    const double dSecs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    const double dBits = BitsPerSymbol(&lm, vTest);
+    if (iBudget == 0) dBase = dBits;
+    cout << iBudget << "\t" << lm.NumNodes() << "\t" << lm.BytesUsed()/1024 << "\t" << dSecs
+         << "\t" << dBits << "\t" << (dBase ? 100.0*(dBits-dBase)/dBase : 0) << "%" << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+// concurrent_ppm_test.cpp
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+// Test of CPPMLanguageModel's support for reading while learning: one thread learns a
+// pseudo-random text while others repeatedly create contexts, enter symbols into them,
+// and call GetProbs and GetProbsBatch, checking every distribution is well-formed
+// (nonzero for every symbol, summing to the norm). Then checks the model gives the same
+// probabilities as one which learnt the same text with nothing else going on (so, that
+// nothing the readers did, inc. caching distributions, changed what was learnt).
+// Repeated with the trie limited in size, so the readers also have to wait for pruning.
+//
+// Usage: ConcurrentPPMTest (exits with non-zero status on failure)
+
+#include "../../Common/Common.h"
+#include "../../DasherCore/SettingsStore.h"
+#include "../../DasherCore/LanguageModelling/PPMLanguageModel.h"
+#include "test_support.h"
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+
+using namespace Dasher;
+using namespace std;
+
+static const int NUM_SYMS = 60;
+static const int TRAIN_LENGTH = 200000;
+static const int TEST_LENGTH = 2000;
+static const int NUM_READERS = 3;
+static const int NORM = 1<<16, UNIFORM = NORM/20;
+
+///A probability for each symbol (inc. 0), nonzero except for 0, summing to NORM
+static bool WellFormed(const vector<unsigned int> &vProbs) {
+  if (vProbs.size() != static_cast<size_t>(NUM_SYMS) + 1 || vProbs[0]) return false;
+  unsigned int iTotal = 0;
+  for (size_t i = 1; i < vProbs.size(); i++) {
+    if (!vProbs[i]) return false;
+    iTotal += vProbs[i];
+  }
+  return iTotal == NORM;
+}
+
+///Until bDone, reads distributions from random points in the text; returns the number not well-formed
+static int Read(CPPMLanguageModel *pLM, const vector<symbol> *pText, unsigned int iSeed, const atomic<bool> *pbDone) {
+  CRandom rand(iSeed);
+  int iBad = 0;
+  vector<unsigned int> vProbs, vProbs2;
+  while (!*pbDone) {
+    CLanguageModel::Context ctx = pLM->CreateEmptyContext();
+    const int iStart = rand.next(TRAIN_LENGTH);
+    for (int i = iStart, iEnd = iStart + rand.next(20); i < iEnd; i++) pLM->EnterSymbol(ctx, (*pText)[i]);
+    pLM->GetProbs(ctx, vProbs, NORM, UNIFORM);
+    if (!WellFormed(vProbs)) iBad++;
+    CLanguageModel::Context ctx2 = pLM->CloneContext(ctx);
+    pLM->EnterSymbol(ctx2, 1 + rand.next(NUM_SYMS - 1));
+    vector<CLanguageModel::ProbsRequest> vRequests;
+    vRequests.push_back(make_pair(ctx, &vProbs));
+    vRequests.push_back(make_pair(ctx2, &vProbs2));
+    pLM->GetProbsBatch(vRequests, NORM, UNIFORM);
+    if (!WellFormed(vProbs) || !WellFormed(vProbs2)) iBad++;
+    pLM->ReleaseContext(ctx2);
+    pLM->ReleaseContext(ctx);
+  }
+  return iBad;
+}
+
+static void Learn(CPPMLanguageModel *pLM, const vector<symbol> *pText, atomic<bool> *pbDone) {
+  CLanguageModel::Context ctx = pLM->CreateEmptyContext();
+  for (int i = 0; i < TRAIN_LENGTH; i++) pLM->LearnSymbol(ctx, (*pText)[i]);
+  pLM->ReleaseContext(ctx);
+  *pbDone = true;
+}
+
+///Hash of the distributions predicting the test text
+static uint64 Test(CPPMLanguageModel &lm, const vector<symbol> &vText) {
+  uint64 iHash = 14695981039346656037ULL;
+  CLanguageModel::Context ctx = lm.CreateEmptyContext();
+  vector<unsigned int> vProbs;
+  for (int i = TRAIN_LENGTH; i < TRAIN_LENGTH + TEST_LENGTH; i++) {
+    lm.GetProbs(ctx, vProbs, NORM, UNIFORM);
+    for (vector<unsigned int>::const_iterator it = vProbs.begin(); it != vProbs.end(); it++)
+      Hash(iHash, *it);
+    lm.EnterSymbol(ctx, vText[i]);
+  }
+  lm.ReleaseContext(ctx);
+  return iHash;
+}
+
+int main(int argc, char *argv[]) {
+  vector<symbol> vText;
+  MakeText(vText, NUM_SYMS, TRAIN_LENGTH + TEST_LENGTH, 12345);
+
+  TestSettings settings;
+  TestUser user(&settings);
+  int iFailures = 0;
+  for (int iPruned = 0; iPruned < 2; iPruned++) {
+    settings.SetLongParameter(LP_LM_MAX_MEMORY, iPruned ? 256 : 0);
+    CPPMLanguageModel lm(&user, NUM_SYMS);
+    atomic<bool> bDone(false);
+    int aiBad[NUM_READERS];
+    vector<thread> vReaders;
+    for (int i = 0; i < NUM_READERS; i++)
+      vReaders.push_back(thread([&lm, &vText, &bDone, &aiBad, i]() {aiBad[i] = Read(&lm, &vText, 1 + i, &bDone);}));
+    thread writer(Learn, &lm, &vText, &bDone);
+    writer.join();
+    int iBad = 0;
+    for (int i = 0; i < NUM_READERS; i++) {
+      vReaders[i].join();
+      iBad += aiBad[i];
+    }
+    cout << (iPruned ? "pruned: " : "unbounded: ") << iBad << " bad distributions";
+    if (iBad) iFailures++;
+    if (!iPruned) {
+      //(if pruned, what is kept depends on the readers' contexts at the time)
+      CPPMLanguageModel ref(&user, NUM_SYMS);
+      atomic<bool> bRefDone(false);
+      Learn(&ref, &vText, &bRefDone);
+      const bool bSame = Test(lm, vText) == Test(ref, vText);
+      cout << (bSame ? ", same as learnt alone" : ", DIFFERENT from learnt alone");
+      if (!bSame) iFailures++;
+    }
+    cout << endl;
+  }
+  return iFailures ? 1 : 0;
+}
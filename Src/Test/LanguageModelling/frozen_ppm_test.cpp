@@ -0,0 +1,167 @@
+// frozen_ppm_test.cpp
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+// Test of CPPMLanguageModel::FreezeModel: a model frozen part way through learning a
+// pseudo-random text (so, learning the rest into an overlay on its static tier) must
+// give exactly the same probabilities, at every point in a test text, as one which
+// was never frozen; with and without update exclusion. Likewise after freezing again,
+// after writing the model to file and reading it back, and after merging a frozen
+// model into another. Also that a model frozen with quantised counts (LP_LM_COUNT_BITS)
+// reads back from file the same, and is exact if quantised into more bits than exact
+// counts need; and that GetProb agrees with GetProbs.
+//
+// Usage: FrozenPPMTest (exits with non-zero status on failure)
+
+#include "../../Common/Common.h"
+#include "../../DasherCore/SettingsStore.h"
+#include "../../DasherCore/LanguageModelling/PPMLanguageModel.h"
+#include "test_support.h"
+
+#include <cstdio>
+#include <iostream>
+
+using namespace Dasher;
+using namespace std;
+
+static const int NUM_SYMS = 60;
+static const int TRAIN_LENGTH = 100000;
+static const int TEST_LENGTH = 2000;
+static const int NORM = 1<<16, UNIFORM = NORM/20;
+static const char *const MODEL_FILE = "frozen_ppm_test.dlm";
+
+///Learns symbols [iFrom, iTo) of the text, in a context which has already learnt
+/// (or entered) everything before iFrom
+static void Learn(CLanguageModel &lm, CLanguageModel::Context ctx, const vector<symbol> &vText, int iFrom, int iTo) {
+  for (int i = iFrom; i < iTo; i++) lm.LearnSymbol(ctx, vText[i]);
+}
+
+///Hash of the distributions predicting the test text, got singly and in batches
+static uint64 Test(CLanguageModel &lm, const vector<symbol> &vText) {
+  uint64 iHash = 14695981039346656037ULL;
+  CLanguageModel::Context ctx = lm.CreateEmptyContext();
+  vector<unsigned int> vProbs, vProbs2;
+  for (int i = TRAIN_LENGTH; i < TRAIN_LENGTH + TEST_LENGTH; i++) {
+    lm.GetProbs(ctx, vProbs, NORM, UNIFORM);
+    //and the distribution after the next symbol, together with this one
+    CLanguageModel::Context ctx2 = lm.CloneContext(ctx);
+    lm.EnterSymbol(ctx2, vText[i]);
+    vector<CLanguageModel::ProbsRequest> vRequests;
+    vRequests.push_back(make_pair(ctx2, &vProbs2));
+    vRequests.push_back(make_pair(ctx, &vProbs));
+    lm.GetProbsBatch(vRequests, NORM, UNIFORM);
+    lm.ReleaseContext(ctx2);
+    for (vector<unsigned int>::const_iterator it = vProbs.begin(); it != vProbs.end(); it++)
+      Hash(iHash, *it);
+    for (vector<unsigned int>::const_iterator it = vProbs2.begin(); it != vProbs2.end(); it++)
+      Hash(iHash, *it);
+    lm.EnterSymbol(ctx, vText[i]);
+  }
+  lm.ReleaseContext(ctx);
+  return iHash;
+}
+
+///Number of points in the test text at which GetProb differs from GetProbs
+static int ProbMismatches(CLanguageModel &lm, const vector<symbol> &vText) {
+  int iMismatches = 0;
+  CLanguageModel::Context ctx = lm.CreateEmptyContext();
+  vector<unsigned int> vProbs;
+  for (int i = TRAIN_LENGTH; i < TRAIN_LENGTH + TEST_LENGTH; i++) {
+    lm.GetProbs(ctx, vProbs, NORM, UNIFORM);
+    if (lm.GetProb(ctx, vText[i], NORM, UNIFORM) != vProbs[vText[i]]) iMismatches++;
+    lm.EnterSymbol(ctx, vText[i]);
+  }
+  lm.ReleaseContext(ctx);
+  return iMismatches;
+}
+
+static int Check(const char *szWhat, uint64 iHash, uint64 iExpected) {
+  cout << "  " << szWhat << (iHash == iExpected ? ": same" : ": DIFFERENT") << endl;
+  return iHash == iExpected ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  vector<symbol> vText, vOther;
+  MakeText(vText, NUM_SYMS, TRAIN_LENGTH + TEST_LENGTH, 12345);
+  MakeText(vOther, NUM_SYMS, TRAIN_LENGTH + TEST_LENGTH, 54321);
+
+  TestSettings settings;
+  TestUser user(&settings);
+  int iFailures = 0;
+  for (int iExclusion = 0; iExclusion < 2; iExclusion++) {
+    settings.SetLongParameter(LP_LM_UPDATE_EXCLUSION, iExclusion);
+    cout << "update exclusion " << iExclusion << ":" << endl;
+
+    //Never frozen
+    CPPMLanguageModel ref(&user, NUM_SYMS);
+    CLanguageModel::Context ctx = ref.CreateEmptyContext();
+    Learn(ref, ctx, vText, 0, TRAIN_LENGTH * 3 / 4);
+    const uint64 iRefPart = Test(ref, vText);
+    Learn(ref, ctx, vText, TRAIN_LENGTH * 3 / 4, TRAIN_LENGTH);
+    ref.ReleaseContext(ctx);
+    const uint64 iRef = Test(ref, vText);
+
+    //Frozen part way through, then again later; the learning context lives throughout
+    CPPMLanguageModel lm(&user, NUM_SYMS);
+    ctx = lm.CreateEmptyContext();
+    Learn(lm, ctx, vText, 0, TRAIN_LENGTH / 2);
+    lm.FreezeModel();
+    Learn(lm, ctx, vText, TRAIN_LENGTH / 2, TRAIN_LENGTH * 3 / 4);
+    iFailures += Check("frozen once", Test(lm, vText), iRefPart);
+    lm.FreezeModel();
+    Learn(lm, ctx, vText, TRAIN_LENGTH * 3 / 4, TRAIN_LENGTH);
+    lm.ReleaseContext(ctx);
+    iFailures += Check("frozen twice", Test(lm, vText), iRef);
+    iFailures += Check("GetProb, unfrozen", ProbMismatches(ref, vText), 0);
+    iFailures += Check("GetProb, frozen", ProbMismatches(lm, vText), 0);
+
+    //Written (static tier and overlay) and read back
+    CPPMLanguageModel loaded(&user, NUM_SYMS);
+    const bool bRead = static_cast<CLanguageModel &>(lm).WriteToFile(MODEL_FILE)
+      && static_cast<CLanguageModel &>(loaded).ReadFromFile(MODEL_FILE);
+    remove(MODEL_FILE);
+    iFailures += Check("read from file", bRead ? Test(loaded, vText) : 0, iRef);
+
+    //Merging another text into a frozen model, and a frozen model into another
+    CPPMLanguageModel other(&user, NUM_SYMS);
+    ctx = other.CreateEmptyContext();
+    Learn(other, ctx, vOther, 0, TRAIN_LENGTH);
+    other.ReleaseContext(ctx);
+    ref.MergeModel(&other);
+    lm.MergeModel(&other);
+    const uint64 iMerged = Test(ref, vText);
+    iFailures += Check("other merged in", Test(lm, vText), iMerged);
+    //(merging is not quite the same as learning the same text, so compare with a merge)
+    CPPMLanguageModel merged(&user, NUM_SYMS), mergedRef(&user, NUM_SYMS);
+    merged.MergeModel(&other);
+    merged.MergeModel(&lm);
+    mergedRef.MergeModel(&other);
+    mergedRef.MergeModel(&ref);
+    iFailures += Check("merged into another", Test(merged, vText), Test(mergedRef, vText));
+
+    //Quantised counts are only approximate, but must be read back as written
+    // (2 bits, as exact counts of this text need only 3)
+    settings.SetLongParameter(LP_LM_COUNT_BITS, 2);
+    CPPMLanguageModel quantised(&user, NUM_SYMS), quantisedLoaded(&user, NUM_SYMS);
+    quantised.MergeModel(&ref);
+    quantised.FreezeModel();
+    //...and quantising into more bits than that stores them exactly
+    settings.SetLongParameter(LP_LM_COUNT_BITS, 8);
+    CPPMLanguageModel wide(&user, NUM_SYMS), exact(&user, NUM_SYMS);
+    wide.MergeModel(&ref);
+    wide.FreezeModel();
+    settings.SetLongParameter(LP_LM_COUNT_BITS, 0);
+    exact.MergeModel(&ref);
+    exact.FreezeModel();
+    iFailures += Check("quantised into more bits than exact", Test(wide, vText), Test(exact, vText));
+    const bool bQuantisedRead = static_cast<CLanguageModel &>(quantised).WriteToFile(MODEL_FILE)
+      && static_cast<CLanguageModel &>(quantisedLoaded).ReadFromFile(MODEL_FILE);
+    remove(MODEL_FILE);
+    iFailures += Check("quantised, read from file", bQuantisedRead ? Test(quantisedLoaded, vText) : 0, Test(quantised, vText));
+  }
+  return iFailures ? 1 : 0;
+}
@@ -6,175 +6,306 @@
 //
 /////////////////////////////////////////////////////////////////////////////
 
-// LanguageModel test application
+// lmbench: compares the language models. Each model is trained on one file, then
+// asked to predict another (held-out) file, reporting for each:
+//  - bits per character (i.e. per symbol of the alphabet) on the held-out text;
+//  - training speed, in symbols learnt per second;
+//  - GetProbs calls per second (while predicting the held-out text);
+//  - peak resident memory of the process, in KB. Each model is run in a separate
+//    process, so this is per model, but includes the text and alphabet (loaded first);
+//  - number of nodes in the model, and bytes they take, where that means something.
+// Results are written as a table to stdout, and optionally as JSON to a file.
+//
+// CPPMPYLanguageModel is given the same alphabet for both its Chinese (context) and
+// pinyin (predicted) symbols, learning each symbol as both (note it is fixed at order 2).
+//
+// Usage: lmbench [options] <alphabet file> <alphabet ID> <training file> <test file>
+//  --models m1,m2,...  models to run, from ppm, word, mixture, ctw, ppmpy (default all)
+//  --json <file>       also write the results, as JSON, to <file>
+//  --learn             learn the test text while predicting it (as Dasher learns what
+//                      the user writes), rather than just entering it
+//  --freeze            freeze each model (FreezeModel) after training, as Dasher does
+//                      after training on the system text
+//  --param <name>=<n>  set a long parameter (by its registry name, e.g. LMMaxOrder=6)
+// e.g. lmbench --json out.json Data/alphabets/alphabet.english.xml "English with limited punctuation"
+//        Data/training/training_english_GB.txt held_out.txt
 
 #include "../../Common/Common.h"
+#include "../../DasherCore/SettingsStore.h"
 #include "../../DasherCore/LanguageModelling/PPMLanguageModel.h"
+#include "../../DasherCore/LanguageModelling/PPMPYLanguageModel.h"
 #include "../../DasherCore/LanguageModelling/WordLanguageModel.h"
-#include "../../DasherCore/LanguageModelling/LanguageModelParams.h"
-
+#include "../../DasherCore/LanguageModelling/DictLanguageModel.h"
+#include "../../DasherCore/LanguageModelling/MixtureLanguageModel.h"
+#include "../../DasherCore/LanguageModelling/CTWLanguageModel.h"
 #include "../../DasherCore/Alphabet/AlphIO.h"
-#include "../../DasherCore/Alphabet/Alphabet.h"
-
+#include "../../DasherCore/Alphabet/AlphabetMap.h"
+#include "test_support.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace Dasher;
 using namespace std;
 
-int main(int argc, char *argv[]) {
-
-  /////////////////////////////////////////////////////////////////////////////
-  // Load the alphabet 
-
-  // This is currently a bit awkward - we cant just pass in a filename, it has to be a directory
-  // and an list of filenames
-
-  //    string userlocation = "C:/Documents and Settings/dward/My Documents/dasher/Data/system.rc/";
-  string userlocation = "/usr/local/share/dasher/";
-  //  string userlocation = "/mnt/data2/pjc51/enron/";
-
-  string filename = "alphabet.english.xml";
-  //  string filename = "enron_train_orig.txt";
-
-  vector < string > vFileNames;
-  vFileNames.push_back(filename);
-
-  // Set up the CAlphIO
-  std::auto_ptr < CAlphIO > ptrAlphIO(new CAlphIO("", userlocation, vFileNames));
-
-  // string strID = "Default";
-  string strID = "English alphabet with lots of punctuation";
-  const CAlphIO::AlphInfo & AlphInfo = ptrAlphIO->GetInfo(strID);
-
-  //      cout << "Alphabet " << filename << ":" << strID <<endl;
-
-  // Create the Alphabet that converts plain text to symbols
-  std::auto_ptr < CAlphabet > ptrAlphabet(new CAlphabet(AlphInfo));
-
-  //string strFileCompress = "C:/Documents and Settings/dward/My Documents/dasher/Data/system.rc/training_english_GB.txt";
-  //string strFileCompress = userlocation + "enron_train_orig.txt";
-  string strFileCompress = userlocation + "training_english_GB.txt";
-
-  //      cout << "Input file " << strFileCompress <<endl;
-
-//      ifstream ifs(strFileCompress.c_str(), ios::in | ios::ate);
-//      if (!ifs)
-//        return 1;
-
-  //      streampos sz = ifs.tellg();
-  //      ifs.seekg(0, ios::beg);
-
-  // Set up the language model for compression test
-
-  // DJW - add some functionality to CAlphabet to get the CSymbolAlphabet
-  CSymbolAlphabet alphabet(ptrAlphabet->GetNumberSymbols());
-  alphabet.SetSpaceSymbol(ptrAlphabet->GetSpaceSymbol());
-
-  CLanguageModelParams settings;
-
-  for(int order(0); order < 10; ++order) {
-// // //          for( int exclusion(0); exclusion < 2; ++exclusion )
-//          for( int update_exclusion(0); update_exclusion < 2; ++update_exclusion )
-
-//        int order(5);
-    int exclusion(0);
-    int update_exclusion(1);
-
-    double alpha(0.77);
-    double beta(0.49);
-
-    int length(10000);
-
-    if(order == 10)
-      settings.SetValue("LMMaxOrder", 10000);
-    else
-      settings.SetValue("LMMaxOrder", order);
-
-    settings.SetValue("LMExclusion", exclusion);
-    settings.SetValue("LMUpdateExclusion", update_exclusion);
-
-    settings.SetValue("LMAlpha", alpha * 100);
-    settings.SetValue("LMBeta", beta * 100);
-
-    //CWordLanguageModel lm( alphabet, &settings );
-    CPPMLanguageModel lm(alphabet, &settings);
-
-    CLanguageModel::Context context;
-    context = lm.CreateEmptyContext();
-
-    std::vector < unsigned int >Probs;
-    int iNorm = 1 << 16;
-
-    int iASize = alphabet.GetSize();
-
-    std::vector < symbol > vStmp;
-
-    int i(0);
-
-    int iSymbIn(0);
-
-    double dSumLogP = 0;
-
-    ifstream ifs(strFileCompress.c_str(), ios::in | ios::ate);
-    if(!ifs)
-      return 1;
-
-    //      streampos sz = ifs.tellg();
-    ifs.seekg(0, ios::beg);
-
-    while(!ifs.eof()) {
-
-      string strCompress(length, '0');
-      ifs.read(&strCompress[0], length);
-
-      std::vector < symbol > vSymbols;
-      ptrAlphabet->GetSymbols(&vSymbols, &strCompress, true /*IsMore */ );
-
-      //              CLanguageModel::Context sub_context;
-      //      sub_context = lm.CreateEmptyContext();
+class ConsoleMessages : public CMessageDisplay {
+public:
+  void Message(const string &strText, bool bInterrupt) {
+    cerr << strText << endl;
+  }
+};
+
+static const char *const MODELS[] = {"ppm", "word", "mixture", "ctw", "ppmpy"};
+static const int NUM_MODELS = sizeof(MODELS)/sizeof(MODELS[0]);
+
+///Everything measured for one model; plain data, so it can be sent through a pipe
+struct SResult {
+  bool bOk;
+  long iTrainSyms, iTestSyms;
+  double dTrainSecs, dProbsSecs, dBits;
+  long iNodes; //-1 = not applicable
+  long iModelKB; //-1 = not known
+  long iPeakRSSKB; //0 = unknown
+};
+
+static CLanguageModel *CreateModel(const string &strModel, TestUser *pUser, const CAlphInfo *pInfo, const CAlphabetMap *pMap) {
+  const int iNumSyms = pInfo->iEnd-1;
+  if (strModel == "ppm") return new CPPMLanguageModel(pUser, iNumSyms);
+  if (strModel == "word") return new CWordLanguageModel(pUser, pInfo, pMap);
+  if (strModel == "mixture") {
+    //as CAlphabetManager::CreateLanguageModel
+    vector<CLanguageModel *> vComponents;
+    vComponents.push_back(new CPPMLanguageModel(pUser, iNumSyms));
+    vComponents.push_back(new CDictLanguageModel(pUser, pInfo, pMap));
+    return new CMixtureLanguageModel(pUser, iNumSyms, vComponents);
+  }
+  if (strModel == "ctw") return new CCTWLanguageModel(iNumSyms, pUser->GetLongParameter(LP_LM_CTW_TABLE_SIZE));
+  if (strModel == "ppmpy") return new CPPMPYLanguageModel(pUser, iNumSyms, iNumSyms);
+  return NULL;
+}
 
-      for(std::vector < symbol >::iterator it(vSymbols.begin()); it != vSymbols.end(); ++it) {
-        lm.GetProbs(context, Probs, iNorm);
+static long NumNodes(CLanguageModel *pLM) {
+  if (CAbstractPPM *pPPM = dynamic_cast<CAbstractPPM *>(pLM)) return pPPM->NumNodes() + pPPM->NumStaticNodes();
+  if (CWordLanguageModel *pWord = dynamic_cast<CWordLanguageModel *>(pLM)) return pWord->NumNodes();
+  if (CCTWLanguageModel *pCTW = dynamic_cast<CCTWLanguageModel *>(pLM)) return pCTW->TotalNodes;
+  return -1;
+}
 
-        symbol s = *it;
+///Memory taken by the model's nodes (inc. any static tier), in KB
+static long ModelKB(CLanguageModel *pLM) {
+  if (CAbstractPPM *pPPM = dynamic_cast<CAbstractPPM *>(pLM)) return static_cast<long>((pPPM->BytesUsed() + pPPM->StaticBytesUsed()) / 1024);
+  return -1;
+}
 
-        int j = Probs[s];
+static void Learn(CLanguageModel *pLM, CLanguageModel::Context ctx, symbol sym) {
+  if (CPPMPYLanguageModel *pPY = dynamic_cast<CPPMPYLanguageModel *>(pLM))
+    pPY->LearnPYSymbol(ctx, sym); //(doesn't move on the context)
+  pLM->LearnSymbol(ctx, sym);
+}
 
-        // DJW
-        // Add one to p since PPMLanguageModel is returning 0 for some symbols because of integer 
-        // round-down
-        // Maybe we insist that p!=0 for all symbols and fix the language models
+static SResult RunModel(const string &strModel, TestUser *pUser, const CAlphInfo *pInfo, const CAlphabetMap *pMap,
+                        const vector<symbol> &vTrain, const vector<symbol> &vTest, bool bLearn, bool bFreeze) {
+  SResult res;
+  memset(&res, 0, sizeof(res));
+  CLanguageModel *pLM = CreateModel(strModel, pUser, pInfo, pMap);
+  if (!pLM) return res;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  CLanguageModel::Context ctx = pLM->CreateEmptyContext();
+  for (vector<symbol>::const_iterator it = vTrain.begin(); it != vTrain.end(); it++)
+    Learn(pLM, ctx, *it);
+  pLM->ReleaseContext(ctx);
+  if (bFreeze) pLM->FreezeModel();
+  res.dTrainSecs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  res.iTrainSyms = vTrain.size();
+
+  const int iNorm(1<<16), iUniform(iNorm * pUser->GetLongParameter(LP_UNIFORM) / 1000);
+  vector<unsigned int> vProbs;
+  ctx = pLM->CreateEmptyContext();
+  for (vector<symbol>::const_iterator it = vTest.begin(); it != vTest.end(); it++) {
+    start = chrono::steady_clock::now();
+    pLM->GetProbs(ctx, vProbs, iNorm, iUniform);
+    res.dProbsSecs += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    //(a model giving zero probability would need infinitely many bits; charge the
+    // uniform share instead, so the comparison remains meaningful)
+    const unsigned int p = (static_cast<size_t>(*it) < vProbs.size() && vProbs[*it]) ? vProbs[*it] : max(1, iUniform/pInfo->iEnd);
+    res.dBits -= log(double(p) / iNorm) / log(2.0);
+    if (bLearn) Learn(pLM, ctx, *it);
+    else pLM->EnterSymbol(ctx, *it);
+  }
+  pLM->ReleaseContext(ctx);
+  res.iTestSyms = vTest.size();
+  res.iNodes = NumNodes(pLM);
+  res.iModelKB = ModelKB(pLM);
+  delete pLM;
+  res.bOk = true;
+  return res;
+}
 
-        double p = double (j + 1) / double (iNorm + iASize);
-        DASHER_ASSERT(p != 0);
+#ifndef _WIN32
+///Runs the model in a child process, so its peak memory use can be measured separately
+static SResult RunModelInChild(const string &strModel, TestUser *pUser, const CAlphInfo *pInfo, const CAlphabetMap *pMap,
+                               const vector<symbol> &vTrain, const vector<symbol> &vTest, bool bLearn, bool bFreeze) {
+  SResult res;
+  memset(&res, 0, sizeof(res));
+  int fds[2];
+  if (pipe(fds)) return res;
+  fflush(stdout);
+  const pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    res = RunModel(strModel, pUser, pInfo, pMap, vTrain, vTest, bLearn, bFreeze);
+    if (write(fds[1], &res, sizeof(res)) != static_cast<ssize_t>(sizeof(res))) _exit(1);
+    _exit(0);
+  }
+  close(fds[1]);
+  if (pid < 0 || read(fds[0], &res, sizeof(res)) != static_cast<ssize_t>(sizeof(res)))
+    res.bOk = false;
+  close(fds[0]);
+  int iStatus;
+  struct rusage usage;
+  if (pid > 0 && wait4(pid, &iStatus, 0, &usage) == pid) {
+#ifdef __APPLE__
+    res.iPeakRSSKB = usage.ru_maxrss / 1024; //bytes
+#else
+    res.iPeakRSSKB = usage.ru_maxrss; //KB
+#endif
+  }
+  return res;
+}
+#endif
+
+static vector<symbol> ReadSymbols(const char *szFile, const CAlphabetMap *pMap) {
+  vector<symbol> vSyms;
+  ifstream in(szFile, ios::binary);
+  if (!in) {
+    cerr << "Could not read " << szFile << endl;
+    exit(1);
+  }
+  CAlphabetMap::SymbolStream syms(in);
+  for (symbol sym; (sym = syms.next(pMap)) != -1; )
+    if (sym) vSyms.push_back(sym); //skip anything not in alphabet
+  return vSyms;
+}
 
-        dSumLogP += log(p);
+static void Usage(const char *szProg) {
+  cerr << "Usage: " << szProg << " [--models m1,m2,...] [--json <file>] [--learn] [--freeze] [--param <name>=<n>]..."
+       << " <alphabet file> <alphabet ID> <training file> <test file>" << endl;
+  exit(1);
+}
 
-        lm.LearnSymbol(context, s);
+int main(int argc, char *argv[]) {
+  TestSettings settings;
+  vector<string> vModels(MODELS, MODELS + NUM_MODELS), vArgs;
+  string strJSON;
+  bool bLearn = false, bFreeze = false;
+  for (int i = 1; i < argc; i++) {
+    const string strArg(argv[i]);
+    if (strArg == "--models" && i+1 < argc) {
+      vModels.clear();
+      istringstream in(argv[++i]);
+      for (string strModel; getline(in, strModel, ','); ) vModels.push_back(strModel);
+    } else if (strArg == "--json" && i+1 < argc) {
+      strJSON = argv[++i];
+    } else if (strArg == "--learn") {
+      bLearn = true;
+    } else if (strArg == "--freeze") {
+      bFreeze = true;
+    } else if (strArg == "--param" && i+1 < argc) {
+      const string strParam(argv[++i]);
+      const size_t iEq = strParam.find('=');
+      int iParam = FIRST_LP;
+      for (; iEq != string::npos && iParam < END_OF_LPS; iParam++)
+        if (strParam.substr(0, iEq) == Settings::GetParameterName(iParam)) break;
+      if (iEq == string::npos || iParam == END_OF_LPS) {
+        cerr << "Unknown long parameter " << strParam << endl;
+        return 1;
       }
+      settings.SetLongParameter(iParam, atol(strParam.c_str() + iEq + 1));
+    } else if (strArg.compare(0, 2, "--") == 0) {
+      Usage(argv[0]);
+    } else vArgs.push_back(strArg);
+  }
+  if (vArgs.size() != 4) Usage(argv[0]);
+
+  ConsoleMessages msgs;
+  CAlphIO alphIO(&msgs);
+  alphIO.ParseFile(vArgs[0], false);
+  const CAlphInfo *pInfo = alphIO.GetInfo(vArgs[1]);
+  if (!pInfo || pInfo->GetID() != vArgs[1]) {
+    cerr << "No alphabet \"" << vArgs[1] << "\" in " << vArgs[0] << endl;
+    return 1;
+  }
 
-      //   cout << i << " " << -dSumLogP/ log(2.0)/ length << " " << lm.GetMemory() << endl;                            
-
-//        for ( std::vector<symbol>::iterator it( vSymbols.begin() ); it != vSymbols.end(); ++it )
-//          {
-//            symbol s = *it;
-//            lm.LearnSymbol(context, s);
-//            ++i;
-//          }
-
-      iSymbIn += vSymbols.size();
-
+  //as CAlphabetManager::InitMap
+  CAlphabetMap map;
+  int iPara = pInfo->GetParagraphSymbol();
+  if (iPara) map.AddParagraphSymbol(iPara);
+  for (int i = 1; i < pInfo->iEnd; i++)
+    if (i!=iPara) map.Add(pInfo->GetText(i), i);
+
+  const vector<symbol> vTrain(ReadSymbols(vArgs[2].c_str(), &map)), vTest(ReadSymbols(vArgs[3].c_str(), &map));
+  TestUser user(&settings);
+
+  vector<pair<string, SResult> > vResults;
+  printf("%-8s %10s %14s %14s %12s %10s %10s\n", "model", "bits/char", "train syms/s", "GetProbs/s", "peak RSS KB", "nodes", "model KB");
+  for (vector<string>::const_iterator it = vModels.begin(); it != vModels.end(); it++) {
+#ifdef _WIN32
+    const SResult res = RunModel(*it, &user, pInfo, &map, vTrain, vTest, bLearn, bFreeze);
+#else
+    const SResult res = RunModelInChild(*it, &user, pInfo, &map, vTrain, vTest, bLearn, bFreeze);
+#endif
+    if (!res.bOk) {
+      printf("%-8s failed (unknown model?)\n", it->c_str());
+      continue;
     }
-    //      cout << "Read " << sz << " bytes, " << vSymbols.size() << " symbols " << endl;
-    //      cout << "Compressed size: " << -dSumLogP/ log(2.0) << " bits" << endl;
-    //cout << "Compression acheivable is " << -dSumLogP/ log(2.0)/ vSymbols.size() << " bits per symbol" << endl;
-    cout << order << " " << exclusion << " " << update_exclusion << " " << -dSumLogP / log(2.0) / iSymbIn << endl;
-
-    //              cout << skip << " " << -dSumLogP/ log(2.0)/ length << endl;
-
-    ifs.close();
+    vResults.push_back(make_pair(*it, res));
+    printf("%-8s %10.4f %14.0f %14.0f %12ld %10s %10s\n", it->c_str(),
+           res.iTestSyms ? res.dBits / res.iTestSyms : 0.0,
+           res.dTrainSecs ? res.iTrainSyms / res.dTrainSecs : 0.0,
+           res.dProbsSecs ? res.iTestSyms / res.dProbsSecs : 0.0,
+           res.iPeakRSSKB, res.iNodes < 0 ? "-" : to_string(res.iNodes).c_str(),
+           res.iModelKB < 0 ? "-" : to_string(res.iModelKB).c_str());
+  }
 
+  if (!strJSON.empty()) {
+    ofstream out(strJSON.c_str());
+    out << "{\n  \"alphabet\": \"" << pInfo->GetID() << "\",\n"
+        << "  \"train_symbols\": " << vTrain.size() << ",\n"
+        << "  \"test_symbols\": " << vTest.size() << ",\n"
+        << "  \"learn_test\": " << (bLearn ? "true" : "false") << ",\n"
+        << "  \"freeze\": " << (bFreeze ? "true" : "false") << ",\n"
+        << "  \"models\": [";
+    for (size_t i = 0; i < vResults.size(); i++) {
+      const SResult &res(vResults[i].second);
+      out << (i ? "," : "") << "\n    {\"model\": \"" << vResults[i].first << "\""
+          << ", \"bits_per_char\": " << (res.iTestSyms ? res.dBits / res.iTestSyms : 0.0)
+          << ", \"train_symbols_per_sec\": " << (res.dTrainSecs ? res.iTrainSyms / res.dTrainSecs : 0.0)
+          << ", \"getprobs_per_sec\": " << (res.dProbsSecs ? res.iTestSyms / res.dProbsSecs : 0.0)
+          << ", \"peak_rss_kb\": " << res.iPeakRSSKB
+          << ", \"nodes\": ";
+      if (res.iNodes < 0) out << "null"; else out << res.iNodes;
+      out << ", \"model_kb\": ";
+      if (res.iModelKB < 0) out << "null"; else out << res.iModelKB;
+      out << "}";
+    }
+    out << "\n  ]\n}\n";
+    if (!out) {
+      cerr << "Could not write " << strJSON << endl;
+      return 1;
+    }
   }
   return 0;
 }
@@ -0,0 +1,212 @@
+// mandarin_py.cpp
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+// Benchmark for CPPMPYLanguageModel as used by Mandarin Dasher: groups the alphabet's
+// characters into pinyin sounds (as CMandarinAlphMgr::InitMap), then trains a model on
+// the first 90% of an annotated training file (as CMandarinAlphMgr's trainer). For each
+// annotated character in the remaining 10%, it generates the candidates as Dasher does -
+// GetProbs for the pinyin sounds, then GetPartProbs for the characters of the sound
+// actually written (as CMandarinAlphMgr::GetConversions) - before learning the character.
+// Reports the size of the trie, the memory taken per node, the bits per character
+// (pinyin sound plus character given sound), and the average candidate-generation latency.
+//
+// Usage: MandarinPY <alphabet file> <alphabet ID> <training file>
+// e.g.   MandarinPY Data/alphabets/alphabet.spyNew.xml "Mandarin (simp) by Pinyin, tone last" Data/training/training_spyNew.txt
+
+#include "../../Common/Common.h"
+#include "../../DasherCore/SettingsStore.h"
+#include "../../DasherCore/LanguageModelling/PPMPYLanguageModel.h"
+#include "../../DasherCore/Alphabet/AlphIO.h"
+#include "../../DasherCore/Alphabet/AlphabetMap.h"
+#include "test_support.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace Dasher;
+using namespace std;
+
+class ConsoleMessages : public CMessageDisplay {
+public:
+  void Message(const string &strText, bool bInterrupt) {
+    cerr << strText << endl;
+  }
+};
+
+///The pinyin sounds and Chinese characters, numbered as by CMandarinAlphMgr
+struct SPinyin {
+  ///Chinese character text -> Chinese symbol number
+  CAlphabetMap map;
+  int iNumCH;
+  ///Indexed by Chinese symbol: the pinyin sounds which can be converted to it
+  vector<set<symbol> > vGroupsByConversion;
+  ///Indexed by pinyin sound: the Chinese symbols to which it can be converted
+  vector<vector<symbol> > vConversionsByGroup;
+  vector<string> vGroupNames;
+};
+
+///Allocates a pinyin sound for each group having characters as direct children (as
+/// CMandarinAlphMgr::makePYgroup)
+static void MakePYGroups(const CAlphInfo *pInfo, const SGroupInfo *pGroup, SPinyin &py) {
+  for (; pGroup; pGroup = pGroup->pNext) {
+    const size_t iSound = py.vConversionsByGroup.size();
+    const SGroupInfo *pChild = pGroup->pChild;
+    for (int i = pGroup->iStart; i < pGroup->iEnd; ) {
+      if (pChild && i >= pChild->iStart) {
+        i = pChild->iEnd; pChild = pChild->pNext;
+        continue;
+      }
+      const string &text(pInfo->GetText(i));
+      int hashed = py.map.Get(text);
+      if (!hashed) {
+        hashed = ++py.iNumCH;
+        if (i == pInfo->GetParagraphSymbol()) py.map.AddParagraphSymbol(hashed);
+        else py.map.Add(text, hashed);
+        py.vGroupsByConversion.push_back(set<symbol>());
+      }
+      if (i != pInfo->GetSpaceSymbol() && i != pInfo->GetParagraphSymbol()) {
+        if (py.vConversionsByGroup.size() == iSound) {
+          py.vGroupNames.push_back(pGroup->strName);
+          py.vConversionsByGroup.push_back(vector<symbol>());
+        }
+        py.vConversionsByGroup.back().push_back(hashed);
+        py.vGroupsByConversion[hashed].insert(iSound);
+      }
+      i++;
+    }
+    MakePYGroups(pInfo, pGroup->pChild, py);
+  }
+}
+
+///A Chinese symbol, with the pinyin sound by which it was written (0 = unknown)
+struct SWritten {
+  symbol ch, py;
+};
+
+///Reads a training file, as CMandarinAlphMgr::CMandarinTrainer::Train (but with no escapes)
+static void ReadTraining(const char *szFile, const CAlphInfo *pInfo, const SPinyin &py, vector<SWritten> &vText) {
+  ifstream in(szFile, ios::binary);
+  CAlphabetMap::SymbolStream syms(in);
+  string strPy; bool bHavePy(false);
+  for (symbol sym; (sym = syms.next(&py.map)) != -1; ) {
+    if (sym == 0 && syms.peekBack() == pInfo->m_strConversionTrainStart) {
+      strPy.clear(); bHavePy = true;
+      for (string s; (s = syms.peekAhead()).length(); strPy += s) {
+        syms.next(&py.map);
+        if (s == pInfo->m_strConversionTrainStop) break;
+      }
+      continue;
+    }
+    if (!sym) continue;
+    SWritten w = {sym, 0};
+    const set<symbol> &posPY(py.vGroupsByConversion[sym]);
+    if (posPY.size() == 1) w.py = *posPY.begin();
+    else if (bHavePy)
+      for (set<symbol>::const_iterator it = posPY.begin(); it != posPY.end(); it++)
+        if (py.vGroupNames[*it] == strPy) w.py = *it;
+    vText.push_back(w);
+    bHavePy = false;
+  }
+}
+
+static long PeakRSSKB() {
+#ifndef _WIN32
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) return usage.ru_maxrss;
+#endif
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    cerr << "Usage: " << argv[0] << " <alphabet file> <alphabet ID> <training file>" << endl;
+    return 1;
+  }
+  ConsoleMessages msgs;
+  CAlphIO alphIO(&msgs);
+  alphIO.ParseFile(argv[1], false);
+  const CAlphInfo *pInfo = alphIO.GetInfo(argv[2]);
+
+  SPinyin py;
+  py.iNumCH = 0;
+  py.vGroupsByConversion.resize(1);
+  py.vConversionsByGroup.resize(1);
+  py.vGroupNames.resize(1);
+  MakePYGroups(pInfo, pInfo, py);
+  //space and paragraph each get a sound of their own (as CMandarinAlphMgr::InitMap)
+  const symbol copy[] = {pInfo->GetSpaceSymbol(), pInfo->GetParagraphSymbol()};
+  for (int i = 0; i < 2; i++) {
+    if (!copy[i]) continue;
+    const int hashed = py.map.Get(pInfo->GetText(copy[i]));
+    py.vGroupsByConversion[hashed].insert(py.vConversionsByGroup.size());
+    py.vConversionsByGroup.push_back(vector<symbol>(1, hashed));
+    py.vGroupNames.push_back("");
+  }
+
+  vector<SWritten> vText;
+  ReadTraining(argv[3], pInfo, py, vText);
+  const size_t iTrain = vText.size() * 9 / 10;
+
+  TestSettings settings;
+  TestUser user(&settings);
+  const long iRSSBefore = PeakRSSKB();
+  CPPMPYLanguageModel lm(&user, py.iNumCH, py.vConversionsByGroup.size() - 1);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  CLanguageModel::Context ctx = lm.CreateEmptyContext();
+  for (size_t i = 0; i < iTrain; i++) {
+    if (vText[i].py) lm.LearnPYSymbol(ctx, vText[i].py);
+    lm.LearnSymbol(ctx, vText[i].ch);
+  }
+  const double dTrainSecs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  const long iRSSKB = PeakRSSKB() - iRSSBefore;
+
+  const int iNorm(1<<16), iUniform(iNorm * user.GetLongParameter(LP_UNIFORM) / 1000);
+  vector<unsigned int> vPYProbs;
+  vector<pair<symbol, unsigned int> > vChildren;
+  double dBits = 0, dSecs = 0;
+  long iPredicted = 0;
+  for (size_t i = iTrain; i < vText.size(); i++) {
+    const SWritten &w(vText[i]);
+    if (w.py) {
+      start = chrono::steady_clock::now();
+      lm.GetProbs(ctx, vPYProbs, iNorm, iUniform);
+      vChildren.clear();
+      const vector<symbol> &convs(py.vConversionsByGroup[w.py]);
+      for (vector<symbol>::const_iterator it = convs.begin(); it != convs.end(); it++)
+        vChildren.push_back(pair<symbol, unsigned int>(*it, 0));
+      lm.GetPartProbs(ctx, vChildren, iNorm, iUniform);
+      dSecs += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+      unsigned int iCHProb = 0;
+      for (vector<pair<symbol, unsigned int> >::const_iterator it = vChildren.begin(); it != vChildren.end(); it++)
+        if (it->first == w.ch) iCHProb = it->second;
+      dBits -= log(double(vPYProbs[w.py]) / iNorm) / log(2.0) + log(double(iCHProb) / iNorm) / log(2.0);
+      iPredicted++;
+      lm.LearnPYSymbol(ctx, w.py);
+    }
+    lm.LearnSymbol(ctx, w.ch);
+  }
+  lm.ReleaseContext(ctx);
+
+  cout << "characters\t" << vText.size() << " (" << iTrain << " trained, " << iPredicted << " predicted)" << endl;
+  cout << "sounds\t" << py.vConversionsByGroup.size() - 1 << endl;
+  cout << "nodes\t" << lm.NumNodes() << endl;
+  cout << "train secs\t" << dTrainSecs << endl;
+  if (iRSSKB > 0) cout << "memory per node (bytes)\t" << 1024.0 * iRSSKB / lm.NumNodes() << endl;
+  cout << "bits/char\t" << (iPredicted ? dBits / iPredicted : 0) << endl;
+  cout << "candidates latency (us)\t" << (iPredicted ? 1e6 * dSecs / iPredicted : 0) << endl;
+  return 0;
+}
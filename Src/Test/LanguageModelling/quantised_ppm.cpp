@@ -0,0 +1,107 @@
+// quantised_ppm.cpp
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+// Benchmark for quantised counts (LP_LM_COUNT_BITS): trains a PPM model on the first
+// 90% of a file and freezes it (as once trained on the system text), storing counts
+// in each number of bits given; then reports the size of the model, and the bits per
+// symbol with which it predicts the remaining 10% (learning as it goes, as when the
+// user writes), compared against the model with exact counts, frozen and not.
+//
+// Usage: QuantisedPPM <alphabet file> <alphabet ID> <training file> <count bits>...
+// e.g.   QuantisedPPM Data/alphabets/alphabet.english.xml "English with limited punctuation" Data/training/training_english_GB.txt 8 6 4 3
+
+#include "../../Common/Common.h"
+#include "../../DasherCore/SettingsStore.h"
+#include "../../DasherCore/LanguageModelling/PPMLanguageModel.h"
+#include "../../DasherCore/Alphabet/AlphIO.h"
+#include "../../DasherCore/Alphabet/AlphabetMap.h"
+#include "test_support.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+using namespace Dasher;
+using namespace std;
+
+class ConsoleMessages : public CMessageDisplay {
+public:
+  void Message(const string &strText, bool bInterrupt) {
+    cerr << strText << endl;
+  }
+};
+
+///Bits per symbol with which pLM predicts vSyms, learning each after predicting it
+static double BitsPerSymbol(CLanguageModel *pLM, const vector<symbol> &vSyms) {
+  const int iNorm(1<<16), iUniform(iNorm/20);
+  CLanguageModel::Context ctx = pLM->CreateEmptyContext();
+  vector<unsigned int> vProbs;
+  double dBits = 0;
+  for (vector<symbol>::const_iterator it = vSyms.begin(); it != vSyms.end(); it++) {
+    pLM->GetProbs(ctx, vProbs, iNorm, iUniform);
+    dBits -= log(double(vProbs[*it]) / iNorm) / log(2.0);
+    pLM->LearnSymbol(ctx, *it);
+  }
+  pLM->ReleaseContext(ctx);
+  return vSyms.empty() ? 0 : dBits / vSyms.size();
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 5) {
+    cerr << "Usage: " << argv[0] << " <alphabet file> <alphabet ID> <training file> <count bits>..." << endl;
+    return 1;
+  }
+  ConsoleMessages msgs;
+  CAlphIO alphIO(&msgs);
+  alphIO.ParseFile(argv[1], false);
+  const CAlphInfo *pInfo = alphIO.GetInfo(argv[2]);
+
+  //as CAlphabetManager::InitMap
+  CAlphabetMap map;
+  int iPara = pInfo->GetParagraphSymbol();
+  if (iPara) map.AddParagraphSymbol(iPara);
+  for (int i = 1; i < pInfo->iEnd; i++)
+    if (i!=iPara) map.Add(pInfo->GetText(i), i);
+
+  vector<symbol> vSyms;
+  ifstream in(argv[3], ios::binary);
+  CAlphabetMap::SymbolStream syms(in);
+  for (symbol sym; (sym = syms.next(&map)) != -1; )
+    if (sym) vSyms.push_back(sym); //skip anything not in alphabet
+  const vector<symbol> vTrain(vSyms.begin(), vSyms.begin() + vSyms.size()*9/10);
+  const vector<symbol> vTest(vSyms.begin() + vTrain.size(), vSyms.end());
+
+  TestSettings settings;
+  TestUser user(&settings);
+
+  cout << "count bits\tfrozen KB\tmodel KB\tbits/symbol\tvs exact" << endl;
+  //not frozen (-1), then exact counts (0) as the baseline
+  vector<long> vBits(1, -1);
+  vBits.push_back(0);
+  for (int iArg = 4; iArg < argc; iArg++) vBits.push_back(atol(argv[iArg]));
+  double dBase = 0;
+  for (vector<long>::const_iterator itB = vBits.begin(); itB != vBits.end(); itB++) {
+    settings.SetLongParameter(LP_LM_COUNT_BITS, max(*itB, 0L));
+    CPPMLanguageModel lm(&user, pInfo->iEnd-1);
+    CLanguageModel::Context ctx = lm.CreateEmptyContext();
+    for (vector<symbol>::const_iterator it = vTrain.begin(); it != vTrain.end(); it++)
+      lm.LearnSymbol(ctx, *it);
+    lm.ReleaseContext(ctx);
+    if (*itB >= 0) lm.FreezeModel();
+    //(before testing, which learns more into the trie)
+    const size_t iFrozenKB = lm.StaticBytesUsed()/1024, iModelKB = (lm.BytesUsed() + lm.StaticBytesUsed())/1024;
+    const double dBits = BitsPerSymbol(&lm, vTest);
+    if (*itB == 0) dBase = dBits;
+    if (*itB < 0) cout << "not frozen"; else if (*itB == 0) cout << "exact"; else cout << *itB;
+    cout << "\t" << iFrozenKB << "\t" << iModelKB << "\t" << dBits;
+    if (*itB > 0) cout << "\t" << 100.0*(dBits-dBase)/dBase << "%";
+    cout << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,101 @@
+// routing_ppm_test.cpp
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+// Regression test for CRoutingPPMLanguageModel: trains models (with routes learnt
+// with and without context, and with the trie pruned or not) on a pseudo-random text
+// over a made-up alphabet in which each base symbol has from one to seven routes, and
+// checks that the probabilities from GetProbs, and the routes from GetBestRoute, hash
+// to the same values as when the model kept its route counts in std::maps.
+//
+// Usage: RoutingPPMTest (exits with non-zero status on failure)
+
+#include "../../Common/Common.h"
+#include "../../DasherCore/SettingsStore.h"
+#include "../../DasherCore/LanguageModelling/RoutingPPMLanguageModel.h"
+#include "test_support.h"
+
+#include <iostream>
+
+using namespace Dasher;
+using namespace std;
+
+static const int NUM_BASE_SYMS = 60;
+static const int TRAIN_LENGTH = 200000;
+static const int TEST_LENGTH = 2000;
+
+///A route for each (base) symbol in turn, biased towards lower-numbered symbols and routes,
+/// and depending on the previous symbol. Sometimes only the base symbol is known (route 0).
+static void MakeText(CRandom &rand, const vector<set<symbol> > &vRoutes, vector<symbol> &vText) {
+  symbol prev = 1;
+  for (int i = 0; i < TRAIN_LENGTH + TEST_LENGTH; i++) {
+    symbol base = 1 + (rand.next(3) ? (prev * 7 + rand.next(5)) % (NUM_BASE_SYMS - 1) : rand.next(rand.next(NUM_BASE_SYMS - 1) + 1));
+    const set<symbol> &routes(vRoutes[base]);
+    set<symbol>::const_iterator it = routes.begin();
+    for (unsigned int r = rand.next(rand.next(routes.size()) + 1); r > 0; r--) it++;
+    vText.push_back(rand.next(8) ? *it : -base);
+    prev = base;
+  }
+}
+
+static uint64 RunModel(CSettingsUser *pUser, const vector<symbol> &vBaseSyms, const vector<set<symbol> > &vRoutes,
+                       const vector<symbol> &vText, bool bContextSensitive) {
+  CRoutingPPMLanguageModel lm(pUser, &vBaseSyms, &vRoutes, bContextSensitive);
+  CLanguageModel::Context ctx = lm.CreateEmptyContext();
+  for (int i = 0; i < TRAIN_LENGTH; i++) {
+    if (vText[i] < 0) lm.LearnBaseSymbol(ctx, -vText[i]);
+    else lm.LearnSymbol(ctx, vText[i]);
+  }
+  uint64 iHash = 14695981039346656037ULL;
+  vector<unsigned int> vProbs;
+  for (int i = TRAIN_LENGTH; i < TRAIN_LENGTH + TEST_LENGTH; i++) {
+    lm.GetProbs(ctx, vProbs, 1<<16, (1<<16)/20);
+    for (vector<unsigned int>::const_iterator it = vProbs.begin(); it != vProbs.end(); it++)
+      Hash(iHash, *it);
+    const symbol base = vText[i] < 0 ? -vText[i] : vBaseSyms[vText[i]];
+    lm.EnterSymbol(ctx, base);
+    Hash(iHash, lm.GetBestRoute(ctx));
+  }
+  lm.ReleaseContext(ctx);
+  return iHash;
+}
+
+int main(int argc, char *argv[]) {
+  //Base symbol i has 1 + (i % 7) routes
+  vector<symbol> vBaseSyms(1, 0);
+  vector<set<symbol> > vRoutes(1);
+  for (symbol base = 1; base < NUM_BASE_SYMS; base++) {
+    vRoutes.push_back(set<symbol>());
+    for (int r = 0; r <= base % 7; r++) {
+      vRoutes.back().insert(vBaseSyms.size());
+      vBaseSyms.push_back(base);
+    }
+  }
+  CRandom rand(12345);
+  vector<symbol> vText;
+  MakeText(rand, vRoutes, vText);
+
+  //Hashes of the results when route counts were kept in std::maps:
+  // context-insensitive and context-sensitive, unbounded and pruned.
+  const uint64 EXPECTED[2][2] = {{4128679290518391864ULL, 1911243772411200666ULL},
+                                 {7670932890274955576ULL, 17828901138771221212ULL}};
+
+  TestSettings settings;
+  TestUser user(&settings);
+  int iFailures = 0;
+  for (int iPruned = 0; iPruned < 2; iPruned++) {
+    settings.SetLongParameter(LP_LM_MAX_MEMORY, iPruned ? 256 : 0);
+    for (int iSensitive = 0; iSensitive < 2; iSensitive++) {
+      const uint64 iHash = RunModel(&user, vBaseSyms, vRoutes, vText, iSensitive != 0);
+      const bool bOk = (iHash == EXPECTED[iSensitive][iPruned]);
+      cout << (iSensitive ? "context-sensitive" : "context-insensitive") << (iPruned ? ", pruned: " : ": ")
+           << iHash << (bOk ? " ok" : " FAILED") << endl;
+      if (!bOk) iFailures++;
+    }
+  }
+  return iFailures ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+// sharded_training.cpp
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+// Benchmark for CShardedTrainer: trains a PPM model on each file given, using
+// 1, 2, 4, ... up to the specified number of threads, and reports the time taken,
+// speedup over one thread, and (as a check on the merged model's fidelity) the
+// bits per symbol with which the resulting model predicts the start of the file.
+//
+// Usage: ShardedTraining <alphabet file> <alphabet ID> <max threads> <update exclusion 0/1> <training file>...
+// e.g.   ShardedTraining Data/alphabets/alphabet.spanish.xml "Español / Spanish with punctuation and numerals" 8 1 Data/training/training_spanish_ES.txt
+
+#include "../../Common/Common.h"
+#include "../../DasherCore/SettingsStore.h"
+#include "../../DasherCore/ShardedTrainer.h"
+#include "../../DasherCore/LanguageModelling/PPMLanguageModel.h"
+#include "../../DasherCore/Alphabet/AlphIO.h"
+#include "test_support.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+using namespace Dasher;
+using namespace std;
+
+class ConsoleMessages : public CMessageDisplay {
+public:
+  void Message(const string &strText, bool bInterrupt) {
+    cerr << strText << endl;
+  }
+};
+
+class BenchmarkSource : public CShardedTrainer::ModelSource, public CSettingsUser {
+public:
+  BenchmarkSource(CSettingsStore *pSettings, const CAlphInfo *pInfo) : CSettingsUser(pSettings), m_pInfo(pInfo) {
+    //as CAlphabetManager::InitMap
+    int iPara = pInfo->GetParagraphSymbol();
+    if (iPara) m_map.AddParagraphSymbol(iPara);
+    for (int i = 1; i < pInfo->iEnd; i++)
+      if (i!=iPara) m_map.Add(pInfo->GetText(i), i);
+  }
+  CLanguageModel *CreateLanguageModel() {
+    return new CPPMLanguageModel(this, m_pInfo->iEnd-1);
+  }
+  CTrainer *GetTrainer(CMessageDisplay *pMsgs, CLanguageModel *pLM) {
+    return new CTrainer(pMsgs, pLM, m_pInfo, &m_map);
+  }
+  const CAlphabetMap *GetMap() const {return &m_map;}
+private:
+  const CAlphInfo * const m_pInfo;
+  CAlphabetMap m_map;
+};
+
+///Bits per symbol with which pLM predicts (without learning) the first iMax symbols of strText
+static double BitsPerSymbol(CLanguageModel *pLM, const CAlphabetMap *pMap, const string &strText, int iMax) {
+  const int iNorm(1<<16), iUniform(iNorm/20);
+  istringstream in(strText);
+  CAlphabetMap::SymbolStream syms(in);
+  CLanguageModel::Context ctx = pLM->CreateEmptyContext();
+  vector<unsigned int> vProbs;
+  double dBits = 0;
+  int iCount = 0;
+  for (symbol sym; iCount < iMax && (sym = syms.next(pMap)) != -1; ) {
+    if (sym == 0) continue; //not in alphabet
+    pLM->GetProbs(ctx, vProbs, iNorm, iUniform);
+    dBits -= log(double(vProbs[sym]) / iNorm) / log(2.0);
+    pLM->EnterSymbol(ctx, sym);
+    iCount++;
+  }
+  pLM->ReleaseContext(ctx);
+  return iCount ? dBits / iCount : 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 6) {
+    cerr << "Usage: " << argv[0] << " <alphabet file> <alphabet ID> <max threads> <update exclusion 0/1> <training file>..." << endl;
+    return 1;
+  }
+  ConsoleMessages msgs;
+  CAlphIO alphIO(&msgs);
+  alphIO.ParseFile(argv[1], false);
+  const CAlphInfo *pInfo = alphIO.GetInfo(argv[2]);
+  const int iMaxThreads = atoi(argv[3]);
+
+  TestSettings settings;
+  settings.SetLongParameter(LP_LM_UPDATE_EXCLUSION, atoi(argv[4]));
+  BenchmarkSource source(&settings, pInfo);
+
+  cout << "file\tbytes\tthreads\tseconds\tspeedup\tbits/symbol" << endl;
+  for (int iFile = 5; iFile < argc; iFile++) {
+    ifstream in(argv[iFile], ios::binary);
+    const string strText((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    double dBase = 0;
+    for (int iThreads = 1; ; iThreads = min(iThreads*2, iMaxThreads)) {
+      CLanguageModel *pLM = source.CreateLanguageModel();
+      CShardedTrainer trainer(&msgs, &source, pLM, iThreads);
+      istringstream is(strText);
+      const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      trainer.Parse(argv[iFile], is, false);
+      const double dSecs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      if (iThreads == 1) dBase = dSecs;
+      cout << argv[iFile] << "\t" << strText.size() << "\t" << iThreads << "\t" << dSecs << "\t" << dBase/dSecs
+           << "\t" << BitsPerSymbol(pLM, source.GetMap(), strText, 100000) << endl;
+      delete pLM;
+      if (iThreads >= iMaxThreads) break;
+    }
+  }
+  return 0;
+}
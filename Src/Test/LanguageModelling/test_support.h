@@ -0,0 +1,62 @@
+// test_support.h
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+// Scaffolding shared by the language model tests and benchmarks (and the rendering
+// benchmark): settings with nothing persisted, and deterministic pseudo-random text.
+
+#ifndef __Test_LanguageModelling_test_support_h__
+#define __Test_LanguageModelling_test_support_h__
+
+#include "../../Common/Common.h"
+#include "../../DasherCore/DasherTypes.h"
+#include "../../DasherCore/SettingsStore.h"
+
+#include <vector>
+
+//Default values for every parameter, and nothing persisted
+class TestSettings : public Dasher::CSettingsStore {
+public:
+  TestSettings() {LoadPersistent();}
+};
+
+class TestUser : public Dasher::CSettingsUser {
+public:
+  TestUser(Dasher::CSettingsStore *pSettings) : Dasher::CSettingsUser(pSettings) {}
+  using Dasher::CSettingsUser::GetLongParameter;
+};
+
+///Deterministic pseudo-random numbers (so the tests don't depend on the C library)
+class CRandom {
+public:
+  CRandom(uint64 iSeed) : m_iState(iSeed) {}
+  unsigned int next(unsigned int n) {
+    m_iState = m_iState * 6364136223846793005ULL + 1442695040888963407ULL;
+    return static_cast<unsigned int>(m_iState >> 33) % n;
+  }
+private:
+  uint64 m_iState;
+};
+
+///FNV-1a
+inline void Hash(uint64 &iHash, unsigned int i) {
+  for (int b = 0; b < 4; b++, i >>= 8) {
+    iHash ^= i & 0xFF;
+    iHash *= 1099511628211ULL;
+  }
+}
+
+///Appends iLength symbols 1..iNumSyms-1, biased towards lower-numbered ones, and
+/// depending on the previous one
+inline void MakeText(std::vector<Dasher::symbol> &vText, int iNumSyms, int iLength, uint64 iSeed) {
+  CRandom rand(iSeed);
+  Dasher::symbol prev = 1;
+  for (int i = 0; i < iLength; i++)
+    vText.push_back(prev = 1 + (rand.next(3) ? (prev * 7 + rand.next(5)) % (iNumSyms - 1) : rand.next(rand.next(iNumSyms - 1) + 1)));
+}
+
+#endif // ndef __Test_LanguageModelling_test_support_h__
@@ -0,0 +1,190 @@
+// render_bench.cpp
+//
+/////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2026 The Dasher Team
+//
+/////////////////////////////////////////////////////////////////////////////
+
+// Headless benchmark of rendering frames: drives a complete interface (alphabet,
+// language model trained on the system training text, default filter) with a
+// simulated mouse, which steers forwards into the display while sweeping slowly up
+// and down it, so writing a stream of text. Nothing is drawn, but every frame is
+// laid out, expanded and collapsed as normal. Reports, per frame, the time taken,
+// the number of nodes in existence and the memory they take, and the language model
+// contexts made (created or cloned) and alive. If given a time budget for expansion
+// (LP_EXPANSION_TIME), also reports how many frames overran it.
+//
+// Usage: RenderBench <data directory> [alphabet ID] [frames] [expansion ms]
+// e.g.   RenderBench Data "English with limited punctuation" 2000
+// (where the data directory contains the alphabets, training, colours and control
+// subdirectories, as in the source tree.)
+
+#include "../../Common/Common.h"
+#include "../../Common/Globber.h"
+#include "../../DasherCore/DashIntfScreenMsgs.h"
+#include "../../DasherCore/DasherInput.h"
+#include "../../DasherCore/DasherNode.h"
+#include "../../DasherCore/DasherModel.h"
+#include "../../DasherCore/FrameRate.h"
+#include "../../DasherCore/NodeCreationManager.h"
+#include "../../DasherCore/AlphabetManager.h"
+#include "../../DasherCore/LanguageModelling/PPMLanguageModel.h"
+#include "../LanguageModelling/test_support.h"
+
+#include <sys/stat.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+using namespace Dasher;
+using namespace std;
+
+///Reads everything from the data directory; writes (and caches) nothing
+class BenchmarkFileUtils : public CFileUtils {
+public:
+  BenchmarkFileUtils(const string &strDataDir) : m_strDataDir(strDataDir + "/") {}
+  int GetFileSize(const string &strFileName) {
+    struct stat s;
+    return stat(strFileName.c_str(), &s) ? 0 : s.st_size;
+  }
+  void ScanFiles(AbstractParser *pParser, const string &strPattern) {
+    const string vDirs[] = {m_strDataDir + "alphabets/" + strPattern, m_strDataDir + "training/" + strPattern,
+                            m_strDataDir + "colours/" + strPattern, m_strDataDir + "control/" + strPattern};
+    const char *userPaths[] = {NULL};
+    const char *systemPaths[] = {vDirs[0].c_str(), vDirs[1].c_str(), vDirs[2].c_str(), vDirs[3].c_str(), NULL};
+    globScan(pParser, userPaths, systemPaths);
+  }
+  bool WriteUserDataFile(const string &strFileName, const string &strNewText, bool bAppend) {
+    return false;
+  }
+private:
+  const string m_strDataDir;
+};
+
+///Measures text (crudely), but draws nothing
+class NullScreen : public CDasherScreen {
+public:
+  NullScreen() : CDasherScreen(800, 600) {}
+  pair<screenint,screenint> TextSize(Label *pLabel, unsigned int iFontSize) {
+    return make_pair(static_cast<screenint>(iFontSize * pLabel->m_strText.size() / 2), static_cast<screenint>(iFontSize));
+  }
+  void DrawString(Label *pLabel, screenint x, screenint y, unsigned int iFontSize, int iColour) {}
+  void DrawRectangle(screenint x1, screenint y1, screenint x2, screenint y2, int iFillColour, int iOutlineColour, int iThickness) {}
+  void DrawCircle(screenint iCX, screenint iCY, screenint iR, int iFillColour, int iLineColour, int iLineWidth) {}
+  void Polyline(point *Points, int Number, int iWidth, int Colour) {}
+  void Polygon(point *Points, int Number, int fillColour, int outlineColour, int lineWidth) {}
+  void Display() {}
+  void SetColourScheme(const CColourIO::ColourInfo *pColourScheme) {}
+  bool IsWindowUnderCursor() {return true;}
+};
+
+///Steers forwards, sweeping up and down the screen once every 400 frames
+class SimulatedMouse : public CScreenCoordInput {
+public:
+  SimulatedMouse() : CScreenCoordInput(0, "Mouse Input"), m_iFrame(0) {}
+  bool GetScreenCoords(screenint &iX, screenint &iY, CDasherView *pView) {
+    iX = 780;
+    iY = static_cast<screenint>(300 + 250 * sin(m_iFrame * 2 * 3.14159265358979 / 400));
+    return true;
+  }
+  int m_iFrame;
+};
+
+///An interface whose edit box is just a string, starting empty (offsets are in bytes,
+/// so correct only for single-byte text)
+class BenchmarkInterface : public CDashIntfScreenMsgs {
+public:
+  BenchmarkInterface(CSettingsStore *pSettings, CFileUtils *pFileUtils, SimulatedMouse *pMouse)
+  : CDashIntfScreenMsgs(pSettings, pFileUtils), m_pMouse(pMouse) {}
+  using CDashIntfScreenMsgs::Realize;
+  using CDashIntfScreenMsgs::NewFrame;
+  unsigned int ctrlMove(bool bForwards, CControlManager::EditDistance dist) {return 0;}
+  unsigned int ctrlDelete(bool bForwards, CControlManager::EditDistance dist) {return 0;}
+  void editOutput(const string &strText, CDasherNode *pCause) {
+    m_strText += strText;
+    CDashIntfScreenMsgs::editOutput(strText, pCause);
+  }
+  void editDelete(const string &strText, CDasherNode *pCause) {
+    m_strText.resize(m_strText.size() - min(m_strText.size(), strText.size()));
+    CDashIntfScreenMsgs::editDelete(strText, pCause);
+  }
+  string GetContext(unsigned int iStart, unsigned int iLength) {
+    return iStart < m_strText.size() ? m_strText.substr(iStart, iLength) : "";
+  }
+  string GetAllContext() {return m_strText;}
+  int GetAllContextLenght() {return m_strText.size();}
+  void Message(const string &strText, bool bInterrupt) {cerr << strText << endl;}
+  ///The language model, if it is PPM (else NULL)
+  CAbstractPPM *GetPPM() {return dynamic_cast<CAbstractPPM *>(GetNCManager()->GetAlphabetManager()->GetLanguageModel());}
+  bool Training() {return !GetNCManager()->GetTrainingStatus().empty();}
+  const CSizeClassAlloc &NodeArena() {return m_pDasherModel->GetNodeArena();}
+  const CFrameRate &FrameRate() {return *m_pFramerate;}
+protected:
+  void CreateModules() {
+    CDashIntfScreenMsgs::CreateModules();
+    RegisterModule(m_pMouse);
+  }
+private:
+  SimulatedMouse *m_pMouse;
+  string m_strText;
+};
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    cerr << "Usage: " << argv[0] << " <data directory> [alphabet ID] [frames] [expansion ms]" << endl;
+    return 1;
+  }
+  const int iFrames = argc > 3 ? atoi(argv[3]) : 2000;
+
+  TestSettings settings;
+  if (argc > 2) settings.SetStringParameter(SP_ALPHABET_ID, argv[2]);
+  if (argc > 4) settings.SetLongParameter(LP_EXPANSION_TIME, atoi(argv[4]));
+  BenchmarkFileUtils fileUtils(argv[1]);
+  NullScreen screen;
+  SimulatedMouse *pMouse = new SimulatedMouse(); //owned by the interface's module manager
+  BenchmarkInterface intf(&settings, &fileUtils, pMouse);
+  intf.Realize(0);
+  intf.ChangeScreen(&screen);
+
+  //Wait for training to finish before starting (each frame polls it)
+  unsigned long iTime = 0;
+  while (intf.Training()) intf.NewFrame(iTime += 20, false);
+  CAbstractPPM *pPPM = intf.GetPPM();
+  if (!pPPM) cerr << "(language model is not PPM; not counting contexts)" << endl;
+
+  //Start moving, as if by a click of the left button
+  settings.SetBoolParameter(BP_START_MOUSE, true);
+  intf.KeyDown(iTime, 100);
+  intf.KeyUp(iTime, 100);
+  const unsigned long iContextsBefore = pPPM ? pPPM->ContextsMade() : 0;
+  double dTotalMs = 0, dMaxMs = 0;
+  long iTotalNodes = 0, iTotalNodeBytes = 0, iTotalLiveContexts = 0;
+  for (int i = 0; i < iFrames; i++) {
+    pMouse->m_iFrame = i;
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    intf.NewFrame(iTime += 20, false);
+    const double dMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    dTotalMs += dMs;
+    dMaxMs = max(dMaxMs, dMs);
+    iTotalNodes += currentNumNodeObjects();
+    iTotalNodeBytes += currentNodeBytes();
+    if (pPPM) iTotalLiveContexts += pPPM->LiveContexts();
+  }
+
+  cout << "frames:                " << iFrames << endl;
+  cout << "text written:          " << intf.GetAllContextLenght() << " bytes" << endl;
+  cout << "ms per frame:          " << dTotalMs / iFrames << " (max " << dMaxMs << ")" << endl;
+  cout << "nodes:                 " << iTotalNodes / iFrames << " (" << iTotalNodeBytes / iFrames / 1024 << " KB)" << endl;
+  cout << "node arena reserved:   " << intf.NodeArena().BytesReserved() / 1024 << " KB" << endl;
+  if (settings.GetLongParameter(LP_EXPANSION_TIME))
+    cout << "expansion overran:     " << intf.FrameRate().MissedDeadlines() << " frames ("
+         << intf.FrameRate().MissedDeadlineMs() << " ms in total)" << endl;
+  if (pPPM) {
+    cout << "LM contexts made:      " << double(pPPM->ContextsMade() - iContextsBefore) / iFrames << " per frame" << endl;
+    cout << "LM contexts alive:     " << iTotalLiveContexts / iFrames << endl;
+  }
+  return 0;
+}
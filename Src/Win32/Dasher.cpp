@@ -233,6 +233,16 @@ int CWinFileUtils::GetFileSize(const std::string &strFileName) {
   return sStatInfo.st_size;
 }
 
+long CWinFileUtils::GetFileModificationTime(const std::string &strFileName) {
+  struct _stat sStatInfo;
+  if (_stat(strFileName.c_str(), &sStatInfo)) return 0;
+  return static_cast<long>(sStatInfo.st_mtime);
+}
+
+std::string CWinFileUtils::GetUserDataFilePath(const std::string &filename) {
+  return GetDataPath(true) + filename;
+}
+
 // TODO: Check that syntax here is sensible
 void CDasher::Move(int iX, int iY, int iWidth, int iHeight) {
   if(m_pCanvas)
@@ -23,6 +23,8 @@ public:
   virtual int GetFileSize(const std::string &strFileName) override;
   virtual void ScanFiles(AbstractParser *parser, const std::string &strPattern) override;
   bool WriteUserDataFile(const std::string &filename, const std::string &strNewText, bool append) override;
+  long GetFileModificationTime(const std::string &strFileName) override;
+  std::string GetUserDataFilePath(const std::string &filename) override;
 private:
   void ScanDirectory(const std::string &strMask, std::vector<std::string> &vFileList);
   // Returns location where program data is stored.